@@ -0,0 +1,596 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/random.h>
+#include "aead.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define AEAD_HAVE_X86 1
+#include <immintrin.h>
+#endif
+
+static uint32_t load32(const unsigned char *p)
+{
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static uint64_t load64(const unsigned char *p)
+{
+    return load32(p) | ((uint64_t)load32(p + 4) << 32);
+}
+
+static void store32(unsigned char *p, uint32_t v)
+{
+    p[0] = v;
+    p[1] = v >> 8;
+    p[2] = v >> 16;
+    p[3] = v >> 24;
+}
+
+static void store64(unsigned char *p, uint64_t v)
+{
+    store32(p, (uint32_t)v);
+    store32(p + 4, (uint32_t)(v >> 32));
+}
+
+/* ChaCha20 -------------------------------------------------------------- */
+
+#define ROTL32(v, n) (((v) << (n)) | ((v) >> (32 - (n))))
+
+#define QUARTER_ROUND(a, b, c, d)                      \
+    do                                                 \
+    {                                                  \
+        a += b; d ^= a; d = ROTL32(d, 16);             \
+        c += d; b ^= c; b = ROTL32(b, 12);             \
+        a += b; d ^= a; d = ROTL32(d, 8);              \
+        c += d; b ^= c; b = ROTL32(b, 7);              \
+    } while (0)
+
+/* XOR blocks 64-byte blocks of keystream into in, the block counter starting at state[12] */
+typedef void (*chacha_xor_fn)(const uint32_t state[16], const unsigned char *in, unsigned char *out, size_t blocks);
+
+static void chacha_block(const uint32_t state[16], unsigned char out[64])
+{
+    uint32_t x[16];
+    memcpy(x, state, sizeof(x));
+    for (int i = 0; i < 10; i++)
+    {
+        QUARTER_ROUND(x[0], x[4], x[8], x[12]);
+        QUARTER_ROUND(x[1], x[5], x[9], x[13]);
+        QUARTER_ROUND(x[2], x[6], x[10], x[14]);
+        QUARTER_ROUND(x[3], x[7], x[11], x[15]);
+        QUARTER_ROUND(x[0], x[5], x[10], x[15]);
+        QUARTER_ROUND(x[1], x[6], x[11], x[12]);
+        QUARTER_ROUND(x[2], x[7], x[8], x[13]);
+        QUARTER_ROUND(x[3], x[4], x[9], x[14]);
+    }
+    for (int i = 0; i < 16; i++)
+    {
+        store32(out + 4 * i, x[i] + state[i]);
+    }
+}
+
+static void chacha_xor_scalar(const uint32_t state[16], const unsigned char *in, unsigned char *out, size_t blocks)
+{
+    uint32_t s[16];
+    unsigned char ks[64];
+    memcpy(s, state, sizeof(s));
+    for (size_t b = 0; b < blocks; b++, s[12]++)
+    {
+        chacha_block(s, ks);
+        for (int i = 0; i < 64; i++)
+        {
+            out[64 * b + i] = in[64 * b + i] ^ ks[i];
+        }
+    }
+}
+
+#ifdef AEAD_HAVE_X86
+
+/*
+ * Wide kernels: lane j of vector x[i] is word i of block j, so the rounds
+ * run on several blocks at once; the words are transposed back into
+ * blocks 4x4 at a time before the XOR.
+ */
+#define SSE_ROTL(v, n) _mm_or_si128(_mm_slli_epi32(v, n), _mm_srli_epi32(v, 32 - (n)))
+
+#define SSE_QUARTER_ROUND(a, b, c, d)                                                   \
+    do                                                                                  \
+    {                                                                                   \
+        a = _mm_add_epi32(a, b); d = _mm_xor_si128(d, a); d = SSE_ROTL(d, 16);          \
+        c = _mm_add_epi32(c, d); b = _mm_xor_si128(b, c); b = SSE_ROTL(b, 12);          \
+        a = _mm_add_epi32(a, b); d = _mm_xor_si128(d, a); d = SSE_ROTL(d, 8);           \
+        c = _mm_add_epi32(c, d); b = _mm_xor_si128(b, c); b = SSE_ROTL(b, 7);           \
+    } while (0)
+
+__attribute__((target("sse2")))
+static void chacha_xor_sse2(const uint32_t state[16], const unsigned char *in, unsigned char *out, size_t blocks)
+{
+    uint32_t s[16];
+    memcpy(s, state, sizeof(s));
+    for (; blocks >= 4; blocks -= 4, in += 256, out += 256, s[12] += 4)
+    {
+        __m128i x[16], orig[16];
+        for (int i = 0; i < 16; i++)
+        {
+            orig[i] = _mm_set1_epi32((int)s[i]);
+        }
+        orig[12] = _mm_add_epi32(orig[12], _mm_set_epi32(3, 2, 1, 0));
+        memcpy(x, orig, sizeof(x));
+        for (int i = 0; i < 10; i++)
+        {
+            SSE_QUARTER_ROUND(x[0], x[4], x[8], x[12]);
+            SSE_QUARTER_ROUND(x[1], x[5], x[9], x[13]);
+            SSE_QUARTER_ROUND(x[2], x[6], x[10], x[14]);
+            SSE_QUARTER_ROUND(x[3], x[7], x[11], x[15]);
+            SSE_QUARTER_ROUND(x[0], x[5], x[10], x[15]);
+            SSE_QUARTER_ROUND(x[1], x[6], x[11], x[12]);
+            SSE_QUARTER_ROUND(x[2], x[7], x[8], x[13]);
+            SSE_QUARTER_ROUND(x[3], x[4], x[9], x[14]);
+        }
+        for (int i = 0; i < 16; i += 4)
+        {
+            __m128i a = _mm_add_epi32(x[i], orig[i]);
+            __m128i b = _mm_add_epi32(x[i + 1], orig[i + 1]);
+            __m128i c = _mm_add_epi32(x[i + 2], orig[i + 2]);
+            __m128i d = _mm_add_epi32(x[i + 3], orig[i + 3]);
+            __m128i t0 = _mm_unpacklo_epi32(a, b);
+            __m128i t1 = _mm_unpacklo_epi32(c, d);
+            __m128i t2 = _mm_unpackhi_epi32(a, b);
+            __m128i t3 = _mm_unpackhi_epi32(c, d);
+            __m128i row[4] = {_mm_unpacklo_epi64(t0, t1), _mm_unpackhi_epi64(t0, t1),
+                              _mm_unpacklo_epi64(t2, t3), _mm_unpackhi_epi64(t2, t3)};
+            for (int j = 0; j < 4; j++)
+            {
+                __m128i m = _mm_loadu_si128((const __m128i *)(in + 64 * j + 4 * i));
+                _mm_storeu_si128((__m128i *)(out + 64 * j + 4 * i), _mm_xor_si128(m, row[j]));
+            }
+        }
+    }
+    chacha_xor_scalar(s, in, out, blocks);
+}
+
+#define AVX_ROTL(v, n) _mm256_or_si256(_mm256_slli_epi32(v, n), _mm256_srli_epi32(v, 32 - (n)))
+
+#define AVX_QUARTER_ROUND(a, b, c, d)                                                               \
+    do                                                                                              \
+    {                                                                                               \
+        a = _mm256_add_epi32(a, b); d = _mm256_xor_si256(d, a); d = _mm256_shuffle_epi8(d, rot16); \
+        c = _mm256_add_epi32(c, d); b = _mm256_xor_si256(b, c); b = AVX_ROTL(b, 12);              \
+        a = _mm256_add_epi32(a, b); d = _mm256_xor_si256(d, a); d = _mm256_shuffle_epi8(d, rot8);  \
+        c = _mm256_add_epi32(c, d); b = _mm256_xor_si256(b, c); b = AVX_ROTL(b, 7);               \
+    } while (0)
+
+__attribute__((target("avx2")))
+static void chacha_xor_avx2(const uint32_t state[16], const unsigned char *in, unsigned char *out, size_t blocks)
+{
+    // Rotations by whole bytes are byte shuffles
+    const __m256i rot16 = _mm256_set_epi8(13, 12, 15, 14, 9, 8, 11, 10, 5, 4, 7, 6, 1, 0, 3, 2,
+                                          13, 12, 15, 14, 9, 8, 11, 10, 5, 4, 7, 6, 1, 0, 3, 2);
+    const __m256i rot8 = _mm256_set_epi8(14, 13, 12, 15, 10, 9, 8, 11, 6, 5, 4, 7, 2, 1, 0, 3,
+                                         14, 13, 12, 15, 10, 9, 8, 11, 6, 5, 4, 7, 2, 1, 0, 3);
+    uint32_t s[16];
+    memcpy(s, state, sizeof(s));
+    for (; blocks >= 8; blocks -= 8, in += 512, out += 512, s[12] += 8)
+    {
+        __m256i x[16], orig[16];
+        for (int i = 0; i < 16; i++)
+        {
+            orig[i] = _mm256_set1_epi32((int)s[i]);
+        }
+        orig[12] = _mm256_add_epi32(orig[12], _mm256_set_epi32(7, 6, 5, 4, 3, 2, 1, 0));
+        memcpy(x, orig, sizeof(x));
+        for (int i = 0; i < 10; i++)
+        {
+            AVX_QUARTER_ROUND(x[0], x[4], x[8], x[12]);
+            AVX_QUARTER_ROUND(x[1], x[5], x[9], x[13]);
+            AVX_QUARTER_ROUND(x[2], x[6], x[10], x[14]);
+            AVX_QUARTER_ROUND(x[3], x[7], x[11], x[15]);
+            AVX_QUARTER_ROUND(x[0], x[5], x[10], x[15]);
+            AVX_QUARTER_ROUND(x[1], x[6], x[11], x[12]);
+            AVX_QUARTER_ROUND(x[2], x[7], x[8], x[13]);
+            AVX_QUARTER_ROUND(x[3], x[4], x[9], x[14]);
+        }
+        // Transposed per 128-bit lane: the low lane holds blocks 0-3, the high lane blocks 4-7
+        for (int i = 0; i < 16; i += 4)
+        {
+            __m256i a = _mm256_add_epi32(x[i], orig[i]);
+            __m256i b = _mm256_add_epi32(x[i + 1], orig[i + 1]);
+            __m256i c = _mm256_add_epi32(x[i + 2], orig[i + 2]);
+            __m256i d = _mm256_add_epi32(x[i + 3], orig[i + 3]);
+            __m256i t0 = _mm256_unpacklo_epi32(a, b);
+            __m256i t1 = _mm256_unpacklo_epi32(c, d);
+            __m256i t2 = _mm256_unpackhi_epi32(a, b);
+            __m256i t3 = _mm256_unpackhi_epi32(c, d);
+            __m256i row[4] = {_mm256_unpacklo_epi64(t0, t1), _mm256_unpackhi_epi64(t0, t1),
+                              _mm256_unpacklo_epi64(t2, t3), _mm256_unpackhi_epi64(t2, t3)};
+            for (int j = 0; j < 4; j++)
+            {
+                const unsigned char *lo_in = in + 64 * j + 4 * i;
+                const unsigned char *hi_in = lo_in + 256;
+                __m128i lo = _mm_xor_si128(_mm_loadu_si128((const __m128i *)lo_in), _mm256_castsi256_si128(row[j]));
+                __m128i hi = _mm_xor_si128(_mm_loadu_si128((const __m128i *)hi_in), _mm256_extracti128_si256(row[j], 1));
+                _mm_storeu_si128((__m128i *)(out + 64 * j + 4 * i), lo);
+                _mm_storeu_si128((__m128i *)(out + 256 + 64 * j + 4 * i), hi);
+            }
+        }
+    }
+    chacha_xor_sse2(s, in, out, blocks);
+}
+
+#endif
+
+typedef struct
+{
+    const char *name;
+    chacha_xor_fn xor_blocks;
+} ChachaKernel;
+
+static const ChachaKernel *chacha_kernel(void)
+{
+    static const ChachaKernel scalar = {"scalar", chacha_xor_scalar};
+#ifdef AEAD_HAVE_X86
+    static const ChachaKernel sse2 = {"sse2", chacha_xor_sse2};
+    static const ChachaKernel avx2 = {"avx2", chacha_xor_avx2};
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+        return &avx2;
+    if (__builtin_cpu_supports("sse2"))
+        return &sse2;
+#endif
+    return &scalar;
+}
+
+const char *aead_kernel_name(void)
+{
+    return chacha_kernel()->name;
+}
+
+/* Key and nonce words of the ChaCha20 state, block counter in state[12] */
+static void chacha_init(uint32_t state[16], const unsigned char key[AEAD_KEY_BYTES], const unsigned char nonce[12],
+                        uint32_t counter)
+{
+    state[0] = 0x61707865;
+    state[1] = 0x3320646e;
+    state[2] = 0x79622d32;
+    state[3] = 0x6b206574;
+    for (int i = 0; i < 8; i++)
+    {
+        state[4 + i] = load32(key + 4 * i);
+    }
+    state[12] = counter;
+    state[13] = load32(nonce);
+    state[14] = load32(nonce + 4);
+    state[15] = load32(nonce + 8);
+}
+
+/* XOR the keystream into n bytes, a short last block included */
+static void chacha_xor(const ChachaKernel *kernel, uint32_t state[16], const unsigned char *in, unsigned char *out,
+                       size_t n)
+{
+    size_t blocks = n / 64;
+    kernel->xor_blocks(state, in, out, blocks);
+    state[12] += blocks;
+    if (n % 64)
+    {
+        unsigned char ks[64];
+        chacha_block(state, ks);
+        for (size_t i = blocks * 64; i < n; i++)
+        {
+            out[i] = in[i] ^ ks[i - blocks * 64];
+        }
+        state[12]++;
+    }
+}
+
+/* Poly1305, 44/44/42-bit limbs -------------------------------------------- */
+
+#define POLY_MASK44 0xfffffffffffULL
+#define POLY_MASK42 0x3ffffffffffULL
+
+typedef unsigned __int128 uint128_t;
+
+typedef struct
+{
+    uint64_t r[3];
+    uint64_t h[3];
+    uint64_t pad[2];
+} Poly1305;
+
+static void poly_init(Poly1305 *p, const unsigned char key[32])
+{
+    uint64_t t0 = load64(key);
+    uint64_t t1 = load64(key + 8);
+    // r is clamped as the RFC requires
+    p->r[0] = t0 & 0xffc0fffffffULL;
+    p->r[1] = ((t0 >> 44) | (t1 << 20)) & 0xfffffc0ffffULL;
+    p->r[2] = (t1 >> 24) & 0x00ffffffc0fULL;
+    p->h[0] = p->h[1] = p->h[2] = 0;
+    p->pad[0] = load64(key + 16);
+    p->pad[1] = load64(key + 24);
+}
+
+/* Absorb whole 16-byte blocks (n a multiple of 16) */
+static void poly_blocks(Poly1305 *p, const unsigned char *m, size_t n)
+{
+    uint64_t r0 = p->r[0], r1 = p->r[1], r2 = p->r[2];
+    uint64_t s1 = r1 * (5 << 2), s2 = r2 * (5 << 2);
+    uint64_t h0 = p->h[0], h1 = p->h[1], h2 = p->h[2];
+
+    for (; n >= 16; n -= 16, m += 16)
+    {
+        uint64_t t0 = load64(m);
+        uint64_t t1 = load64(m + 8);
+        h0 += t0 & POLY_MASK44;
+        h1 += ((t0 >> 44) | (t1 << 20)) & POLY_MASK44;
+        h2 += ((t1 >> 24) & POLY_MASK42) | (1ULL << 40);
+
+        uint128_t d0 = (uint128_t)h0 * r0 + (uint128_t)h1 * s2 + (uint128_t)h2 * s1;
+        uint128_t d1 = (uint128_t)h0 * r1 + (uint128_t)h1 * r0 + (uint128_t)h2 * s2;
+        uint128_t d2 = (uint128_t)h0 * r2 + (uint128_t)h1 * r1 + (uint128_t)h2 * r0;
+        uint64_t c = (uint64_t)(d0 >> 44);
+        h0 = (uint64_t)d0 & POLY_MASK44;
+        d1 += c;
+        c = (uint64_t)(d1 >> 44);
+        h1 = (uint64_t)d1 & POLY_MASK44;
+        d2 += c;
+        c = (uint64_t)(d2 >> 42);
+        h2 = (uint64_t)d2 & POLY_MASK42;
+        h0 += c * 5;
+        c = h0 >> 44;
+        h0 &= POLY_MASK44;
+        h1 += c;
+    }
+    p->h[0] = h0;
+    p->h[1] = h1;
+    p->h[2] = h2;
+}
+
+/* Absorb n bytes zero padded to a whole block, as the AEAD construction does */
+static void poly_padded(Poly1305 *p, const unsigned char *m, size_t n)
+{
+    poly_blocks(p, m, n - n % 16);
+    if (n % 16)
+    {
+        unsigned char block[16] = {0};
+        memcpy(block, m + n - n % 16, n % 16);
+        poly_blocks(p, block, 16);
+    }
+}
+
+static void poly_finish(Poly1305 *p, unsigned char tag[16])
+{
+    uint64_t h0 = p->h[0], h1 = p->h[1], h2 = p->h[2];
+    uint64_t c;
+
+    // Fully carry h
+    c = h1 >> 44; h1 &= POLY_MASK44; h2 += c;
+    c = h2 >> 42; h2 &= POLY_MASK42; h0 += c * 5;
+    c = h0 >> 44; h0 &= POLY_MASK44; h1 += c;
+    c = h1 >> 44; h1 &= POLY_MASK44; h2 += c;
+    c = h2 >> 42; h2 &= POLY_MASK42; h0 += c * 5;
+    c = h0 >> 44; h0 &= POLY_MASK44; h1 += c;
+
+    // h - p, selected without branches when h >= p
+    uint64_t g0 = h0 + 5;
+    c = g0 >> 44; g0 &= POLY_MASK44;
+    uint64_t g1 = h1 + c;
+    c = g1 >> 44; g1 &= POLY_MASK44;
+    uint64_t g2 = h2 + c - (1ULL << 42);
+    c = (g2 >> 63) - 1;
+    g0 &= c; g1 &= c; g2 &= c;
+    c = ~c;
+    h0 = (h0 & c) | g0;
+    h1 = (h1 & c) | g1;
+    h2 = (h2 & c) | g2;
+
+    // tag = (h + pad) mod 2^128
+    uint64_t t0 = p->pad[0], t1 = p->pad[1];
+    h0 += t0 & POLY_MASK44;
+    c = h0 >> 44; h0 &= POLY_MASK44;
+    h1 += (((t0 >> 44) | (t1 << 20)) & POLY_MASK44) + c;
+    c = h1 >> 44; h1 &= POLY_MASK44;
+    h2 += ((t1 >> 24) & POLY_MASK42) + c;
+    h2 &= POLY_MASK42;
+    store64(tag, h0 | (h1 << 44));
+    store64(tag + 8, (h1 >> 20) | (h2 << 24));
+}
+
+/* ChaCha20-Poly1305 ------------------------------------------------------- */
+
+/*
+ * RFC 8439 AEAD over one message: encrypt (or decrypt) n bytes of in and
+ * compute the tag of the ciphertext and aad
+ */
+static void aead_crypt(const unsigned char key[AEAD_KEY_BYTES], const unsigned char nonce[12], const unsigned char *aad,
+                       size_t aad_len, const unsigned char *in, size_t n, unsigned char *out, int encrypting,
+                       unsigned char tag[AEAD_TAG_BYTES])
+{
+    const ChachaKernel *kernel = chacha_kernel();
+    uint32_t state[16];
+    unsigned char otk[64];
+    unsigned char lengths[16];
+    Poly1305 poly;
+
+    // Block 0 gives the one-time Poly1305 key, the payload starts at block 1
+    chacha_init(state, key, nonce, 0);
+    chacha_block(state, otk);
+    state[12] = 1;
+    poly_init(&poly, otk);
+    poly_padded(&poly, aad, aad_len);
+
+    // Interleave per 4 KiB so the ciphertext is still in L1 for Poly1305
+    for (size_t done = 0; done < n; done += 4096)
+    {
+        size_t len = n - done < 4096 ? n - done : 4096;
+        // Only the last piece can end on a partial block, so padding each piece is exact
+        if (!encrypting)
+            poly_padded(&poly, in + done, len);
+        chacha_xor(kernel, state, in + done, out + done, len);
+        if (encrypting)
+            poly_padded(&poly, out + done, len);
+    }
+    store64(lengths, aad_len);
+    store64(lengths + 8, n);
+    poly_blocks(&poly, lengths, 16);
+    poly_finish(&poly, tag);
+    memset(otk, 0, sizeof(otk));
+}
+
+/* Constant time tag comparison */
+static int tags_equal(const unsigned char *a, const unsigned char *b)
+{
+    unsigned char diff = 0;
+    for (int i = 0; i < AEAD_TAG_BYTES; i++)
+    {
+        diff |= a[i] ^ b[i];
+    }
+    return diff == 0;
+}
+
+static void segment_nonce(const AeadStream *stream, unsigned long long index, int last, unsigned char nonce[12])
+{
+    memcpy(nonce, stream->prefix, AEAD_PREFIX_BYTES);
+    store32(nonce + AEAD_PREFIX_BYTES, (uint32_t)index | (last ? 0x80000000u : 0));
+}
+
+unsigned long long aead_sealed_size(unsigned long long plain)
+{
+    unsigned long long segments = plain ? (plain + AEAD_SEGMENT - 1) / AEAD_SEGMENT : 1;
+    return plain + segments * AEAD_TAG_BYTES;
+}
+
+Status aead_plain_size(unsigned long long sealed, unsigned long long *plain)
+{
+    unsigned long long segments = (sealed + AEAD_SEALED_SEGMENT - 1) / AEAD_SEALED_SEGMENT;
+    unsigned long long last = sealed - (segments ? segments - 1 : 0) * AEAD_SEALED_SEGMENT;
+    // Every segment carries its tag, and only an empty payload has a segment holding nothing else
+    if (segments == 0 || last < AEAD_TAG_BYTES || (segments > 1 && last == AEAD_TAG_BYTES))
+        return e_failure;
+    *plain = sealed - segments * AEAD_TAG_BYTES;
+    return e_success;
+}
+
+static int hex_digit(unsigned char c)
+{
+    if (c >= '0' && c <= '9')
+        return c - '0';
+    if (c >= 'a' && c <= 'f')
+        return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F')
+        return c - 'A' + 10;
+    return -1;
+}
+
+Status aead_load_key(const char *fname, unsigned char key[AEAD_KEY_BYTES])
+{
+    unsigned char buf[2 * AEAD_KEY_BYTES + 2];
+    FILE *fp = fopen(fname, "rb");
+    Status status = e_failure;
+
+    if (fp == NULL)
+        return e_failure;
+    size_t n = fread(buf, 1, sizeof(buf), fp);
+    int longer = fgetc(fp) != EOF;
+    fclose(fp);
+    if (!longer && n == AEAD_KEY_BYTES)
+    {
+        memcpy(key, buf, AEAD_KEY_BYTES);
+        status = e_success;
+    }
+    else if (!longer)
+    {
+        // Hex, as written by e.g. "openssl rand -hex 32"
+        while (n > 0 && (buf[n - 1] == '\n' || buf[n - 1] == '\r'))
+            n--;
+        status = n == 2 * AEAD_KEY_BYTES ? e_success : e_failure;
+        for (size_t i = 0; status == e_success && i < AEAD_KEY_BYTES; i++)
+        {
+            int hi = hex_digit(buf[2 * i]), lo = hex_digit(buf[2 * i + 1]);
+            if (hi < 0 || lo < 0)
+                status = e_failure;
+            else
+                key[i] = (unsigned char)(hi << 4 | lo);
+        }
+    }
+    memset(buf, 0, sizeof(buf));
+    return status;
+}
+
+Status aead_new_prefix(unsigned char prefix[AEAD_PREFIX_BYTES])
+{
+    return getrandom(prefix, AEAD_PREFIX_BYTES, 0) == AEAD_PREFIX_BYTES ? e_success : e_failure;
+}
+
+/* One aead_seal()/aead_open() call, one segment per index */
+typedef struct
+{
+    const AeadStream *stream;
+    unsigned long long first;  // Segment number of index 0
+    const unsigned char *in;
+    unsigned char *out;
+    size_t n;                  // Plaintext bytes (seal) or sealed bytes (open)
+    size_t segments;
+    int final;
+    unsigned char *failed;     // Open: per segment tag mismatch
+} AeadJob;
+
+static void seal_segment(void *ctx, size_t index)
+{
+    AeadJob *job = ctx;
+    size_t start = index * AEAD_SEGMENT;
+    size_t len = job->n - start < AEAD_SEGMENT ? job->n - start : AEAD_SEGMENT;
+    unsigned char *out = job->out + index * AEAD_SEALED_SEGMENT;
+    unsigned char nonce[12];
+
+    segment_nonce(job->stream, job->first + index, job->final && index + 1 == job->segments, nonce);
+    aead_crypt(job->stream->key, nonce, NULL, 0, job->in + start, len, out, 1, out + len);
+}
+
+void aead_seal(ThreadPool *pool, const AeadStream *stream, unsigned long long index, const unsigned char *in,
+               size_t n, int final, unsigned char *out)
+{
+    AeadJob job = {stream, index, in, out, n, 0, final, NULL};
+    job.segments = final && n == 0 ? 1 : (n + AEAD_SEGMENT - 1) / AEAD_SEGMENT;
+    pool_parallel_for(pool, job.segments, seal_segment, &job);
+}
+
+static void open_segment(void *ctx, size_t index)
+{
+    AeadJob *job = ctx;
+    size_t start = index * AEAD_SEALED_SEGMENT;
+    size_t len = (job->n - start < AEAD_SEALED_SEGMENT ? job->n - start : AEAD_SEALED_SEGMENT) - AEAD_TAG_BYTES;
+    const unsigned char *in = job->in + start;
+    unsigned char nonce[12];
+    unsigned char tag[AEAD_TAG_BYTES];
+
+    segment_nonce(job->stream, job->first + index, job->final && index + 1 == job->segments, nonce);
+    aead_crypt(job->stream->key, nonce, NULL, 0, in, len, job->out + index * AEAD_SEGMENT, 0, tag);
+    job->failed[index] = !tags_equal(tag, in + len);
+}
+
+Status aead_open(ThreadPool *pool, const AeadStream *stream, unsigned long long index, const unsigned char *in,
+                 size_t n, int final, unsigned char *out)
+{
+    AeadJob job = {stream, index, in, out, n, (n + AEAD_SEALED_SEGMENT - 1) / AEAD_SEALED_SEGMENT, final, NULL};
+    Status status = e_success;
+
+    // Only the last segment of the payload may be short, and it still has its tag
+    if (job.segments == 0 || n - (job.segments - 1) * AEAD_SEALED_SEGMENT < AEAD_TAG_BYTES
+        || (!final && n % AEAD_SEALED_SEGMENT))
+        return e_failure;
+    unsigned char failed_small[64];
+    job.failed = job.segments <= sizeof(failed_small) ? failed_small : malloc(job.segments);
+    if (job.failed == NULL)
+        return e_failure;
+    pool_parallel_for(pool, job.segments, open_segment, &job);
+    for (size_t i = 0; i < job.segments; i++)
+    {
+        if (job.failed[i])
+            status = e_failure;
+    }
+    if (job.failed != failed_small)
+        free(job.failed);
+    return status;
+}
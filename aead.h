@@ -0,0 +1,68 @@
+#ifndef AEAD_H
+#define AEAD_H
+
+#include <stddef.h>
+#include "types.h"
+#include "threadpool.h"
+
+/*
+ * Payload encryption (--encrypt)
+ * ChaCha20-Poly1305 (RFC 8439) in the STREAM construction: the payload is
+ * cut into AEAD_SEGMENT plaintext bytes and every segment is sealed on its
+ * own, with its 16-byte tag right after it. The 96-bit nonce of segment i
+ * is the 8 random prefix bytes stored in the stego header followed by i
+ * (32-bit little-endian) with bit 31 set on the last segment, so segments
+ * cannot be dropped, reordered or cut off at a segment boundary unnoticed.
+ * Segments seal and open in parallel, and a decoder checks every tag before
+ * the plaintext of that segment goes anywhere.
+ *
+ * ChaCha20 runs 8 blocks at a time with AVX2 or 4 with SSE2 when the CPU
+ * has them; Poly1305 keeps its accumulator in three 44/44/42-bit limbs,
+ * multiplied into 128-bit products.
+ */
+#define AEAD_KEY_BYTES 32
+#define AEAD_TAG_BYTES 16
+#define AEAD_PREFIX_BYTES 8
+#define AEAD_SEGMENT (64 * 1024)
+#define AEAD_SEALED_SEGMENT (AEAD_SEGMENT + AEAD_TAG_BYTES)
+
+/* One payload: the key and the nonce prefix of its segments */
+typedef struct _AeadStream
+{
+    unsigned char key[AEAD_KEY_BYTES];
+    unsigned char prefix[AEAD_PREFIX_BYTES];
+} AeadStream;
+
+/* Sealed size of plain bytes (an empty payload is one empty segment and its tag) */
+unsigned long long aead_sealed_size(unsigned long long plain);
+
+/* Plaintext size behind sealed bytes, e_failure if no payload seals to that size */
+Status aead_plain_size(unsigned long long sealed, unsigned long long *plain);
+
+/* Read a key file: AEAD_KEY_BYTES raw bytes, or twice as many hex digits and an optional line end */
+Status aead_load_key(const char *fname, unsigned char key[AEAD_KEY_BYTES]);
+
+/* Fill prefix with random bytes for a new payload */
+Status aead_new_prefix(unsigned char prefix[AEAD_PREFIX_BYTES]);
+
+/*
+ * Seal n plaintext bytes as the segments from index on, into
+ * aead_sealed_size(n) bytes of out (n + 16 per segment). Every segment is
+ * full but the last one of the payload, which is sealed when final is set.
+ * n must be a multiple of AEAD_SEGMENT unless final.
+ */
+void aead_seal(ThreadPool *pool, const AeadStream *stream, unsigned long long index, const unsigned char *in,
+               size_t n, int final, unsigned char *out);
+
+/*
+ * Open n sealed bytes (whole sealed segments, the last one short only when
+ * final) from segment index on. Returns e_failure, with out undefined, if
+ * any tag does not match.
+ */
+Status aead_open(ThreadPool *pool, const AeadStream *stream, unsigned long long index, const unsigned char *in,
+                 size_t n, int final, unsigned char *out);
+
+/* Name of the ChaCha20 kernel selected for this CPU */
+const char *aead_kernel_name(void);
+
+#endif
@@ -0,0 +1,683 @@
+#define _GNU_SOURCE
+#define _FILE_OFFSET_BITS 64
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "aio.h"
+
+#ifdef _WIN32
+
+/* No engine: every caller stays on stdio */
+AioEngine *aio_create(void)
+{
+    return NULL;
+}
+
+const char *aio_engine_name(const AioEngine *engine)
+{
+    (void)engine;
+    return "stdio";
+}
+
+void aio_destroy(AioEngine *engine)
+{
+    (void)engine;
+}
+
+int aio_file_ok(FILE *fp)
+{
+    (void)fp;
+    return 0;
+}
+
+AioStream *aio_reader(AioEngine *engine, int fd, unsigned long long off, unsigned long long end)
+{
+    (void)engine, (void)fd, (void)off, (void)end;
+    return NULL;
+}
+
+AioStream *aio_writer(AioEngine *engine, int fd, unsigned long long off)
+{
+    (void)engine, (void)fd, (void)off;
+    return NULL;
+}
+
+Status aio_read(AioStream *stream, unsigned char *dst, size_t n)
+{
+    (void)stream, (void)dst, (void)n;
+    return e_failure;
+}
+
+Status aio_write(AioStream *stream, const unsigned char *src, size_t n)
+{
+    (void)stream, (void)src, (void)n;
+    return e_failure;
+}
+
+unsigned long long aio_offset(const AioStream *stream)
+{
+    (void)stream;
+    return 0;
+}
+
+int aio_eof(const AioStream *stream)
+{
+    (void)stream;
+    return 0;
+}
+
+Status aio_close(AioStream *stream)
+{
+    (void)stream;
+    return e_success;
+}
+
+#else
+
+#include <pthread.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "threadpool.h"
+
+#if defined(__linux__)
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+#if defined(__NR_io_uring_setup) && defined(__NR_io_uring_enter)
+#define AIO_URING 1
+#endif
+#endif
+
+/* Ring entries: room for every slot of the streams of one job */
+#define AIO_QUEUE 32
+/* Fallback threads, the queue depth without io_uring */
+#define AIO_THREADS AIO_SLOTS
+
+enum
+{
+    AIO_IDLE,                 // Nothing requested
+    AIO_BUSY,                 // In flight
+    AIO_DONE                  // Finished, error tells how
+};
+
+/* One read or write of len bytes at off, carried out in full */
+typedef struct _AioOp
+{
+    AioEngine *engine;
+    int fd;
+    int write;
+    unsigned char *buf;
+    size_t len;
+    unsigned long long off;
+    size_t done;              // Bytes moved so far, short transfers are sent again for the rest
+    int state;
+    int error;                // errno of a failed request, EIO for a file that ended early
+} AioOp;
+
+#ifdef AIO_URING
+/* The rings shared with the kernel */
+typedef struct
+{
+    int fd;
+    unsigned entries;
+    unsigned inflight;        // Entries the kernel has taken and not completed yet
+    unsigned *sq_head, *sq_tail, *sq_mask, *sq_array;
+    unsigned *cq_head, *cq_tail, *cq_mask;
+    struct io_uring_sqe *sqes;
+    struct io_uring_cqe *cqes;
+    void *sq_ring, *cq_ring;
+    size_t sq_ring_size, cq_ring_size, sqes_size;
+} Uring;
+#endif
+
+struct _AioEngine
+{
+    const char *name;
+#ifdef AIO_URING
+    int uring;
+    Uring ring;
+    int broken;               // Waiting on the ring failed: requests may still be out, nothing more is reaped
+#endif
+    ThreadPool *workers;      // Fallback: blocking pread/pwrite
+    pthread_mutex_t lock;     // Guards the state of requests handed to workers
+    pthread_cond_t done_cv;
+};
+
+struct _AioStream
+{
+    AioEngine *engine;
+    int fd;
+    int write;
+    unsigned long long next_off; // Reader: next block to request; writer: where the next block goes
+    unsigned long long end;      // Reader: nothing is requested past it
+    unsigned long long offset;   // Just past the last byte read or queued
+    AioOp slots[AIO_SLOTS];
+    unsigned char *buffers;
+    int cur;                  // Slot being read from or filled
+    size_t pos;               // Bytes of it read or filled
+    int eof;
+    int failed;
+};
+
+static Status engine_submit(AioEngine *engine, AioOp *op);
+
+/* Send the rest of a request again; if that fails the request is over, failed */
+static Status op_resend(AioEngine *engine, AioOp *op)
+{
+    if (engine_submit(engine, op) != e_success)
+    {
+        op->error = errno ? errno : EIO;
+        op->state = AIO_DONE;
+    }
+    return e_success;
+}
+
+/* A request came back having moved res bytes (or failed with -res): finish it or send the rest */
+static Status op_progress(AioEngine *engine, AioOp *op, long res)
+{
+    if (res == -EINTR || res == -EAGAIN)
+    {
+        return op_resend(engine, op);
+    }
+    if (res <= 0)
+    {
+        op->error = res < 0 ? (int)-res : EIO;
+        op->state = AIO_DONE;
+        return e_success;
+    }
+    op->done += res;
+    if (op->done < op->len)
+    {
+        return op_resend(engine, op);
+    }
+    op->state = AIO_DONE;
+    return e_success;
+}
+
+#ifdef AIO_URING
+static int uring_enter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags)
+{
+    return (int)syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, NULL, 0);
+}
+
+static Status uring_setup(Uring *r)
+{
+    struct io_uring_params p;
+    memset(&p, 0, sizeof(p));
+    memset(r, 0, sizeof(*r));
+    r->fd = (int)syscall(__NR_io_uring_setup, AIO_QUEUE, &p);
+    if (r->fd < 0)
+    {
+        return e_failure;
+    }
+    // IORING_OP_READ/WRITE came with 5.6, as did this feature bit
+    if (!(p.features & IORING_FEAT_RW_CUR_POS))
+    {
+        close(r->fd);
+        return e_failure;
+    }
+    r->sq_ring_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    r->cq_ring_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    int single = (p.features & IORING_FEAT_SINGLE_MMAP) != 0;
+    if (single)
+    {
+        r->sq_ring_size = r->cq_ring_size = r->sq_ring_size > r->cq_ring_size ? r->sq_ring_size : r->cq_ring_size;
+    }
+    r->sq_ring = mmap(NULL, r->sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, r->fd,
+                      IORING_OFF_SQ_RING);
+    r->cq_ring = single || r->sq_ring == MAP_FAILED
+                     ? r->sq_ring
+                     : mmap(NULL, r->cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, r->fd,
+                            IORING_OFF_CQ_RING);
+    r->sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+    r->sqes = r->cq_ring == MAP_FAILED ? MAP_FAILED
+                                       : mmap(NULL, r->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                                              r->fd, IORING_OFF_SQES);
+    if (r->sqes == MAP_FAILED)
+    {
+        if (r->cq_ring != MAP_FAILED && r->cq_ring != r->sq_ring)
+            munmap(r->cq_ring, r->cq_ring_size);
+        if (r->sq_ring != MAP_FAILED)
+            munmap(r->sq_ring, r->sq_ring_size);
+        close(r->fd);
+        return e_failure;
+    }
+    unsigned char *sq = r->sq_ring, *cq = r->cq_ring;
+    r->sq_head = (unsigned *)(sq + p.sq_off.head);
+    r->sq_tail = (unsigned *)(sq + p.sq_off.tail);
+    r->sq_mask = (unsigned *)(sq + p.sq_off.ring_mask);
+    r->sq_array = (unsigned *)(sq + p.sq_off.array);
+    r->cq_head = (unsigned *)(cq + p.cq_off.head);
+    r->cq_tail = (unsigned *)(cq + p.cq_off.tail);
+    r->cq_mask = (unsigned *)(cq + p.cq_off.ring_mask);
+    r->cqes = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+    r->entries = p.sq_entries;
+    return e_success;
+}
+
+static void uring_teardown(Uring *r)
+{
+    munmap(r->sqes, r->sqes_size);
+    if (r->cq_ring != r->sq_ring)
+        munmap(r->cq_ring, r->cq_ring_size);
+    munmap(r->sq_ring, r->sq_ring_size);
+    close(r->fd);
+}
+
+/*
+ * Take one completion, waiting for it if none is there. A failed wait
+ * breaks the engine for good: what is still out can no longer be told
+ * apart, so no request of it is ever reaped or sent again.
+ */
+static Status uring_reap(AioEngine *engine)
+{
+    Uring *r = &engine->ring;
+    unsigned head = *r->cq_head;
+    while (head == __atomic_load_n(r->cq_tail, __ATOMIC_ACQUIRE))
+    {
+        if (engine->broken || r->inflight == 0)
+        {
+            errno = EIO;
+            return e_failure;
+        }
+        if (uring_enter(r->fd, 0, 1, IORING_ENTER_GETEVENTS) < 0 && errno != EINTR)
+        {
+            engine->broken = 1;
+            return e_failure;
+        }
+    }
+    struct io_uring_cqe *cqe = &r->cqes[head & *r->cq_mask];
+    AioOp *op = (AioOp *)(uintptr_t)cqe->user_data;
+    long res = cqe->res;
+    __atomic_store_n(r->cq_head, head + 1, __ATOMIC_RELEASE);
+    r->inflight--;
+    return op_progress(engine, op, res);
+}
+
+static Status uring_submit(AioEngine *engine, AioOp *op)
+{
+    Uring *r = &engine->ring;
+    if (engine->broken)
+    {
+        errno = EIO;
+        return e_failure;
+    }
+    while (r->inflight >= r->entries)
+    {
+        if (uring_reap(engine) != e_success)
+        {
+            return e_failure;
+        }
+    }
+    // Only this thread moves the tail, the kernel only reads it
+    unsigned tail = *r->sq_tail;
+    unsigned index = tail & *r->sq_mask;
+    struct io_uring_sqe *sqe = &r->sqes[index];
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = op->write ? IORING_OP_WRITE : IORING_OP_READ;
+    sqe->fd = op->fd;
+    sqe->addr = (uintptr_t)(op->buf + op->done);
+    sqe->len = (unsigned)(op->len - op->done);
+    sqe->off = op->off + op->done;
+    sqe->user_data = (uintptr_t)op;
+    r->sq_array[index] = index;
+    __atomic_store_n(r->sq_tail, tail + 1, __ATOMIC_RELEASE);
+    int ret;
+    while ((ret = uring_enter(r->fd, 1, 0, 0)) < 0 && errno == EINTR)
+        ;
+    // In flight only once the kernel has taken the entry
+    if (ret == 1 || __atomic_load_n(r->sq_head, __ATOMIC_ACQUIRE) != tail)
+    {
+        r->inflight++;
+        return e_success;
+    }
+    // Not taken: withdraw it, the kernel only looks at the tail while entering
+    int error = ret < 0 ? errno : EAGAIN;
+    __atomic_store_n(r->sq_tail, tail, __ATOMIC_RELEASE);
+    errno = error;
+    return e_failure;
+}
+#endif
+
+/* Fallback: the whole request on a worker thread */
+static void worker_task(void *arg)
+{
+    AioOp *op = arg;
+    AioEngine *engine = op->engine;
+    int error = 0;
+    while (op->done < op->len)
+    {
+        ssize_t n = op->write ? pwrite(op->fd, op->buf + op->done, op->len - op->done, op->off + op->done)
+                              : pread(op->fd, op->buf + op->done, op->len - op->done, op->off + op->done);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+        {
+            error = n < 0 ? errno : EIO;
+            break;
+        }
+        op->done += n;
+    }
+    pthread_mutex_lock(&engine->lock);
+    op->error = error;
+    op->state = AIO_DONE;
+    pthread_cond_broadcast(&engine->done_cv);
+    pthread_mutex_unlock(&engine->lock);
+}
+
+static Status engine_submit(AioEngine *engine, AioOp *op)
+{
+#ifdef AIO_URING
+    if (engine->uring)
+        return uring_submit(engine, op);
+#endif
+    return pool_submit(engine->workers, worker_task, op);
+}
+
+/* Send op off from its start */
+static Status op_start(AioEngine *engine, AioOp *op)
+{
+    op->engine = engine;
+    op->done = 0;
+    op->error = 0;
+    op->state = AIO_BUSY;
+    if (engine_submit(engine, op) != e_success)
+    {
+        op->state = AIO_IDLE;
+        return e_failure;
+    }
+    return e_success;
+}
+
+/* Wait until op is finished, e_failure (errno set) if it failed */
+static Status op_wait(AioEngine *engine, AioOp *op)
+{
+#ifdef AIO_URING
+    if (engine->uring)
+    {
+        while (op->state == AIO_BUSY)
+        {
+            if (uring_reap(engine) != e_success)
+            {
+                return e_failure;
+            }
+        }
+    }
+    else
+#endif
+    {
+        pthread_mutex_lock(&engine->lock);
+        while (op->state == AIO_BUSY)
+            pthread_cond_wait(&engine->done_cv, &engine->lock);
+        pthread_mutex_unlock(&engine->lock);
+    }
+    // The caller can tell a full disk from an I/O error
+    if (op->error)
+    {
+        errno = op->error;
+        return e_failure;
+    }
+    return e_success;
+}
+
+AioEngine *aio_create(void)
+{
+    const char *want = getenv("STEGO_IO");
+    if (want && strcmp(want, "stdio") == 0)
+    {
+        return NULL;
+    }
+    AioEngine *engine = calloc(1, sizeof(*engine));
+    if (engine == NULL)
+    {
+        return NULL;
+    }
+#ifdef AIO_URING
+    if (!(want && strcmp(want, "threads") == 0) && uring_setup(&engine->ring) == e_success)
+    {
+        engine->uring = 1;
+        engine->name = "io_uring";
+        return engine;
+    }
+#endif
+    if ((engine->workers = pool_create(AIO_THREADS)) == NULL)
+    {
+        free(engine);
+        return NULL;
+    }
+    pthread_mutex_init(&engine->lock, NULL);
+    pthread_cond_init(&engine->done_cv, NULL);
+    engine->name = "threads";
+    return engine;
+}
+
+const char *aio_engine_name(const AioEngine *engine)
+{
+    return engine->name;
+}
+
+void aio_destroy(AioEngine *engine)
+{
+    if (engine == NULL)
+    {
+        return;
+    }
+#ifdef AIO_URING
+    if (engine->uring)
+    {
+        uring_teardown(&engine->ring);
+        free(engine);
+        return;
+    }
+#endif
+    pool_destroy(engine->workers);
+    pthread_mutex_destroy(&engine->lock);
+    pthread_cond_destroy(&engine->done_cv);
+    free(engine);
+}
+
+int aio_file_ok(FILE *fp)
+{
+    struct stat st;
+    return fp && fileno(fp) >= 0 && fstat(fileno(fp), &st) == 0 && S_ISREG(st.st_mode);
+}
+
+static AioStream *stream_open(AioEngine *engine, int fd, int write, unsigned long long off)
+{
+    AioStream *stream = calloc(1, sizeof(*stream));
+    void *buffers = NULL;
+    if (stream == NULL || posix_memalign(&buffers, 4096, (size_t)AIO_SLOTS * AIO_BLOCK) != 0)
+    {
+        free(stream);
+        return NULL;
+    }
+    stream->engine = engine;
+    stream->fd = fd;
+    stream->write = write;
+    stream->next_off = off;
+    stream->offset = off;
+    stream->buffers = buffers;
+    for (int i = 0; i < AIO_SLOTS; i++)
+    {
+        stream->slots[i].fd = fd;
+        stream->slots[i].write = write;
+        stream->slots[i].buf = stream->buffers + (size_t)i * AIO_BLOCK;
+        stream->slots[i].state = AIO_IDLE;
+    }
+    return stream;
+}
+
+/* Reader: ask for the next block into an idle slot, if the end is not reached */
+static void request_block(AioStream *stream, AioOp *op)
+{
+    if (stream->next_off >= stream->end)
+    {
+        return;
+    }
+    op->off = stream->next_off;
+    op->len = stream->end - stream->next_off < AIO_BLOCK ? stream->end - stream->next_off : AIO_BLOCK;
+    if (op_start(stream->engine, op) != e_success)
+    {
+        stream->failed = 1;
+        return;
+    }
+    stream->next_off += op->len;
+}
+
+AioStream *aio_reader(AioEngine *engine, int fd, unsigned long long off, unsigned long long end)
+{
+    struct stat st;
+    if (fstat(fd, &st) != 0)
+    {
+        return NULL;
+    }
+    AioStream *stream = stream_open(engine, fd, 0, off);
+    if (stream == NULL)
+    {
+        return NULL;
+    }
+    // A shorter file ends the stream there, the reader sees aio_eof()
+    stream->end = end < (unsigned long long)st.st_size ? end : (unsigned long long)st.st_size;
+    for (int i = 0; i < AIO_SLOTS; i++)
+    {
+        request_block(stream, &stream->slots[i]);
+    }
+    return stream;
+}
+
+AioStream *aio_writer(AioEngine *engine, int fd, unsigned long long off)
+{
+    return stream_open(engine, fd, 1, off);
+}
+
+Status aio_read(AioStream *stream, unsigned char *dst, size_t n)
+{
+    while (n > 0)
+    {
+        AioOp *op = &stream->slots[stream->cur];
+        if (stream->failed)
+        {
+            return e_failure;
+        }
+        if (op->state == AIO_IDLE)
+        {
+            stream->eof = 1;
+            return e_failure;
+        }
+        if (op_wait(stream->engine, op) != e_success)
+        {
+            stream->failed = 1;
+            return e_failure;
+        }
+        size_t take = op->len - stream->pos < n ? op->len - stream->pos : n;
+        memcpy(dst, op->buf + stream->pos, take);
+        dst += take;
+        n -= take;
+        stream->pos += take;
+        stream->offset += take;
+        // Block used up: its slot goes to the block AIO_SLOTS ahead
+        if (stream->pos == op->len)
+        {
+            op->state = AIO_IDLE;
+            stream->pos = 0;
+            request_block(stream, op);
+            stream->cur = (stream->cur + 1) % AIO_SLOTS;
+        }
+    }
+    return e_success;
+}
+
+/* Writer: send the slot being filled off and move to the next one */
+static Status flush_block(AioStream *stream)
+{
+    AioOp *op = &stream->slots[stream->cur];
+    op->off = stream->next_off;
+    op->len = stream->pos;
+    if (op_start(stream->engine, op) != e_success)
+    {
+        stream->failed = 1;
+        return e_failure;
+    }
+    stream->next_off += stream->pos;
+    stream->pos = 0;
+    stream->cur = (stream->cur + 1) % AIO_SLOTS;
+    return e_success;
+}
+
+Status aio_write(AioStream *stream, const unsigned char *src, size_t n)
+{
+    while (n > 0)
+    {
+        AioOp *op = &stream->slots[stream->cur];
+        if (stream->failed)
+        {
+            return e_failure;
+        }
+        // The slot still holds a block written AIO_SLOTS ago: it must be out first
+        if (stream->pos == 0 && op->state != AIO_IDLE)
+        {
+            if (op_wait(stream->engine, op) != e_success)
+            {
+                stream->failed = 1;
+                return e_failure;
+            }
+            op->state = AIO_IDLE;
+        }
+        size_t take = AIO_BLOCK - stream->pos < n ? AIO_BLOCK - stream->pos : n;
+        memcpy(op->buf + stream->pos, src, take);
+        src += take;
+        n -= take;
+        stream->pos += take;
+        stream->offset += take;
+        if (stream->pos == AIO_BLOCK && flush_block(stream) != e_success)
+        {
+            return e_failure;
+        }
+    }
+    return e_success;
+}
+
+unsigned long long aio_offset(const AioStream *stream)
+{
+    return stream->offset;
+}
+
+int aio_eof(const AioStream *stream)
+{
+    return stream->eof;
+}
+
+Status aio_close(AioStream *stream)
+{
+    if (stream == NULL)
+    {
+        return e_success;
+    }
+    Status status = stream->failed ? e_failure : e_success;
+    if (stream->write && stream->pos > 0 && !stream->failed && flush_block(stream) != e_success)
+    {
+        status = e_failure;
+    }
+    // Every request must be back before its buffer goes
+    int out = 0;
+    for (int i = 0; i < AIO_SLOTS; i++)
+    {
+        AioOp *op = &stream->slots[i];
+        if (op->state != AIO_IDLE && op_wait(stream->engine, op) != e_success && stream->write)
+        {
+            status = e_failure;
+        }
+        out |= op->state == AIO_BUSY;
+    }
+    // A broken ring may still have requests out on them: the buffers are left to the kernel
+    if (!out)
+    {
+        free(stream->buffers);
+    }
+    free(stream);
+    return status;
+}
+
+#endif
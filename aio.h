@@ -0,0 +1,61 @@
+#ifndef AIO_H
+#define AIO_H
+
+#include <stdio.h>
+#include <stddef.h>
+#include "types.h"
+
+/*
+ * Overlapped file I/O
+ * A stream reads a file ahead, or writes it behind, in AIO_BLOCK requests
+ * with up to AIO_SLOTS of them in flight, so the caller works on one block
+ * while the next ones are read and the last ones written. Requests go to
+ * io_uring (set up with raw system calls, no liburing) and to a few
+ * threads doing blocking pread/pwrite where io_uring is not available.
+ * STEGO_IO=io_uring|threads|stdio forces an engine, stdio turns it off.
+ * Streams work on plain files at absolute offsets and leave the file
+ * position alone; an engine and its streams belong to one thread.
+ */
+
+/* Bytes per request */
+#define AIO_BLOCK (1024 * 1024)
+/* Requests in flight per stream */
+#define AIO_SLOTS 4
+
+typedef struct _AioEngine AioEngine;
+typedef struct _AioStream AioStream;
+
+/* Start an engine (NULL when turned off or nothing works: stay on stdio) */
+AioEngine *aio_create(void);
+
+/* "io_uring" or "threads" */
+const char *aio_engine_name(const AioEngine *engine);
+
+/* Stop the engine, every stream closed first; safe on NULL */
+void aio_destroy(AioEngine *engine);
+
+/* Can fp be read or written through a stream: a plain file with a descriptor */
+int aio_file_ok(FILE *fp);
+
+/* Read fd from off up to end, the first blocks requested right away (NULL on failure) */
+AioStream *aio_reader(AioEngine *engine, int fd, unsigned long long off, unsigned long long end);
+
+/* Write fd from off on */
+AioStream *aio_writer(AioEngine *engine, int fd, unsigned long long off);
+
+/* Next n bytes of a reader into dst; fails on an I/O error or at end (see aio_eof()) */
+Status aio_read(AioStream *stream, unsigned char *dst, size_t n);
+
+/* Queue n bytes for a writer; an I/O error (errno set) shows here or at aio_close() */
+Status aio_write(AioStream *stream, const unsigned char *src, size_t n);
+
+/* File offset just past the last byte read from or queued on the stream */
+unsigned long long aio_offset(const AioStream *stream);
+
+/* The reader ran into its end (or the end of the file) */
+int aio_eof(const AioStream *stream);
+
+/* Write out what is queued, wait for every request and free the stream */
+Status aio_close(AioStream *stream);
+
+#endif
@@ -0,0 +1,256 @@
+#define _FILE_OFFSET_BITS 64
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "archive.h"
+#include "crc32c.h"
+#include "lz.h"
+
+/* Entry bytes besides the name: name length, flags, offset, stored size, size, CRC32C */
+#define ARCHIVE_ENTRY_FIXED_BYTES (1 + 1 + 8 + 8 + 8 + 4)
+
+static void put_be(unsigned char *p, unsigned long long value, int nbytes)
+{
+    for (int i = nbytes - 1; i >= 0; i--)
+    {
+        p[i] = (unsigned char)value;
+        value >>= 8;
+    }
+}
+
+static unsigned long long get_be(const unsigned char *p, int nbytes)
+{
+    unsigned long long value = 0;
+    for (int i = 0; i < nbytes; i++)
+    {
+        value = (value << 8) | p[i];
+    }
+    return value;
+}
+
+int archive_name_ok(const char *name)
+{
+    size_t len = strlen(name);
+    return len > 0 && len <= ARCHIVE_NAME_MAX && strchr(name, '/') == NULL && strcmp(name, ".") != 0
+           && strcmp(name, "..") != 0;
+}
+
+/* A member on its way into the archive */
+typedef struct
+{
+    const char *name;
+    unsigned char *data;   // Raw bytes, or packed when flags say so
+    unsigned long long stored;
+    unsigned long long size;
+    uint32_t crc;
+    int flags;
+} PendingMember;
+
+/* Read the whole file into a malloc'd buffer */
+static Status read_member(const char *path, PendingMember *member)
+{
+    FILE *fp = fopen(path, "rb");
+    if (fp == NULL)
+    {
+        perror("fopen");
+        fprintf(stderr, "ERROR : Unable to open file %s\n", path);
+        return e_failure;
+    }
+    off_t size = -1;
+    if (fseeko(fp, 0, SEEK_END) == 0)
+        size = ftello(fp);
+    rewind(fp);
+    if (size < 0 || (unsigned long long)size > SIZE_MAX)
+    {
+        fclose(fp);
+        return e_failure;
+    }
+    member->size = member->stored = size;
+    member->data = malloc(size ? size : 1);
+    if (member->data == NULL || fread(member->data, 1, size, fp) != (size_t)size)
+    {
+        fclose(fp);
+        return e_failure;
+    }
+    fclose(fp);
+    member->crc = crc32c_update(0, member->data, size);
+    return e_success;
+}
+
+/* -z: pack the member on its own, keep it raw when that does not shrink it */
+static Status pack_member(ThreadPool *pool, PendingMember *member)
+{
+    unsigned char *packed = lz_pack_bound(member->size) < SIZE_MAX ? malloc(lz_pack_bound(member->size) + 1) : NULL;
+    if (packed == NULL)
+    {
+        return e_failure;
+    }
+    size_t packed_size = lz_pack(pool, member->data, member->size, packed);
+    if (packed_size >= member->size)
+    {
+        free(packed);
+        return e_success;
+    }
+    free(member->data);
+    member->data = packed;
+    member->stored = packed_size;
+    member->flags |= ARCHIVE_ENTRY_PACKED;
+    return e_success;
+}
+
+Status archive_build(ThreadPool *pool, char *const *paths, int count, int compress, unsigned char **payload,
+                     unsigned long long *size)
+{
+    PendingMember *members = calloc(count ? count : 1, sizeof(*members));
+    unsigned long long toc = 4 + 4;
+    Status status = members ? e_success : e_failure;
+
+    for (int i = 0; status == e_success && i < count; i++)
+    {
+        const char *slash = strrchr(paths[i], '/');
+        members[i].name = slash ? slash + 1 : paths[i];
+        if (!archive_name_ok(members[i].name))
+        {
+            printf("ERROR : Unusable archive member name %s\n", paths[i]);
+            status = e_failure;
+            break;
+        }
+        for (int j = 0; j < i; j++)
+        {
+            if (strcmp(members[j].name, members[i].name) == 0)
+            {
+                printf("ERROR : Two archive members are called %s\n", members[i].name);
+                status = e_failure;
+            }
+        }
+        if (status == e_success)
+            status = read_member(paths[i], &members[i]);
+        if (status == e_success && compress)
+            status = pack_member(pool, &members[i]);
+        toc += ARCHIVE_ENTRY_FIXED_BYTES + strlen(members[i].name);
+    }
+
+    // Members follow the TOC in order
+    unsigned long long total = ARCHIVE_TOC_LENGTH_BYTES + toc;
+    for (int i = 0; status == e_success && i < count; i++)
+    {
+        total += members[i].stored;
+    }
+    unsigned char *out = status == e_success && total <= SIZE_MAX ? malloc(total) : NULL;
+    if (out)
+    {
+        unsigned char *p = out;
+        unsigned long long offset = ARCHIVE_TOC_LENGTH_BYTES + toc;
+        put_be(p, toc, ARCHIVE_TOC_LENGTH_BYTES);
+        p += ARCHIVE_TOC_LENGTH_BYTES;
+        put_be(p, count, 4);
+        p += 4;
+        for (int i = 0; i < count; i++)
+        {
+            size_t name_len = strlen(members[i].name);
+            *p++ = (unsigned char)name_len;
+            memcpy(p, members[i].name, name_len);
+            p += name_len;
+            *p++ = (unsigned char)members[i].flags;
+            put_be(p, offset, 8);
+            put_be(p + 8, members[i].stored, 8);
+            put_be(p + 16, members[i].size, 8);
+            put_be(p + 24, members[i].crc, 4);
+            p += 28;
+            memcpy(out + offset, members[i].data, members[i].stored);
+            offset += members[i].stored;
+        }
+        put_be(p, crc32c_update(0, out + ARCHIVE_TOC_LENGTH_BYTES, toc - 4), 4);
+        *payload = out;
+        *size = total;
+    }
+    else
+    {
+        status = e_failure;
+    }
+
+    for (int i = 0; members && i < count; i++)
+    {
+        free(members[i].data);
+    }
+    free(members);
+    return status;
+}
+
+Status archive_parse_toc(const unsigned char *toc, size_t len, unsigned long long payload_size, ArchiveToc *out)
+{
+    out->entries = NULL;
+    out->count = 0;
+    if (len < 4 + 4 || get_be(toc + len - 4, 4) != crc32c_update(0, toc, len - 4))
+    {
+        return e_failure;
+    }
+    unsigned long long count = get_be(toc, 4);
+    // Every entry takes at least a one-character name and its fixed fields
+    if (count > (len - 8) / (ARCHIVE_ENTRY_FIXED_BYTES + 1))
+    {
+        return e_failure;
+    }
+    out->entries = calloc(count ? count : 1, sizeof(*out->entries));
+    if (out->entries == NULL)
+    {
+        return e_failure;
+    }
+
+    size_t pos = 4;
+    unsigned long long data_start = ARCHIVE_TOC_LENGTH_BYTES + len;
+    for (unsigned i = 0; i < count; i++)
+    {
+        ArchiveEntry *entry = &out->entries[i];
+        size_t name_len = pos < len - 4 ? toc[pos] : 0;
+        if (name_len == 0 || len - 4 - pos < ARCHIVE_ENTRY_FIXED_BYTES + name_len)
+        {
+            archive_free_toc(out);
+            return e_failure;
+        }
+        memcpy(entry->name, toc + pos + 1, name_len);
+        entry->name[name_len] = '\0';
+        pos += 1 + name_len;
+        entry->flags = toc[pos];
+        entry->offset = get_be(toc + pos + 1, 8);
+        entry->stored = get_be(toc + pos + 9, 8);
+        entry->size = get_be(toc + pos + 17, 8);
+        entry->crc = (uint32_t)get_be(toc + pos + 25, 4);
+        pos += 29;
+        // Members must lie inside the payload, behind the TOC, with a usable name
+        if (!archive_name_ok(entry->name) || strlen(entry->name) != name_len || (entry->flags & ~ARCHIVE_ENTRY_PACKED)
+            || entry->offset < data_start || entry->offset > payload_size || entry->stored > payload_size - entry->offset
+            || (!(entry->flags & ARCHIVE_ENTRY_PACKED) && entry->stored != entry->size))
+        {
+            archive_free_toc(out);
+            return e_failure;
+        }
+        out->count++;
+    }
+    if (pos != len - 4)
+    {
+        archive_free_toc(out);
+        return e_failure;
+    }
+    return e_success;
+}
+
+const ArchiveEntry *archive_find(const ArchiveToc *toc, const char *name)
+{
+    for (unsigned i = 0; i < toc->count; i++)
+    {
+        if (strcmp(toc->entries[i].name, name) == 0)
+        {
+            return &toc->entries[i];
+        }
+    }
+    return NULL;
+}
+
+void archive_free_toc(ArchiveToc *toc)
+{
+    free(toc->entries);
+    toc->entries = NULL;
+    toc->count = 0;
+}
@@ -0,0 +1,67 @@
+#ifndef ARCHIVE_H
+#define ARCHIVE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "types.h"
+#include "threadpool.h"
+
+/*
+ * Archive payloads (-a): several files in one carrier
+ * The payload (before sealing) starts with a table of contents, all fields
+ * MSB first like the stego header:
+ *   TOC length    → 4 bytes, the bytes that follow up to the first member
+ *   entry count   → 4 bytes
+ *   every entry   → name length (1 byte), name, flags (1 byte),
+ *                   offset (8), stored size (8), size (8), CRC32C (4)
+ *   TOC checksum  → 4 bytes, CRC32C of the count and the entries
+ * then the members, each at its offset from the payload start. A member
+ * with ARCHIVE_ENTRY_PACKED is packed on its own by lz.h, so every member
+ * can be extracted without touching the others, and its CRC32C (of the
+ * extracted bytes) is checked without the rest of the payload.
+ */
+#define ARCHIVE_TOC_LENGTH_BYTES 4
+#define ARCHIVE_NAME_MAX 255
+#define ARCHIVE_ENTRY_PACKED 0x01
+
+/* One member as listed in the TOC */
+typedef struct _ArchiveEntry
+{
+    char name[ARCHIVE_NAME_MAX + 1];
+    int flags;                // ARCHIVE_ENTRY_PACKED
+    unsigned long long offset; // Payload offset of the stored bytes
+    unsigned long long stored; // Bytes stored, packed size with ARCHIVE_ENTRY_PACKED
+    unsigned long long size;   // Bytes once extracted
+    uint32_t crc;              // CRC32C of the extracted bytes
+} ArchiveEntry;
+
+typedef struct _ArchiveToc
+{
+    ArchiveEntry *entries;
+    unsigned count;
+} ArchiveToc;
+
+/*
+ * Read every file in paths and lay them out as an archive payload
+ * (malloc'd into *payload), packing every member that shrinks when
+ * compress is set. Members are named after the last path component.
+ */
+Status archive_build(ThreadPool *pool, char *const *paths, int count, int compress, unsigned char **payload,
+                     unsigned long long *size);
+
+/*
+ * Parse len TOC bytes (what follows the length field) of a payload_size
+ * byte archive, e_failure if the checksum or any entry is off
+ */
+Status archive_parse_toc(const unsigned char *toc, size_t len, unsigned long long payload_size, ArchiveToc *out);
+
+/* Entry called name, NULL if there is none */
+const ArchiveEntry *archive_find(const ArchiveToc *toc, const char *name);
+
+/* Free what archive_parse_toc() allocated */
+void archive_free_toc(ArchiveToc *toc);
+
+/* A member name that stays inside the output directory: no '/', not "." or ".." */
+int archive_name_ok(const char *name);
+
+#endif
@@ -0,0 +1,162 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "arena.h"
+
+struct _ArenaBlock
+{
+    ArenaBlock *next;         // Older block
+    size_t size;              // Usable bytes from data on
+    unsigned char *data;      // First aligned byte after the header
+};
+
+/* Hand out the caller's storage again, from its first aligned byte */
+static void use_storage(Arena *arena)
+{
+    size_t skip = (ARENA_ALIGN - (uintptr_t)arena->storage % ARENA_ALIGN) % ARENA_ALIGN;
+    if (arena->storage == NULL || skip >= arena->storage_size)
+    {
+        arena->next = NULL;
+        arena->left = 0;
+        return;
+    }
+    arena->next = arena->storage + skip;
+    arena->left = arena->storage_size - skip;
+}
+
+/* Put a block of at least need bytes in use, twice the last one when that is larger */
+static int grow(Arena *arena, size_t need)
+{
+    size_t size = arena->blocks ? arena->blocks->size : ARENA_MIN_BLOCK / 2;
+    size = size <= SIZE_MAX / 4 ? 2 * size : need;
+    if (size < need)
+    {
+        size = need;
+    }
+    if (size > SIZE_MAX - sizeof(ArenaBlock) - ARENA_ALIGN)
+    {
+        return 0;
+    }
+    ArenaBlock *block = malloc(sizeof(*block) + ARENA_ALIGN + size);
+    // Doubling is only worth it while memory is plentiful
+    if (block == NULL && size > need)
+    {
+        size = need;
+        block = malloc(sizeof(*block) + ARENA_ALIGN + size);
+    }
+    if (block == NULL)
+    {
+        return 0;
+    }
+    uintptr_t start = (uintptr_t)(block + 1);
+    block->data = (unsigned char *)(block + 1) + (ARENA_ALIGN - start % ARENA_ALIGN) % ARENA_ALIGN;
+    block->size = size;
+    block->next = arena->blocks;
+    arena->blocks = block;
+    arena->next = block->data;
+    arena->left = size;
+    return 1;
+}
+
+/* Free every block from block on */
+static void free_blocks(ArenaBlock *block)
+{
+    while (block)
+    {
+        ArenaBlock *next = block->next;
+        free(block);
+        block = next;
+    }
+}
+
+void arena_init(Arena *arena, void *storage, size_t size)
+{
+    arena->storage = storage;
+    arena->storage_size = storage ? size : 0;
+    arena->blocks = NULL;
+    arena->taken = 0;
+    use_storage(arena);
+}
+
+void *arena_alloc(Arena *arena, size_t n)
+{
+    if (arena == NULL || n > SIZE_MAX - ARENA_ALIGN)
+    {
+        return NULL;
+    }
+    // Whole alignment units keep the next allocation aligned too
+    size_t need = n ? (n + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1) : ARENA_ALIGN;
+    if (need > arena->left && !grow(arena, need))
+    {
+        return NULL;
+    }
+    void *p = arena->next;
+    arena->next += need;
+    arena->left -= need;
+    arena->taken += need;
+    return p;
+}
+
+char *arena_strdup(Arena *arena, const char *s)
+{
+    size_t len = strlen(s);
+    char *copy = arena_alloc(arena, len + 1);
+    if (copy)
+    {
+        memcpy(copy, s, len + 1);
+    }
+    return copy;
+}
+
+char *arena_concat(Arena *arena, const char *s, const char *tail)
+{
+    size_t len = strlen(s);
+    size_t tail_len = strlen(tail);
+    char *joined = arena_alloc(arena, len + tail_len + 1);
+    if (joined)
+    {
+        memcpy(joined, s, len);
+        memcpy(joined + len, tail, tail_len + 1);
+    }
+    return joined;
+}
+
+void arena_reset(Arena *arena)
+{
+    ArenaBlock *last = arena->blocks;
+    if (last && arena->taken > last->size)
+    {
+        // The job spilled over several blocks: one that holds it all serves the next one
+        size_t taken = arena->taken;
+        free_blocks(last);
+        arena->blocks = NULL;
+        if (!grow(arena, taken))
+        {
+            use_storage(arena);
+        }
+    }
+    else if (last)
+    {
+        free_blocks(last->next);
+        last->next = NULL;
+        arena->next = last->data;
+        arena->left = last->size;
+    }
+    else
+    {
+        use_storage(arena);
+    }
+    arena->taken = 0;
+}
+
+void arena_release(Arena *arena)
+{
+    if (arena == NULL)
+    {
+        return;
+    }
+    free_blocks(arena->blocks);
+    arena->blocks = NULL;
+    arena->taken = 0;
+    use_storage(arena);
+}
@@ -0,0 +1,53 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+
+/*
+ * Job arenas
+ * What a job needs while it runs (the output name, the payload extension,
+ * batch buffers) is carved out of one arena: nothing is freed on its own,
+ * everything goes at once when the job is over. A reset keeps the memory
+ * for the next job, and a job that had to grow the arena leaves it one
+ * block as large as all it took, so batch and daemon workers running job
+ * after job in the same arena stop allocating once they have seen the
+ * largest job. An arena belongs to one thread at a time.
+ */
+
+/* Alignment of every allocation: a cache line, enough for any SIMD load */
+#define ARENA_ALIGN 64
+
+/* Smallest block the arena allocates by itself */
+#define ARENA_MIN_BLOCK (64 * 1024)
+
+typedef struct _ArenaBlock ArenaBlock;
+
+typedef struct _Arena
+{
+    unsigned char *storage;   // Caller's memory, used up first (NULL = none)
+    size_t storage_size;
+    ArenaBlock *blocks;       // Blocks allocated by the arena, the one in use first
+    unsigned char *next;      // Free space left in the storage or block in use
+    size_t left;
+    size_t taken;             // Bytes handed out since the last reset
+} Arena;
+
+/* Start an empty arena that hands out size bytes of storage (may be NULL) before allocating */
+void arena_init(Arena *arena, void *storage, size_t size);
+
+/* n bytes aligned to ARENA_ALIGN, valid until the next reset (NULL when out of memory or no arena) */
+void *arena_alloc(Arena *arena, size_t n);
+
+/* Copy of s */
+char *arena_strdup(Arena *arena, const char *s);
+
+/* New string: s followed by tail */
+char *arena_concat(Arena *arena, const char *s, const char *tail);
+
+/* Take back everything handed out, keeping the memory for the next job */
+void arena_reset(Arena *arena);
+
+/* Free what the arena allocated, leaving it empty as after arena_init(); safe on NULL */
+void arena_release(Arena *arena);
+
+#endif
@@ -0,0 +1,243 @@
+#define _POSIX_C_SOURCE 200809L
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "batch.h"
+#include "encode.h"
+#include "decode.h"
+
+#define BATCH_MAX_FIELDS 3
+
+/* State shared by the manifest reader and the jobs */
+typedef struct
+{
+    const BatchOptions *opts;
+    BatchSummary *summary;
+    pthread_mutex_t lock;
+    pthread_cond_t slot_cv; // Signalled whenever a job finishes
+    int in_flight;          // Jobs queued or running
+    int max_in_flight;      // Bound on queued jobs, and so on buffer memory
+    Arena *arenas;          // One per job in flight, reset and handed to the next job when one is over
+    Arena **idle;           // Arenas no job holds, idle_count of them
+    int idle_count;
+} BatchState;
+
+/* One manifest line */
+typedef struct
+{
+    BatchState *state;
+    Arena *arena;                   // Job memory, the state's until the job is over
+    unsigned long line_no;
+    char *line;                     // Owns the storage the fields point into
+    char *fields[BATCH_MAX_FIELDS];
+    int nfields;
+} BatchJob;
+
+/* Split a manifest line in place; tabs win over spaces so paths may contain blanks */
+static void split_fields(BatchJob *job)
+{
+    const char *delims = strchr(job->line, '\t') ? "\t" : " ";
+    char *save = NULL;
+    job->nfields = 0;
+
+    for (char *tok = strtok_r(job->line, delims, &save); tok; tok = strtok_r(NULL, delims, &save))
+    {
+        if (job->nfields == BATCH_MAX_FIELDS)
+        {
+            job->nfields++; // Too many fields, reported as a bad line
+            break;
+        }
+        job->fields[job->nfields++] = tok;
+    }
+}
+
+static double elapsed_ms(const struct timespec *start)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start->tv_sec) * 1e3 + (now.tv_nsec - start->tv_nsec) / 1e6;
+}
+
+/* Run one encode job through the regular validate + do_encoding path */
+static const char *run_encode_job(BatchJob *job, const char **output)
+{
+    EncodeInfo encInfo;
+    char *argv[] = {"stego", "-e", job->fields[0], job->fields[1], job->fields[2], NULL};
+
+    if (job->nfields != 3)
+        return "expected: carrier secret output";
+
+    memset(&encInfo, 0, sizeof(encInfo));
+    encInfo.arena = job->arena;
+    encInfo.use_mmap = job->state->opts->use_mmap || job->state->opts->key;
+    encInfo.depth = job->state->opts->depth;
+    encInfo.key = job->state->opts->key;
+    encInfo.compress = job->state->opts->compress;
+    encInfo.cipher_key = job->state->opts->cipher_key;
+    encInfo.carrier.raw = job->state->opts->raw;
+    encInfo.quiet = 1;
+    *output = job->fields[2];
+    if (read_and_validate_encode_args(argv, &encInfo) != e_success)
+        return "validation failed";
+    if (do_encoding(&encInfo) != e_success)
+        return "encoding failed";
+    return NULL;
+}
+
+/* Run one decode job; output keeps pointing at the final name once known */
+static const char *run_decode_job(BatchJob *job, const char **output, DecodeInfo *decInfo)
+{
+    char *argv[] = {"stego", "-d", job->fields[0], job->fields[1], NULL};
+
+    if (job->nfields != 2)
+        return "expected: stego output";
+
+    memset(decInfo, 0, sizeof(*decInfo));
+    decInfo->arena = job->arena;
+    decInfo->use_mmap = job->state->opts->use_mmap || job->state->opts->key;
+    decInfo->key = job->state->opts->key;
+    decInfo->cipher_key = job->state->opts->cipher_key;
+    decInfo->raw_layout = job->state->opts->raw;
+    decInfo->quiet = 1;
+    *output = job->fields[1];
+    if (read_and_validate_decode_args(argv, decInfo) != d_success)
+        return "validation failed";
+    DStatus status = do_decoding(decInfo);
+    // The extension made a new name in the arena, it stays there until the report line is out
+    *output = decInfo->output_fname;
+    if (status != d_success)
+        return decInfo->truncated         ? "image truncated"
+               : decInfo->checksum_failed ? "checksum mismatch"
+               : decInfo->auth_failed     ? "authentication failed"
+                                          : "decoding failed";
+    return NULL;
+}
+
+static void run_job(void *arg)
+{
+    BatchJob *job = arg;
+    BatchState *state = job->state;
+    DecodeInfo decInfo;
+    const char *output = "";
+    const char *error;
+    struct timespec start;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    if (state->opts->op == e_encode)
+        error = run_encode_job(job, &output);
+    else
+        error = run_decode_job(job, &output, &decInfo);
+    double ms = elapsed_ms(&start);
+
+    pthread_mutex_lock(&state->lock);
+    fprintf(state->opts->report, "%lu\t%s\t%s\t%s\t%.3f\t%s\n", job->line_no,
+            error ? "failed" : "ok", job->nfields > 0 ? job->fields[0] : "", output, ms,
+            error ? error : "");
+    if (error)
+        state->summary->failed++;
+    else
+        state->summary->ok++;
+    state->in_flight--;
+    arena_reset(job->arena);
+    state->idle[state->idle_count++] = job->arena;
+    pthread_cond_signal(&state->slot_cv);
+    pthread_mutex_unlock(&state->lock);
+
+    free(job->line);
+    free(job);
+}
+
+Status run_batch(const char *manifest, const BatchOptions *opts, BatchSummary *summary)
+{
+    FILE *fp = strcmp(manifest, "-") == 0 ? stdin : fopen(manifest, "r");
+    if (fp == NULL)
+    {
+        perror("fopen");
+        fprintf(stderr, "ERROR: Unable to open manifest %s\n", manifest);
+        return e_failure;
+    }
+
+    BatchState state;
+    memset(summary, 0, sizeof(*summary));
+    state.opts = opts;
+    state.summary = summary;
+    state.in_flight = 0;
+    // Two jobs per worker keep everyone busy without reading the whole manifest ahead
+    state.max_in_flight = opts->pool ? 2 * pool_size(opts->pool) : 1;
+    state.arenas = calloc(state.max_in_flight, sizeof(*state.arenas));
+    state.idle = calloc(state.max_in_flight, sizeof(*state.idle));
+    if (state.arenas == NULL || state.idle == NULL)
+    {
+        free(state.arenas);
+        free(state.idle);
+        if (fp != stdin)
+            fclose(fp);
+        return e_failure;
+    }
+    for (state.idle_count = 0; state.idle_count < state.max_in_flight; state.idle_count++)
+    {
+        arena_init(&state.arenas[state.idle_count], NULL, 0);
+        state.idle[state.idle_count] = &state.arenas[state.idle_count];
+    }
+    pthread_mutex_init(&state.lock, NULL);
+    pthread_cond_init(&state.slot_cv, NULL);
+
+    char *line = NULL;
+    size_t cap = 0;
+    ssize_t len;
+    unsigned long line_no = 0;
+    Status status = e_success;
+
+    while ((len = getline(&line, &cap, fp)) >= 0)
+    {
+        line_no++;
+        while (len > 0 && (line[len - 1] == '\n' || line[len - 1] == '\r'))
+            line[--len] = '\0';
+        if (len == 0 || line[0] == '#')
+            continue;
+
+        BatchJob *job = calloc(1, sizeof(*job));
+        if (job == NULL || (job->line = strdup(line)) == NULL)
+        {
+            free(job);
+            status = e_failure;
+            break;
+        }
+        job->state = &state;
+        job->line_no = line_no;
+        split_fields(job);
+
+        pthread_mutex_lock(&state.lock);
+        while (state.in_flight >= state.max_in_flight)
+            pthread_cond_wait(&state.slot_cv, &state.lock);
+        state.in_flight++;
+        job->arena = state.idle[--state.idle_count];
+        summary->jobs++;
+        pthread_mutex_unlock(&state.lock);
+
+        if (opts->pool == NULL || pool_submit(opts->pool, run_job, job) != e_success)
+            run_job(job);
+    }
+
+    // Wait for the tail of the batch
+    pthread_mutex_lock(&state.lock);
+    while (state.in_flight > 0)
+        pthread_cond_wait(&state.slot_cv, &state.lock);
+    pthread_mutex_unlock(&state.lock);
+
+    free(line);
+    if (fp != stdin)
+        fclose(fp);
+    fflush(opts->report);
+    pthread_mutex_destroy(&state.lock);
+    pthread_cond_destroy(&state.slot_cv);
+    for (int i = 0; i < state.max_in_flight; i++)
+        arena_release(&state.arenas[i]);
+    free(state.arenas);
+    free(state.idle);
+
+    if (summary->failed > 0)
+        status = e_failure;
+    return status;
+}
@@ -0,0 +1,41 @@
+#ifndef BATCH_H
+#define BATCH_H
+
+#include <stdio.h>
+#include "types.h"
+#include "threadpool.h"
+#include "pnm.h"
+
+/*
+ * Batch mode: run many encode or decode jobs in one process.
+ * The manifest has one job per line, fields separated by tabs
+ * (or by spaces when the line has no tab):
+ *   encode : <carrier.bmp> <secret file> <output.bmp>
+ *   decode : <stego.bmp> <output name>
+ * Blank lines and lines starting with '#' are skipped.
+ */
+typedef struct _BatchOptions
+{
+    OperationType op; // e_encode or e_decode
+    int use_mmap;     // Map files instead of streaming them
+    int depth;        // Encode: LSBs per carrier byte (1-4)
+    const char *key;  // --key for every job (implies use_mmap)
+    int compress;     // -z for every encode job
+    const unsigned char *cipher_key; // --encrypt key for every job (NULL = none)
+    const RawLayout *raw; // --raw: every carrier/stego image is a headerless dump of this layout
+    ThreadPool *pool; // Jobs run on these workers (NULL = one at a time)
+    FILE *report;     // Per-job status lines: line, status, input, output, ms
+} BatchOptions;
+
+/* Totals of a batch run */
+typedef struct _BatchSummary
+{
+    unsigned long jobs;
+    unsigned long ok;
+    unsigned long failed;
+} BatchSummary;
+
+/* Run every job of the manifest ("-" reads it from stdin) */
+Status run_batch(const char *manifest, const BatchOptions *opts, BatchSummary *summary);
+
+#endif
@@ -0,0 +1,571 @@
+/*
+ * Benchmark harness
+ * Generates synthetic 24 bpp carriers and random payloads, then runs every
+ * stage of encoding and decoding for a set of variants and prints one JSON
+ * document with per-stage times, throughput, syscalls and peak RSS.
+ *
+ * Build from the repository root:
+ *   gcc -O2 -pthread -I. bench/bench.c $(ls *.c | grep -v main.c) -o stego-bench
+ * Run:
+ *   ./stego-bench --sizes 1M,64M,512M,2G --repeat 3 > bench.json
+ *
+ * The stages mirror do_encoding()/do_decoding() step by step; "baseline"
+ * is the default command line path (stdio, automatic kernel, one thread,
+ * depth 1) and is the reference the other variants are compared against.
+ */
+#define _FILE_OFFSET_BITS 64
+#define _POSIX_C_SOURCE 200809L
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/resource.h>
+#include "encode.h"
+#include "decode.h"
+#include "lsb.h"
+#include "common.h"
+
+/* One configuration of the tool */
+typedef struct
+{
+    const char *name;
+    const char *kernel; // NULL = automatic choice
+    int use_mmap;
+    int jobs;           // 0 = --jobs
+    int depth;
+} Variant;
+
+static const Variant variants[] = {
+    {"baseline", NULL, 0, 1, 1},
+    {"scalar", "scalar", 0, 1, 1},
+    {"mmap", NULL, 1, 1, 1},
+    {"mmap-threads", NULL, 1, 0, 1},
+    {"depth4", NULL, 1, 1, 4},
+};
+
+#define VARIANT_COUNT (sizeof(variants) / sizeof(variants[0]))
+
+/* Stage names, in the order do_encoding()/do_decoding() run them */
+static const char *const encode_stages[] = {"open", "capacity", "header", "metadata", "data", "tail", "close"};
+static const char *const decode_stages[] = {"open", "header", "metadata", "data", "close"};
+
+#define MAX_STAGES 7
+
+/* Counters sampled around a run */
+typedef struct
+{
+    unsigned long long read_calls;
+    unsigned long long write_calls;
+    long minor_faults;
+    long major_faults;
+} Counters;
+
+/* One timed encode or decode */
+typedef struct
+{
+    double stage[MAX_STAGES];
+    double total;
+    Counters cost;
+    long peak_rss_kb;
+    int ok;
+} RunResult;
+
+typedef struct
+{
+    const char *dir;
+    unsigned long long sizes[16];
+    int nsizes;
+    int fill;       // Payload size as a percentage of the depth-1 capacity
+    int repeat;
+    int jobs;
+    int keep;
+    const char *only; // Comma separated variant names, NULL = all
+} BenchOptions;
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* read/write syscalls from /proc/self/io, page faults from getrusage */
+static void sample_counters(Counters *c)
+{
+    char line[128];
+    FILE *fp = fopen("/proc/self/io", "r");
+    memset(c, 0, sizeof(*c));
+    while (fp && fgets(line, sizeof(line), fp))
+    {
+        sscanf(line, "syscr: %llu", &c->read_calls);
+        sscanf(line, "syscw: %llu", &c->write_calls);
+    }
+    if (fp)
+        fclose(fp);
+
+    struct rusage ru;
+    getrusage(RUSAGE_SELF, &ru);
+    c->minor_faults = ru.ru_minflt;
+    c->major_faults = ru.ru_majflt;
+}
+
+/* Reset the peak RSS watermark where the kernel allows it (Linux 4.0+) */
+static void reset_peak_rss(void)
+{
+    FILE *fp = fopen("/proc/self/clear_refs", "w");
+    if (fp)
+    {
+        fputs("5", fp);
+        fclose(fp);
+    }
+}
+
+static long peak_rss_kb(void)
+{
+    char line[128];
+    long kb = -1;
+    FILE *fp = fopen("/proc/self/status", "r");
+    while (fp && fgets(line, sizeof(line), fp))
+    {
+        if (sscanf(line, "VmHWM: %ld", &kb) == 1)
+            break;
+    }
+    if (fp)
+        fclose(fp);
+    if (kb < 0)
+    {
+        struct rusage ru;
+        getrusage(RUSAGE_SELF, &ru);
+        kb = ru.ru_maxrss;
+    }
+    return kb;
+}
+
+/* xorshift64*: fast, good enough for pixel noise and payloads */
+static void fill_random(unsigned char *buf, size_t n, uint64_t *state)
+{
+    for (size_t i = 0; i < n; i += 8)
+    {
+        *state ^= *state >> 12;
+        *state ^= *state << 25;
+        *state ^= *state >> 27;
+        uint64_t v = *state * 0x2545F4914F6CDD1DULL;
+        memcpy(buf + i, &v, n - i < 8 ? n - i : 8);
+    }
+}
+
+static Status write_random(FILE *fp, unsigned long long n, uint64_t *state)
+{
+    unsigned char *buf = malloc(1 << 20);
+    Status status = buf ? e_success : e_failure;
+    while (status == e_success && n > 0)
+    {
+        size_t len = n < (1 << 20) ? n : (1 << 20);
+        fill_random(buf, len, state);
+        if (fwrite(buf, 1, len, fp) != len)
+            status = e_failure;
+        n -= len;
+    }
+    free(buf);
+    return status;
+}
+
+static void put_le16(unsigned char *p, unsigned v)
+{
+    p[0] = v;
+    p[1] = v >> 8;
+}
+
+static void put_le32(unsigned char *p, unsigned long v)
+{
+    put_le16(p, v & 0xFFFF);
+    put_le16(p + 2, v >> 16);
+}
+
+/* A 24 bpp bottom-up BMP of about size bytes, 4096 pixels wide */
+static Status make_carrier(const char *path, unsigned long long size, unsigned long long *capacity)
+{
+    const unsigned width = 4096;
+    unsigned long long stride = width * 3;
+    unsigned long long height = size > 54 + stride ? (size - 54) / stride : 1;
+    unsigned char header[54] = {'B', 'M'};
+
+    put_le32(header + 2, (unsigned long)(54 + stride * height)); // Wraps past 4 GB, like real tools
+    put_le32(header + 10, 54);
+    put_le32(header + 14, 40);
+    put_le32(header + 18, width);
+    put_le32(header + 22, (unsigned long)height);
+    put_le16(header + 26, 1);
+    put_le16(header + 28, 24);
+
+    FILE *fp = fopen(path, "wb");
+    uint64_t state = 0x9E3779B97F4A7C15ULL ^ size;
+    if (fp == NULL)
+        return e_failure;
+    Status status = fwrite(header, sizeof(header), 1, fp) == 1 ? write_random(fp, stride * height, &state) : e_failure;
+    if (fclose(fp) != 0)
+        status = e_failure;
+    *capacity = stride * height;
+    return status;
+}
+
+static Status make_payload(const char *path, unsigned long long size)
+{
+    FILE *fp = fopen(path, "wb");
+    uint64_t state = 0xD1B54A32D192ED03ULL ^ size;
+    if (fp == NULL)
+        return e_failure;
+    Status status = write_random(fp, size, &state);
+    if (fclose(fp) != 0)
+        status = e_failure;
+    return status;
+}
+
+/* Compare two files byte for byte */
+static int same_file(const char *a, const char *b)
+{
+    FILE *fa = fopen(a, "rb");
+    FILE *fb = fopen(b, "rb");
+    int same = fa && fb;
+    char ba[1 << 16], bb[1 << 16];
+    size_t na, nb;
+    while (same && (na = fread(ba, 1, sizeof(ba), fa)) > 0)
+    {
+        nb = fread(bb, 1, sizeof(bb), fb);
+        same = na == nb && memcmp(ba, bb, na) == 0;
+    }
+    if (same)
+        same = fread(bb, 1, 1, fb) == 0;
+    if (fa)
+        fclose(fa);
+    if (fb)
+        fclose(fb);
+    return same;
+}
+
+/* Time one stage: t is updated to the end of the stage */
+#define STAGE(res, i, t, expr)               \
+    do                                       \
+    {                                        \
+        int stage_ok_ = (expr);              \
+        double end_ = now();                 \
+        (res)->stage[i] = end_ - (t);        \
+        (t) = end_;                          \
+        if (!stage_ok_)                      \
+            goto fail;                       \
+    } while (0)
+
+/* The steps of do_encoding(), timed one by one */
+static void run_encode(const Variant *v, ThreadPool *pool, char *carrier, char *payload, char *output, RunResult *res)
+{
+    EncodeInfo encInfo;
+    Arena arena;
+    memset(&encInfo, 0, sizeof(encInfo));
+    memset(res, 0, sizeof(*res));
+    arena_init(&arena, NULL, 0);
+    encInfo.arena = &arena;
+    encInfo.src_image_fname = carrier;
+    encInfo.secret_fname = payload;
+    encInfo.stego_image_fname = output;
+    encInfo.use_mmap = v->use_mmap;
+    encInfo.depth = v->depth;
+    encInfo.pool = pool;
+    encInfo.quiet = 1;
+    encInfo.extn_secret_file = ".txt";
+
+    Counters before, after;
+    reset_peak_rss();
+    sample_counters(&before);
+    double start = now(), t = start;
+
+    STAGE(res, 0, t, (v->use_mmap ? open_mapped_files(&encInfo) : open_files(&encInfo)) == e_success);
+    STAGE(res, 1, t, check_capacity(&encInfo) == e_success);
+    STAGE(res, 2, t, v->use_mmap || copy_carrier_header(&encInfo) == e_success);
+    STAGE(res, 3, t, encode_magic_string(MAGIC_STRING, &encInfo) == e_success
+                         && encode_format_descriptor(&encInfo) == e_success
+                         && encode_secret_file_extn_size(strlen(encInfo.extn_secret_file), &encInfo) == e_success
+                         && encode_secret_file_extn(encInfo.extn_secret_file, &encInfo) == e_success
+                         && encode_secret_file_size(encInfo.size_secret_file, &encInfo) == e_success);
+    STAGE(res, 4, t, encode_secret_file_data(&encInfo) == e_success);
+    STAGE(res, 5, t, v->use_mmap || copy_remaining_img_data(encInfo.fptr_src_image, encInfo.fptr_stego_image, &encInfo.tail_copy) == e_success);
+    STAGE(res, 6, t, close_encode_files(&encInfo) == e_success);
+    res->ok = 1;
+
+fail:
+    if (!res->ok)
+        close_encode_files(&encInfo);
+    res->total = now() - start;
+    arena_release(&arena);
+    sample_counters(&after);
+    res->peak_rss_kb = peak_rss_kb();
+    res->cost.read_calls = after.read_calls - before.read_calls;
+    res->cost.write_calls = after.write_calls - before.write_calls;
+    res->cost.minor_faults = after.minor_faults - before.minor_faults;
+    res->cost.major_faults = after.major_faults - before.major_faults;
+}
+
+static void close_decode(DecodeInfo *decInfo)
+{
+    if (decInfo->use_mmap)
+        unmap_file(&decInfo->stego_map);
+    else if (decInfo->fptr_stego_image)
+        fclose(decInfo->fptr_stego_image);
+    if (decInfo->fptr_output)
+        fclose(decInfo->fptr_output);
+    decInfo->fptr_stego_image = NULL;
+    decInfo->fptr_output = NULL;
+    decInfo->raw = NULL;
+}
+
+static int open_decode_input(DecodeInfo *decInfo)
+{
+    if (decInfo->use_mmap)
+        return map_file_read(decInfo->stego_image_fname, &decInfo->stego_map) == e_success;
+    return (decInfo->fptr_stego_image = fopen(decInfo->stego_image_fname, "rb")) != NULL;
+}
+
+/* The steps of do_decoding(), timed one by one */
+static void run_decode(const Variant *v, ThreadPool *pool, char *stego, const char *output, RunResult *res)
+{
+    DecodeInfo decInfo;
+    Arena arena;
+    memset(&decInfo, 0, sizeof(decInfo));
+    memset(res, 0, sizeof(*res));
+    arena_init(&arena, NULL, 0);
+    decInfo.arena = &arena;
+    decInfo.stego_image_fname = stego;
+    decInfo.output_fname = arena_strdup(&arena, output);
+    decInfo.use_mmap = v->use_mmap;
+    decInfo.pool = pool;
+    decInfo.quiet = 1;
+
+    Counters before, after;
+    reset_peak_rss();
+    sample_counters(&before);
+    double start = now(), t = start;
+
+    STAGE(res, 0, t, open_decode_input(&decInfo));
+    STAGE(res, 1, t, skip_bmp_header(&decInfo) == d_success);
+    STAGE(res, 2, t, decode_magic_string(&decInfo) == d_success
+                         && decode_format_descriptor(&decInfo) == d_success
+                         && decode_secret_file_extn_size(&decInfo) == d_success
+                         && decode_secret_file_extn(&decInfo) == d_success
+                         && (decInfo.fptr_output = fopen(decInfo.output_fname, "wb")) != NULL
+                         && decode_secret_file_size(&decInfo) == d_success);
+    STAGE(res, 3, t, decode_secret_file_data(&decInfo) == d_success);
+    STAGE(res, 4, t, (close_decode(&decInfo), 1));
+    res->ok = 1;
+
+fail:
+    if (!res->ok)
+        close_decode(&decInfo);
+    res->total = now() - start;
+    arena_release(&arena);
+    sample_counters(&after);
+    res->peak_rss_kb = peak_rss_kb();
+    res->cost.read_calls = after.read_calls - before.read_calls;
+    res->cost.write_calls = after.write_calls - before.write_calls;
+    res->cost.minor_faults = after.minor_faults - before.minor_faults;
+    res->cost.major_faults = after.major_faults - before.major_faults;
+}
+
+static int cmp_double(const void *a, const void *b)
+{
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+/* Print the fastest of the runs, with the median total next to it */
+static void print_result(const char *op, const char *const *stages, int nstages, RunResult *runs, int nruns,
+                         unsigned long long carrier_bytes, unsigned long long payload_bytes, int *first)
+{
+    RunResult *best = &runs[0];
+    double totals[64];
+    int ok = 1;
+    for (int i = 0; i < nruns; i++)
+    {
+        totals[i] = runs[i].total;
+        ok = ok && runs[i].ok;
+        if (runs[i].total < best->total)
+            best = &runs[i];
+    }
+    qsort(totals, nruns, sizeof(double), cmp_double);
+
+    printf("%s      {\"op\": \"%s\", \"ok\": %s, \"runs\": %d, \"best_s\": %.6f, \"median_s\": %.6f,\n",
+           *first ? "" : ",\n", op, ok ? "true" : "false", nruns, best->total, totals[nruns / 2]);
+    printf("       \"payload_mb_s\": %.2f, \"carrier_mb_s\": %.2f,\n",
+           payload_bytes / 1e6 / best->total, carrier_bytes / 1e6 / best->total);
+    printf("       \"stages_s\": {");
+    for (int i = 0; i < nstages; i++)
+        printf("%s\"%s\": %.6f", i ? ", " : "", stages[i], best->stage[i]);
+    printf("},\n");
+    printf("       \"syscalls\": {\"read\": %llu, \"write\": %llu}, \"page_faults\": {\"minor\": %ld, \"major\": %ld},\n",
+           best->cost.read_calls, best->cost.write_calls, best->cost.minor_faults, best->cost.major_faults);
+    printf("       \"peak_rss_kb\": %ld}", best->peak_rss_kb);
+    *first = 0;
+}
+
+static int variant_selected(const BenchOptions *opts, const char *name)
+{
+    if (opts->only == NULL)
+        return 1;
+    size_t len = strlen(name);
+    for (const char *p = opts->only; (p = strstr(p, name)) != NULL; p += len)
+    {
+        if ((p == opts->only || p[-1] == ',') && (p[len] == '\0' || p[len] == ','))
+            return 1;
+    }
+    return 0;
+}
+
+static void bench_size(const BenchOptions *opts, unsigned long long size, int *first_size)
+{
+    char carrier[512], payload[512], stego[512], decoded[512], decoded_file[512];
+    unsigned long long capacity;
+
+    snprintf(carrier, sizeof(carrier), "%s/bench_carrier_%llu.bmp", opts->dir, size);
+    snprintf(payload, sizeof(payload), "%s/bench_payload_%llu.txt", opts->dir, size);
+    snprintf(stego, sizeof(stego), "%s/bench_stego_%llu.bmp", opts->dir, size);
+    snprintf(decoded, sizeof(decoded), "%s/bench_decoded", opts->dir);
+    snprintf(decoded_file, sizeof(decoded_file), "%s/bench_decoded.txt", opts->dir);
+
+    fprintf(stderr, "INFO : Generating %llu byte carrier\n", size);
+    if (make_carrier(carrier, size, &capacity) != e_success)
+    {
+        fprintf(stderr, "ERROR: Unable to write %s\n", carrier);
+        return;
+    }
+    // Leave room for the header fields at depth 1
+    unsigned long long payload_bytes = capacity / 8 * opts->fill / 100;
+    payload_bytes = payload_bytes > 64 ? payload_bytes - 64 : 0;
+    if (make_payload(payload, payload_bytes) != e_success)
+    {
+        fprintf(stderr, "ERROR: Unable to write %s\n", payload);
+        remove(carrier);
+        return;
+    }
+
+    printf("%s    {\"carrier_bytes\": %llu, \"payload_bytes\": %llu, \"variants\": [\n",
+           *first_size ? "" : ",\n", capacity + 54, payload_bytes);
+    *first_size = 0;
+
+    int first_variant = 1;
+    for (size_t i = 0; i < VARIANT_COUNT; i++)
+    {
+        const Variant *v = &variants[i];
+        if (!variant_selected(opts, v->name) || !lsb_use_kernel(v->kernel))
+            continue;
+        int jobs = v->jobs ? v->jobs : opts->jobs;
+        ThreadPool *pool = jobs > 1 ? pool_create(jobs - 1) : NULL;
+        RunResult enc[64], dec[64];
+        int verified = 1;
+
+        fprintf(stderr, "INFO : %s, %llu bytes\n", v->name, size);
+        for (int r = 0; r < opts->repeat; r++)
+        {
+            run_encode(v, pool, carrier, payload, stego, &enc[r]);
+            run_decode(v, pool, stego, decoded, &dec[r]);
+            verified = verified && enc[r].ok && dec[r].ok && same_file(payload, decoded_file);
+        }
+        pool_destroy(pool);
+
+        printf("%s     {\"variant\": \"%s\", \"kernel\": \"%s\", \"mmap\": %s, \"jobs\": %d, \"depth\": %d, \"verified\": %s, \"results\": [\n",
+               first_variant ? "" : ",\n", v->name, lsb_kernel_name(), v->use_mmap ? "true" : "false", jobs, v->depth,
+               verified ? "true" : "false");
+        int first = 1;
+        print_result("encode", encode_stages, 7, enc, opts->repeat, capacity + 54, payload_bytes, &first);
+        print_result("decode", decode_stages, 5, dec, opts->repeat, capacity + 54, payload_bytes, &first);
+        printf("]}");
+        first_variant = 0;
+        lsb_use_kernel(NULL);
+    }
+    printf("]}");
+
+    remove(stego);
+    remove(decoded_file);
+    if (!opts->keep)
+    {
+        remove(carrier);
+        remove(payload);
+    }
+}
+
+/* "64M" -> 67108864 */
+static int parse_size(const char *s, unsigned long long *size)
+{
+    char *end;
+    unsigned long long v = strtoull(s, &end, 10);
+    if (end == s)
+        return 0;
+    switch (*end)
+    {
+    case 'G': case 'g': v <<= 10; /* fall through */
+    case 'M': case 'm': v <<= 10; /* fall through */
+    case 'K': case 'k': v <<= 10; end++; break;
+    }
+    *size = v;
+    return (*end == '\0' || *end == ',') && v > 0;
+}
+
+static void print_bench_usage(void)
+{
+    fprintf(stderr, "Usage: stego-bench [options] > results.json\n");
+    fprintf(stderr, "  --sizes LIST   : carrier sizes, e.g. 1M,64M,2G (default 1M,16M,128M)\n");
+    fprintf(stderr, "  --fill PCT     : payload size in %% of the 1-bit capacity (default 50)\n");
+    fprintf(stderr, "  --repeat N     : runs per variant, the fastest is reported (default 3)\n");
+    fprintf(stderr, "  --jobs N       : threads for the mmap-threads variant (default one per CPU)\n");
+    fprintf(stderr, "  --variants LIST: only these variants (baseline,scalar,mmap,mmap-threads,depth4)\n");
+    fprintf(stderr, "  --dir DIR      : where carriers are generated (default /tmp)\n");
+    fprintf(stderr, "  --keep         : keep the generated carriers and payloads\n");
+}
+
+int main(int argc, char *argv[])
+{
+    BenchOptions opts = {"/tmp", {1 << 20, 16 << 20, 128 << 20}, 3, 50, 3, 0, 0, NULL};
+    opts.jobs = pool_cpu_count();
+
+    for (int i = 1; i < argc; i++)
+    {
+        const char *value = i + 1 < argc ? argv[i + 1] : NULL;
+        if (strcmp(argv[i], "--sizes") == 0 && value)
+        {
+            opts.nsizes = 0;
+            for (const char *p = value; p && opts.nsizes < 16; p = strchr(p, ','), p = p ? p + 1 : NULL)
+            {
+                if (!parse_size(p, &opts.sizes[opts.nsizes++]))
+                {
+                    print_bench_usage();
+                    return 1;
+                }
+            }
+            i++;
+        }
+        else if (strcmp(argv[i], "--fill") == 0 && value && (opts.fill = atoi(value)) > 0 && opts.fill <= 100)
+            i++;
+        else if (strcmp(argv[i], "--repeat") == 0 && value && (opts.repeat = atoi(value)) > 0 && opts.repeat <= 64)
+            i++;
+        else if (strcmp(argv[i], "--jobs") == 0 && value && (opts.jobs = atoi(value)) > 0)
+            i++;
+        else if (strcmp(argv[i], "--variants") == 0 && value)
+            opts.only = argv[++i];
+        else if (strcmp(argv[i], "--dir") == 0 && value)
+            opts.dir = argv[++i];
+        else if (strcmp(argv[i], "--keep") == 0)
+            opts.keep = 1;
+        else
+        {
+            print_bench_usage();
+            return 1;
+        }
+    }
+
+    printf("{\n  \"tool\": \"stego-bench\", \"format_revision\": %d, \"auto_kernel\": \"%s\", \"cpus\": %d,\n",
+           STEGO_FORMAT_REVISION, lsb_kernel_name(), pool_cpu_count());
+    printf("  \"sizes\": [\n");
+    int first_size = 1;
+    for (int i = 0; i < opts.nsizes; i++)
+        bench_size(&opts, opts.sizes[i], &first_size);
+    printf("\n  ]\n}\n");
+    return 0;
+}
@@ -0,0 +1,281 @@
+#include <limits.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "bmp.h"
+
+/* BMP headers are little-endian whatever the host is */
+static uint32_t read_le16(const unsigned char *p)
+{
+    return p[0] | (p[1] << 8);
+}
+
+static uint32_t read_le32(const unsigned char *p)
+{
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+/* Compression types that can carry an LSB payload */
+#define BMP_RGB 0
+#define BMP_BITFIELDS 3
+#define BMP_ALPHABITFIELDS 6
+
+Status bmp_parse(const unsigned char *buf, size_t len, BmpInfo *info)
+{
+    if (len < 18 || buf[0] != 'B' || buf[1] != 'M')
+    {
+        return e_failure;
+    }
+    size_t dib_size = read_le32(buf + 14);
+    if (len < 14 + dib_size)
+    {
+        return e_failure;
+    }
+
+    long long width, height;
+    uint32_t bpp, compression = BMP_RGB;
+    // Default BGR(A) channel masks, overridden by bitfield headers
+    uint32_t masks[3] = {0x00FF0000, 0x0000FF00, 0x000000FF};
+    size_t masks_end = 14 + dib_size;
+
+    if (dib_size == 12)
+    {
+        // BITMAPCOREHEADER: 16-bit unsigned dimensions, always bottom-up
+        width = read_le16(buf + 18);
+        height = read_le16(buf + 20);
+        bpp = read_le16(buf + 24);
+    }
+    else if (dib_size >= 40)
+    {
+        // BITMAPINFOHEADER and its V2-V5 extensions share the first 40 bytes
+        width = (int32_t)read_le32(buf + 18);
+        height = (int32_t)read_le32(buf + 22);
+        bpp = read_le16(buf + 28);
+        compression = read_le32(buf + 30);
+        if (compression == BMP_BITFIELDS || compression == BMP_ALPHABITFIELDS)
+        {
+            // Masks are part of the header from V2 on, follow a plain info header otherwise
+            if (dib_size == 40)
+            {
+                masks_end = 54 + (compression == BMP_ALPHABITFIELDS ? 16 : 12);
+            }
+            if (len < 66)
+            {
+                return e_failure;
+            }
+            for (int i = 0; i < 3; i++)
+            {
+                masks[i] = read_le32(buf + 54 + 4 * i);
+            }
+        }
+    }
+    else
+    {
+        return e_failure;
+    }
+
+    memset(info, 0, sizeof(*info));
+    info->data_offset = read_le32(buf + 10);
+    if (info->data_offset < masks_end || width <= 0 || height == 0 || height == INT32_MIN)
+    {
+        return e_failure;
+    }
+    info->top_down = height < 0;
+    info->width = (uint)width;
+    info->height = (uint)(height < 0 ? -height : height);
+    info->bpp = bpp;
+
+    if (bpp == 24 && compression == BMP_RGB)
+    {
+        info->channels = 3;
+        for (int i = 0; i < 3; i++)
+            info->channel_offset[i] = i;
+    }
+    else if (bpp == 32 && (compression == BMP_RGB || compression == BMP_BITFIELDS || compression == BMP_ALPHABITFIELDS))
+    {
+        // Only bytes entirely inside the colour masks, never alpha or padding bits
+        uint32_t colour = masks[0] | masks[1] | masks[2];
+        for (int i = 0; i < 4; i++)
+        {
+            if (((0xFFu << (8 * i)) & ~colour) == 0)
+                info->channel_offset[info->channels++] = i;
+        }
+    }
+    if (info->channels == 0)
+    {
+        return e_failure;
+    }
+    info->pixel_bytes = bpp / 8;
+
+    // Rows are padded to a multiple of 4 bytes
+    unsigned long long stride = ((unsigned long long)info->width * bpp + 31) / 32 * 4;
+    if (stride > SIZE_MAX / 4)
+    {
+        return e_failure;
+    }
+    // 31-bit dimensions: none of this can overflow 64 bits
+    info->stride = stride;
+    info->row_bytes = (size_t)info->width * info->channels;
+    info->capacity = (unsigned long long)info->row_bytes * info->height;
+    info->image_end = info->data_offset + stride * info->height;
+    info->bmp_header = 1;
+    return e_success;
+}
+
+Status bmp_read_header(FILE *fp, const unsigned char *start, size_t got, unsigned char **header, BmpInfo *info)
+{
+    unsigned char begin[18];
+    *header = NULL;
+    if (got > sizeof(begin))
+    {
+        return e_failure;
+    }
+    memcpy(begin, start, got);
+    if (fread(begin + got, 1, sizeof(begin) - got, fp) != sizeof(begin) - got)
+    {
+        return e_failure;
+    }
+    size_t data_offset = read_le32(begin + 10);
+    if (data_offset < sizeof(begin) || data_offset > BMP_MAX_HEADER)
+    {
+        return e_failure;
+    }
+    unsigned char *buf = malloc(data_offset);
+    if (buf == NULL)
+    {
+        return e_failure;
+    }
+    memcpy(buf, begin, sizeof(begin));
+    if (fread(buf + sizeof(begin), 1, data_offset - sizeof(begin), fp) != data_offset - sizeof(begin)
+        || bmp_parse(buf, data_offset, info) != e_success)
+    {
+        free(buf);
+        return e_failure;
+    }
+    *header = buf;
+    return e_success;
+}
+
+void bmp_legacy_layout(BmpInfo *info)
+{
+    // One endless row of one-byte "pixels" right after a 54-byte header
+    memset(info, 0, sizeof(*info));
+    info->data_offset = 54;
+    info->bpp = 8;
+    info->pixel_bytes = 1;
+    info->channels = 1;
+    info->stride = SIZE_MAX;
+    info->row_bytes = SIZE_MAX;
+    info->capacity = ULLONG_MAX / 2;
+    info->image_end = ULLONG_MAX;
+}
+
+unsigned long long bmp_offset(const BmpInfo *info, unsigned long long pos)
+{
+    unsigned long long row = pos / info->row_bytes;
+    size_t col = pos % info->row_bytes;
+    return info->data_offset + row * info->stride
+           + col / info->channels * info->pixel_bytes + info->channel_offset[col % info->channels];
+}
+
+void bmp_cursor_init(const BmpInfo *info, BmpCursor *cur)
+{
+    cur->pos = 0;
+    cur->file_off = info->data_offset;
+}
+
+size_t bmp_span(const BmpInfo *info, const BmpCursor *cur, size_t n)
+{
+    return n == 0 ? 0 : bmp_offset(info, cur->pos + n - 1) + 1 - cur->file_off;
+}
+
+/*
+ * Row walk shared by gather and scatter: whole row segments are one
+ * memcpy when every pixel byte is usable, 32 bpp rows step pixel by pixel.
+ * Offsets are computed relative to cur->file_off (unsigned wrap-around is
+ * fine, only offsets inside the span are ever dereferenced).
+ */
+static void walk_rows(const BmpInfo *info, const BmpCursor *cur, unsigned char *raw, size_t n,
+                      unsigned char *buf, int to_raw)
+{
+    unsigned long long pos = cur->pos;
+    while (n > 0)
+    {
+        unsigned long long row = pos / info->row_bytes;
+        size_t col = pos % info->row_bytes;
+        size_t run = info->row_bytes - col < n ? info->row_bytes - col : n;
+        size_t base = (size_t)(info->data_offset + row * info->stride - cur->file_off);
+
+        if (info->channels == info->pixel_bytes)
+        {
+            if (to_raw)
+                memcpy(raw + base + col, buf, run);
+            else
+                memcpy(buf, raw + base + col, run);
+        }
+        else
+        {
+            size_t off = base + col / info->channels * info->pixel_bytes;
+            int ch = col % info->channels;
+            size_t i = 0;
+            // BGRX/BGRA: whole pixels are the 3 leading bytes of every 4
+            if (ch == 0 && info->channels == 3 && info->pixel_bytes == 4 && info->channel_offset[2] == 2)
+            {
+                for (; i + 3 <= run; i += 3, off += 4)
+                {
+                    unsigned char *p = raw + off;
+                    if (to_raw)
+                    {
+                        p[0] = buf[i];
+                        p[1] = buf[i + 1];
+                        p[2] = buf[i + 2];
+                    }
+                    else
+                    {
+                        buf[i] = p[0];
+                        buf[i + 1] = p[1];
+                        buf[i + 2] = p[2];
+                    }
+                }
+            }
+            for (; i < run; i++)
+            {
+                unsigned char *p = raw + off + info->channel_offset[ch];
+                if (to_raw)
+                    *p = buf[i];
+                else
+                    buf[i] = *p;
+                if (++ch == info->channels)
+                {
+                    ch = 0;
+                    off += info->pixel_bytes;
+                }
+            }
+        }
+        buf += run;
+        pos += run;
+        n -= run;
+    }
+}
+
+void bmp_gather(const BmpInfo *info, const BmpCursor *cur, const unsigned char *raw, size_t n, unsigned char *out)
+{
+    walk_rows(info, cur, (unsigned char *)raw, n, out, 0);
+}
+
+void bmp_scatter(const BmpInfo *info, const BmpCursor *cur, unsigned char *raw, size_t n, const unsigned char *in)
+{
+    walk_rows(info, cur, raw, n, (unsigned char *)in, 1);
+}
+
+void bmp_advance(const BmpInfo *info, BmpCursor *cur, size_t n)
+{
+    cur->file_off += bmp_span(info, cur, n);
+    cur->pos += n;
+}
+
+void bmp_cursor_seek(const BmpInfo *info, BmpCursor *cur, unsigned long long pos)
+{
+    cur->pos = pos;
+    cur->file_off = pos ? bmp_offset(info, pos - 1) + 1 : info->data_offset;
+}
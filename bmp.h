@@ -0,0 +1,79 @@
+#ifndef BMP_H
+#define BMP_H
+
+#include <stdio.h>
+#include <stddef.h>
+#include "types.h"
+
+/*
+ * BMP carrier descriptor
+ * Parsed from the file header and the DIB header (core, info, V2-V5).
+ * Only the bytes listed in channel_offset are ever touched: row padding
+ * and alpha/unused bytes of 32 bpp pixels are skipped. Usable bytes are
+ * numbered in file order, row after row, whatever the orientation.
+ */
+typedef struct _BmpInfo
+{
+    size_t data_offset;       // bfOffBits: first byte of the pixel array
+    uint width;
+    uint height;              // Always positive, see top_down
+    int top_down;             // Negative height in the header: first row is the top one
+    int bpp;                  // 24 or 32
+    int pixel_bytes;          // Bytes per pixel (bpp / 8)
+    int channels;             // Usable bytes per pixel
+    int channel_offset[4];    // Byte offset of each usable byte inside a pixel
+    size_t stride;            // Bytes per stored row, padded to 4
+    size_t row_bytes;         // Usable bytes per row (width * channels)
+    unsigned long long capacity;  // Usable bytes in the whole image
+    unsigned long long image_end; // File offset just past the pixel array
+    int transcoded;           // Rows decoded from a compressed format (carrier.h), not the file bytes
+    int bmp_header;           // Parsed from a BMP header, the only format images before the descriptor came in
+} BmpInfo;
+
+/* Position in the usable bytes of a carrier */
+typedef struct _BmpCursor
+{
+    unsigned long long pos;      // Next usable byte
+    unsigned long long file_off; // File offset just past the last byte consumed
+} BmpCursor;
+
+/* Largest header (file + DIB + masks + gaps) accepted before the pixels */
+#define BMP_MAX_HEADER (1024 * 1024)
+
+/* Parse a header held in memory (len bytes, at least up to the pixel data) */
+Status bmp_parse(const unsigned char *buf, size_t len, BmpInfo *info);
+
+/*
+ * Read everything up to the pixel data from fp without seeking, so it
+ * works on pipes. The first got bytes were already read (to tell the
+ * format), they are passed in start. On success *header holds
+ * info->data_offset bytes (malloc'd, the caller frees it).
+ */
+Status bmp_read_header(FILE *fp, const unsigned char *start, size_t got, unsigned char **header, BmpInfo *info);
+
+/* Layout of images written before the parser existed: every byte after offset 54 */
+void bmp_legacy_layout(BmpInfo *info);
+
+/* File offset of usable byte pos */
+unsigned long long bmp_offset(const BmpInfo *info, unsigned long long pos);
+
+/* Cursor at the first usable byte */
+void bmp_cursor_init(const BmpInfo *info, BmpCursor *cur);
+
+/* File bytes from cur->file_off through the next n usable bytes */
+size_t bmp_span(const BmpInfo *info, const BmpCursor *cur, size_t n);
+
+/*
+ * Move the next n usable bytes between raw (the file bytes starting at
+ * cur->file_off, as returned by bmp_span()) and a contiguous buffer.
+ */
+void bmp_gather(const BmpInfo *info, const BmpCursor *cur, const unsigned char *raw, size_t n, unsigned char *out);
+void bmp_scatter(const BmpInfo *info, const BmpCursor *cur, unsigned char *raw, size_t n, const unsigned char *in);
+
+/* Consume the next n usable bytes */
+void bmp_advance(const BmpInfo *info, BmpCursor *cur, size_t n);
+
+/* Move the cursor to usable byte pos, as if everything in front of it had been consumed */
+void bmp_cursor_seek(const BmpInfo *info, BmpCursor *cur, unsigned long long pos);
+
+#endif
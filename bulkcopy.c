@@ -0,0 +1,96 @@
+#define _FILE_OFFSET_BITS 64
+#ifdef __linux__
+#define _GNU_SOURCE
+#include <errno.h>
+#include <sys/sendfile.h>
+#include <unistd.h>
+#endif
+
+#include "bulkcopy.h"
+
+#ifdef __linux__
+
+/* Errors meaning "this method does not apply here", not a real I/O failure */
+static int method_unsupported(int err)
+{
+    return err == ENOSYS || err == EXDEV || err == EINVAL || err == EOPNOTSUPP || err == EBADF;
+}
+
+/* copy_file_range: may share extents (reflink) instead of moving data */
+static Status copy_with_copy_file_range(int in_fd, off_t *in_off, int out_fd, off_t *out_off,
+                                        long long *len, CopyResult *res)
+{
+    while (*len > 0)
+    {
+        ssize_t n = copy_file_range(in_fd, in_off, out_fd, out_off, (size_t)*len, 0);
+        if (n < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            return e_failure;
+        }
+        if (n == 0)
+            break; // Source hit EOF early
+        *len -= n;
+        res->bytes += n;
+        res->method = "copy_file_range";
+    }
+    return e_success;
+}
+
+/* sendfile: writes at the current offset of out_fd, so seek it first */
+static Status copy_with_sendfile(int in_fd, off_t *in_off, int out_fd, off_t *out_off,
+                                 long long *len, CopyResult *res)
+{
+    off_t saved = lseek(out_fd, 0, SEEK_CUR);
+    if (saved < 0 || lseek(out_fd, *out_off, SEEK_SET) < 0)
+        return e_failure;
+
+    Status status = e_success;
+    while (*len > 0)
+    {
+        ssize_t n = sendfile(out_fd, in_fd, in_off, (size_t)*len);
+        if (n < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            status = e_failure;
+            break;
+        }
+        if (n == 0)
+            break;
+        *len -= n;
+        *out_off += n;
+        res->bytes += n;
+        res->method = "sendfile";
+    }
+    lseek(out_fd, saved, SEEK_SET);
+    return status;
+}
+
+Status kernel_copy_range(int in_fd, long long in_off, int out_fd, long long out_off,
+                         long long len, CopyResult *res)
+{
+    off_t ioff = (off_t)in_off;
+    off_t ooff = (off_t)out_off;
+
+    if (copy_with_copy_file_range(in_fd, &ioff, out_fd, &ooff, &len, res) == e_success)
+        return e_success;
+    if (!method_unsupported(errno))
+        return e_failure;
+
+    if (copy_with_sendfile(in_fd, &ioff, out_fd, &ooff, &len, res) == e_success)
+        return e_success;
+    return e_failure;
+}
+
+#else
+
+Status kernel_copy_range(int in_fd, long long in_off, int out_fd, long long out_off,
+                         long long len, CopyResult *res)
+{
+    (void)in_fd; (void)in_off; (void)out_fd; (void)out_off; (void)len; (void)res;
+    return e_failure;
+}
+
+#endif
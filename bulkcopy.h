@@ -0,0 +1,23 @@
+#ifndef BULKCOPY_H
+#define BULKCOPY_H
+
+#include "types.h"
+
+/* Outcome of a bulk copy: how much was copied and how */
+typedef struct _CopyResult
+{
+    unsigned long long bytes; // Bytes copied
+    const char *method;       // "copy_file_range", "sendfile" or "buffered"
+} CopyResult;
+
+/*
+ * Copy len bytes from in_fd at in_off to out_fd at out_off inside the kernel,
+ * trying copy_file_range (which reflinks on filesystems that support it)
+ * and then sendfile. File offsets of both descriptors are left untouched.
+ * res->bytes is advanced by whatever was copied, so on e_failure the
+ * caller can finish the remainder with plain reads and writes.
+ */
+Status kernel_copy_range(int in_fd, long long in_off, int out_fd, long long out_off,
+                         long long len, CopyResult *res);
+
+#endif
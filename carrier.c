@@ -0,0 +1,197 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "carrier.h"
+#include "png.h"
+#include "pnm.h"
+
+struct _CarrierFormat
+{
+    const char *name;
+    const char *extension;
+    const char *default_output; // Stego image name when none is given
+    const unsigned char *magic;
+    size_t magic_len;
+    int in_place;             // Pixels are file bytes, no transcoding
+    /* In-place formats: parse a header held in memory, for the mapped modes */
+    Status (*parse)(const unsigned char *buf, size_t len, BmpInfo *info);
+    /* Read the header, the first CARRIER_MAGIC_BYTES of the file already in magic */
+    Status (*open_read)(FILE **fp, const unsigned char *magic, Carrier *carrier, BmpInfo *info);
+    Status (*open_write)(Carrier *carrier, FILE **fp);
+    void (*close)(Carrier *carrier);
+};
+
+static Status bmp_open_read(FILE **fp, const unsigned char *magic, Carrier *carrier, BmpInfo *info)
+{
+    if (bmp_read_header(*fp, magic, CARRIER_MAGIC_BYTES, &carrier->header, info) != e_success)
+    {
+        return e_failure;
+    }
+    carrier->header_len = info->data_offset;
+    return e_success;
+}
+
+static Status bmp_open_write(Carrier *carrier, FILE **fp)
+{
+    // A headerless dump has nothing in front of the pixels (and no header buffer)
+    if (carrier->header_len == 0)
+    {
+        return e_success;
+    }
+    return fwrite(carrier->header, 1, carrier->header_len, *fp) == carrier->header_len ? e_success : e_failure;
+}
+
+static void bmp_close(Carrier *carrier)
+{
+    free(carrier->header);
+}
+
+static Status pnm_open_read(FILE **fp, const unsigned char *magic, Carrier *carrier, BmpInfo *info)
+{
+    if (pnm_read_header(*fp, magic, CARRIER_MAGIC_BYTES, &carrier->header, info) != e_success)
+    {
+        return e_failure;
+    }
+    carrier->header_len = info->data_offset;
+    return e_success;
+}
+
+static Status png_carrier_open_read(FILE **fp, const unsigned char *magic, Carrier *carrier, BmpInfo *info)
+{
+    (void)magic;
+    return png_open_read(fp, info, (PngImage **)&carrier->state);
+}
+
+static Status png_carrier_open_write(Carrier *carrier, FILE **fp)
+{
+    return png_open_write(carrier->state, fp);
+}
+
+static void png_carrier_close(Carrier *carrier)
+{
+    png_release(carrier->state);
+}
+
+static const unsigned char bmp_magic[] = {'B', 'M'};
+static const unsigned char ppm_magic[PNM_MAGIC_BYTES] = {'P', '6'};
+static const unsigned char pgm_magic[PNM_MAGIC_BYTES] = {'P', '5'};
+
+static const CarrierFormat formats[] = {
+    {"BMP", ".bmp", "default_stego.bmp", bmp_magic, sizeof(bmp_magic), 1, bmp_parse, bmp_open_read, bmp_open_write,
+     bmp_close},
+    {"PNG", ".png", "default_stego.png", png_signature, PNG_SIGNATURE_BYTES, 0, NULL, png_carrier_open_read,
+     png_carrier_open_write, png_carrier_close},
+    {"PPM", ".ppm", "default_stego.ppm", ppm_magic, PNM_MAGIC_BYTES, 1, pnm_parse, pnm_open_read, bmp_open_write,
+     bmp_close},
+    {"PGM", ".pgm", "default_stego.pgm", pgm_magic, PNM_MAGIC_BYTES, 1, pnm_parse, pnm_open_read, bmp_open_write,
+     bmp_close},
+};
+
+/* Headerless dumps have no magic and are never detected: only a --raw layout picks this */
+static const CarrierFormat raw_format = {"raw", ".raw", "default_stego.raw", NULL, 0, 1, NULL, NULL, bmp_open_write,
+                                         bmp_close};
+
+static const CarrierFormat *detect_format(const unsigned char *magic, size_t n)
+{
+    for (size_t i = 0; i < sizeof(formats) / sizeof(formats[0]); i++)
+    {
+        if (n >= formats[i].magic_len && memcmp(magic, formats[i].magic, formats[i].magic_len) == 0)
+        {
+            return &formats[i];
+        }
+    }
+    return NULL;
+}
+
+const char *carrier_format_name(const unsigned char *magic, size_t n)
+{
+    const CarrierFormat *format = detect_format(magic, n);
+    return format ? format->name : NULL;
+}
+
+const char *carrier_file_format(const char *fname, int *in_place)
+{
+    unsigned char magic[CARRIER_MAGIC_BYTES];
+    FILE *fp = fopen(fname, "rb");
+    *in_place = 0;
+    if (fp == NULL)
+    {
+        return NULL;
+    }
+    const CarrierFormat *format = detect_format(magic, fread(magic, 1, sizeof(magic), fp));
+    fclose(fp);
+    *in_place = format && format->in_place;
+    return format ? format->name : NULL;
+}
+
+const char *carrier_default_output(const char *fname, const RawLayout *raw)
+{
+    unsigned char magic[CARRIER_MAGIC_BYTES];
+    FILE *fp = raw ? NULL : fopen(fname, "rb");
+    const CarrierFormat *format = raw ? &raw_format : &formats[0];
+    if (fp)
+    {
+        const CarrierFormat *found = detect_format(magic, fread(magic, 1, sizeof(magic), fp));
+        fclose(fp);
+        format = found ? found : format;
+    }
+    return format->default_output;
+}
+
+Status carrier_parse(const unsigned char *buf, size_t len, const RawLayout *raw, BmpInfo *info)
+{
+    if (raw)
+    {
+        return pnm_raw_layout(raw, info);
+    }
+    const CarrierFormat *format = detect_format(buf, len);
+    return format && format->parse ? format->parse(buf, len, info) : e_failure;
+}
+
+Status carrier_open_read(FILE **fp, Carrier *carrier, BmpInfo *info)
+{
+    unsigned char magic[CARRIER_MAGIC_BYTES];
+    carrier->format = NULL;
+    carrier->header = NULL;
+    carrier->header_len = 0;
+    carrier->state = NULL;
+    // Nothing to read or to tell a dump by: its samples start at the first byte
+    if (carrier->raw)
+    {
+        if (pnm_raw_layout(carrier->raw, info) != e_success)
+        {
+            return e_failure;
+        }
+        carrier->format = &raw_format;
+        return e_success;
+    }
+    // Read, not peeked: stdin may be a pipe, every format takes these bytes as read
+    if (fread(magic, 1, sizeof(magic), *fp) != sizeof(magic))
+    {
+        return e_failure;
+    }
+    const CarrierFormat *format = detect_format(magic, sizeof(magic));
+    if (format == NULL || format->open_read(fp, magic, carrier, info) != e_success)
+    {
+        return e_failure;
+    }
+    carrier->format = format;
+    return e_success;
+}
+
+Status carrier_open_write(Carrier *carrier, FILE **fp)
+{
+    return carrier->format ? carrier->format->open_write(carrier, fp) : e_failure;
+}
+
+void carrier_close(Carrier *carrier)
+{
+    if (carrier->format)
+    {
+        carrier->format->close(carrier);
+    }
+    carrier->format = NULL;
+    carrier->header = NULL;
+    carrier->header_len = 0;
+    carrier->state = NULL;
+}
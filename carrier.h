@@ -0,0 +1,77 @@
+#ifndef CARRIER_H
+#define CARRIER_H
+
+#include <stdio.h>
+#include <stddef.h>
+#include "types.h"
+#include "bmp.h"
+#include "pnm.h"
+
+/*
+ * Carrier formats
+ * Every format turns its file into rows of pixels described by a BmpInfo,
+ * the layout all embedding works on. BMP pixels are stored as they are, so
+ * a BMP is read and written in place: its header is copied and the pixel
+ * bytes follow it. So are binary PPM/PGM images and headerless sample
+ * dumps (pnm.h), which are also the only other formats the mapped modes
+ * take. Formats that store pixels compressed (PNG, png.h) are
+ * decoded on the way in and encoded again on the way out: their stream is
+ * replaced by one of bare rows (data_offset 0, transcoded set), which the
+ * rest of the code reads and writes like any other, front to back.
+ * The format is told by the first bytes of the file, never by its name
+ * (a headerless dump has none and is named by its layout), and the stego
+ * image always has the format of its carrier.
+ */
+
+/* Bytes read up front to tell the formats apart */
+#define CARRIER_MAGIC_BYTES 8
+
+typedef struct _CarrierFormat CarrierFormat;
+
+/* A carrier being read, and what it takes to write the stego image out in its format */
+typedef struct _Carrier
+{
+    const CarrierFormat *format;
+    unsigned char *header;    // In-place formats: the bytes in front of the pixels
+    size_t header_len;
+    void *state;              // Transcoded formats: the decoder state the encoder picks up
+    const RawLayout *raw;     // Set by the caller: a headerless dump of this layout, NULL to detect the format
+} Carrier;
+
+/* Name of the format of a file starting with these n bytes ("BMP", "PNG", "PPM", "PGM"), NULL if none matches */
+const char *carrier_format_name(const unsigned char *magic, size_t n);
+
+/*
+ * Format name of the file fname, NULL if it cannot be read or is no
+ * carrier. *in_place says whether it is embedded in place: the mapped
+ * modes (-m, --key) and the library take only those.
+ */
+const char *carrier_file_format(const char *fname, int *in_place);
+
+/* Stego image name used when none is given, in the format of the carrier fname (BMP if unknown) */
+const char *carrier_default_output(const char *fname, const RawLayout *raw);
+
+/*
+ * Describe the pixels of an in-place carrier held in memory (len bytes,
+ * at least its whole header), a headerless dump of layout raw if not NULL
+ */
+Status carrier_parse(const unsigned char *buf, size_t len, const RawLayout *raw, BmpInfo *info);
+
+/*
+ * Read the carrier header from *fp without seeking and describe its pixels
+ * in info; carrier->raw is read, every other field is set. For a transcoded format *fp is replaced by the stream of its
+ * rows (see above). carrier_close() releases what this holds.
+ */
+Status carrier_open_read(FILE **fp, Carrier *carrier, BmpInfo *info);
+
+/*
+ * Start the stego image on *fp: the header of an in-place format, or the
+ * encoder of a transcoded one, which takes the place of *fp and finishes
+ * the file when it is closed
+ */
+Status carrier_open_write(Carrier *carrier, FILE **fp);
+
+/* Release what carrier_open_read() holds, safe on a zeroed Carrier */
+void carrier_close(Carrier *carrier);
+
+#endif
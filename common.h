@@ -4,4 +4,69 @@
 /* Magic string to identify whether stegged or not */
 #define MAGIC_STRING "#*"
 
+/*
+ * Format descriptor: one byte right after the magic string, always at one
+ * bit per carrier byte. High nibble is the format revision, low nibble the
+ * number of LSBs per carrier byte used by every field that follows.
+ * Images from before the descriptor have 0 here (the top byte of the
+ * extension size), which decoders treat as the legacy 1-bit layout.
+ */
+#define STEGO_FORMAT_REVISION 4
+#define STEGO_DESCRIPTOR(depth) ((STEGO_FORMAT_REVISION << 4) | (depth))
+#define STEGO_DESCRIPTOR_REVISION(desc) ((desc) >> 4)
+#define STEGO_DESCRIPTOR_DEPTH(desc) ((desc) & 0x07)
+
+/*
+ * Bit 3 of the low nibble (depths only need bits 0-2): the payload data is
+ * scattered over the carrier by a key, see scatter.h. The fields in front
+ * of it stay in place, so the image still probes without the key. Older
+ * readers see depth 9-12 and refuse the image.
+ */
+#define STEGO_FLAG_KEYED 0x08
+#define STEGO_DESCRIPTOR_KEYED(desc) (((desc) & STEGO_FLAG_KEYED) != 0)
+
+/* Bytes of the payload size field: 32-bit up to revision 1, 64-bit from revision 2 */
+#define STEGO_SIZE_FIELD_BYTES(revision) ((revision) >= 2 ? 8 : 4)
+
+/*
+ * From revision 3 a flags byte follows the descriptor, at the payload
+ * depth. With STEGO_FLAG_COMPRESSED the payload is stored packed by lz.h:
+ * the size field gives the stored bytes and a second 64-bit field after
+ * it the original size. Other bits are reserved and must be zero.
+ */
+#define STEGO_FLAGS_FIELD_BYTES(revision) ((revision) >= 3 ? 1 : 0)
+#define STEGO_FLAG_COMPRESSED 0x01
+#define STEGO_RAW_SIZE_FIELD_BYTES 8
+
+/*
+ * STEGO_FLAG_ENCRYPTED: the stored bytes are sealed by aead.h (after
+ * packing, when both flags are set). The size field gives the sealed bytes
+ * and the nonce prefix of the segments follows the size fields.
+ */
+#define STEGO_FLAG_ENCRYPTED 0x02
+#define STEGO_NONCE_FIELD_BYTES 8
+
+/*
+ * STEGO_FLAG_ARCHIVE: the payload is an archive of several files with a
+ * table of contents in front (archive.h). The extension field is empty.
+ */
+#define STEGO_FLAG_ARCHIVE 0x04
+
+/*
+ * STEGO_FLAG_SHARD: the payload is one slice of a secret spread over
+ * several carriers. After the nonce come the set ID (8 bytes), shard index
+ * (4), shard count (4), offset of the slice in the secret (8) and the
+ * secret size (8). Every shard is packed and sealed on its own.
+ */
+#define STEGO_FLAG_SHARD 0x08
+
+/*
+ * From revision 4 the fields end with a CRC32C (crc32c.h) of everything
+ * in front of it, magic string included, so a decoder rejects a damaged
+ * header before it reads the payload. A second CRC32C, of the stored
+ * payload bytes, follows the payload; keyed payloads keep it right after
+ * the header checksum instead, in front of the scattered area.
+ */
+#define STEGO_CHECKSUM_FIELD_BYTES(revision) ((revision) >= 4 ? 4 : 0)
+
 #endif
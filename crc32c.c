@@ -0,0 +1,107 @@
+#include <string.h>
+#include "crc32c.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define CRC32C_HAVE_X86 1
+#include <immintrin.h>
+#endif
+
+/* Reflected Castagnoli polynomial */
+#define CRC32C_POLY 0x82f63b78u
+
+/* CRC of every 4-bit value */
+static const uint32_t nibble_table[16] = {
+    0x00000000, 0x105ec76f, 0x20bd8ede, 0x30e349b1, 0x417b1dbc, 0x5125dad3, 0x61c69362, 0x7198540d,
+    0x82f63b78, 0x92a8fc17, 0xa24bb5a6, 0xb21572c9, 0xc38d26c4, 0xd3d3e1ab, 0xe330a81a, 0xf36e6f75,
+};
+
+static uint32_t crc32c_table(uint32_t crc, const unsigned char *p, size_t n)
+{
+    while (n--)
+    {
+        crc ^= *p++;
+        crc = (crc >> 4) ^ nibble_table[crc & 15];
+        crc = (crc >> 4) ^ nibble_table[crc & 15];
+    }
+    return crc;
+}
+
+#ifdef CRC32C_HAVE_X86
+
+__attribute__((target("sse4.2")))
+static uint32_t crc32c_sse42(uint32_t crc, const unsigned char *p, size_t n)
+{
+#ifdef __x86_64__
+    uint64_t c = crc;
+    for (; n >= 8; n -= 8, p += 8)
+    {
+        uint64_t v;
+        memcpy(&v, p, sizeof(v));
+        c = _mm_crc32_u64(c, v);
+    }
+    crc = (uint32_t)c;
+#endif
+    for (; n >= 4; n -= 4, p += 4)
+    {
+        uint32_t v;
+        memcpy(&v, p, sizeof(v));
+        crc = _mm_crc32_u32(crc, v);
+    }
+    while (n--)
+        crc = _mm_crc32_u8(crc, *p++);
+    return crc;
+}
+
+static int have_sse42(void)
+{
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("sse4.2");
+}
+
+#endif
+
+uint32_t crc32c_update(uint32_t crc, const void *data, size_t n)
+{
+    crc = ~crc;
+#ifdef CRC32C_HAVE_X86
+    if (have_sse42())
+        return ~crc32c_sse42(crc, data, n);
+#endif
+    return ~crc32c_table(crc, data, n);
+}
+
+const char *crc32c_kernel_name(void)
+{
+#ifdef CRC32C_HAVE_X86
+    if (have_sse42())
+        return "sse4.2";
+#endif
+    return "table";
+}
+
+/* a * b modulo the polynomial, bit 31 being x^0 */
+static uint32_t multiply_mod(uint32_t a, uint32_t b)
+{
+    uint32_t product = 0;
+    for (uint32_t m = 1u << 31; m; m >>= 1)
+    {
+        if (a & m)
+            product ^= b;
+        b = b & 1 ? (b >> 1) ^ CRC32C_POLY : b >> 1;
+    }
+    return product;
+}
+
+uint32_t crc32c_combine(uint32_t crc_a, uint32_t crc_b, unsigned long long len_b)
+{
+    // Shift crc_a past len_b zero bytes: multiply by x^(8 * len_b), one
+    // squaring of x^8 per bit of len_b
+    uint32_t shift = 1u << 31;
+    for (uint32_t power = 1u << (31 - 8); len_b; len_b >>= 1)
+    {
+        if (len_b & 1)
+            shift = multiply_mod(shift, power);
+        power = multiply_mod(power, power);
+    }
+    return multiply_mod(shift, crc_a) ^ crc_b;
+}
@@ -0,0 +1,23 @@
+#ifndef CRC32C_H
+#define CRC32C_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * CRC32C (Castagnoli), the checksum of the stego header and payload
+ * The SSE4.2 crc32 instruction handles 8 bytes per step when the CPU has
+ * it, a 4-bit table otherwise. Pieces checksummed on their own (one chunk
+ * per worker) are joined with crc32c_combine().
+ */
+
+/* CRC32C of n more bytes after crc (0 to start), crc32c_update(0, "123456789", 9) == 0xe3069283 */
+uint32_t crc32c_update(uint32_t crc, const void *data, size_t n);
+
+/* CRC32C of A followed by B, from the CRC32C of each and the length of B */
+uint32_t crc32c_combine(uint32_t crc_a, uint32_t crc_b, unsigned long long len_b);
+
+/* Name of the CRC32C implementation used on this CPU */
+const char *crc32c_kernel_name(void);
+
+#endif
@@ -1,10 +1,40 @@
+#define _FILE_OFFSET_BITS 64
 
+#include <stdint.h>
 #include <stdio.h>
+#include <stdarg.h>
 #include <string.h>
 #include <stdlib.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
 #include "decode.h"
+#include "lsb.h"
 #include "types.h"
 #include "common.h"
+#include "stream.h"
+#include "metrics.h"
+#include "stego.h"
+#include "scatter.h"
+#include "lz.h"
+#include "aead.h"
+#include "crc32c.h"
+#include "archive.h"
+#include "carrier.h"
+
+/* Print an INFO line unless the caller asked for quiet operation */
+static void decode_info(const DecodeInfo *decInfo, const char *fmt, ...)
+{
+    if (decInfo->quiet)
+    {
+        return;
+    }
+    va_list ap;
+    va_start(ap, fmt);
+    vprintf(fmt, ap);
+    va_end(ap);
+}
 
 /* Read and validate Decode args from argv */
 DStatus read_and_validate_decode_args(char *argv[], DecodeInfo *decInfo)
@@ -16,286 +46,1437 @@ DStatus read_and_validate_decode_args(char *argv[], DecodeInfo *decInfo)
         return d_failure;
     }
 
-    // Validate that the provided file has a .bmp extension
-    // Decoding works only on BMP images
-    if (strstr(argv[2], ".bmp") == NULL)
+    // The stego image is told by its first bytes (BMP, PNG, PPM, PGM), a headerless dump by --raw
+    // (a file that cannot be read is left for the open to report)
+    int in_place;
+    if (!is_stream_name(argv[2]) && decInfo->raw_layout == NULL && carrier_file_format(argv[2], &in_place) == NULL
+        && access(argv[2], R_OK) == 0)
+    {
+        printf("Error : %s is not a BMP, PNG, PPM or PGM image (headerless dumps need --raw)\n", argv[2]);
         return d_failure;
+    }
 
     // Store the stego image file name in the structure
     decInfo->stego_image_fname = argv[2];
 
     // Check if the user provided an output filename (argv[3])
-    // If yes, copy it to the decode structure
-    if (argv[3])
-    strcpy(decInfo->output_fname, argv[3]);
-    else
-    // If no output file name provided, use default name "decoded"
-    strcpy(decInfo->output_fname, "decoded");
+    // If not, use the default name "decoded"; the extension is appended after decoding it
+    decInfo->output_fname = arena_strdup(decInfo->arena, argv[3] ? argv[3] : "decoded");
+    if (decInfo->output_fname == NULL)
+    {
+        printf("ERROR : Out of memory\n");
+        return d_failure;
+    }
 
     return d_success; // validations successful
 }
 
-/* Skip BMP header */
-DStatus skip_bmp_header(FILE *fptr)
-{   // Skip the 54-byte BMP header to reach pixel data
-    fseek(fptr, 54, SEEK_SET);
+/* Skip the carrier header */
+DStatus skip_bmp_header(DecodeInfo *decInfo)
+{   // Parse the header to find the pixel data and which bytes carry data
+    if (decInfo->use_mmap)
+    {
+        if (carrier_parse(decInfo->stego_map.data, decInfo->stego_map.size, decInfo->raw_layout, &decInfo->bmp)
+            != e_success)
+        {
+            return d_failure;
+        }
+    }
+    else
+    {
+        // Read rather than seek, stdin may be a pipe; a PNG is decoded row by row from here on
+        Carrier carrier = {0};
+        carrier.raw = decInfo->raw_layout;
+        if (carrier_open_read(&decInfo->fptr_stego_image, &carrier, &decInfo->bmp) != e_success)
+        {
+            return d_failure;
+        }
+        carrier_close(&carrier);
+    }
+    bmp_cursor_init(&decInfo->bmp, &decInfo->cursor);
     return d_success;
 }
 
-
-
-/* Get File pointers for input stego and output decoded files*/
-DStatus open_decode_files(DecodeInfo *decInfo)
+/* Switch to the layout of images from before the format descriptor:
+ * every byte after a 54-byte header, the 24 bytes of magic string
+ * and descriptor slot already read. */
+static DStatus use_legacy_layout(DecodeInfo *decInfo)
 {
-    // open Stego Image file
-    decInfo->fptr_stego_image = fopen(decInfo->stego_image_fname, "r");
-    // Do Error handling
-    if (decInfo->fptr_stego_image == NULL)
+    size_t file_off = decInfo->cursor.file_off;
+    // Only BMPs were written back then
+    if (!decInfo->bmp.bmp_header)
     {
-        // print system error
-    	perror("fopen");
-    	fprintf(stderr, "ERROR : Unable to open file %s\n", decInfo->stego_image_fname);
-    	return d_failure; 
+        return d_failure;
     }
-    // Open/create the output file where decoded secret data will be written
-    decInfo->fptr_output = fopen(decInfo->output_fname, "w");
-    // Error handling for opening output file
-    if (decInfo->fptr_output == NULL)
+    bmp_legacy_layout(&decInfo->bmp);
+    bmp_cursor_init(&decInfo->bmp, &decInfo->cursor);
+    bmp_advance(&decInfo->bmp, &decInfo->cursor, 8 * (strlen(MAGIC_STRING) + 1));
+    if (decInfo->use_mmap || decInfo->cursor.file_off == file_off)
     {
-        perror("fopen");
-        fprintf(stderr, "ERROR: Unable to open output file %s\n", decInfo->output_fname);
-        return e_failure;
+        return d_success;
     }
-    return d_success;
-    
+    return fseeko(decInfo->fptr_stego_image, decInfo->cursor.file_off, SEEK_SET) == 0 ? d_success : d_failure;
 }
 
-/* Decode LSBs from image buffer into 1 byte */
-DStatus decode_byte_from_lsb(char *image_buffer)
+/*
+ * Fetch the next n usable stego image bytes.
+ * In mmap mode a contiguous run points into the mapping, otherwise the
+ * file bytes are read; runs broken by padding or alpha bytes are
+ * gathered into buffer. Returns NULL when the image runs out.
+ */
+static const unsigned char *get_stego_bytes(DecodeInfo *decInfo, size_t n, unsigned char *buffer)
 {
-    unsigned char data = 0;
-    // Loop through 8 bytes → extract 8 bits
-    for (int i = 0; i < 8; i++)
-    {   // Shift left to make space for next bit
-        data = data << 1;
-        data |= (image_buffer[i] & 1);  // Extract LSB and insert into data
+    if (decInfo->cursor.pos + n > decInfo->bmp.capacity)
+    {
+        return NULL;
+    }
+    size_t span = bmp_span(&decInfo->bmp, &decInfo->cursor, n);
+    const unsigned char *bytes;
+    if (decInfo->use_mmap)
+    {
+        if (decInfo->cursor.file_off + span > decInfo->stego_map.size)
+        {
+            return NULL;
+        }
+        bytes = decInfo->stego_map.data + decInfo->cursor.file_off;
     }
-    return data;
+    else
+    {
+        if (span != n && decInfo->raw_size < span)
+        {
+            // The old scratch is simply left to the arena
+            unsigned char *raw = arena_alloc(decInfo->arena, span);
+            if (raw == NULL)
+            {
+                return NULL;
+            }
+            decInfo->raw = raw;
+            decInfo->raw_size = span;
+        }
+        unsigned char *dest = span == n ? buffer : decInfo->raw;
+        if (decInfo->aio_stego ? aio_read(decInfo->aio_stego, dest, span) != e_success
+                               : fread(dest, 1, span, decInfo->fptr_stego_image) != span)
+        {
+            return NULL;
+        }
+        bytes = dest;
+    }
+    if (span != n)
+    {
+        bmp_gather(&decInfo->bmp, &decInfo->cursor, bytes, n, buffer);
+        bytes = buffer;
+    }
+    bmp_advance(&decInfo->bmp, &decInfo->cursor, n);
+    return bytes;
 }
 
-// Function definition decode size from lsb
-DStatus decode_size_from_lsb(char *image_buffer)
+/* Decode n bytes stored at the given depth, starting on a fresh carrier byte, and add them to the header checksum */
+static DStatus decode_bytes(DecodeInfo *decInfo, unsigned char *data, size_t n, int depth)
 {
-    int size = 0;
-    // Extract 32 bits → each bit comes from LSB of one image byte
-    for (int i = 0; i < 32; i++)
-    {   // Shift left to make space for next bit
-        size = (size << 1);
-        size |= (image_buffer[i] & 1);   // Add LSB to size
+    unsigned char buffer[128];
+    size_t len = lsb_carrier_bytes(n, depth);
+    // Only a long extension outgrows the stack
+    unsigned char *dest = len > sizeof(buffer) ? arena_alloc(decInfo->arena, len) : buffer;
+    if (dest == NULL)
+    {
+        return d_failure;
     }
-    return size;
+    const unsigned char *image_buffer = get_stego_bytes(decInfo, len, dest);
+    if (image_buffer == NULL)
+    {
+        return d_failure;
+    }
+    lsb_extract_block(image_buffer, n, data, depth);
+    decInfo->header_crc = crc32c_update(decInfo->header_crc, data, n);
+    return d_success;
 }
 
-
+/* Decode an unsigned field of nbytes (up to 8), MSB first */
+static DStatus decode_int_field(DecodeInfo *decInfo, int nbytes, unsigned long long *value)
+{
+    unsigned char bytes[8];
+    if (decode_bytes(decInfo, bytes, nbytes, decInfo->depth) != d_success)
+    {
+        return d_failure;
+    }
+    *value = 0;
+    for (int i = 0; i < nbytes; i++)
+    {
+        *value = (*value << 8) | bytes[i];
+    }
+    return d_success;
+}
 
 /* Deore Magic String from image */
 DStatus decode_magic_string(DecodeInfo *decInfo)
 {
-    char image_buffer[8];
     char magic_string[10];
-    // Read MAGIC_STRING length bytes
-    for (int i = 0; i < strlen(MAGIC_STRING); i++)
+    // The first field: both checksums start here
+    decInfo->header_crc = 0;
+    decInfo->payload_crc = 0;
+    // Read MAGIC_STRING length bytes, always one bit per carrier byte
+    if (decode_bytes(decInfo, (unsigned char *)magic_string, strlen(MAGIC_STRING), 1) != d_success)
     {
-       fread(image_buffer, 8, 1, decInfo->fptr_stego_image);
-       magic_string[i]= decode_byte_from_lsb(image_buffer);    // decode 1 byte
+        if (!decInfo->quiet)
+            printf("ERROR: Image too small for a magic string.\n");
+        return d_failure;
     }
 
     magic_string[strlen(MAGIC_STRING)] = '\0';  
     // Compare with expected MAGIC_STRING
     if (strcmp(magic_string, MAGIC_STRING) == 0)
     {
-        printf("INFO: Magic string matched successfully.\n");
         return e_success;
     }
     else
     {
-        printf("ERROR: Magic string mismatch.\n");
+        if (!decInfo->quiet)
+            printf("ERROR: Magic string mismatch.\n");
         return e_failure;
     }
 
 }
 
+/* Decode the format descriptor that follows the magic string */
+DStatus decode_format_descriptor(DecodeInfo *decInfo)
+{
+    unsigned char desc;
+    if (decode_bytes(decInfo, &desc, 1, 1) != d_success)
+    {
+        return d_failure;
+    }
+    // Legacy images: this was the (zero) top byte of the extension size
+    decInfo->legacy = desc == 0;
+    decInfo->flags = 0;
+    if (decInfo->legacy)
+    {
+        decInfo->revision = 0;
+        decInfo->depth = 1;
+        return use_legacy_layout(decInfo);
+    }
+    // Every revision so far is readable, they differ in field sizes only
+    decInfo->revision = STEGO_DESCRIPTOR_REVISION(desc);
+    decInfo->depth = STEGO_DESCRIPTOR_DEPTH(desc);
+    decInfo->keyed = STEGO_DESCRIPTOR_KEYED(desc);
+    if (decInfo->revision < 1 || decInfo->revision > STEGO_FORMAT_REVISION
+        || decInfo->depth < LSB_MIN_DEPTH || decInfo->depth > LSB_MAX_DEPTH)
+    {
+        if (!decInfo->quiet)
+            printf("ERROR: Unsupported format descriptor 0x%02x\n", desc);
+        return d_failure;
+    }
+    if (STEGO_FLAGS_FIELD_BYTES(decInfo->revision))
+    {
+        unsigned char flags;
+        if (decode_bytes(decInfo, &flags, 1, decInfo->depth) != d_success)
+        {
+            return d_failure;
+        }
+        // Reserved bits mean a newer layout this reader cannot follow, and archives pack their members themselves
+        if ((flags & ~(STEGO_FLAG_COMPRESSED | STEGO_FLAG_ENCRYPTED | STEGO_FLAG_ARCHIVE | STEGO_FLAG_SHARD))
+            || (flags & (STEGO_FLAG_COMPRESSED | STEGO_FLAG_ARCHIVE)) == (STEGO_FLAG_COMPRESSED | STEGO_FLAG_ARCHIVE))
+        {
+            if (!decInfo->quiet)
+                printf("ERROR: Unsupported format flags 0x%02x\n", flags);
+            return d_failure;
+        }
+        decInfo->flags = flags;
+    }
+    return d_success;
+}
+
 
 // Function definition for decode file extn size
 DStatus decode_secret_file_extn_size(DecodeInfo *decInfo)
 {
-    char image_buffer[32];
-    // Read 32 bytes → 32 bits of length
-    fread(image_buffer, 32, 1, decInfo->fptr_stego_image);
-    // Convert LSB encoded bits → integer
-    decInfo->extn_size = decode_size_from_lsb(image_buffer);
-
+    if (decInfo->legacy)
+    {
+        // The descriptor slot already consumed the top byte, 24 bits remain
+        unsigned char bytes[3];
+        if (decode_bytes(decInfo, bytes, sizeof(bytes), 1) != d_success)
+        {
+            return d_failure;
+        }
+        decInfo->extn_size = (bytes[0] << 16) | (bytes[1] << 8) | bytes[2];
+        return d_success;
+    }
+    unsigned long long extn_size;
+    if (decode_int_field(decInfo, 4, &extn_size) != d_success)
+    {
+        return d_failure;
+    }
+    decInfo->extn_size = extn_size > STEGO_EXTN_MAX ? -1 : (int)extn_size;
     return d_success;
-
 }
 
 
+/* Append the decoded extension to the output name unless it already ends with it */
+DStatus append_extension(DecodeInfo *decInfo, const char *file_extn)
+{
+    //Check if the output filename already ends with the extension 
+    size_t name_len = strlen(decInfo->output_fname);
+    size_t ext_len  = strlen(file_extn);
+
+    //Check if the output filename already ends with the extension 
+    if (name_len >= ext_len &&
+        strcmp(decInfo->output_fname + name_len - ext_len, file_extn) == 0)
+    {
+        // extension already present --> no change
+        return d_success;
+    }
+    // extension not present, so append (the longer name comes from the arena too)
+    char *fname = arena_concat(decInfo->arena, decInfo->output_fname, file_extn);
+    if (fname == NULL)
+    {
+        printf("ERROR : Out of memory\n");
+        return d_failure;
+    }
+    decInfo->output_fname = fname;
+    return d_success;
+}
+
 /* Decode secret file extenstion */
 DStatus decode_secret_file_extn(DecodeInfo *decInfo)
 {
-    char image_buffer[8];
-    int extn_size;
-    // Read each extension character
-    for (int i = 0; i < decInfo->extn_size; i++)
+    // A corrupt or foreign image can claim any size, keep it to what a file name can take
+    if (decInfo->extn_size < 0 || decInfo->extn_size > STEGO_EXTN_MAX
+        || (decInfo->file_extn = arena_alloc(decInfo->arena, decInfo->extn_size + 1)) == NULL)
     {
-        fread(image_buffer, 8, 1, decInfo->fptr_stego_image);
-        decInfo->file_extn[i] = decode_byte_from_lsb(image_buffer);
-
+        return d_failure;
+    }
+    // Read the extension characters
+    if (decode_bytes(decInfo, (unsigned char *)decInfo->file_extn, decInfo->extn_size, decInfo->depth) != d_success)
+    {
+        return d_failure;
     }
     // Null-terminate
     decInfo->file_extn[decInfo->extn_size] = '\0';  
+    // The extension comes from the image, it may not lead the output out of its directory
+    if (!stego_extn_ok(decInfo->file_extn))
+    {
+        return d_failure;
+    }
 
-    //Check if the output filename already ends with the extension 
-    int name_len = strlen(decInfo->output_fname);
-    int ext_len  = strlen(decInfo->file_extn);
+    // The library decodes to memory, it has no output name
+    return decInfo->output_fname ? append_extension(decInfo, decInfo->file_extn) : d_success;
+}
 
-    //Check if the output filename already ends with the extension 
-    if (name_len >= ext_len &&
-        strcmp(decInfo->output_fname + name_len - ext_len, decInfo->file_extn) == 0)
+/* Why a decode stopped, for the error line */
+const char *decode_failure_reason(const DecodeInfo *decInfo)
+{
+    if (decInfo->truncated)
+        return "Stego image is truncated, it ends before the payload";
+    if (decInfo->checksum_failed)
+        return "Payload checksum mismatch (corrupt image)";
+    if (decInfo->auth_failed)
+        return "Payload authentication failed (wrong key or tampered image)";
+    if (decInfo->write_failed)
+        return "Unable to write the output file (disk full or I/O error)";
+    return NULL;
+}
+
+
+/*
+ * Decode secret file size, the original size of a packed payload and the
+ * nonce prefix of a sealed one, then check them all against the header
+ * checksum before any of them is trusted
+ */
+DStatus decode_secret_file_size(DecodeInfo *decInfo)
+{
+    if (decode_int_field(decInfo, STEGO_SIZE_FIELD_BYTES(decInfo->revision), &decInfo->size_secret_file) != d_success)
     {
-        // extension already present --> no change
+        return d_failure;
     }
-    else
+    if ((decInfo->flags & STEGO_FLAG_COMPRESSED)
+        && decode_int_field(decInfo, STEGO_RAW_SIZE_FIELD_BYTES, &decInfo->size_unpacked) != d_success)
+    {
+        return d_failure;
+    }
+    if ((decInfo->flags & STEGO_FLAG_ENCRYPTED)
+        && decode_bytes(decInfo, decInfo->aead.prefix, STEGO_NONCE_FIELD_BYTES, decInfo->depth) != d_success)
+    {
+        return d_failure;
+    }
+    if (decInfo->flags & STEGO_FLAG_SHARD)
+    {
+        unsigned long long index, count;
+        if (decode_int_field(decInfo, 8, &decInfo->shard.set_id) != d_success || decode_int_field(decInfo, 4, &index) != d_success
+            || decode_int_field(decInfo, 4, &count) != d_success
+            || decode_int_field(decInfo, 8, &decInfo->shard.offset) != d_success
+            || decode_int_field(decInfo, 8, &decInfo->shard.total) != d_success)
+        {
+            return d_failure;
+        }
+        decInfo->shard.index = (unsigned)index;
+        decInfo->shard.count = (unsigned)count;
+    }
+    int checksum_bytes = STEGO_CHECKSUM_FIELD_BYTES(decInfo->revision);
+    if (checksum_bytes)
+    {
+        uint32_t expected = decInfo->header_crc;
+        unsigned long long crc;
+        if (decode_int_field(decInfo, checksum_bytes, &crc) != d_success)
+        {
+            return d_failure;
+        }
+        if (crc != expected)
+        {
+            decInfo->checksum_failed = 1;
+            return d_failure;
+        }
+        // Keyed payloads have no fixed end, their checksum comes first
+        if (decInfo->keyed)
+        {
+            if (decode_int_field(decInfo, checksum_bytes, &crc) != d_success)
+            {
+                return d_failure;
+            }
+            decInfo->expected_payload_crc = (uint32_t)crc;
+        }
+    }
+    decInfo->payload_pos = decInfo->cursor.pos;
+    decInfo->size_plain = decInfo->size_secret_file;
+    if ((decInfo->flags & STEGO_FLAG_ENCRYPTED) && aead_plain_size(decInfo->size_secret_file, &decInfo->size_plain) != e_success)
+    {
+        return d_failure;
+    }
+    if (!(decInfo->flags & STEGO_FLAG_COMPRESSED))
+    {
+        decInfo->size_unpacked = decInfo->size_plain;
+    }
+    // A corrupt size must not run past the end of the carrier, payload checksum included
+    unsigned long long left = decInfo->bmp.capacity - decInfo->cursor.pos;
+    size_t trailer = decInfo->keyed ? 0 : lsb_carrier_bytes(checksum_bytes, decInfo->depth);
+    if (left < trailer)
+    {
+        return d_failure;
+    }
+    left -= trailer;
+    if (decInfo->size_secret_file > left / 8 * decInfo->depth + left % 8 * decInfo->depth / 8)
+    {
+        return d_failure;
+    }
+    // A shard lies inside its secret
+    const StegoShard *shard = &decInfo->shard;
+    if ((decInfo->flags & STEGO_FLAG_SHARD)
+        && (shard->index >= shard->count || shard->offset > shard->total
+            || decInfo->size_unpacked > shard->total - shard->offset))
+    {
+        return d_failure;
+    }
+    // Nor claim more blocks than their 4-byte headers can account for
+    if (decInfo->flags & STEGO_FLAG_COMPRESSED)
     {
-        // extension not present, so append
-        strcat(decInfo->output_fname, decInfo->file_extn);
+        return decInfo->size_unpacked / LZ_BLOCK + (decInfo->size_unpacked % LZ_BLOCK != 0) <= decInfo->size_plain / 4
+                   ? d_success : d_failure;
     }
+    return d_success;
+}
 
+/* File size of the stego image, 0 when it is not known up front (a pipe) */
+static unsigned long long stego_image_length(const DecodeInfo *decInfo)
+{
+    struct stat st;
+    if (decInfo->use_mmap)
+    {
+        return decInfo->stego_map.size;
+    }
+    if (fstat(fileno(decInfo->fptr_stego_image), &st) != 0 || !S_ISREG(st.st_mode))
+    {
+        return 0;
+    }
+    return st.st_size;
+}
+
+/* A cut off image fails here, before a single payload byte is written out */
+static DStatus check_stego_length(DecodeInfo *decInfo)
+{
+    unsigned long long length = stego_image_length(decInfo);
+    unsigned long long end = decInfo->keyed
+        ? decInfo->bmp.capacity
+        : decInfo->cursor.pos + lsb_carrier_bytes(decInfo->size_secret_file, decInfo->depth)
+              + lsb_carrier_bytes(STEGO_CHECKSUM_FIELD_BYTES(decInfo->revision), decInfo->depth);
+    if (length && end && bmp_offset(&decInfo->bmp, end - 1) >= length)
+    {
+        decInfo->truncated = 1;
+        return d_failure;
+    }
     return d_success;
 }
 
+/* Read the payload checksum that follows the data and compare it with what was extracted */
+static DStatus check_payload_crc(DecodeInfo *decInfo)
+{
+    int checksum_bytes = STEGO_CHECKSUM_FIELD_BYTES(decInfo->revision);
+    unsigned long long crc;
+    if (checksum_bytes == 0)
+    {
+        return d_success;
+    }
+    if (decode_int_field(decInfo, checksum_bytes, &crc) != d_success)
+    {
+        return d_failure;
+    }
+    if (crc != decInfo->payload_crc)
+    {
+        decInfo->checksum_failed = 1;
+        return d_failure;
+    }
+    return d_success;
+}
 
-/* Decode secret file size */
-DStatus decode_secret_file_size(DecodeInfo *decInfo)
+/* Keyed mode: gather the scattered carrier bytes straight from the mapping */
+static DStatus decode_scattered(DecodeInfo *decInfo, unsigned char *out)
 {
+    ScatterMap map;
+    if (!decInfo->use_mmap || decInfo->key == NULL || out == NULL
+        || decInfo->bmp.image_end > decInfo->stego_map.size || decInfo->size_secret_file > SIZE_MAX)
+    {
+        return d_failure;
+    }
+    scatter_init(&map, decInfo->key, decInfo->bmp.capacity - decInfo->cursor.pos);
+    scatter_extract(decInfo->pool, &map, &decInfo->bmp, decInfo->cursor.pos, decInfo->stego_map.data,
+                    decInfo->size_secret_file, out, decInfo->depth);
+    if (STEGO_CHECKSUM_FIELD_BYTES(decInfo->revision)
+        && crc32c_update(0, out, decInfo->size_secret_file) != decInfo->expected_payload_crc)
+    {
+        decInfo->checksum_failed = 1;
+        return d_failure;
+    }
+    return d_success;
+}
 
-    char image_buffer[32];
+/* Payload bytes extracted per step: one chunk per worker so the whole pool has work */
+static size_t decode_batch_bytes(const DecodeInfo *decInfo)
+{
+    return lsb_chunk_bytes(decInfo->depth) * (decInfo->pool ? pool_size(decInfo->pool) : 1);
+}
 
-    fread(image_buffer, 32, 1, decInfo->fptr_stego_image);
+/*
+ * A sealed or packed payload on its way to fptr_output: every segment is
+ * opened, and every block expanded, as soon as its last stored byte is
+ * extracted, so only the segment and block in progress are held, never
+ * the whole payload. Nothing is written before its tag has been checked.
+ */
+typedef struct
+{
+    unsigned char *sealed;          // Stored bytes of segments not complete yet (--encrypt)
+    size_t sealed_len;
+    unsigned char *opened;          // Plaintext of the segments opened in one go
+    unsigned long long segment;     // Next segment to open
+    unsigned long long sealed_left; // Stored bytes not opened yet
 
-    decode_size_from_lsb(image_buffer);
+    unsigned char *pending;      // Packed bytes of blocks not complete yet (-z)
+    size_t pending_len;
+    unsigned char *block;        // One expanded block, LZ_BLOCK bytes
+    unsigned long long raw_left; // Expanded bytes still to write
+} PayloadSink;
 
-    // decode integer from 32 LSB bits
-    decInfo->size_secret_file = decode_size_from_lsb(image_buffer);
+/* Write n payload bytes to the output, behind the extraction when it is a plain file */
+static DStatus write_output(DecodeInfo *decInfo, const unsigned char *bytes, size_t n)
+{
+    if (decInfo->aio_output ? aio_write(decInfo->aio_output, bytes, n) == e_success
+                            : fwrite(bytes, 1, n, decInfo->fptr_output) == n)
+    {
+        return d_success;
+    }
+    perror("write");
+    decInfo->write_failed = 1;
+    return d_failure;
+}
+
+/* Write n plaintext bytes to the output, expanding them first when packed */
+static DStatus write_plain(DecodeInfo *decInfo, PayloadSink *sink, const unsigned char *bytes, size_t n)
+{
+    if (!(decInfo->flags & STEGO_FLAG_COMPRESSED))
+    {
+        return write_output(decInfo, bytes, n);
+    }
+    memcpy(sink->pending + sink->pending_len, bytes, n);
+    sink->pending_len += n;
 
+    size_t pos = 0;
+    while (sink->pending_len - pos >= 4)
+    {
+        size_t span = lz_block_span(sink->pending + pos);
+        if (span > 4 + LZ_BLOCK || sink->raw_left == 0)
+        {
+            return d_failure;
+        }
+        if (span > sink->pending_len - pos)
+        {
+            break;
+        }
+        size_t raw = sink->raw_left < LZ_BLOCK ? sink->raw_left : LZ_BLOCK;
+        if (lz_unpack_block(sink->pending, sink->pending_len, &pos, sink->block, raw) != e_success
+            || write_output(decInfo, sink->block, raw) != d_success)
+        {
+            return d_failure;
+        }
+        sink->raw_left -= raw;
+    }
+    // At most one incomplete block is left, it moves to the front
+    memmove(sink->pending, sink->pending + pos, sink->pending_len - pos);
+    sink->pending_len -= pos;
     return d_success;
 }
 
+/* Write n extracted bytes to the output, opening and expanding them as the flags say */
+static DStatus write_payload(DecodeInfo *decInfo, PayloadSink *sink, const unsigned char *bytes, size_t n)
+{
+    if (!(decInfo->flags & STEGO_FLAG_ENCRYPTED))
+    {
+        return write_plain(decInfo, sink, bytes, n);
+    }
+    memcpy(sink->sealed + sink->sealed_len, bytes, n);
+    sink->sealed_len += n;
+
+    // The last segment may be short, it is only complete once every stored byte is in
+    int final = sink->sealed_len == sink->sealed_left;
+    size_t len = final ? sink->sealed_len : sink->sealed_len - sink->sealed_len % AEAD_SEALED_SEGMENT;
+    unsigned long long plain = len - len / AEAD_SEALED_SEGMENT * AEAD_TAG_BYTES;
+    if (len == 0)
+    {
+        return d_success;
+    }
+    if (final && aead_plain_size(len, &plain) != e_success)
+    {
+        return d_failure;
+    }
+    // All the complete segments open in parallel
+    if (aead_open(decInfo->pool, &decInfo->aead, sink->segment, sink->sealed, len, final, sink->opened) != e_success)
+    {
+        decInfo->auth_failed = 1;
+        return d_failure;
+    }
+    sink->segment += len / AEAD_SEALED_SEGMENT;
+    sink->sealed_left -= len;
+    memmove(sink->sealed, sink->sealed + len, sink->sealed_len - len);
+    sink->sealed_len -= len;
+    return write_plain(decInfo, sink, sink->opened, plain);
+}
+
+/*
+ * Read the carrier bytes of total stored bytes of a plain file stego image
+ * ahead, AIO_SLOTS blocks in flight, so extracting one batch overlaps
+ * reading the next ones. Pipes and decoded rows stay on stdio. The reads
+ * share the engine of the output writer when there is one.
+ */
+static AioEngine *start_overlapped_read(DecodeInfo *decInfo, unsigned long long total)
+{
+    AioEngine *engine;
+    off_t pos;
+    if (decInfo->use_mmap || decInfo->bmp.transcoded || total == 0 || !aio_file_ok(decInfo->fptr_stego_image)
+        || (pos = ftello(decInfo->fptr_stego_image)) < 0
+        || (engine = decInfo->aio ? decInfo->aio : aio_create()) == NULL)
+    {
+        return NULL;
+    }
+    unsigned long long left = lsb_carrier_bytes(total, decInfo->depth);
+    unsigned long long end = decInfo->cursor.pos + left <= decInfo->bmp.capacity
+                                 ? bmp_offset(&decInfo->bmp, decInfo->cursor.pos + left - 1) + 1
+                                 : decInfo->bmp.image_end;
+    if ((decInfo->aio_stego = aio_reader(engine, fileno(decInfo->fptr_stego_image), pos, end)) == NULL)
+    {
+        if (engine != decInfo->aio)
+            aio_destroy(engine);
+        return NULL;
+    }
+    return engine;
+}
+
+/* Hand the stego image back to stdio just past the payload */
+static DStatus finish_overlapped_read(DecodeInfo *decInfo, AioEngine *engine)
+{
+    if (engine == NULL)
+    {
+        return d_success;
+    }
+    off_t pos = aio_offset(decInfo->aio_stego);
+    aio_close(decInfo->aio_stego);
+    if (engine != decInfo->aio)
+        aio_destroy(engine);
+    decInfo->aio_stego = NULL;
+    return fseeko(decInfo->fptr_stego_image, pos, SEEK_SET) == 0 ? d_success : d_failure;
+}
 
-/* Decode secret file data*/
+/* A batch buffer of at least size bytes, kept for the rest of the job (the arena takes it back) */
+static unsigned char *batch_buffer(DecodeInfo *decInfo, unsigned char **buf, size_t *buf_size, size_t size)
+{
+    if (*buf_size < size)
+    {
+        unsigned char *grown = arena_alloc(decInfo->arena, size);
+        if (grown == NULL)
+        {
+            return NULL;
+        }
+        *buf = grown;
+        *buf_size = size;
+    }
+    return *buf;
+}
+
+/*
+ * Extract total stored bytes from the cursor on into out, or to
+ * fptr_output when out is NULL (through write_payload() when sink is set)
+ */
+static DStatus extract_stored(DecodeInfo *decInfo, unsigned long long total, unsigned char *out, PayloadSink *sink)
+{
+    // In mmap mode contiguous carrier runs are read straight from the mapping
+    size_t batch = decode_batch_bytes(decInfo);
+    unsigned char *image_buffer = batch_buffer(decInfo, &decInfo->carrier_buf, &decInfo->carrier_buf_size,
+                                               lsb_carrier_bytes(batch, decInfo->depth));
+    // In-memory decodes extract straight into the caller's buffer
+    unsigned char *secret = out ? NULL : batch_buffer(decInfo, &decInfo->payload_buf, &decInfo->payload_buf_size, batch);
+    if (image_buffer == NULL || (secret == NULL && out == NULL))
+    {
+        return d_failure;
+    }
+
+    DStatus status = d_success;
+    unsigned long long remaining = total;
+    AioEngine *engine = start_overlapped_read(decInfo, total);
+
+    // Extract one chunk per worker concurrently, then write them out at once
+    while (remaining > 0)
+    {
+        size_t n = remaining < batch ? remaining : batch;
+        const unsigned char *carrier = get_stego_bytes(decInfo, lsb_carrier_bytes(n, decInfo->depth), image_buffer);
+        if (carrier == NULL)
+        {
+            // A pipe has no length to check up front, it just runs dry, and decoded PNG rows break off
+            decInfo->truncated = !decInfo->use_mmap
+                                 && (decInfo->aio_stego ? aio_eof(decInfo->aio_stego)
+                                                        : feof(decInfo->fptr_stego_image)
+                                                              || (decInfo->bmp.transcoded
+                                                                  && ferror(decInfo->fptr_stego_image)));
+            status = d_failure;
+            break;
+        }
+        if (out)
+        {
+            lsb_extract_parallel_crc(decInfo->pool, carrier, n, out, decInfo->depth, &decInfo->payload_crc);
+            out += n;
+        }
+        else
+        {
+            lsb_extract_parallel_crc(decInfo->pool, carrier, n, secret, decInfo->depth, &decInfo->payload_crc);
+            if ((sink ? write_payload(decInfo, sink, secret, n) : write_output(decInfo, secret, n)) != d_success)
+            {
+                status = d_failure;
+                break;
+            }
+        }
+        remaining -= n;
+    }
+    if (finish_overlapped_read(decInfo, engine) != d_success)
+    {
+        status = d_failure;
+    }
+    return status;
+}
+
+/*
+ * Extract the stored payload into out, or to fptr_output when out is NULL
+ * (through write_payload() when sink is set), and check it against the
+ * payload checksum
+ */
+static DStatus extract_payload(DecodeInfo *decInfo, unsigned char *out, PayloadSink *sink)
+{
+    if (decInfo->keyed)
+    {
+        return decode_scattered(decInfo, out);
+    }
+    DStatus status = extract_stored(decInfo, decInfo->size_secret_file, out, sink);
+    return status == d_success ? check_payload_crc(decInfo) : status;
+}
+
+/*
+ * Sealed (--encrypt) and packed (-z) payloads, in memory: the stored bytes
+ * are extracted whole, then every segment opens and every block expands
+ * in parallel
+ */
+static DStatus decode_whole(DecodeInfo *decInfo)
+{
+    int sealed = (decInfo->flags & STEGO_FLAG_ENCRYPTED) != 0;
+    int packed = (decInfo->flags & STEGO_FLAG_COMPRESSED) != 0;
+    unsigned char *stored = malloc(decInfo->size_secret_file ? decInfo->size_secret_file : 1);
+    // Opened bytes go straight to the caller's buffer unless they still have to expand
+    unsigned char *plain = sealed && packed ? malloc(decInfo->size_plain ? decInfo->size_plain : 1)
+                           : sealed ? decInfo->out_data : stored;
+    DStatus status = stored && plain ? extract_payload(decInfo, stored, NULL) : d_failure;
+
+    if (status == d_success && sealed
+        && aead_open(decInfo->pool, &decInfo->aead, 0, stored, decInfo->size_secret_file, 1, plain) != e_success)
+    {
+        decInfo->auth_failed = 1;
+        status = d_failure;
+    }
+    if (status == d_success && packed
+        && lz_unpack(decInfo->pool, plain, decInfo->size_plain, decInfo->out_data, decInfo->size_unpacked) != e_success)
+    {
+        status = d_failure;
+    }
+    if (sealed && packed)
+        free(plain);
+    free(stored);
+    return status;
+}
+
+/* Sealed and packed payloads to fptr_output, opened and expanded while the extraction goes on */
+static DStatus decode_streamed(DecodeInfo *decInfo)
+{
+    int sealed = (decInfo->flags & STEGO_FLAG_ENCRYPTED) != 0;
+    int packed = (decInfo->flags & STEGO_FLAG_COMPRESSED) != 0;
+    // A step passes at most one batch on, plus what the previous steps held back
+    size_t batch = decode_batch_bytes(decInfo) + AEAD_SEALED_SEGMENT;
+    PayloadSink sink = {NULL, 0, NULL, 0, decInfo->size_secret_file, NULL, 0, NULL, decInfo->size_unpacked};
+    DStatus status = d_success;
+
+    if (sealed && ((sink.sealed = arena_alloc(decInfo->arena, batch)) == NULL
+                   || (sink.opened = arena_alloc(decInfo->arena, batch)) == NULL))
+        status = d_failure;
+    if (packed && ((sink.pending = arena_alloc(decInfo->arena, batch + 4 + LZ_BLOCK)) == NULL
+                   || (sink.block = arena_alloc(decInfo->arena, LZ_BLOCK)) == NULL))
+        status = d_failure;
+    if (status == d_success)
+        status = extract_payload(decInfo, NULL, &sink);
+    // Every stored byte must have gone into a segment or block, and every one of them must be there
+    if ((sealed && (sink.sealed_len != 0 || sink.sealed_left != 0))
+        || (packed && (sink.pending_len != 0 || sink.raw_left != 0)))
+    {
+        status = d_failure;
+    }
+    return status;
+}
+
+/*
+ * Output to a plain file: its blocks are reserved for the whole payload up
+ * front, so a full disk shows before anything is extracted and the file is
+ * not laid out piece by piece, and the payload is written behind the
+ * extraction in AIO_BLOCK positional writes. Pipes stay on fwrite.
+ */
+static DStatus open_output(DecodeInfo *decInfo)
+{
+    FILE *fp = decInfo->fptr_output;
+    off_t pos;
+    if (!aio_file_ok(fp) || fflush(fp) != 0 || (pos = ftello(fp)) < 0)
+    {
+        return d_success;
+    }
+    if (file_preallocate(fileno(fp), pos, decInfo->size_unpacked) != e_success)
+    {
+        perror("fallocate");
+        decInfo->write_failed = 1;
+        return d_failure;
+    }
+    // Appends ignore the offset, writes finishing out of order would land out of order
+    if (fcntl(fileno(fp), F_GETFL) & O_APPEND)
+    {
+        return d_success;
+    }
+    if ((decInfo->aio = aio_create()) != NULL
+        && (decInfo->aio_output = aio_writer(decInfo->aio, fileno(fp), pos)) == NULL)
+    {
+        aio_destroy(decInfo->aio);
+        decInfo->aio = NULL;
+    }
+    return d_success;
+}
+
+/* Wait for the writes behind and hand the output back to stdio where the payload ended */
+static DStatus close_output(DecodeInfo *decInfo, DStatus status)
+{
+    if (decInfo->aio == NULL)
+    {
+        return status;
+    }
+    off_t pos = aio_offset(decInfo->aio_output);
+    if (aio_close(decInfo->aio_output) != e_success && !decInfo->write_failed)
+    {
+        perror("write");
+        decInfo->write_failed = 1;
+        status = d_failure;
+    }
+    aio_destroy(decInfo->aio);
+    decInfo->aio_output = NULL;
+    decInfo->aio = NULL;
+    if (status == d_success && fseeko(decInfo->fptr_output, pos, SEEK_SET) != 0)
+    {
+        status = d_failure;
+    }
+    return status;
+}
+
+/* Decode the payload to the output file, or into out_data */
+static DStatus decode_payload(DecodeInfo *decInfo)
+{
+    if (!(decInfo->flags & (STEGO_FLAG_COMPRESSED | STEGO_FLAG_ENCRYPTED)))
+    {
+        return extract_payload(decInfo, decInfo->out_data, NULL);
+    }
+    if (decInfo->size_secret_file > SIZE_MAX)
+    {
+        return d_failure;
+    }
+    if (decInfo->flags & STEGO_FLAG_ENCRYPTED)
+    {
+        if (decInfo->cipher_key == NULL)
+        {
+            return d_failure;
+        }
+        memcpy(decInfo->aead.key, decInfo->cipher_key, AEAD_KEY_BYTES);
+    }
+    return decInfo->out_data ? decode_whole(decInfo) : decode_streamed(decInfo);
+}
+
+/* Decode secret file data in decode_batch_bytes() blocks */
 DStatus decode_secret_file_data(DecodeInfo *decInfo)
 {
+    if (check_stego_length(decInfo) != d_success)
+    {
+        return d_failure;
+    }
+    if (decInfo->out_data)
+    {
+        return decode_payload(decInfo);
+    }
+    if (open_output(decInfo) != d_success)
+    {
+        return d_failure;
+    }
+    return close_output(decInfo, decode_payload(decInfo));
+}
+
+/* Archives: n stored bytes from payload offset on, wherever the cursor was */
+static DStatus read_stored(DecodeInfo *decInfo, unsigned long long offset, size_t n, unsigned char *out)
+{
+    // Start on a carrier byte: at depth 3 only every third payload byte does
+    unsigned long long first = decInfo->depth == 3 ? offset - offset % 3 : offset;
+    size_t skip = offset - first;
+    unsigned char *dest = skip ? malloc(n + skip) : out;
+    DStatus status = d_success;
+
+    if (dest == NULL || offset > decInfo->size_secret_file || n > decInfo->size_secret_file - offset)
+    {
+        status = d_failure;
+    }
+    else if (decInfo->keyed)
+    {
+        ScatterMap map;
+        if (!decInfo->use_mmap || decInfo->key == NULL || decInfo->bmp.image_end > decInfo->stego_map.size)
+        {
+            status = d_failure;
+        }
+        else
+        {
+            scatter_init(&map, decInfo->key, decInfo->bmp.capacity - decInfo->payload_pos);
+            scatter_extract_at(decInfo->pool, &map, &decInfo->bmp, decInfo->payload_pos, decInfo->stego_map.data, first,
+                               n + skip, dest, decInfo->depth);
+        }
+    }
+    else
+    {
+        bmp_cursor_seek(&decInfo->bmp, &decInfo->cursor, decInfo->payload_pos + first * 8 / decInfo->depth);
+        if (!decInfo->use_mmap && fseeko(decInfo->fptr_stego_image, decInfo->cursor.file_off, SEEK_SET) != 0)
+        {
+            status = d_failure;
+        }
+        else
+        {
+            status = extract_stored(decInfo, n + skip, dest, NULL);
+        }
+    }
+    if (skip && dest)
+    {
+        if (status == d_success)
+            memcpy(out, dest + skip, n);
+        free(dest);
+    }
+    return status;
+}
 
-    char image_buffer[8];
-    char ch;
-    // Read every byte of secret file
-    for (int i = 0; i < decInfo->size_secret_file; i++)
+/* Archives: n plaintext bytes from payload offset on, opening only the segments that hold them */
+static DStatus read_plain(DecodeInfo *decInfo, unsigned long long offset, size_t n, unsigned char *out)
+{
+    if (!(decInfo->flags & STEGO_FLAG_ENCRYPTED))
+    {
+        return read_stored(decInfo, offset, n, out);
+    }
+    if (n == 0)
     {
-        fread(image_buffer, 8, 1, decInfo->fptr_stego_image);
-        ch= decode_byte_from_lsb(image_buffer);   // decode one byte
-        fputc(ch, decInfo->fptr_output);         // write to output file
+        return d_success;
+    }
+    if (offset > decInfo->size_plain || n > decInfo->size_plain - offset)
+    {
+        return d_failure;
+    }
+    unsigned long long segment = offset / AEAD_SEGMENT;
+    unsigned long long start = segment * AEAD_SEALED_SEGMENT;
+    unsigned long long end = ((offset + n - 1) / AEAD_SEGMENT + 1) * AEAD_SEALED_SEGMENT;
+    int final = end >= decInfo->size_secret_file;
+    if (final)
+    {
+        end = decInfo->size_secret_file;
+    }
+    unsigned char *sealed = end - start <= SIZE_MAX ? malloc(end - start) : NULL;
+    unsigned char *opened = sealed ? malloc(end - start) : NULL;
+    DStatus status = opened ? read_stored(decInfo, start, end - start, sealed) : d_failure;
 
+    if (status == d_success
+        && aead_open(decInfo->pool, &decInfo->aead, segment, sealed, end - start, final, opened) != e_success)
+    {
+        decInfo->auth_failed = 1;
+        status = d_failure;
+    }
+    if (status == d_success)
+    {
+        memcpy(out, opened + (offset - segment * AEAD_SEGMENT), n);
     }
+    free(sealed);
+    free(opened);
+    return status;
+}
 
+/* Extract one archive member into the file at path, checked against its CRC32C */
+static DStatus extract_member(DecodeInfo *decInfo, const ArchiveEntry *entry, const char *path)
+{
+    int packed = (entry->flags & ARCHIVE_ENTRY_PACKED) != 0;
+    if (entry->stored > SIZE_MAX || entry->size > SIZE_MAX)
+    {
+        return d_failure;
+    }
+    unsigned char *stored = malloc(entry->stored ? entry->stored : 1);
+    unsigned char *data = packed ? malloc(entry->size ? entry->size : 1) : stored;
+    DStatus status = stored && data ? read_plain(decInfo, entry->offset, entry->stored, stored) : d_failure;
+
+    if (status == d_success && packed
+        && lz_unpack(decInfo->pool, stored, entry->stored, data, entry->size) != e_success)
+    {
+        status = d_failure;
+    }
+    if (status == d_success && crc32c_update(0, data, entry->size) != entry->crc)
+    {
+        decInfo->checksum_failed = 1;
+        status = d_failure;
+    }
+    if (status == d_success)
+    {
+        FILE *fp = fopen(path, "wb");
+        if (fp == NULL)
+        {
+            perror("fopen");
+            fprintf(stderr, "ERROR: Unable to open output file %s\n", path);
+            status = d_failure;
+        }
+        else if ((fwrite(data, 1, entry->size, fp) != entry->size) | (fclose(fp) != 0))
+        {
+            perror("write");
+            remove(path);
+            status = d_failure;
+        }
+    }
+    if (packed)
+        free(data);
+    free(stored);
+    return status;
+}
+
+/*
+ * Archive payloads: the TOC is read from the front of the payload, then
+ * every member (or only decInfo->member) straight from its own stored
+ * bytes into output_fname, which becomes a directory. Nothing in front of
+ * a member is extracted to get to it.
+ */
+static DStatus decode_archive(DecodeInfo *decInfo)
+{
+    unsigned char field[ARCHIVE_TOC_LENGTH_BYTES];
+    ArchiveToc toc = {NULL, 0};
+    unsigned char *toc_bytes = NULL;
+    unsigned long long toc_len = 0;
+    DStatus status = check_stego_length(decInfo);
+
+    if (decInfo->flags & STEGO_FLAG_ENCRYPTED)
+        memcpy(decInfo->aead.key, decInfo->cipher_key, AEAD_KEY_BYTES);
+    if (status == d_success && decInfo->size_plain >= sizeof(field))
+        status = read_plain(decInfo, 0, sizeof(field), field);
+    else
+        status = d_failure;
+    for (size_t i = 0; status == d_success && i < sizeof(field); i++)
+        toc_len = (toc_len << 8) | field[i];
+    if (status == d_success && (toc_len > decInfo->size_plain - sizeof(field) || (toc_bytes = malloc(toc_len ? toc_len : 1)) == NULL))
+        status = d_failure;
+    if (status == d_success)
+        status = read_plain(decInfo, sizeof(field), toc_len, toc_bytes);
+    if (status == d_success && archive_parse_toc(toc_bytes, toc_len, decInfo->size_plain, &toc) != e_success)
+    {
+        printf("ERROR : Corrupt archive table of contents\n");
+        status = d_failure;
+    }
+    free(toc_bytes);
+    if (status != d_success)
+        return d_failure;
+    decode_info(decInfo, "INFO : Archive of %u files\n", toc.count);
+
+    const ArchiveEntry *only = decInfo->member ? archive_find(&toc, decInfo->member) : NULL;
+    if (decInfo->member && only == NULL)
+    {
+        printf("ERROR : No member %s in the archive\n", decInfo->member);
+        status = d_failure;
+    }
+    else if (mkdir(decInfo->output_fname, 0777) != 0 && errno != EEXIST)
+    {
+        perror("mkdir");
+        fprintf(stderr, "ERROR: Unable to create output directory %s\n", decInfo->output_fname);
+        status = d_failure;
+    }
+    // One path buffer for every member, the longest name fits
+    size_t path_size = strlen(decInfo->output_fname) + 1 + ARCHIVE_NAME_MAX + 1;
+    char *path = status == d_success ? arena_alloc(decInfo->arena, path_size) : NULL;
+    if (status == d_success && path == NULL)
+        status = d_failure;
+    for (unsigned i = 0; status == d_success && i < toc.count; i++)
+    {
+        const ArchiveEntry *entry = &toc.entries[i];
+        if (only && entry != only)
+            continue;
+        snprintf(path, path_size, "%s/%s", decInfo->output_fname, entry->name);
+        status = extract_member(decInfo, entry, path);
+        if (status == d_success)
+            decode_info(decInfo, "INFO : %s, %llu bytes%s\n", path, entry->size,
+                        entry->flags & ARCHIVE_ENTRY_PACKED ? " (packed)" : "");
+    }
+    archive_free_toc(&toc);
+    return status;
+}
+
+/* Close or unmap the stego image */
+static void close_stego_image(DecodeInfo *decInfo)
+{
+    // The raw scratch and batch buffers went back with the arena
+    decInfo->raw = NULL;
+    decInfo->raw_size = 0;
+    if (decInfo->use_mmap)
+        unmap_file(&decInfo->stego_map);
+    else
+        fclose(decInfo->fptr_stego_image);
+}
+
+/* Close everything after a failed stage and record the failure */
+static DStatus decode_failed(DecodeInfo *decInfo)
+{
+    close_stego_image(decInfo);
+    if (decInfo->fptr_output)
+    {
+        fclose(decInfo->fptr_output);
+        decInfo->fptr_output = NULL;
+    }
+    metrics_job_end(&decInfo->metrics, 0);
+    return d_failure;
+}
+
+/*
+ * mmap mode: the output file is created at the payload size and mapped,
+ * and the library API extracts straight into it
+ */
+static DStatus decode_mapped(DecodeInfo *decInfo)
+{
+    JobMetrics *m = &decInfo->metrics;
+    StegoView stego = {decInfo->stego_map.data, decInfo->stego_map.size};
+    StegoOptions opts = {0, NULL, decInfo->pool, m, decInfo->key, 0, decInfo->cipher_key, 0, NULL, decInfo->arena};
+    StegoHeader header;
+    MappedFile out_map;
+
+    StegoStatus status = stego_decode_header(&stego, &header);
+    if (status == STEGO_OK && header.keyed && decInfo->key == NULL)
+        status = STEGO_ERR_KEY;
+    if (status == STEGO_OK && header.encrypted && decInfo->cipher_key == NULL)
+        status = STEGO_ERR_ENCRYPTED;
+    if (status == STEGO_OK && decInfo->member)
+    {
+        printf("ERROR : -x needs an archive, the payload is a single file\n");
+        return decode_failed(decInfo);
+    }
+    if (status == STEGO_OK && header.sharded)
+    {
+        printf("ERROR : Image holds shard %u of %u, decode it together with the others (--shard)\n",
+               header.shard.index + 1, header.shard.count);
+        return decode_failed(decInfo);
+    }
+    if (status != STEGO_OK || header.size > SIZE_MAX)
+    {
+        decInfo->checksum_failed = status == STEGO_ERR_CHECKSUM;
+        printf("ERROR : %s\n", status != STEGO_OK ? stego_status_string(status) : "payload too large to map");
+        return decode_failed(decInfo);
+    }
+    if (append_extension(decInfo, header.extn) != d_success)
+    {
+        return decode_failed(decInfo);
+    }
+    decode_info(decInfo, header.revision ? "INFO : Format revision %d, %d bit depth\n" : "INFO : Legacy 1 bit image\n",
+                header.revision, header.depth);
+    if (header.encrypted)
+        decode_info(decInfo, "INFO : Payload sealed with ChaCha20-Poly1305 (%s kernel), %llu bytes stored\n",
+                    aead_kernel_name(), header.stored);
+    if (header.compressed)
+        decode_info(decInfo, "INFO : Payload packed, expands to %llu bytes\n", header.size);
+
+    stage_begin(m);
+    if (map_file_create(decInfo->output_fname, header.size, &out_map) != e_success)
+    {
+        return decode_failed(decInfo);
+    }
+    // A mapping with no blocks behind it would only run out of disk as a SIGBUS halfway through
+    if (file_preallocate(out_map.fd, 0, header.size) != e_success)
+    {
+        perror("fallocate");
+        printf("ERROR : No room for the %llu byte output %s\n", header.size, decInfo->output_fname);
+        unmap_file(&out_map);
+        remove(decInfo->output_fname);
+        return decode_failed(decInfo);
+    }
+    stage_end(m, STAGE_OPEN, 0);
+
+    StegoBuffer out = {out_map.data, 0, out_map.size};
+    status = stego_decode(&stego, &out, NULL, &opts);
+    // An empty payload has no mapping, the library allocated a placeholder
+    if (out.data != out_map.data)
+        free(out.data);
+    if (status != STEGO_OK)
+    {
+        printf("ERROR : %s\n", stego_status_string(status));
+        unmap_file(&out_map);
+        // The mapping holds whatever the failed segments decrypted to, or the part before a bad checksum
+        decInfo->auth_failed = status == STEGO_ERR_AUTH;
+        decInfo->checksum_failed = status == STEGO_ERR_CHECKSUM;
+        decInfo->truncated = status == STEGO_ERR_TRUNCATED;
+        if (decode_failure_reason(decInfo))
+            remove(decInfo->output_fname);
+        return decode_failed(decInfo);
+    }
+    decode_info(decInfo, "INFO : Payload written to %s\n", decInfo->output_fname);
+
+    stage_begin(m);
+    unmap_file(&out_map);
+    close_stego_image(decInfo);
+    stage_end(m, STAGE_CLOSE, 0);
+    metrics_job_end(m, 1);
     return d_success;
-   
+}
+
+/* mmap mode: does the image hold an archive? (anything wrong with it is left to decode_mapped()) */
+static int mapped_archive(const DecodeInfo *decInfo)
+{
+    StegoView stego = {decInfo->stego_map.data, decInfo->stego_map.size};
+    StegoHeader header;
+    return stego_decode_header(&stego, &header) == STEGO_OK && header.archive;
 }
 
 /* Main decoding */
 DStatus do_decoding(DecodeInfo *decInfo)
 {
-    printf("INFO : ## Decoding Procedure Started ##\n");
+    JobMetrics *m = &decInfo->metrics;
+
+    metrics_job_begin(m, METRICS_DECODE, decInfo->quiet);
+    decode_info(decInfo, "INFO : ## Decoding %s (%s kernel, %s crc32c) ##\n", decInfo->stego_image_fname, lsb_kernel_name(),
+                crc32c_kernel_name());
 
     // Open stego image FIRST
-    printf("INFO : Opening stego image\n");
-    decInfo->fptr_stego_image = fopen(decInfo->stego_image_fname, "rb");
-    if (!decInfo->fptr_stego_image)
+    stage_begin(m);
+    decInfo->fptr_output = NULL;
+    if (decInfo->use_mmap)
+    {
+        int in_place;
+        const char *format = carrier_file_format(decInfo->stego_image_fname, &in_place);
+        // Mapped images go through the library, which tells the format by its header
+        if (decInfo->raw_layout)
+        {
+            printf("ERROR : Headerless dumps are read front to back, -m and --key need a BMP, PPM or PGM\n");
+            metrics_job_end(m, 0);
+            return d_failure;
+        }
+        if (format && !in_place)
+        {
+            printf("ERROR : %s images are decoded row by row, -m and --key need a BMP, PPM or PGM\n", format);
+            metrics_job_end(m, 0);
+            return d_failure;
+        }
+        if (map_file_read(decInfo->stego_image_fname, &decInfo->stego_map) != e_success)
+        {
+            metrics_job_end(m, 0);
+            return d_failure;
+        }
+        decInfo->fptr_stego_image = NULL;
+        stage_end(m, STAGE_OPEN, 0);
+        // Archives take the steps below, every member is read straight from the mapping
+        if (!mapped_archive(decInfo))
+            return decode_mapped(decInfo);
+    }
+    else if ((decInfo->fptr_stego_image = fopen(decInfo->stego_image_fname, "rb")) == NULL)
     {
         perror("fopen");
         fprintf(stderr, "ERROR : Unable to open file %s\n", decInfo->stego_image_fname);
+        metrics_job_end(m, 0);
         return d_failure;
     }
-    printf("INFO : Done\n");
+    stage_end(m, STAGE_OPEN, 0);
 
-    //Skip 54-byte BMP header
-    skip_bmp_header(decInfo->fptr_stego_image);
+    //Skip the BMP header, parsing where the pixels are
+    stage_begin(m);
+    if (skip_bmp_header(decInfo) != d_success)
+    {
+        printf("ERROR : Unsupported or corrupt carrier header\n");
+        return decode_failed(decInfo);
+    }
+    stage_end(m, STAGE_PARSE, decInfo->bmp.data_offset);
 
     /* Decode Magic String */
-    printf("INFO : Decoding Magic String Signature\n");
+    stage_begin(m);
     if (decode_magic_string(decInfo) != d_success)
     {
         printf("ERROR : Magic String Mismatch\n");
-        fclose(decInfo->fptr_stego_image);
-        return d_failure;
+        return decode_failed(decInfo);
+    }
+    stage_end(m, STAGE_MAGIC, strlen(MAGIC_STRING));
+
+    /* Decode format descriptor */
+    stage_begin(m);
+    if (decode_format_descriptor(decInfo) != d_success)
+    {
+        printf("ERROR : Failed decoding format descriptor\n");
+        return decode_failed(decInfo);
+    }
+    stage_end(m, STAGE_DESCRIPTOR, !decInfo->legacy);
+    decode_info(decInfo, decInfo->legacy ? "INFO : Legacy 1 bit image\n" : "INFO : Format revision %d, %d bit depth\n",
+                decInfo->revision, decInfo->depth);
+    // Scattered carrier bytes are only reachable through a mapping (--key implies -m)
+    if (decInfo->keyed && !(decInfo->use_mmap && decInfo->key))
+    {
+        printf("ERROR : Payload is scattered by a key, decode with --key\n");
+        return decode_failed(decInfo);
     }
-    printf("INFO : Done\n");
 
     /*  Decode extension size */
-    printf("INFO : Decoding Extension Size\n");
+    stage_begin(m);
     if (decode_secret_file_extn_size(decInfo) != d_success)
     {
         printf("ERROR : Failed decoding extension size\n");
-        fclose(decInfo->fptr_stego_image);
-        return d_failure;
+        return decode_failed(decInfo);
     }
-    printf("INFO : Done\n");
+    stage_end(m, STAGE_EXTN_SIZE, sizeof(int));
 
     /* Decode extension (this appends to output_fname) */
-    printf("INFO : Decoding Extension\n");
+    stage_begin(m);
     if (decode_secret_file_extn(decInfo) != d_success)
     {
         printf("ERROR : Failed decoding extension\n");
-        fclose(decInfo->fptr_stego_image);
-        return d_failure;
+        return decode_failed(decInfo);
     }
-    printf("INFO : Done\n");
+    stage_end(m, STAGE_EXTN, decInfo->extn_size);
 
-    /* Now open output file with the FINAL name (after extension appended) */
+    /*  Decode secret file size, the header checksum closes the fields */
+    stage_begin(m);
+    if (decode_secret_file_size(decInfo) != d_success)
+    {
+        printf(decInfo->checksum_failed ? "ERROR : Header checksum mismatch (corrupt image)\n"
+                                        : "ERROR : Failed decoding secret file size\n");
+        return decode_failed(decInfo);
+    }
+    stage_end(m, STAGE_SIZE, STEGO_SIZE_FIELD_BYTES(decInfo->revision));
+    if (decInfo->flags & STEGO_FLAG_ENCRYPTED)
+    {
+        if (decInfo->cipher_key == NULL)
+        {
+            printf("ERROR : Payload is encrypted, decode with --encrypt KEYFILE\n");
+            return decode_failed(decInfo);
+        }
+        decode_info(decInfo, "INFO : Payload sealed with ChaCha20-Poly1305 (%s kernel), %llu bytes stored\n",
+                    aead_kernel_name(), decInfo->size_secret_file);
+    }
+    if (decInfo->flags & STEGO_FLAG_COMPRESSED)
+        decode_info(decInfo, "INFO : Payload packed, %llu bytes expand to %llu\n", decInfo->size_plain,
+                    decInfo->size_unpacked);
+    if (decInfo->flags & STEGO_FLAG_SHARD)
+    {
+        printf("ERROR : Image holds shard %u of %u, decode it together with the others (--shard)\n",
+               decInfo->shard.index + 1, decInfo->shard.count);
+        return decode_failed(decInfo);
+    }
+
+    /* Archives: every member goes to its own file in the output directory */
+    if (decInfo->flags & STEGO_FLAG_ARCHIVE)
+    {
+        // Members are read by seeking, decoded rows only go forward
+        if (decInfo->bmp.transcoded)
+        {
+            printf("ERROR : Archives are extracted from BMP, PPM, PGM and raw images only\n");
+            return decode_failed(decInfo);
+        }
+        stage_begin(m);
+        if (decode_archive(decInfo) != d_success)
+        {
+            if (decode_failure_reason(decInfo))
+                printf("ERROR : %s\n", decode_failure_reason(decInfo));
+            return decode_failed(decInfo);
+        }
+        stage_end(m, STAGE_DATA, decInfo->size_secret_file);
+        stage_begin(m);
+        close_stego_image(decInfo);
+        stage_end(m, STAGE_CLOSE, 0);
+        metrics_job_end(m, 1);
+        return d_success;
+    }
+    if (decInfo->member)
+    {
+        printf("ERROR : -x needs an archive, the payload is a single file\n");
+        return decode_failed(decInfo);
+    }
+
+    /* Now open output file with the FINAL name, once the header is known to be intact */
+    stage_begin(m);
     decInfo->fptr_output = fopen(decInfo->output_fname, "wb");
     if (!decInfo->fptr_output)
     {
         perror("fopen");
         fprintf(stderr, "ERROR: Unable to open output file %s\n", decInfo->output_fname);
-        fclose(decInfo->fptr_stego_image);
-        return d_failure;
+        return decode_failed(decInfo);
     }
+    stage_end(m, STAGE_OPEN, 0);
 
-    /*  Decode secret file size */
-    printf("INFO : Decoding Secret File Size\n");
-    if (decode_secret_file_size(decInfo) != d_success)
+    /*  Decode secret file data */
+    stage_begin(m);
+    if (decode_secret_file_data(decInfo) != d_success)
     {
-        printf("ERROR : Failed decoding secret file size\n");
-        fclose(decInfo->fptr_stego_image);
-        fclose(decInfo->fptr_output);
+        const char *reason = decode_failure_reason(decInfo);
+        if (reason == NULL)
+        {
+            printf("ERROR : Failed decoding secret file data\n");
+            return decode_failed(decInfo);
+        }
+        printf("ERROR : %s\n", reason);
+        // What was written is cut off or failed its check, it is no use
+        decode_failed(decInfo);
+        remove(decInfo->output_fname);
         return d_failure;
     }
-    printf("INFO : Done\n");
+    stage_end(m, STAGE_DATA, decInfo->size_secret_file);
 
-    /*  Decode secret file data */
-    printf("INFO : Decoding Secret File Data\n");
-    if (decode_secret_file_data(decInfo) != d_success)
+    /* Close files, what stdio still holds goes out now */
+    stage_begin(m);
+    close_stego_image(decInfo);
+    int closed = fclose(decInfo->fptr_output);
+    decInfo->fptr_output = NULL;
+    if (closed != 0)
     {
-        printf("ERROR : Failed decoding secret file data\n");
-        fclose(decInfo->fptr_stego_image);
-        fclose(decInfo->fptr_output);
+        perror("write");
+        printf("ERROR : Unable to write the output file %s\n", decInfo->output_fname);
+        remove(decInfo->output_fname);
+        metrics_job_end(m, 0);
         return d_failure;
     }
-    printf("INFO : Done\n");
-    printf("INFO: Decoding completed successfully.\n");
-
-    /* Close files */
-    fclose(decInfo->fptr_stego_image);
-    fclose(decInfo->fptr_output);
+    stage_end(m, STAGE_CLOSE, 0);
+    decode_info(decInfo, "INFO : Payload written to %s\n", decInfo->output_fname);
+    metrics_job_end(m, 1);
 
     return d_success;
 }
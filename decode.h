@@ -2,7 +2,16 @@
 #define DECODE_H
 
 #include <stdio.h>
+#include <stdint.h>
 #include "types.h"
+#include "mapfile.h"
+#include "threadpool.h"
+#include "bmp.h"
+#include "pnm.h"
+#include "metrics.h"
+#include "aead.h"
+#include "stego.h"
+#include "aio.h"
 
 /* Structure to store decoding information */
 typedef struct _DecodeInfo
@@ -10,15 +19,61 @@ typedef struct _DecodeInfo
     /* Stego Image Info */
     char *stego_image_fname;
     FILE *fptr_stego_image;
+    const RawLayout *raw_layout; // --raw: the stego image is a headerless dump of this layout (NULL = detect)
 
     /* Secret File Info */
-    char output_fname[100];
+    char *output_fname;  // Output name, the payload extension added once it is known (from the arena)
     FILE *fptr_output;
-    int size_secret_file;
+    unsigned long long size_secret_file;
     char *extn_secret_file;
-    char file_extn[10];
+    char *file_extn;     // Payload extension, up to STEGO_EXTN_MAX bytes (from the arena)
     int extn_size;
 
+    /* Layout from the format descriptor */
+    int depth;        // LSBs per carrier byte after the descriptor
+    int revision;     // Format revision (0 = legacy, from before the descriptor)
+    int legacy;       // Image predates the descriptor (1 bit, no descriptor byte)
+    int keyed;        // Payload scattered by a key (STEGO_FLAG_KEYED)
+    int flags;        // Flags byte from revision 3 (STEGO_FLAG_*), 0 before
+    unsigned long long size_plain;    // Payload bytes once opened, size_secret_file when not sealed
+    unsigned long long size_unpacked; // Payload bytes once expanded, size_plain when not packed
+    const char *key;  // --key given on the command line (NULL = none)
+    const unsigned char *cipher_key; // --encrypt key, AEAD_KEY_BYTES (NULL = none)
+    AeadStream aead;  // Key and nonce prefix of a sealed payload
+    int auth_failed;  // A sealed segment did not authenticate
+    uint32_t header_crc;  // CRC32C of the fields read so far
+    uint32_t payload_crc; // CRC32C of the stored payload bytes extracted so far
+    uint32_t expected_payload_crc; // Keyed images: payload checksum read in front of the scattered area
+    int checksum_failed; // Header or payload checksum mismatch (revision 4)
+    int truncated;       // The image ends before the payload does
+    int write_failed;    // The output could not be written (disk full, I/O error)
+    unsigned long long payload_pos; // Usable byte the stored payload starts at
+    const char *member;  // -x NAME: extract only this archive member (NULL = every member)
+    StegoShard shard;    // Shard fields, with STEGO_FLAG_SHARD
+
+    /* mmap mode: the stego image is read straight from a mapping */
+    int use_mmap;
+    MappedFile stego_map;
+
+    /* Walk over the usable bytes of the stego image */
+    BmpInfo bmp;
+    BmpCursor cursor;
+    unsigned char *raw; // Scratch for spans with padding or alpha bytes (stdio mode, from the arena)
+    size_t raw_size;
+    AioEngine *aio;       // stdio mode: engine of the overlapped payload reads and writes (NULL = stdio)
+    AioStream *aio_stego; // stdio mode on a plain file: the payload is read ahead (aio.h), NULL = fread
+    AioStream *aio_output; // Output to a plain file: written behind at absolute offsets, NULL = fwrite
+    unsigned char *out_data; // In-memory decode: payload extracted here instead of fptr_output
+    Arena *arena;            // Job memory (arena.h): names and batch buffers, taken back when the job is over
+    unsigned char *carrier_buf; // Batch buffers of extract_stored(), kept for every later batch of the job
+    size_t carrier_buf_size;
+    unsigned char *payload_buf;
+    size_t payload_buf_size;
+
+    ThreadPool *pool; // Workers for chunk-parallel extraction (NULL = serial)
+    int quiet;        // Suppress the INFO progress lines
+    JobMetrics metrics; // Stage timings of this job
+
 } DecodeInfo;
 
 /* Function Prototypes */
@@ -29,20 +84,23 @@ DStatus read_and_validate_decode_args(char *argv[], DecodeInfo *decodeInfo);
 /* Perform Decoding */
 DStatus do_decoding(DecodeInfo *decodeInfo);
 
-/* Skip BMP Header */
-DStatus skip_bmp_header(FILE *fptr_src_image);
+/* Parse the carrier header and move past it to the pixel data */
+DStatus skip_bmp_header(DecodeInfo *decInfo);
 
 /* Decode Magic String */
 DStatus decode_magic_string(DecodeInfo *decodeInfo);
 
+/* Decode the format descriptor, or detect a legacy image */
+DStatus decode_format_descriptor(DecodeInfo *decInfo);
+
 /* Decode secret file extension size */
 DStatus decode_secret_file_extn_size(DecodeInfo *decInfo);
 
 /* Decode secret file extension */
 DStatus decode_secret_file_extn(DecodeInfo *decodeInfo);
 
-/* Open secret file to store decoded data */
-DStatus open_decode_files(DecodeInfo *decInfo);
+/* Append file_extn to output_fname unless it already ends with it */
+DStatus append_extension(DecodeInfo *decInfo, const char *file_extn);
 
 /* Decode secret file size */
 DStatus decode_secret_file_size(DecodeInfo *decodeInfo);
@@ -50,10 +108,7 @@ DStatus decode_secret_file_size(DecodeInfo *decodeInfo);
 /* Decode secret file data */
 DStatus decode_secret_file_data(DecodeInfo *decodeInfo);
 
-/* Decode 1 byte from LSB */
-DStatus decode_byte_from_lsb(char *image_buffer);
-
-/* Decode integer (4 bytes) from LSB */
-DStatus decode_size_from_lsb(char *image_buffer);
+/* Why the data step failed (truncated image, checksum, authentication, output), NULL if none of these */
+const char *decode_failure_reason(const DecodeInfo *decInfo);
 
 #endif
\ No newline at end of file
@@ -1,41 +1,69 @@
+#define _FILE_OFFSET_BITS 64
+#include <stdint.h>
 #include <stdio.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/stat.h>
 #include "encode.h"
+#include "lsb.h"
+#include "bulkcopy.h"
 #include "types.h"
 #include <string.h>
 #include "common.h"
+#include "stream.h"
+#include "metrics.h"
+#include "stego.h"
+#include "scatter.h"
+#include "lz.h"
+#include "aead.h"
+#include "crc32c.h"
+#include "archive.h"
 
 /* Function Definitions */
 
+/* Print an INFO line unless the caller asked for quiet operation */
+static void encode_info(const EncodeInfo *encInfo, const char *fmt, ...)
+{
+    if (encInfo->quiet)
+    {
+        return;
+    }
+    va_list ap;
+    va_start(ap, fmt);
+    vprintf(fmt, ap);
+    va_end(ap);
+}
+
 /* Get image size
  * Input: Image file ptr
- * Output: width * height * bytes per pixel (3 in our case)
- * Description: In BMP Image, width is stored in offset 18,
- * and height after that. size is 4 bytes
+ * Output: usable carrier bytes, the parsed layout in bmp
+ * Description: The carrier format is told by its first bytes. For a BMP
+ * the file and DIB headers give the pixel data offset, bit depth, row
+ * stride and orientation; row padding and alpha bytes are not usable.
+ * PPM/PGM samples follow their text header, a headerless dump is laid
+ * out by carrier->raw. A PNG is decoded row by row from here on (carrier.h).
  */
-uint get_image_size_for_bmp(FILE *fptr_image)
+unsigned long long get_image_size(FILE **fptr_image, Carrier *carrier, BmpInfo *bmp)
 {
-    uint width, height;
-    // Seek to 18th byte
-    fseek(fptr_image, 18, SEEK_SET);
-
-    // Read the width (an int)
-    fread(&width, sizeof(int), 1, fptr_image);
-    printf("width = %u\n", width);
-
-    // Read the height (an int)
-    fread(&height, sizeof(int), 1, fptr_image);
-    printf("height = %u\n", height);
-
+    rewind(*fptr_image);
+    if (carrier_open_read(fptr_image, carrier, bmp) != e_success)
+    {
+        return 0;
+    }
     // Return image capacity
-    return width * height * 3;
+    return bmp->capacity;
 }
-// Find the size of secret file data
-uint get_file_size(FILE *fptr)
+// Find the size of secret file data (64-bit offsets, so files over 4 GB work)
+long long get_file_size(FILE *fptr)
 {
     
-    fseek(fptr, 0, SEEK_END);      // Move to end of file
-    uint size = ftell(fptr);       // Get current file position (end = size)
-    rewind(fptr);                  // Reset to start
+    if (fseeko(fptr, 0, SEEK_END) != 0)   // Move to end of file
+    {
+        return -1;
+    }
+    off_t size = ftello(fptr);            // Get current file position (end = size)
+    rewind(fptr);                         // Reset to start
     return size;
 }
 
@@ -51,19 +79,26 @@ uint get_file_size(FILE *fptr)
 
 Status read_and_validate_encode_args(char *argv[], EncodeInfo *encInfo)
 {
-    //Check if argv[2] has a .bmp file or not 
-    if (strstr(argv[2], ".bmp") != NULL)
+    // The carrier is told by its first bytes, a headerless dump by --raw ("-" streams it from stdin);
+    // a file that cannot be read is left for open_files() to report
+    int in_place;
+    if (is_stream_name(argv[2]) || encInfo->carrier.raw || carrier_file_format(argv[2], &in_place)
+        || access(argv[2], R_OK) != 0)
     {
         encInfo->src_image_fname = argv[2];
     }
     else
     {
-        printf("Invalid : source file must be a .bmp file\n");
+        printf("Invalid : %s is not a BMP, PNG, PPM or PGM image (headerless dumps need --raw)\n", argv[2]);
         return e_failure;
     }
 
-    // Validate secret file (.txt, .c, .sh, .pdf)
-    if (strstr(argv[3], ".txt") != NULL)
+    // Validate secret file (.txt, .c, .sh, .pdf, or an already open "fd:N")
+    if (is_secret_fd_name(argv[3]))
+    {
+        encInfo->secret_fname = argv[3];
+    }
+    else if (strstr(argv[3], ".txt") != NULL)
     {
         encInfo->secret_fname = argv[3];
     }
@@ -85,15 +120,10 @@ Status read_and_validate_encode_args(char *argv[], EncodeInfo *encInfo)
         return e_failure;
     }
 
-    // Validate output stego file (.bmp)
+    // Output stego file, in the format of the carrier whatever its name
     if (argv[4] == NULL)
     {
-        encInfo->stego_image_fname = "default_stego.bmp";
-    }
-    else if (strstr(argv[4], ".bmp") == NULL)
-    {
-        printf("Invalid : output file must be a .bmp file\n");
-        return e_failure;
+        encInfo->stego_image_fname = (char *)carrier_default_output(argv[2], encInfo->carrier.raw);
     }
     else
     {
@@ -139,31 +169,161 @@ Status open_files(EncodeInfo *encInfo)
         fprintf(stderr, "ERROR: Unable to open file %s\n", encInfo->stego_image_fname);
         return e_failure;
     }
+    // A device or a pipe given as the output is never removed
+    struct stat st;
+    encInfo->stego_created = fstat(fileno(encInfo->fptr_stego_image), &st) == 0 && S_ISREG(st.st_mode);
 
     // No failure return e_success
     return e_success;
 }
 
- /* Check if the source image has enough capacity to store:
- *  magic string        → 2 bytes
- *  extn size           → 4 bytes
- *  extn characters     → variable
- *  secret file size    → 4 bytes
- *  secret file data    → n bytes
- * Each byte requires 8 bits → 8 image bytes*/
+/* mmap mode: map source and secret read-only, create the stego image
+ * at the source size and fill it with one bulk copy of the carrier.
+ * The encode_* steps then patch the LSBs in place. */
+Status open_mapped_files(EncodeInfo *encInfo)
+{
+    if (map_file_read(encInfo->src_image_fname, &encInfo->src_map) != e_success)
+    {
+        return e_failure;
+    }
+    if (map_file_read(encInfo->secret_fname, &encInfo->secret_map) != e_success)
+    {
+        close_mapped_files(encInfo);
+        return e_failure;
+    }
+    if (map_file_create(encInfo->stego_image_fname, encInfo->src_map.size, &encInfo->stego_map) != e_success)
+    {
+        close_mapped_files(encInfo);
+        return e_failure;
+    }
+    encInfo->stego_created = 1;
+    // Let the kernel copy (or reflink) the carrier, memcpy whatever it could not
+    encInfo->carrier_copy.bytes = 0;
+    encInfo->carrier_copy.method = "memcpy";
+    kernel_copy_range(encInfo->src_map.fd, 0, encInfo->stego_map.fd, 0,
+                      encInfo->src_map.size, &encInfo->carrier_copy);
+    size_t copied = encInfo->carrier_copy.bytes;
+    if (copied < encInfo->src_map.size)
+    {
+        memcpy(encInfo->stego_map.data + copied, encInfo->src_map.data + copied,
+               encInfo->src_map.size - copied);
+        encInfo->carrier_copy.bytes = encInfo->src_map.size;
+        encInfo->carrier_copy.method = "memcpy";
+    }
+    return e_success;
+}
+
+/* Unmap everything mapped by open_mapped_files() */
+void close_mapped_files(EncodeInfo *encInfo)
+{
+    unmap_file(&encInfo->src_map);
+    unmap_file(&encInfo->secret_map);
+    unmap_file(&encInfo->stego_map);
+}
+
+/*
+ * Carrier bytes needed to store:
+ *  magic string        → 2 bytes, 8 image bytes each
+ *  format descriptor   → 1 byte, 8 image bytes
+ *  flags               → 1 byte   \
+ *  extn size           → 4 bytes   |
+ *  extn characters     → up to 255 | depth bits per image byte,
+ *  secret file size    → 8 bytes   | every field starts on a fresh one
+ *  original size       → 8 bytes   | (compressed payloads only)
+ *  nonce prefix        → 8 bytes   | (encrypted payloads only)
+ *  shard fields        → 32 bytes  | (shards only)
+ *  header checksum     → 4 bytes   |
+ *  secret file data    → n bytes   |
+ *  payload checksum    → 4 bytes  /
+ */
+const char *secret_file_extension(const char *fname)
+{
+    const char *base = strrchr(fname, '/');
+    return strrchr(base ? base + 1 : fname, '.');
+}
+
+unsigned long long stego_required_bytes(unsigned long long secret_size, size_t extn_len, int depth, int flags)
+{
+    // Payload term in 64 bits: secret_size * 8 stays far below overflow for any real file
+    return 8 * (strlen(MAGIC_STRING) + 1)
+           + lsb_carrier_bytes(STEGO_FLAGS_FIELD_BYTES(STEGO_FORMAT_REVISION), depth)
+           + lsb_carrier_bytes(4, depth)
+           + lsb_carrier_bytes(extn_len, depth)
+           + lsb_carrier_bytes(STEGO_SIZE_FIELD_BYTES(STEGO_FORMAT_REVISION), depth)
+           + (flags & STEGO_FLAG_COMPRESSED ? lsb_carrier_bytes(STEGO_RAW_SIZE_FIELD_BYTES, depth) : 0)
+           + (flags & STEGO_FLAG_ENCRYPTED ? lsb_carrier_bytes(STEGO_NONCE_FIELD_BYTES, depth) : 0)
+           // Set ID, offset and secret size, then index and count, each on fresh carrier bytes
+           + (flags & STEGO_FLAG_SHARD ? 3 * lsb_carrier_bytes(8, depth) + 2 * lsb_carrier_bytes(4, depth) : 0)
+           + 2 * lsb_carrier_bytes(STEGO_CHECKSUM_FIELD_BYTES(STEGO_FORMAT_REVISION), depth)
+           + (secret_size * 8 + depth - 1) / depth;
+}
+
+int encode_payload_flags(const EncodeInfo *encInfo)
+{
+    return (encInfo->compress ? STEGO_FLAG_COMPRESSED : 0) | (encInfo->cipher_key ? STEGO_FLAG_ENCRYPTED : 0)
+           | (encInfo->archive ? STEGO_FLAG_ARCHIVE : 0) | (encInfo->shard ? STEGO_FLAG_SHARD : 0);
+}
+
+unsigned long long encode_stored_size(const EncodeInfo *encInfo)
+{
+    return encInfo->cipher_key ? aead_sealed_size(encInfo->size_secret_file) : encInfo->size_secret_file;
+}
+
+/* Check if the source image has enough capacity for stego_required_bytes() */
 
 Status check_capacity(EncodeInfo *encInfo)
 {   
-    //get total image capacity 
-    encInfo->image_capacity = get_image_size_for_bmp(encInfo->fptr_src_image);
-    //get secret file size
-    encInfo->size_secret_file = get_file_size(encInfo->fptr_secret);
+    long long file_size;
+    if (encInfo->use_mmap)
+    {
+        if (carrier_parse(encInfo->src_map.data, encInfo->src_map.size, encInfo->carrier.raw, &encInfo->bmp)
+            != e_success)
+        {
+            printf("ERROR : Unsupported or corrupt carrier header\n");
+            return e_failure;
+        }
+        encInfo->image_capacity = encInfo->bmp.capacity;
+        if (encInfo->packed == NULL)
+            encInfo->size_secret_file = encInfo->secret_map.size;
+        file_size = encInfo->src_map.size;
+    }
+    else
+    {
+        //get total image capacity 
+        encInfo->image_capacity = get_image_size(&encInfo->fptr_src_image, &encInfo->carrier, &encInfo->bmp);
+        if (encInfo->image_capacity == 0)
+        {
+            printf("ERROR : Unsupported or corrupt carrier header\n");
+            return e_failure;
+        }
+        //get secret file size
+        long long secret_size = get_file_size(encInfo->fptr_secret);
+        if (secret_size < 0)
+        {
+            return e_failure;
+        }
+        // A packed secret or an archive was sized by compress_secret()/build_archive()
+        if (encInfo->packed == NULL)
+            encInfo->size_secret_file = secret_size;
+        // Decoded rows are checked as they come, a cut off PNG fails the read
+        file_size = encInfo->bmp.transcoded ? (long long)encInfo->bmp.image_end : get_file_size(encInfo->fptr_src_image);
+    }
+    if (file_size < 0 || encInfo->bmp.image_end > (unsigned long long)file_size)
+    {
+        printf("ERROR : Carrier pixel data is truncated\n");
+        return e_failure;
+    }
+    bmp_cursor_init(&encInfo->bmp, &encInfo->cursor);
     
-    /* capacity = (magic string size(2*8) + secret extn size(4*8) + secret file extn(4*8) + secret file size(4*8) + secret file data size*8; */
-    int capacity = 16 + 32 + 32 + 32 + (encInfo -> size_secret_file * 8);
+    encode_info(encInfo, "INFO : Image %ux%u, %d bpp, %s, capacity = %llu bytes\n", encInfo->bmp.width,
+                encInfo->bmp.height, encInfo->bmp.bpp, encInfo->bmp.top_down ? "top-down" : "bottom-up",
+                encInfo->image_capacity);
+
+    unsigned long long capacity = stego_required_bytes(encode_stored_size(encInfo), strlen(encInfo->extn_secret_file),
+                                                       encInfo->depth, encode_payload_flags(encInfo));
 
     //check if image can store all the data
-    if(encInfo->image_capacity > capacity)
+    if(encInfo->image_capacity >= capacity)
     {
         return e_success;   
     }
@@ -174,242 +334,849 @@ Status check_capacity(EncodeInfo *encInfo)
     }
 }
    
-/* Copy  BMP header into the stego image*/
-Status copy_bmp_header(FILE *fptr_src_image, FILE *fptr_dest_image)
-{
-    // Setting pointer to point to 0th position
-    rewind(fptr_src_image);
-    char header[54];
-    // Reading 54 bytes of header from source.bmp
-    fread(header, 54, 1, fptr_src_image);
-    // Writing the 54 bytes header to destination.bmp
-    fwrite(header, 54, 1, fptr_dest_image);
-    if(ftell(fptr_src_image) == ftell(fptr_dest_image))
+/*
+ * Start the stego image: the BMP header (file header, DIB header, masks,
+ * gaps) is written unchanged, a PNG gets its chunks up to the image data
+ * and the stego image becomes its row encoder
+ */
+Status copy_carrier_header(EncodeInfo *encInfo)
+{
+    // get_file_size() left a BMP at its start, the pixels follow the header read before
+    if (!encInfo->bmp.transcoded && fseeko(encInfo->fptr_src_image, encInfo->bmp.data_offset, SEEK_SET) != 0)
     {
-        return e_success;
+        return e_failure;
+    }
+    return carrier_open_write(&encInfo->carrier, &encInfo->fptr_stego_image);
+}
+
+/*
+ * Fetch the next n usable carrier bytes to be modified.
+ * The file bytes they live in (the span, padding and alpha included) come
+ * from the stego mapping in mmap mode, otherwise from the source image.
+ * When the span is exactly the n bytes they are modified in place,
+ * otherwise they are gathered into buffer.
+ * Returns NULL when the carrier runs out.
+ */
+static unsigned char *get_carrier_bytes(EncodeInfo *encInfo, size_t n, unsigned char *buffer)
+{
+    if (encInfo->cursor.pos + n > encInfo->bmp.capacity)
+    {
+        return NULL;
+    }
+    size_t span = bmp_span(&encInfo->bmp, &encInfo->cursor, n);
+    if (encInfo->use_mmap)
+    {
+        if (encInfo->cursor.file_off + span > encInfo->stego_map.size)
+        {
+            return NULL;
+        }
+        encInfo->span = encInfo->stego_map.data + encInfo->cursor.file_off;
     }
     else
     {
-        return e_failure;
-    }    
+        if (span != n && encInfo->raw_size < span)
+        {
+            // The old scratch is simply left to the arena
+            unsigned char *raw = arena_alloc(encInfo->arena, span);
+            if (raw == NULL)
+            {
+                return NULL;
+            }
+            encInfo->raw = raw;
+            encInfo->raw_size = span;
+        }
+        encInfo->span = span == n ? buffer : encInfo->raw;
+        if (encInfo->aio_src ? aio_read(encInfo->aio_src, encInfo->span, span) != e_success
+                             : fread(encInfo->span, 1, span, encInfo->fptr_src_image) != span)
+        {
+            return NULL;
+        }
+    }
+    if (span == n)
+    {
+        return encInfo->span;
+    }
+    bmp_gather(&encInfo->bmp, &encInfo->cursor, encInfo->span, n, buffer);
+    return buffer;
 }
 
-/* Encode  byte → into LSBs image bytes*/
-Status encode_byte_to_lsb(char data, char *image_buffer)
+/* Write back carrier bytes obtained from get_carrier_bytes() and move past them */
+static Status put_carrier_bytes(EncodeInfo *encInfo, const unsigned char *bytes, size_t n)
 {
-    for (int i = 0; i < 8; i++)
+    size_t span = bmp_span(&encInfo->bmp, &encInfo->cursor, n);
+    if (bytes != encInfo->span)
     {
-        image_buffer[i] &= 0xFE;                   // clear LSB
-        image_buffer[i] |= ((data >> (7 - i)) & 1); // set bit
+        bmp_scatter(&encInfo->bmp, &encInfo->cursor, encInfo->span, n, bytes);
     }
-    return e_success;
+    bmp_advance(&encInfo->bmp, &encInfo->cursor, n);
+    if (encInfo->use_mmap)
+    {
+        return e_success;
+    }
+    if (encInfo->aio_stego)
+    {
+        return aio_write(encInfo->aio_stego, encInfo->span, span);
+    }
+    return fwrite(encInfo->span, 1, span, encInfo->fptr_stego_image) == span ? e_success : e_failure;
+}
+
+/* Encode n bytes at the given depth, starting on a fresh carrier byte, and add them to the header checksum */
+static Status encode_bytes(const unsigned char *data, size_t n, int depth, EncodeInfo *encInfo)
+{
+    unsigned char buffer[64];
+    size_t len = lsb_carrier_bytes(n, depth);
+    // Only a long extension outgrows the stack
+    unsigned char *dest = len > sizeof(buffer) ? arena_alloc(encInfo->arena, len) : buffer;
+    if (dest == NULL)
+    {
+        return e_failure;
+    }
+    unsigned char *imageBuffer = get_carrier_bytes(encInfo, len, dest);
+    if (imageBuffer == NULL)
+    {
+        return e_failure;
+    }
+    lsb_embed_block(data, n, imageBuffer, depth);
+    encInfo->header_crc = crc32c_update(encInfo->header_crc, data, n);
+    return put_carrier_bytes(encInfo, imageBuffer, len);
 }
-/** Encode 32-bit integer → into LSBs of 32 image bytes*/
-Status encode_size_to_lsb(int size, char *imageBuffer)
+
+/* Encode an unsigned field of nbytes (4 or 8), MSB first */
+static Status encode_int_field(unsigned long long value, int nbytes, EncodeInfo *encInfo)
 {
-    for (int i = 0; i < 32; i++)
+    unsigned char bytes[8];
+    for (int i = 0; i < nbytes; i++)
     {
-        imageBuffer[i] &= 0xFE;
-        imageBuffer[i] |= ((size >> (31 - i)) & 1);
+        bytes[i] = value >> (8 * (nbytes - 1 - i));
     }
-    return e_success;
+    return encode_bytes(bytes, nbytes, encInfo->depth, encInfo);
 }
+
 /*Encode magic string like "#*" for validation during decoding*/
 Status encode_magic_string(const char *magic_string, EncodeInfo *encInfo)
 {
-    char imageBuffer[8];
-    for (int i = 0; i < strlen(magic_string); i++)
+    // The first field: both checksums start here
+    encInfo->header_crc = 0;
+    encInfo->payload_crc = 0;
+    // Always one bit per byte, the decoder does not know the depth yet
+    return encode_bytes((const unsigned char *)magic_string, strlen(magic_string), 1, encInfo);
+}
+/*Encode the format descriptor, also at one bit per byte*/
+Status encode_format_descriptor(EncodeInfo *encInfo)
+{
+    unsigned char desc = STEGO_DESCRIPTOR(encInfo->depth) | (encInfo->key ? STEGO_FLAG_KEYED : 0);
+    if (encode_bytes(&desc, 1, 1, encInfo) != e_success)
     {
-        fread(imageBuffer, 8, 1, encInfo->fptr_src_image);
-        encode_byte_to_lsb(magic_string[i], imageBuffer);
-        fwrite(imageBuffer, 8, 1, encInfo->fptr_stego_image);
+        return e_failure;
     }
-    return e_success;
+    // The flags byte is already at the payload depth
+    unsigned char flags = encode_payload_flags(encInfo);
+    return encode_bytes(&flags, 1, encInfo->depth, encInfo);
 }
 /*Encode secret file extension size*/
 Status encode_secret_file_extn_size(int size, EncodeInfo *encInfo)
 {
-    char imageBuffer[32];
-    fread(imageBuffer, 32, 1, encInfo->fptr_src_image);
-    encode_size_to_lsb(size, imageBuffer);
-    fwrite(imageBuffer, 32, 1, encInfo->fptr_stego_image);
-    return e_success;
+    return encode_int_field(size, 4, encInfo);
 }
 /*Encode file extension characters*/
 Status encode_secret_file_extn(const char *file_extn, EncodeInfo *encInfo)
 {
-    char imageBuffer[8];
-    for(int i=0; i<strlen(file_extn); i++)
+    return encode_bytes((const unsigned char *)file_extn, strlen(file_extn), encInfo->depth, encInfo);
+}
+/*
+ * Encode secret file size, 64 bits (the sealed size with --encrypt), the
+ * original size of a packed secret, the nonce prefix of a sealed one and
+ * the place of a shard, then close the fields with their checksum
+ */
+Status encode_secret_file_size(unsigned long long file_size, EncodeInfo *encInfo)
+{
+    unsigned long long stored = encInfo->cipher_key ? aead_sealed_size(file_size) : file_size;
+    if (encode_int_field(stored, STEGO_SIZE_FIELD_BYTES(STEGO_FORMAT_REVISION), encInfo) != e_success)
+    {
+        return e_failure;
+    }
+    if (encInfo->compress
+        && encode_int_field(encInfo->size_unpacked, STEGO_RAW_SIZE_FIELD_BYTES, encInfo) != e_success)
+    {
+        return e_failure;
+    }
+    if (encInfo->cipher_key)
+    {
+        // Every payload gets a fresh prefix, so a key can be used again
+        memcpy(encInfo->aead.key, encInfo->cipher_key, AEAD_KEY_BYTES);
+        encInfo->segment = 0;
+        encInfo->sealed_carry = 0;
+        if (aead_new_prefix(encInfo->aead.prefix) != e_success
+            || encode_bytes(encInfo->aead.prefix, STEGO_NONCE_FIELD_BYTES, encInfo->depth, encInfo) != e_success)
+        {
+            return e_failure;
+        }
+    }
+    const StegoShard *shard = encInfo->shard;
+    if (shard
+        && (encode_int_field(shard->set_id, 8, encInfo) != e_success || encode_int_field(shard->index, 4, encInfo) != e_success
+            || encode_int_field(shard->count, 4, encInfo) != e_success
+            || encode_int_field(shard->offset, 8, encInfo) != e_success
+            || encode_int_field(shard->total, 8, encInfo) != e_success))
+    {
+        return e_failure;
+    }
+    return encode_int_field(encInfo->header_crc, STEGO_CHECKSUM_FIELD_BYTES(STEGO_FORMAT_REVISION), encInfo);
+}
+
+/*
+ * -z: the stored size goes in front of the data, so the whole secret is
+ * packed before anything is embedded (the blocks in parallel on the pool).
+ * A secret that does not shrink is embedded as it is.
+ */
+Status compress_secret(EncodeInfo *encInfo)
+{
+    unsigned char *secret = encInfo->use_mmap ? encInfo->secret_map.data : NULL;
+    unsigned long long size = encInfo->secret_map.size;
+
+    if (!encInfo->use_mmap)
+    {
+        long long file_size = get_file_size(encInfo->fptr_secret);
+        if (file_size < 0 || (unsigned long long)file_size > SIZE_MAX)
+        {
+            return e_failure;
+        }
+        size = file_size;
+        secret = malloc(size ? size : 1);
+        if (secret == NULL || fread(secret, 1, size, encInfo->fptr_secret) != size)
+        {
+            free(secret);
+            return e_failure;
+        }
+    }
+    encInfo->size_unpacked = size;
+    encInfo->size_secret_file = size;
+    encInfo->packed = lz_pack_bound(size) < SIZE_MAX ? malloc(lz_pack_bound(size) + 1) : NULL;
+    if (encInfo->packed == NULL)
+    {
+        if (!encInfo->use_mmap)
+            free(secret);
+        return e_failure;
+    }
+
+    size_t packed_size = lz_pack(encInfo->pool, secret, size, encInfo->packed);
+    if (!encInfo->use_mmap)
+        free(secret);
+    if (packed_size >= size)
+    {
+        free(encInfo->packed);
+        encInfo->packed = NULL;
+        encInfo->compress = 0;
+        return e_success;
+    }
+    encInfo->size_secret_file = packed_size;
+    return e_success;
+}
+
+Status build_archive(EncodeInfo *encInfo)
+{
+    char **paths = malloc((encInfo->archive_count + 1) * sizeof(*paths));
+    if (paths == NULL)
+    {
+        return e_failure;
+    }
+    paths[0] = encInfo->secret_fname;
+    memcpy(paths + 1, encInfo->archive_files, encInfo->archive_count * sizeof(*paths));
+    Status status = archive_build(encInfo->pool, paths, encInfo->archive_count + 1, encInfo->compress,
+                                  &encInfo->packed, &encInfo->size_secret_file);
+    free(paths);
+    // Members are packed one by one, the archive as a whole is not
+    encInfo->size_unpacked = encInfo->size_secret_file;
+    encInfo->compress = 0;
+    encInfo->archive = 1;
+    return status;
+}
+
+/* Embed one block of secret data into the next carrier bytes */
+Status encode_data_block(EncodeInfo *encInfo, const unsigned char *secret, size_t n, unsigned char *imageBuffer)
+{
+    size_t len = lsb_carrier_bytes(n, encInfo->depth);
+    unsigned char *carrier = get_carrier_bytes(encInfo, len, imageBuffer);
+    if (carrier == NULL)
+    {
+        return e_failure;
+    }
+    lsb_embed_parallel_crc(encInfo->pool, secret, n, carrier, encInfo->depth, &encInfo->payload_crc);
+    return put_carrier_bytes(encInfo, carrier, len);
+}
+
+size_t encode_batch_bytes(const EncodeInfo *encInfo)
+{
+    // One chunk (or segment) per worker at a time so the whole pool has work
+    size_t workers = encInfo->pool ? pool_size(encInfo->pool) : 1;
+    return (encInfo->cipher_key ? AEAD_SEGMENT : lsb_chunk_bytes(encInfo->depth)) * workers;
+}
+
+/* Sealed bytes one batch can leave for the carrier, the carry in front included */
+static size_t sealed_batch_bytes(const EncodeInfo *encInfo)
+{
+    return aead_sealed_size(encode_batch_bytes(encInfo)) + 2;
+}
+
+size_t encode_scratch_bytes(const EncodeInfo *encInfo)
+{
+    if (!encInfo->cipher_key)
+    {
+        return lsb_carrier_bytes(encode_batch_bytes(encInfo), encInfo->depth);
+    }
+    // The carrier buffer, then the sealed bytes waiting for it
+    return lsb_carrier_bytes(sealed_batch_bytes(encInfo), encInfo->depth) + sealed_batch_bytes(encInfo);
+}
+
+/* --encrypt: seal n payload bytes and embed what fills whole carrier bytes */
+static Status seal_payload_block(EncodeInfo *encInfo, const unsigned char *chunk, size_t n, int last, unsigned char *scratch)
+{
+    unsigned char *sealed = scratch + lsb_carrier_bytes(sealed_batch_bytes(encInfo), encInfo->depth);
+    aead_seal(encInfo->pool, &encInfo->aead, encInfo->segment, chunk, n, last, sealed + encInfo->sealed_carry);
+    encInfo->segment += n / AEAD_SEGMENT;
+
+    // Segments do not fill whole carrier bytes at depth 3 (3 payload bytes
+    // to 8 carrier bytes): the odd sealed bytes wait for the next block
+    size_t total = encInfo->sealed_carry + aead_sealed_size(n);
+    size_t unit = encInfo->depth == 3 ? 3 : 1;
+    size_t embed = last ? total : total - total % unit;
+    if (encode_data_block(encInfo, sealed, embed, scratch) != e_success)
     {
-        fread(imageBuffer,8 ,1, encInfo->fptr_src_image);
-        encode_byte_to_lsb(file_extn[i],imageBuffer);
-        fwrite(imageBuffer,8 ,1 ,encInfo->fptr_stego_image);
+        return e_failure;
     }
+    memmove(sealed, sealed + embed, total - embed);
+    encInfo->sealed_carry = total - embed;
     return e_success;
 }
-/*Encode secret file size*/
-Status encode_secret_file_size(long file_size, EncodeInfo *encInfo)
+
+Status encode_payload_block(EncodeInfo *encInfo, const unsigned char *chunk, size_t n, int last, unsigned char *scratch)
+{
+    Status status = encInfo->cipher_key ? seal_payload_block(encInfo, chunk, n, last, scratch)
+                    : n                 ? encode_data_block(encInfo, chunk, n, scratch)
+                                        : e_success;
+    // The payload checksum follows the last stored byte
+    if (status == e_success && last)
+    {
+        status = encode_int_field(encInfo->payload_crc, STEGO_CHECKSUM_FIELD_BYTES(STEGO_FORMAT_REVISION), encInfo);
+    }
+    return status;
+}
+
+/*
+ * Keyed mode: the carrier bytes of the payload are spread over everything
+ * after the fields, which takes random access to the stego mapping
+ */
+static Status encode_scattered(EncodeInfo *encInfo)
 {
-    char imageBuffer[32];
-    fread(imageBuffer, 32, 1,encInfo->fptr_src_image);
-    encode_size_to_lsb(file_size, imageBuffer);
-    fwrite(imageBuffer,32 ,1 ,encInfo->fptr_stego_image);
+    ScatterMap map;
+    const unsigned char *payload = encInfo->packed ? encInfo->packed : encInfo->secret_map.data;
+    unsigned long long stored = encode_stored_size(encInfo);
+    unsigned char *sealed = NULL;
+    if (!encInfo->use_mmap || stored > SIZE_MAX)
+    {
+        return e_failure;
+    }
+    // Scattering needs the whole stored payload, so it is sealed in one go
+    if (encInfo->cipher_key)
+    {
+        if ((sealed = malloc(stored)) == NULL)
+        {
+            return e_failure;
+        }
+        aead_seal(encInfo->pool, &encInfo->aead, 0, payload, encInfo->size_secret_file, 1, sealed);
+        payload = sealed;
+    }
+    // The payload checksum goes in front of the scattered area, its end is not a fixed place
+    encInfo->payload_crc = crc32c_update(0, payload, stored);
+    if (encode_int_field(encInfo->payload_crc, STEGO_CHECKSUM_FIELD_BYTES(STEGO_FORMAT_REVISION), encInfo) != e_success)
+    {
+        free(sealed);
+        return e_failure;
+    }
+    scatter_init(&map, encInfo->key, encInfo->bmp.capacity - encInfo->cursor.pos);
+    scatter_embed(encInfo->pool, &map, &encInfo->bmp, encInfo->cursor.pos, payload, stored,
+                  encInfo->stego_map.data, encInfo->depth);
+    free(sealed);
     return e_success;
 }
-/*Encode secret file data byte-by-byte*/
+
+/*
+ * Move the payload blocks of a plain file carrier onto overlapped I/O: the
+ * carrier (and the secret) are read ahead and the stego image is written
+ * behind, several AIO_BLOCK requests in flight, so embedding one batch
+ * overlaps reading the next and writing the last. The carrier is read up
+ * to the end of the payload, the tail is copied by copy_remaining_img_data().
+ * Pipes and decoded rows stay on stdio, as does everything when no engine
+ * starts.
+ */
+static void start_overlapped_io(EncodeInfo *encInfo, int in_memory)
+{
+    if (encInfo->bmp.transcoded || !aio_file_ok(encInfo->fptr_src_image) || !aio_file_ok(encInfo->fptr_stego_image)
+        || fflush(encInfo->fptr_stego_image) != 0)
+    {
+        return;
+    }
+    off_t src_pos = ftello(encInfo->fptr_src_image);
+    off_t dest_pos = ftello(encInfo->fptr_stego_image);
+    if (src_pos < 0 || dest_pos < 0 || (encInfo->aio = aio_create()) == NULL)
+    {
+        return;
+    }
+    // Usable bytes still to come: the stored payload and its checksum, with room to spare
+    unsigned long long left = lsb_carrier_bytes(encode_stored_size(encInfo) + 64, encInfo->depth);
+    unsigned long long end = encInfo->cursor.pos + left < encInfo->bmp.capacity
+                                 ? bmp_offset(&encInfo->bmp, encInfo->cursor.pos + left - 1) + 1
+                                 : encInfo->bmp.image_end;
+    encInfo->aio_src = aio_reader(encInfo->aio, fileno(encInfo->fptr_src_image), src_pos, end);
+    encInfo->aio_stego = aio_writer(encInfo->aio, fileno(encInfo->fptr_stego_image), dest_pos);
+    if (!in_memory && aio_file_ok(encInfo->fptr_secret))
+    {
+        encInfo->aio_secret = aio_reader(encInfo->aio, fileno(encInfo->fptr_secret), 0, encInfo->size_secret_file);
+    }
+    if (encInfo->aio_src == NULL || encInfo->aio_stego == NULL)
+    {
+        aio_close(encInfo->aio_src);
+        aio_close(encInfo->aio_stego);
+        aio_close(encInfo->aio_secret);
+        aio_destroy(encInfo->aio);
+        encInfo->aio_src = encInfo->aio_stego = encInfo->aio_secret = NULL;
+        encInfo->aio = NULL;
+        return;
+    }
+    encode_info(encInfo, "INFO : Payload I/O overlapped (%s, %d x %d KiB in flight)\n", aio_engine_name(encInfo->aio),
+                AIO_SLOTS, AIO_BLOCK / 1024);
+}
+
+/* Wait for the overlapped writes and hand the files back to stdio where the payload ended */
+static Status finish_overlapped_io(EncodeInfo *encInfo)
+{
+    Status status = e_success;
+    if (encInfo->aio == NULL)
+    {
+        return e_success;
+    }
+    off_t src_pos = aio_offset(encInfo->aio_src);
+    off_t dest_pos = aio_offset(encInfo->aio_stego);
+    aio_close(encInfo->aio_src);
+    aio_close(encInfo->aio_secret);
+    if (aio_close(encInfo->aio_stego) != e_success
+        || fseeko(encInfo->fptr_src_image, src_pos, SEEK_SET) != 0
+        || fseeko(encInfo->fptr_stego_image, dest_pos, SEEK_SET) != 0)
+    {
+        status = e_failure;
+    }
+    aio_destroy(encInfo->aio);
+    encInfo->aio_src = encInfo->aio_stego = encInfo->aio_secret = NULL;
+    encInfo->aio = NULL;
+    return status;
+}
+
+/*Encode secret file data in encode_batch_bytes() blocks*/
 Status encode_secret_file_data(EncodeInfo *encInfo)
 {
-    if(!encInfo || !encInfo->fptr_secret || !encInfo->fptr_src_image || !encInfo->fptr_stego_image)
+    if (!encInfo || (!encInfo->use_mmap && (!encInfo->fptr_secret || !encInfo->fptr_src_image || !encInfo->fptr_stego_image)))
+    {
+        return e_failure;
+    }
+    if (encInfo->key)
+    {
+        return encode_scattered(encInfo);
+    }
+    // A packed secret or an archive, or the secret in mmap mode, is embedded straight from memory
+    // (an empty mapping has no address, so the mode decides, not the pointer)
+    int in_memory = encInfo->packed || encInfo->use_mmap;
+    const unsigned char *source = encInfo->packed ? encInfo->packed : encInfo->secret_map.data;
+    if (!in_memory)
+    {
+        rewind(encInfo->fptr_secret);
+    }
+
+    size_t batch = encode_batch_bytes(encInfo);
+    // In mmap mode the carrier buffer is only touched for spans with padding or alpha bytes
+    unsigned char *secret = in_memory ? NULL : arena_alloc(encInfo->arena, batch);
+    unsigned char *scratch = arena_alloc(encInfo->arena, encode_scratch_bytes(encInfo));
+    if ((secret == NULL && !in_memory) || scratch == NULL)
     {
         return e_failure;
     }
-   
-    rewind(encInfo->fptr_secret);
 
-    int byte_read;
-    char imageBuffer[8];
+    Status status = e_success;
+    unsigned long long done = 0;
+    if (!encInfo->use_mmap)
+    {
+        start_overlapped_io(encInfo, in_memory);
+    }
 
-    // Read secret file one byte at a time to avoid large memory use
-    while(fread(&byte_read, 1, 1, encInfo->fptr_secret) == 1)
+    // One block call per chunk embeds the secret into 8/depth times as many image bytes
+    // (an empty secret still makes one call, a sealed payload always has a tag)
+    do
     {
-        if(fread(imageBuffer, 8, 1, encInfo->fptr_src_image) != 1)
+        size_t n = encInfo->size_secret_file - done < batch ? encInfo->size_secret_file - done : batch;
+        const unsigned char *chunk = in_memory ? source + done : secret;
+        if (!in_memory && (encInfo->aio_secret ? aio_read(encInfo->aio_secret, secret, n) != e_success
+                                               : fread(secret, 1, n, encInfo->fptr_secret) != n))
         {
-            return e_failure; 
+            status = e_failure;
+            break;
         }
-        encode_byte_to_lsb((char)byte_read, imageBuffer);
+        done += n;
+        status = encode_payload_block(encInfo, chunk, n, done == encInfo->size_secret_file, scratch);
+    } while (status == e_success && done < encInfo->size_secret_file);
+    if (finish_overlapped_io(encInfo) != e_success)
+    {
+        status = e_failure;
+    }
+    return status;
+}
+/*
+ * Copy leftover image data after encoding.
+ * The untouched pixels are usually more than 99% of the image, so they
+ * are copied inside the kernel where possible and in 1 MiB blocks otherwise.
+ * Transcoded carriers (no descriptor behind their rows) always take the
+ * blocks. res reports how many bytes were copied and by which method.
+ */
+Status copy_remaining_img_data(FILE *fptr_src, FILE *fptr_dest, CopyResult *res)
+{
+    res->bytes = 0;
+    res->method = "buffered";
 
-        if (fwrite(imageBuffer, 8, 1, encInfo->fptr_stego_image) != 1)
+    if (fileno(fptr_src) >= 0 && fileno(fptr_dest) >= 0)
+    {
+        // Everything written so far must reach the file before the kernel appends to it
+        if (fflush(fptr_dest) != 0)
+        {
+            return e_failure;
+        }
+        off_t src_pos = ftello(fptr_src);
+        off_t dest_pos = ftello(fptr_dest);
+        fseeko(fptr_src, 0, SEEK_END);
+        off_t len = ftello(fptr_src) - src_pos;
+        if (src_pos < 0 || dest_pos < 0 || len < 0)
         {
-            return e_failure; 
+            return e_failure;
         }
-            
+
+        if (kernel_copy_range(fileno(fptr_src), src_pos, fileno(fptr_dest), dest_pos, len, res) == e_success
+            && res->bytes == (unsigned long long)len)
+        {
+            fseeko(fptr_dest, 0, SEEK_END);
+            return e_success;
+        }
+
+        // Finish whatever the kernel did not copy with large buffered blocks
+        fseeko(fptr_src, src_pos + res->bytes, SEEK_SET);
+        fseeko(fptr_dest, dest_pos + res->bytes, SEEK_SET);
+    }
+    char *buffer = malloc(1024 * 1024);
+    if (buffer == NULL)
+    {
+        return e_failure;
+    }
+    size_t n;
+    Status status = e_success;
+    while ((n = fread(buffer, 1, 1024 * 1024, fptr_src)) > 0)
+    {
+        if (fwrite(buffer, 1, n, fptr_dest) != n)
+        {
+            status = e_failure;
+            break;
+        }
+        res->bytes += n;
+        res->method = "buffered";
+    }
+    if (ferror(fptr_src))
+        status = e_failure;
+    free(buffer);
+    return status;
+}
+
+/*
+ * Close whatever open_files()/open_mapped_files() managed to open.
+ * Closing a PNG stego image finishes it, so that one is checked.
+ */
+Status close_encode_files(EncodeInfo *encInfo)
+{
+    Status status = e_success;
+    // The raw scratch went back with the arena
+    encInfo->raw = NULL;
+    encInfo->raw_size = 0;
+    free(encInfo->packed);
+    encInfo->packed = NULL;
+    if (encInfo->use_mmap)
+    {
+        close_mapped_files(encInfo);
+        return e_success;
+    }
+    if (encInfo->fptr_src_image)
+        fclose(encInfo->fptr_src_image);
+    if (encInfo->fptr_secret)
+        fclose(encInfo->fptr_secret);
+    if (encInfo->fptr_stego_image && fclose(encInfo->fptr_stego_image) != 0)
+        status = e_failure;
+    encInfo->fptr_src_image = NULL;
+    encInfo->fptr_secret = NULL;
+    encInfo->fptr_stego_image = NULL;
+    carrier_close(&encInfo->carrier);
+    return status;
+}
+
+/* Close everything after a failed stage, drop the unfinished output and record the failure */
+static Status encode_failed(EncodeInfo *encInfo)
+{
+    close_encode_files(encInfo);
+    // Up to the payload the output is only a copy of the carrier: it must not pass for a stego image
+    if (encInfo->stego_created)
+    {
+        remove(encInfo->stego_image_fname);
+        encInfo->stego_created = 0;
+    }
+    metrics_job_end(&encInfo->metrics, 0);
+    return e_failure;
+}
+
+/*
+ * mmap mode: the stego mapping already holds a copy of the carrier, so the
+ * library API embeds into it in place, the same as for any caller's buffer
+ */
+static Status encode_mapped(EncodeInfo *encInfo)
+{
+    StegoView carrier = {encInfo->stego_map.data, encInfo->stego_map.size};
+    StegoView payload = {encInfo->secret_map.data, encInfo->secret_map.size};
+    StegoBuffer out = {encInfo->stego_map.data, 0, encInfo->stego_map.size};
+    StegoOptions opts = {encInfo->depth, encInfo->extn_secret_file, encInfo->pool, &encInfo->metrics, encInfo->key,
+                         encInfo->compress, encInfo->cipher_key, encInfo->archive, NULL, encInfo->arena};
+
+    // An archive is laid out before the library sees it
+    if (encInfo->archive)
+    {
+        payload.data = encInfo->packed;
+        payload.size = encInfo->size_secret_file;
     }
 
+    StegoStatus status = stego_encode(&carrier, &payload, &out, &opts);
+    if (status != STEGO_OK)
+    {
+        printf("ERROR : %s\n", stego_status_string(status));
+        return encode_failed(encInfo);
+    }
+    stage_begin(&encInfo->metrics);
+    close_encode_files(encInfo);
+    stage_end(&encInfo->metrics, STAGE_CLOSE, 0);
+    metrics_job_end(&encInfo->metrics, 1);
     return e_success;
 }
-/*Copy leftover image data after encoding*/
-Status copy_remaining_img_data(FILE *fptr_src, FILE *fptr_dest)
+
+/* -a: build the archive payload, timed as the codec stage */
+static Status encode_archive_members(EncodeInfo *encInfo)
 {
-    char ch;
-    while(fread(&ch, 1, 1, fptr_src) > 0)
+    int compress = encInfo->compress;
+    stage_begin(&encInfo->metrics);
+    if (build_archive(encInfo) != e_success)
     {
-        fwrite(&ch, 1, 1, fptr_dest);
+        printf("ERROR : Failed to build the archive\n");
+        return e_failure;
     }
+    stage_end(&encInfo->metrics, STAGE_CODEC, encInfo->size_secret_file);
+    encode_info(encInfo, "INFO : Archive of %d files%s, %llu bytes\n", encInfo->archive_count + 1,
+                compress ? " (members packed)" : "", encInfo->size_secret_file);
     return e_success;
 }
 
 /*The main encoding controller function*/
 Status do_encoding(EncodeInfo *encInfo)
 {
-    printf("INFO: Opening required files\n");
-    /* Open source image, secret file, and create stego output file */
-    if (open_files(encInfo) == e_success)
+    JobMetrics *m = &encInfo->metrics;
+
+    if (encInfo->depth < LSB_MIN_DEPTH || encInfo->depth > LSB_MAX_DEPTH)
     {
-        // get the actual size of secret.txt
-        encInfo->size_secret_file = get_file_size(encInfo->fptr_secret);
-        printf("INFO : Opened SkeletonCode/extension file \n");
-        printf("INFO : Done\n");
+        printf("ERROR : Depth must be %d to %d bits per byte\n", LSB_MIN_DEPTH, LSB_MAX_DEPTH);
+        return e_failure;
     }
-    else
+    // A descriptor has no name to map, seek or size by: the pipeline encoder reads it front to back
+    // and records --extn (.bin by default), whatever the carrier and the output are
+    if (is_secret_fd_name(encInfo->secret_fname))
     {
-        printf("ERROR: Failed to Open files \n");
+        if (encInfo->use_mmap || encInfo->key || encInfo->compress || encInfo->archive_count)
+        {
+            printf("ERROR : -m, --key, -z and -a need the secret in a file, not fd:N\n");
+            return e_failure;
+        }
+        return do_stream_encoding(encInfo);
+    }
+    // Transcoded carriers are read front to back only: nothing to map, and archive members are read back by seeking
+    int in_place;
+    const char *format = carrier_file_format(encInfo->src_image_fname, &in_place);
+    // Mapped carriers go through the library, which tells the format by its header
+    if (encInfo->carrier.raw && encInfo->use_mmap)
+    {
+        printf("ERROR : Headerless dumps are read front to back, -m and --key need a BMP, PPM or PGM\n");
         return e_failure;
     }
-    /* Check if image has enough capacity to encode all required data */
-    printf("INFO : ##---Encoding Procedure Started---##\n");
-    printf("INFO : Checking for SkeletonCode/.ext file capacity to handle secret.txt\n");
-    if (check_capacity(encInfo) == e_success)
+    if (!encInfo->carrier.raw && format && !in_place && (encInfo->use_mmap || encInfo->archive_count))
     {
-        printf("INFO : Done. Found OK\n");
+        printf("ERROR : %s carriers are decoded row by row, -m, --key and -a need a BMP, PPM or PGM\n", format);
+        return e_failure;
     }
-    else
+    /*Extract the extension from secret file*/
+    // Extract extension (from the file name, so directories with dots are fine); archives record none
+    const char *extn = encInfo->archive_count ? "" : secret_file_extension(encInfo->secret_fname);
+    if (extn == NULL || !stego_extn_ok(extn))
     {
-        printf("ERROR : Image cannot hold secret data\n");
+        printf("ERROR : Unsupported secret file extension\n");
         return e_failure;
     }
-    /* Copy the 54-byte BMP header unchanged to the stego image */
-    printf("INFO : Copying Image Header\n"); 
-    if (copy_bmp_header(encInfo->fptr_src_image, encInfo->fptr_stego_image) == e_success)
+    encInfo->extn_secret_file = extn;
+    metrics_job_begin(m, METRICS_ENCODE, encInfo->quiet);
+    encode_info(encInfo, "INFO : ## Encoding %s into %s (%s kernel, %s crc32c, %d bit depth) ##\n",
+                encInfo->secret_fname, encInfo->src_image_fname, lsb_kernel_name(), crc32c_kernel_name(), encInfo->depth);
+
+    /* Open source image, secret file, and create stego output file */
+    stage_begin(m);
+    if (encInfo->use_mmap)
     {
-        printf("INFO : Done\n");
+        if (open_mapped_files(encInfo) != e_success)
+        {
+            printf("ERROR: Failed to map files \n");
+            metrics_job_end(m, 0);
+            return e_failure;
+        }
+        encInfo->size_secret_file = encInfo->secret_map.size;
+        stage_end(m, STAGE_OPEN, encInfo->carrier_copy.bytes);
+        encode_info(encInfo, "INFO : Mapped files, carrier copied in one pass (%s)\n", encInfo->carrier_copy.method);
+        if (encInfo->archive_count && encode_archive_members(encInfo) != e_success)
+        {
+            return encode_failed(encInfo);
+        }
+        if (encInfo->cipher_key)
+            encode_info(encInfo, "INFO : Payload sealed with ChaCha20-Poly1305 (%s kernel)\n", aead_kernel_name());
+        return encode_mapped(encInfo);
     }
-    else
+    else if (open_files(encInfo) != e_success)
     {
-        printf("ERROR : Failed to copy bmp header\n");
-        return e_failure;
+        printf("ERROR: Failed to Open files \n");
+        return encode_failed(encInfo);
     }
-    /*Encode magic string ("#*") into image*/
-    printf("INFO : Encoding Magic String Signature\n"); 
-    if (encode_magic_string(MAGIC_STRING, encInfo) == e_success)
+    stage_end(m, STAGE_OPEN, 0);
+
+    /* Lay the archive out or pack the secret first, the capacity check needs the stored size */
+    if (encInfo->archive_count)
     {
-        printf("INFO : Done\n");
+        if (encode_archive_members(encInfo) != e_success)
+        {
+            return encode_failed(encInfo);
+        }
     }
-    else
+    else if (encInfo->compress)
+    {
+        stage_begin(m);
+        if (compress_secret(encInfo) != e_success)
+        {
+            printf("ERROR : Failed to compress secret file\n");
+            return encode_failed(encInfo);
+        }
+        stage_end(m, STAGE_CODEC, encInfo->size_unpacked);
+        encode_info(encInfo, encInfo->packed ? "INFO : Secret packed from %llu to %llu bytes\n"
+                                             : "INFO : Secret does not compress, stored as is\n",
+                    encInfo->size_unpacked, encInfo->size_secret_file);
+    }
+
+    /* Check if image has enough capacity to encode all required data */
+    stage_begin(m);
+    if (check_capacity(encInfo) != e_success)
+    {
+        printf("ERROR : Image cannot hold secret data\n");
+        return encode_failed(encInfo);
+    }
+    stage_end(m, STAGE_PARSE, 0);
+    if (encInfo->cipher_key)
+        encode_info(encInfo, "INFO : Payload sealed with ChaCha20-Poly1305 (%s kernel), %llu bytes stored\n",
+                    aead_kernel_name(), encode_stored_size(encInfo));
+
+    /* Copy the carrier header (everything before the pixels) unchanged to the stego image */
+    stage_begin(m);
+    if (copy_carrier_header(encInfo) != e_success)
+    {
+        printf("ERROR : Failed to copy carrier header\n");
+        return encode_failed(encInfo);
+    }
+    stage_end(m, STAGE_HEADER_COPY, encInfo->bmp.data_offset);
+
+    /*Encode magic string ("#*") into image*/
+    stage_begin(m);
+    if (encode_magic_string(MAGIC_STRING, encInfo) != e_success)
     {
         printf("ERROR : Failed to encode magic string\n");
-        return e_failure;
+        return encode_failed(encInfo);
     }
-    /*Extract the extension from secret file*/
-    printf("INFO : Encoding secret.txt File Extenstion Size\n"); 
-    // Extract extension
-    strcpy(encInfo->extn_secret_file, strstr(encInfo->secret_fname, "."));
-    if (encode_secret_file_extn_size(strlen(encInfo->extn_secret_file), encInfo) == e_success)
+    stage_end(m, STAGE_MAGIC, strlen(MAGIC_STRING));
+
+    /*Encode format descriptor (revision + depth)*/
+    stage_begin(m);
+    if (encode_format_descriptor(encInfo) != e_success)
     {
-        printf("INFO : Done\n");
+        printf("ERROR : Failed to encode format descriptor\n");
+        return encode_failed(encInfo);
     }
-    else
+    stage_end(m, STAGE_DESCRIPTOR, 1);
+
+    /*Encode the extension size*/
+    stage_begin(m);
+    if (encode_secret_file_extn_size(strlen(encInfo->extn_secret_file), encInfo) != e_success)
     {
         printf("ERROR : Failed to encode secret file extn size\n");
-        return e_failure;
+        return encode_failed(encInfo);
     }
+    stage_end(m, STAGE_EXTN_SIZE, sizeof(int));
+
     /*Encode actual extension characters*/
-    printf("INFO : Encoding secret.txt File Extenstion\n"); 
-    if (encode_secret_file_extn(encInfo->extn_secret_file, encInfo) == e_success)
-    {
-        printf("INFO : Done\n");
-    }
-    else
+    stage_begin(m);
+    if (encode_secret_file_extn(encInfo->extn_secret_file, encInfo) != e_success)
     {
         printf("ERROR : Failed to encode secret file extn\n");
-        return e_failure;
-    }/*Encode secret file size (in bytes)  */
-    printf("INFO : Encoding secret.txt File Size\n");
-    if (encode_secret_file_size(encInfo->size_secret_file, encInfo) == e_success)
-    {
-        printf("INFO : Done\n");
+        return encode_failed(encInfo);
     }
-    else
+    stage_end(m, STAGE_EXTN, strlen(encInfo->extn_secret_file));
+
+    /*Encode secret file size (in bytes)  */
+    stage_begin(m);
+    if (encode_secret_file_size(encInfo->size_secret_file, encInfo) != e_success)
     {
         printf("ERROR : Failed to encode secret file size\n");
-        return e_failure;
+        return encode_failed(encInfo);
     }
+    stage_end(m, STAGE_SIZE, STEGO_SIZE_FIELD_BYTES(STEGO_FORMAT_REVISION));
+
     /*Encode secret file data byte-by-byte */
-    printf("INFO : Encoding secret.txt File Data\n"); 
-    if (encode_secret_file_data(encInfo) == e_success)
-    {
-        printf("INFO : Done\n");
-    }
-    else
+    stage_begin(m);
+    if (encode_secret_file_data(encInfo) != e_success)
     {
         printf("ERROR : Failed to encode secret file data\n");
-        return e_failure;
+        return encode_failed(encInfo);
     }
+    stage_end(m, STAGE_DATA, encInfo->size_secret_file);
+
     /*Copy the remaining pixels of the image*/
-    printf("INFO : Copying Left Over Data\n"); 
-    if (copy_remaining_img_data(encInfo->fptr_src_image, encInfo->fptr_stego_image) == e_success)
-    {
-        printf("INFO : Done\n");
-    }
-    else
+    stage_begin(m);
+    if (copy_remaining_img_data(encInfo->fptr_src_image, encInfo->fptr_stego_image, &encInfo->tail_copy) != e_success)
     {
         printf("ERROR : Failed to copy remaining data successfully\n");
-        return e_failure;
+        return encode_failed(encInfo);
     }
+    stage_end(m, STAGE_TAIL, encInfo->tail_copy.bytes);
+    encode_info(encInfo, "INFO : Left over data copied with %s\n", encInfo->tail_copy.method);
 
     // close all the opened files
-    fclose(encInfo->fptr_src_image);
-    fclose(encInfo->fptr_secret);
-    fclose(encInfo->fptr_stego_image);
+    stage_begin(m);
+    if (close_encode_files(encInfo) != e_success)
+    {
+        printf("ERROR : Failed to write %s\n", encInfo->stego_image_fname);
+        if (encInfo->stego_created)
+            remove(encInfo->stego_image_fname);
+        metrics_job_end(m, 0);
+        return e_failure;
+    }
+    stage_end(m, STAGE_CLOSE, 0);
+    metrics_job_end(m, 1);
 
     return e_success;
-}
\ No newline at end of file
+}
@@ -1,8 +1,19 @@
 #ifndef ENCODE_H
 #define ENCODE_H
 #include <stdio.h>
+#include <stdint.h>
 
 #include "types.h" // Contains user defined types
+#include "mapfile.h"
+#include "bulkcopy.h"
+#include "threadpool.h"
+#include "bmp.h"
+#include "carrier.h"
+#include "metrics.h"
+#include "aead.h"
+#include "stego.h"
+#include "aio.h"
+#include "arena.h"
 
 /*
  * Structure to store information required for
@@ -16,18 +27,75 @@ typedef struct _EncodeInfo
     /* Source Image info */
     char *src_image_fname; // To store the src image name
     FILE *fptr_src_image;  // To store the address of the src image
-    uint image_capacity;   // To store the size of image
+    unsigned long long image_capacity; // Usable carrier bytes of the image
+    BmpInfo bmp;           // Parsed carrier layout
+    Carrier carrier;       // Its format, and how the stego image is written in it (stdio mode)
 
     /* Secret File Info */
     char *secret_fname;       // To store the secret file name
     FILE *fptr_secret;        // To store the secret file address
-    char extn_secret_file[5]; // To store the Secret file extension
-    char secret_data[100];    // To store the secret data
-    long size_secret_file;    // To store the size of the secret data
+    const char *extn_secret_file; // Secret file extension, up to STEGO_EXTN_MAX bytes (points into secret_fname or --extn)
+    unsigned long long size_secret_file; // To store the size of the secret data
 
     /* Stego Image Info */
     char *stego_image_fname; // To store the dest file name
     FILE *fptr_stego_image;  // To store the address of stego image
+    int stego_created;       // The stego image is a regular file made by this job, removed again if the job fails
+
+    /* mmap mode: files are mapped instead of streamed through FILE* */
+    int use_mmap;            // Set by -m on the command line
+    MappedFile src_map;      // Source image, read-only
+    MappedFile secret_map;   // Secret file, read-only
+    MappedFile stego_map;    // Stego image, created at its final size
+
+    /* Walk over the usable carrier bytes */
+    BmpCursor cursor;        // Next usable byte and its file offset
+    unsigned char *span;     // File bytes of the carrier block being modified
+    unsigned char *raw;      // Scratch for spans with padding or alpha bytes (stdio mode, from the arena)
+    size_t raw_size;
+    Arena *arena;            // Job memory (arena.h): batch buffers, taken back when the job is over
+
+    /* stdio mode on plain files: the payload blocks go through overlapped I/O (aio.h) */
+    AioEngine *aio;          // NULL = fread/fwrite
+    AioStream *aio_src;      // Carrier, read ahead
+    AioStream *aio_stego;    // Stego image, written behind
+    AioStream *aio_secret;   // Secret file, read ahead (NULL when packed or not a plain file)
+
+    /* How the untouched carrier bytes were copied */
+    CopyResult carrier_copy; // mmap mode: whole carrier into the stego mapping
+    CopyResult tail_copy;    // stdio mode: pixels after the payload
+
+    int depth;               // LSBs used per carrier byte after the descriptor (1-4)
+    uint32_t header_crc;     // CRC32C of the fields written so far
+    uint32_t payload_crc;    // CRC32C of the stored payload bytes embedded so far
+    const char *key;         // --key: scatter the payload by this key (mmap mode only, NULL = sequential)
+
+    /* -z: the payload is packed by lz.h before embedding */
+    int compress;            // Set the compressed flag and embed packed instead of the secret
+    unsigned char *packed;   // Packed payload or archive, size_secret_file bytes (NULL = embed the secret as is)
+    unsigned long long size_unpacked; // Secret bytes before packing
+
+    /* -a: the payload is an archive (archive.h) of the secret file and more files */
+    int archive;             // Set the archive flag, packed holds the archive
+    char **archive_files;    // Members after the secret file
+    int archive_count;
+
+    /* --shard: the payload is one slice of a secret spread over several carriers */
+    const StegoShard *shard; // Set the shard flag and record where the slice goes (NULL = whole secret)
+
+    /* --encrypt: the payload is sealed by aead.h on its way into the carrier */
+    const unsigned char *cipher_key; // AEAD_KEY_BYTES of key (NULL = stored in the clear)
+    AeadStream aead;         // Key and nonce prefix of this payload
+    unsigned long long segment; // Next segment to seal
+    size_t sealed_carry;     // Sealed bytes held back for the next block (depth 3 alignment)
+
+    ThreadPool *pool;        // Workers for chunk-parallel embedding (NULL = serial)
+    int quiet;               // Suppress the INFO progress lines
+    JobMetrics metrics;      // Stage timings of this job
+
+    /* Pipeline mode ("-" for the carrier or stego image) */
+    int size_declared;       // size_secret_file was given up front (--size)
+    const char *stream_extn; // Extension to record for an "fd:N" secret (--extn)
 
 } EncodeInfo;
 
@@ -42,21 +110,60 @@ Status do_encoding(EncodeInfo *encInfo);
 /* Get File pointers for i/p and o/p files */
 Status open_files(EncodeInfo *encInfo);
 
+/* Close all files opened for encoding, safe after a partial open; e_failure if the stego image did not close cleanly */
+Status close_encode_files(EncodeInfo *encInfo);
+
+/* Map source and secret, create the stego image and bulk copy the carrier into it */
+Status open_mapped_files(EncodeInfo *encInfo);
+
+/* Unmap everything mapped by open_mapped_files() */
+void close_mapped_files(EncodeInfo *encInfo);
+
 /* check capacity */
 Status check_capacity(EncodeInfo *encInfo);
 
-/* Get image size */
-uint get_image_size_for_bmp(FILE *fptr_image);
+/* Extension length capacity estimates assume while the extension is not known (".bin") */
+#define STEGO_EXTN_ESTIMATE 4
+
+/*
+ * Carrier bytes the whole stego layout needs for secret_size stored bytes
+ * and an extn_len byte extension, flags as in the flags byte
+ */
+unsigned long long stego_required_bytes(unsigned long long secret_size, size_t extn_len, int depth, int flags);
+
+/* Extension of a secret file: from the last '.' of the last path component (NULL = none) */
+const char *secret_file_extension(const char *fname);
+
+/* Flags byte of the payload (STEGO_FLAG_COMPRESSED, ENCRYPTED, ARCHIVE, SHARD) */
+int encode_payload_flags(const EncodeInfo *encInfo);
 
-/* Get file size */
-uint get_file_size(FILE *fptr);
+/* Bytes the payload takes in the carrier: size_secret_file, sealed with --encrypt */
+unsigned long long encode_stored_size(const EncodeInfo *encInfo);
 
-/* Copy bmp image header */
-Status copy_bmp_header(FILE *fptr_src_image, FILE *fptr_dest_image);
+/* Read the whole secret and pack it, clearing compress when packing does not shrink it */
+Status compress_secret(EncodeInfo *encInfo);
+
+/* Lay the secret and archive_files out as an archive in packed, members packed one by one with compress */
+Status build_archive(EncodeInfo *encInfo);
+
+/*
+ * Parse the carrier header, return the usable carrier bytes (0 if
+ * unsupported). A transcoded carrier replaces *fptr_image by its rows.
+ */
+unsigned long long get_image_size(FILE **fptr_image, Carrier *carrier, BmpInfo *bmp);
+
+/* Get file size, -1 if it cannot be determined */
+long long get_file_size(FILE *fptr);
+
+/* Start the stego image in the carrier format: the header up to the pixel data, or the row encoder */
+Status copy_carrier_header(EncodeInfo *encInfo);
 
 /* Store Magic String */
 Status encode_magic_string(const char *magic_string, EncodeInfo *encInfo);
 
+/* Store the format descriptor (revision and depth) */
+Status encode_format_descriptor(EncodeInfo *encInfo);
+
 /*Encode extension size*/
 Status encode_secret_file_extn_size(int size, EncodeInfo *encInfo);
 
@@ -64,18 +171,28 @@ Status encode_secret_file_extn_size(int size, EncodeInfo *encInfo);
 Status encode_secret_file_extn(const char *file_extn, EncodeInfo *encInfo);
 
 /* Encode secret file size */
-Status encode_secret_file_size(long file_size, EncodeInfo *encInfo);
+Status encode_secret_file_size(unsigned long long file_size, EncodeInfo *encInfo);
 
 /* Encode secret file data*/
 Status encode_secret_file_data(EncodeInfo *encInfo);
 
-/* Encode a byte into LSB of image data array */
-Status encode_byte_to_lsb(char data, char *image_buffer);
+/* Embed n secret bytes into the next carrier bytes, imageBuffer holds lsb_carrier_bytes(n, depth) */
+Status encode_data_block(EncodeInfo *encInfo, const unsigned char *secret, size_t n, unsigned char *imageBuffer);
 
-// Encode a size to lsb
-Status encode_size_to_lsb(int size, char *image_Buffer);
+/* Payload bytes to pass encode_payload_block() at a time: whole segments with --encrypt */
+size_t encode_batch_bytes(const EncodeInfo *encInfo);
+
+/* Scratch encode_payload_block() needs, kept by the caller from the first block to the last */
+size_t encode_scratch_bytes(const EncodeInfo *encInfo);
+
+/*
+ * Embed the next n payload bytes (at most encode_batch_bytes()), last set
+ * on the final block, which may be empty. With --encrypt they are sealed
+ * first. Every block but the last must be a full batch.
+ */
+Status encode_payload_block(EncodeInfo *encInfo, const unsigned char *chunk, size_t n, int last, unsigned char *scratch);
 
 /* Copy remaining image bytes from src to stego image after encoding */
-Status copy_remaining_img_data(FILE *fptr_src, FILE *fptr_dest);
+Status copy_remaining_img_data(FILE *fptr_src, FILE *fptr_dest, CopyResult *res);
 
 #endif
\ No newline at end of file
@@ -0,0 +1,959 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "flate.h"
+
+#define FLATE_MAX_BITS 15
+#define FLATE_LITLEN_CODES 286
+#define FLATE_DIST_CODES 30
+#define FLATE_CLEN_CODES 19
+#define FLATE_MIN_MATCH 3
+#define FLATE_MAX_MATCH 258
+#define FLATE_WINDOW_MASK (FLATE_WINDOW - 1)
+
+/* Base value and extra bits of every length (257..285) and distance code */
+static const uint16_t length_base[29] = {3,  4,  5,  6,  7,  8,  9,  10, 11,  13,  15,  17,  19,  23, 27,
+                                         31, 35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258};
+static const uint8_t length_extra[29] = {0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2,
+                                         2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0};
+static const uint16_t dist_base[30] = {1,   2,   3,   4,   5,   7,    9,    13,   17,   25,   33,   49,    65,    97,    129,
+                                       193, 257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577};
+static const uint8_t dist_extra[30] = {0, 0, 0, 0, 1, 1, 2, 2,  3,  3,  4,  4,  5,  5,  6,
+                                       6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13};
+/* Order the code length code lengths are sent in */
+static const uint8_t clen_order[FLATE_CLEN_CODES] = {16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15};
+
+/* Adler-32 of n more bytes, the zlib trailer */
+static uint32_t adler32_update(uint32_t adler, const unsigned char *p, size_t n)
+{
+    uint32_t a = adler & 0xffff, b = adler >> 16;
+    while (n > 0)
+    {
+        // 5552 bytes is the most that cannot overflow b before the modulo
+        size_t run = n < 5552 ? n : 5552;
+        n -= run;
+        while (run--)
+        {
+            a += *p++;
+            b += a;
+        }
+        a %= 65521;
+        b %= 65521;
+    }
+    return (b << 16) | a;
+}
+
+/* Low n bits of code in reverse order: Huffman codes go out first bit first, everything else LSB first */
+static unsigned reverse_bits(unsigned code, int n)
+{
+    unsigned r = 0;
+    while (n-- > 0)
+    {
+        r = (r << 1) | (code & 1);
+        code >>= 1;
+    }
+    return r;
+}
+
+/* First code of every length of the canonical code with these length counts */
+static void first_codes(const uint16_t *count, unsigned *next)
+{
+    unsigned code = 0;
+    next[0] = 0;
+    for (int len = 1; len <= FLATE_MAX_BITS; len++)
+    {
+        code = (code + (len > 1 ? count[len - 1] : 0)) << 1;
+        next[len] = code;
+    }
+}
+
+/* Inflate */
+
+/* Codes up to this long decode with one table lookup, longer ones bit by bit */
+#define INFLATE_FAST_BITS 9
+
+typedef struct
+{
+    uint16_t count[FLATE_MAX_BITS + 1];    // Codes of every length
+    uint16_t symbol[FLATE_LITLEN_CODES + 2]; // Symbols in canonical order
+    uint16_t fast[1 << INFLATE_FAST_BITS];  // Length << 9 | symbol for the short codes, 0 otherwise
+} Huffman;
+
+enum
+{
+    INFLATE_HEADER,  // zlib header
+    INFLATE_BLOCK,   // Block header, or the trailer after the last block
+    INFLATE_STORED,  // Inside a stored block
+    INFLATE_CODES,   // Inside a Huffman coded block
+    INFLATE_DONE,    // Trailer checked
+    INFLATE_ERROR
+};
+
+struct _Inflater
+{
+    FlateReadFn read;
+    void *ctx;
+    uint64_t bits;       // Input bits not consumed yet, next one lowest
+    int nbits;
+    int eof;             // read() ran dry
+    int state;
+    int last;            // The current block is the last one
+    unsigned stored_left; // Bytes left in the stored block
+    unsigned copy_len;   // Bytes left of a match that did not fit the caller's buffer
+    unsigned copy_dist;
+    Huffman lit;
+    Huffman dist;
+    unsigned char window[FLATE_WINDOW]; // The last 32 KiB of output, at total & FLATE_WINDOW_MASK
+    unsigned long long total; // Bytes inflated so far
+    uint32_t adler;
+};
+
+/* Top the bit buffer up to n bits, 0 if the input runs out first */
+static int need_bits(Inflater *inf, int n)
+{
+    while (inf->nbits < n)
+    {
+        int c = inf->eof ? -1 : inf->read(inf->ctx);
+        if (c < 0)
+        {
+            inf->eof = 1;
+            return 0;
+        }
+        inf->bits |= (uint64_t)c << inf->nbits;
+        inf->nbits += 8;
+    }
+    return 1;
+}
+
+/* Take n (at most 16) bits, LSB first */
+static int get_bits(Inflater *inf, int n, unsigned *value)
+{
+    if (!need_bits(inf, n))
+    {
+        return 0;
+    }
+    *value = inf->bits & ((1u << n) - 1);
+    inf->bits >>= n;
+    inf->nbits -= n;
+    return 1;
+}
+
+/* Canonical code from n code lengths, e_failure if it is over-subscribed */
+static Status build_huffman(Huffman *h, const uint8_t *lengths, int n)
+{
+    uint16_t offset[FLATE_MAX_BITS + 1];
+    unsigned next[FLATE_MAX_BITS + 1];
+    int left = 1;
+
+    memset(h->count, 0, sizeof(h->count));
+    for (int i = 0; i < n; i++)
+    {
+        h->count[lengths[i]]++;
+    }
+    h->count[0] = 0;
+    for (int len = 1; len <= FLATE_MAX_BITS; len++)
+    {
+        left = (left << 1) - h->count[len];
+        if (left < 0)
+        {
+            return e_failure;
+        }
+    }
+    // Incomplete codes are fine (a lone distance code is common), their gaps just never decode
+    offset[1] = 0;
+    for (int len = 1; len < FLATE_MAX_BITS; len++)
+    {
+        offset[len + 1] = offset[len] + h->count[len];
+    }
+    first_codes(h->count, next);
+    memset(h->fast, 0, sizeof(h->fast));
+    for (int sym = 0; sym < n; sym++)
+    {
+        int len = lengths[sym];
+        if (len == 0)
+        {
+            continue;
+        }
+        h->symbol[offset[len]++] = sym;
+        unsigned code = next[len]++;
+        if (len <= INFLATE_FAST_BITS)
+        {
+            for (unsigned i = reverse_bits(code, len); i < (1u << INFLATE_FAST_BITS); i += 1u << len)
+            {
+                h->fast[i] = (len << 9) | sym;
+            }
+        }
+    }
+    return e_success;
+}
+
+/* Next symbol of code h, -1 if the input is cut off or holds an unused code */
+static int decode_symbol(Inflater *inf, const Huffman *h)
+{
+    // The stream may end closer than INFLATE_FAST_BITS, the bit walk below copes with that
+    need_bits(inf, INFLATE_FAST_BITS);
+    unsigned entry = h->fast[inf->bits & ((1u << INFLATE_FAST_BITS) - 1)];
+    if (entry && (int)(entry >> 9) <= inf->nbits)
+    {
+        inf->bits >>= entry >> 9;
+        inf->nbits -= entry >> 9;
+        return entry & 511;
+    }
+    int code = 0, first = 0, index = 0;
+    for (int len = 1; len <= FLATE_MAX_BITS; len++)
+    {
+        unsigned bit;
+        if (!get_bits(inf, 1, &bit))
+        {
+            return -1;
+        }
+        code |= bit;
+        int count = h->count[len];
+        if (code - count < first)
+        {
+            return h->symbol[index + (code - first)];
+        }
+        index += count;
+        first = (first + count) << 1;
+        code <<= 1;
+    }
+    return -1;
+}
+
+static Status fixed_tables(Inflater *inf)
+{
+    uint8_t lengths[FLATE_LITLEN_CODES + 2];
+    int i = 0;
+    for (; i < 144; i++)
+        lengths[i] = 8;
+    for (; i < 256; i++)
+        lengths[i] = 9;
+    for (; i < 280; i++)
+        lengths[i] = 7;
+    for (; i < FLATE_LITLEN_CODES + 2; i++)
+        lengths[i] = 8;
+    if (build_huffman(&inf->lit, lengths, FLATE_LITLEN_CODES + 2) != e_success)
+    {
+        return e_failure;
+    }
+    memset(lengths, 5, FLATE_DIST_CODES);
+    return build_huffman(&inf->dist, lengths, FLATE_DIST_CODES);
+}
+
+/* Code lengths of a dynamic block, themselves Huffman and run-length coded */
+static Status dynamic_tables(Inflater *inf)
+{
+    uint8_t lengths[FLATE_LITLEN_CODES + FLATE_DIST_CODES];
+    uint8_t clens[FLATE_CLEN_CODES] = {0};
+    unsigned hlit, hdist, hclen;
+
+    if (!get_bits(inf, 5, &hlit) || !get_bits(inf, 5, &hdist) || !get_bits(inf, 4, &hclen))
+    {
+        return e_failure;
+    }
+    hlit += 257;
+    hdist += 1;
+    hclen += 4;
+    if (hlit > FLATE_LITLEN_CODES || hdist > FLATE_DIST_CODES)
+    {
+        return e_failure;
+    }
+    for (unsigned i = 0; i < hclen; i++)
+    {
+        unsigned len;
+        if (!get_bits(inf, 3, &len))
+        {
+            return e_failure;
+        }
+        clens[clen_order[i]] = len;
+    }
+    // The literal table is free until the lengths are known, it decodes the lengths meanwhile
+    if (build_huffman(&inf->lit, clens, FLATE_CLEN_CODES) != e_success)
+    {
+        return e_failure;
+    }
+    for (unsigned i = 0; i < hlit + hdist;)
+    {
+        int sym = decode_symbol(inf, &inf->lit);
+        unsigned repeat, value = 0;
+        if (sym < 0)
+        {
+            return e_failure;
+        }
+        if (sym < 16)
+        {
+            lengths[i++] = sym;
+            continue;
+        }
+        if (sym == 16)
+        {
+            if (i == 0 || !get_bits(inf, 2, &repeat))
+                return e_failure;
+            value = lengths[i - 1];
+            repeat += 3;
+        }
+        else if (sym == 17)
+        {
+            if (!get_bits(inf, 3, &repeat))
+                return e_failure;
+            repeat += 3;
+        }
+        else
+        {
+            if (!get_bits(inf, 7, &repeat))
+                return e_failure;
+            repeat += 11;
+        }
+        if (repeat > hlit + hdist - i)
+        {
+            return e_failure;
+        }
+        memset(lengths + i, value, repeat);
+        i += repeat;
+    }
+    // A block without an end-of-block code could never end
+    if (lengths[256] == 0 || build_huffman(&inf->lit, lengths, hlit) != e_success)
+    {
+        return e_failure;
+    }
+    return build_huffman(&inf->dist, lengths + hlit, hdist);
+}
+
+Inflater *inflater_create(FlateReadFn read, void *ctx)
+{
+    Inflater *inf = malloc(sizeof(*inf));
+    if (inf == NULL)
+    {
+        return NULL;
+    }
+    inf->read = read;
+    inf->ctx = ctx;
+    inf->bits = 0;
+    inf->nbits = 0;
+    inf->eof = 0;
+    inf->state = INFLATE_HEADER;
+    inf->last = 0;
+    inf->stored_left = 0;
+    inf->copy_len = 0;
+    inf->copy_dist = 0;
+    inf->total = 0;
+    inf->adler = 1;
+    return inf;
+}
+
+/* zlib header: deflate with at most a 32 KiB window, no preset dictionary */
+static int read_zlib_header(Inflater *inf)
+{
+    unsigned cmf, flg;
+    if (!get_bits(inf, 8, &cmf) || !get_bits(inf, 8, &flg))
+    {
+        return INFLATE_ERROR;
+    }
+    if ((cmf & 0x0f) != 8 || (cmf >> 4) > 7 || (cmf * 256 + flg) % 31 != 0 || (flg & 0x20))
+    {
+        return INFLATE_ERROR;
+    }
+    return INFLATE_BLOCK;
+}
+
+/* Next block header, or the Adler-32 trailer once the last block is done */
+static int read_block_header(Inflater *inf)
+{
+    unsigned value;
+    if (inf->last)
+    {
+        // The trailer starts on a byte boundary, MSB first
+        uint32_t adler = 0;
+        inf->bits >>= inf->nbits % 8;
+        inf->nbits -= inf->nbits % 8;
+        for (int i = 0; i < 4; i++)
+        {
+            if (!get_bits(inf, 8, &value))
+            {
+                return INFLATE_ERROR;
+            }
+            adler = (adler << 8) | value;
+        }
+        return adler == inf->adler ? INFLATE_DONE : INFLATE_ERROR;
+    }
+    if (!get_bits(inf, 1, &value))
+    {
+        return INFLATE_ERROR;
+    }
+    inf->last = value;
+    if (!get_bits(inf, 2, &value))
+    {
+        return INFLATE_ERROR;
+    }
+    if (value == 0)
+    {
+        unsigned len, nlen;
+        inf->bits >>= inf->nbits % 8;
+        inf->nbits -= inf->nbits % 8;
+        if (!get_bits(inf, 16, &len) || !get_bits(inf, 16, &nlen) || len != (~nlen & 0xffff))
+        {
+            return INFLATE_ERROR;
+        }
+        inf->stored_left = len;
+        return INFLATE_STORED;
+    }
+    if (value == 1)
+    {
+        return fixed_tables(inf) == e_success ? INFLATE_CODES : INFLATE_ERROR;
+    }
+    if (value == 2)
+    {
+        return dynamic_tables(inf) == e_success ? INFLATE_CODES : INFLATE_ERROR;
+    }
+    return INFLATE_ERROR;
+}
+
+/* Length and distance of the match after length symbol sym, INFLATE_ERROR if they are off */
+static int read_match(Inflater *inf, int sym)
+{
+    unsigned extra;
+    sym -= 257;
+    if (sym >= 29 || !get_bits(inf, length_extra[sym], &extra))
+    {
+        return INFLATE_ERROR;
+    }
+    inf->copy_len = length_base[sym] + extra;
+    sym = decode_symbol(inf, &inf->dist);
+    if (sym < 0 || sym >= FLATE_DIST_CODES || !get_bits(inf, dist_extra[sym], &extra))
+    {
+        return INFLATE_ERROR;
+    }
+    inf->copy_dist = dist_base[sym] + extra;
+    // Nothing before the first byte can be copied
+    return inf->copy_dist <= inf->total ? INFLATE_CODES : INFLATE_ERROR;
+}
+
+Status inflater_read(Inflater *inf, unsigned char *out, size_t n, size_t *got)
+{
+    size_t done = 0, summed = 0;
+
+    while (done < n && inf->state != INFLATE_DONE && inf->state != INFLATE_ERROR)
+    {
+        // A match cut short by the previous call (or the buffer end) goes first
+        while (inf->copy_len && done < n)
+        {
+            unsigned char c = inf->window[(inf->total - inf->copy_dist) & FLATE_WINDOW_MASK];
+            inf->window[inf->total++ & FLATE_WINDOW_MASK] = c;
+            out[done++] = c;
+            inf->copy_len--;
+        }
+        if (done == n)
+        {
+            break;
+        }
+        switch (inf->state)
+        {
+        case INFLATE_HEADER:
+            inf->state = read_zlib_header(inf);
+            break;
+        case INFLATE_BLOCK:
+            // The trailer checks everything inflated so far
+            inf->adler = adler32_update(inf->adler, out + summed, done - summed);
+            summed = done;
+            inf->state = read_block_header(inf);
+            break;
+        case INFLATE_STORED:
+            while (inf->stored_left && done < n)
+            {
+                unsigned c;
+                if (!get_bits(inf, 8, &c))
+                {
+                    inf->state = INFLATE_ERROR;
+                    break;
+                }
+                inf->window[inf->total++ & FLATE_WINDOW_MASK] = c;
+                out[done++] = c;
+                inf->stored_left--;
+            }
+            if (inf->stored_left == 0 && inf->state == INFLATE_STORED)
+                inf->state = INFLATE_BLOCK;
+            break;
+        case INFLATE_CODES:
+            while (done < n && inf->copy_len == 0)
+            {
+                int sym = decode_symbol(inf, &inf->lit);
+                if (sym < 0)
+                {
+                    inf->state = INFLATE_ERROR;
+                    break;
+                }
+                if (sym < 256)
+                {
+                    inf->window[inf->total++ & FLATE_WINDOW_MASK] = sym;
+                    out[done++] = sym;
+                }
+                else if (sym == 256)
+                {
+                    inf->state = INFLATE_BLOCK;
+                    break;
+                }
+                else if ((inf->state = read_match(inf, sym)) == INFLATE_ERROR)
+                {
+                    break;
+                }
+            }
+            break;
+        }
+    }
+    inf->adler = adler32_update(inf->adler, out + summed, done - summed);
+    *got = done;
+    return inf->state == INFLATE_ERROR ? e_failure : e_success;
+}
+
+void inflater_free(Inflater *inf)
+{
+    free(inf);
+}
+
+/* Deflate */
+
+#define DEFLATE_HASH_BITS 15
+/* Candidates tried per position: enough for image rows, cheap enough to stay fast */
+#define DEFLATE_MAX_CHAIN 8
+/* Symbols per block, every block gets code lengths of its own */
+#define DEFLATE_BLOCK_SYMBOLS (16 * 1024)
+#define DEFLATE_OUT_BYTES (16 * 1024)
+
+struct _Deflater
+{
+    FlateWriteFn write;
+    void *ctx;
+    Status status;
+    unsigned char window[2 * FLATE_WINDOW]; // History and input not compressed yet
+    unsigned long long base;  // Stream offset of window[0]
+    size_t start;             // Next byte to compress
+    size_t end;               // End of the input
+    uint64_t head[1 << DEFLATE_HASH_BITS]; // Stream offset + 1 of the last position with every hash, 0 = none
+    uint64_t prev[FLATE_WINDOW];           // The position before it with the same hash, by offset & FLATE_WINDOW_MASK
+    uint16_t sym_len[DEFLATE_BLOCK_SYMBOLS];  // Literal byte, or match length
+    uint16_t sym_dist[DEFLATE_BLOCK_SYMBOLS]; // Match distance, 0 for a literal
+    size_t nsyms;
+    uint64_t bits;            // Output bits not written yet
+    int nbits;
+    unsigned char out[DEFLATE_OUT_BYTES + 8];
+    size_t outlen;
+    uint32_t adler;
+};
+
+static void flush_out(Deflater *def)
+{
+    if (def->status == e_success && def->outlen)
+    {
+        def->status = def->write(def->ctx, def->out, def->outlen);
+    }
+    def->outlen = 0;
+}
+
+static void put_bits(Deflater *def, uint32_t value, int n)
+{
+    def->bits |= (uint64_t)value << def->nbits;
+    def->nbits += n;
+    while (def->nbits >= 8)
+    {
+        def->out[def->outlen++] = (unsigned char)def->bits;
+        def->bits >>= 8;
+        def->nbits -= 8;
+    }
+    if (def->outlen >= DEFLATE_OUT_BYTES)
+    {
+        flush_out(def);
+    }
+}
+
+Deflater *deflater_create(FlateWriteFn write, void *ctx)
+{
+    Deflater *def = malloc(sizeof(*def));
+    if (def == NULL)
+    {
+        return NULL;
+    }
+    def->write = write;
+    def->ctx = ctx;
+    def->status = e_success;
+    def->base = 0;
+    def->start = 0;
+    def->end = 0;
+    memset(def->head, 0, sizeof(def->head));
+    def->nsyms = 0;
+    def->bits = 0;
+    def->nbits = 0;
+    def->outlen = 0;
+    def->adler = 1;
+    // zlib header: deflate, 32 KiB window, fastest level
+    put_bits(def, 0x78, 8);
+    put_bits(def, 0x01, 8);
+    return def;
+}
+
+static unsigned length_code(unsigned len)
+{
+    unsigned code = 28;
+    while (length_base[code] > len)
+    {
+        code--;
+    }
+    return code;
+}
+
+static unsigned dist_code(unsigned dist)
+{
+    unsigned code = FLATE_DIST_CODES - 1;
+    while (dist_base[code] > dist)
+    {
+        code--;
+    }
+    return code;
+}
+
+/*
+ * Huffman code lengths for n frequencies, none longer than limit. When the
+ * tree comes out too deep the frequencies are flattened and it is built
+ * again, which always ends: equal frequencies give a balanced tree.
+ */
+static void build_lengths(const uint32_t *freq, int n, int limit, uint8_t *lengths)
+{
+    uint32_t f[FLATE_LITLEN_CODES];
+    uint32_t weight[2 * FLATE_LITLEN_CODES];
+    int parent[2 * FLATE_LITLEN_CODES];
+    int depth[2 * FLATE_LITLEN_CODES];
+    int leaf[FLATE_LITLEN_CODES];
+
+    memcpy(f, freq, n * sizeof(*f));
+    for (;;)
+    {
+        int leaves = 0, max = 0;
+        memset(lengths, 0, n);
+        // Leaves by increasing frequency
+        for (int i = 0; i < n; i++)
+        {
+            if (f[i] == 0)
+                continue;
+            int j = leaves++;
+            for (; j > 0 && f[leaf[j - 1]] > f[i]; j--)
+                leaf[j] = leaf[j - 1];
+            leaf[j] = i;
+        }
+        if (leaves < 2)
+        {
+            if (leaves == 1)
+                lengths[leaf[0]] = 1;
+            return;
+        }
+        // Two queues: leaves in order, and the internal nodes, made in order of weight
+        for (int i = 0; i < leaves; i++)
+        {
+            weight[i] = f[leaf[i]];
+        }
+        int next_leaf = 0, next_node = leaves, nodes = leaves;
+        while (nodes < 2 * leaves - 1)
+        {
+            int pick[2];
+            for (int k = 0; k < 2; k++)
+            {
+                if (next_leaf < leaves && (next_node >= nodes || weight[next_leaf] <= weight[next_node]))
+                    pick[k] = next_leaf++;
+                else
+                    pick[k] = next_node++;
+            }
+            weight[nodes] = weight[pick[0]] + weight[pick[1]];
+            parent[pick[0]] = parent[pick[1]] = nodes++;
+        }
+        // Parents come after their children, so depths fill in from the root down
+        depth[nodes - 1] = 0;
+        for (int i = nodes - 2; i >= 0; i--)
+        {
+            depth[i] = depth[parent[i]] + 1;
+        }
+        for (int i = 0; i < leaves; i++)
+        {
+            lengths[leaf[i]] = depth[i];
+            max = depth[i] > max ? depth[i] : max;
+        }
+        if (max <= limit)
+        {
+            return;
+        }
+        for (int i = 0; i < n; i++)
+        {
+            if (f[i])
+                f[i] = (f[i] + 1) / 2;
+        }
+    }
+}
+
+/* Canonical codes for the lengths, bit-reversed for output */
+static void build_codes(const uint8_t *lengths, int n, uint16_t *codes)
+{
+    uint16_t count[FLATE_MAX_BITS + 1] = {0};
+    unsigned next[FLATE_MAX_BITS + 1];
+    for (int i = 0; i < n; i++)
+    {
+        count[lengths[i]]++;
+    }
+    first_codes(count, next);
+    for (int i = 0; i < n; i++)
+    {
+        codes[i] = lengths[i] ? reverse_bits(next[lengths[i]]++, lengths[i]) : 0;
+    }
+}
+
+/* Give a tree at least two codes, so no decoder sees a lone incomplete code */
+static void two_codes_at_least(uint32_t *freq, int n)
+{
+    int used = 0;
+    for (int i = 0; i < n; i++)
+    {
+        used += freq[i] != 0;
+    }
+    for (int i = 0; used < 2 && i < n; i++)
+    {
+        if (freq[i] == 0)
+        {
+            freq[i] = 1;
+            used++;
+        }
+    }
+}
+
+/* Emit the symbols gathered so far as one dynamic Huffman block */
+static void flush_block(Deflater *def, int last)
+{
+    uint32_t lfreq[FLATE_LITLEN_CODES] = {0}, dfreq[FLATE_DIST_CODES] = {0}, cfreq[FLATE_CLEN_CODES] = {0};
+    uint8_t lengths[FLATE_LITLEN_CODES + FLATE_DIST_CODES], clens[FLATE_CLEN_CODES];
+    uint16_t lcodes[FLATE_LITLEN_CODES], dcodes[FLATE_DIST_CODES], ccodes[FLATE_CLEN_CODES];
+    uint8_t rle[FLATE_LITLEN_CODES + FLATE_DIST_CODES], rle_extra[FLATE_LITLEN_CODES + FLATE_DIST_CODES];
+    int hlit = FLATE_LITLEN_CODES, hdist = FLATE_DIST_CODES, hclen = FLATE_CLEN_CODES, nrle = 0;
+
+    for (size_t i = 0; i < def->nsyms; i++)
+    {
+        if (def->sym_dist[i] == 0)
+        {
+            lfreq[def->sym_len[i]]++;
+        }
+        else
+        {
+            lfreq[257 + length_code(def->sym_len[i])]++;
+            dfreq[dist_code(def->sym_dist[i])]++;
+        }
+    }
+    lfreq[256] = 1;
+    two_codes_at_least(lfreq, FLATE_LITLEN_CODES);
+    two_codes_at_least(dfreq, FLATE_DIST_CODES);
+    build_lengths(lfreq, FLATE_LITLEN_CODES, FLATE_MAX_BITS, lengths);
+    build_lengths(dfreq, FLATE_DIST_CODES, FLATE_MAX_BITS, lengths + FLATE_LITLEN_CODES);
+    build_codes(lengths, FLATE_LITLEN_CODES, lcodes);
+    build_codes(lengths + FLATE_LITLEN_CODES, FLATE_DIST_CODES, dcodes);
+    while (hlit > 257 && lengths[hlit - 1] == 0)
+        hlit--;
+    while (hdist > 1 && lengths[FLATE_LITLEN_CODES + hdist - 1] == 0)
+        hdist--;
+    // Both length lists go out as one run-length coded sequence
+    memmove(lengths + hlit, lengths + FLATE_LITLEN_CODES, hdist);
+    for (int i = 0; i < hlit + hdist;)
+    {
+        int run = 1;
+        while (i + run < hlit + hdist && lengths[i + run] == lengths[i])
+            run++;
+        if (lengths[i] == 0 && run >= 3)
+        {
+            run = run > 138 ? 138 : run;
+            rle[nrle] = run >= 11 ? 18 : 17;
+            rle_extra[nrle++] = run >= 11 ? run - 11 : run - 3;
+        }
+        else if (run >= 4)
+        {
+            // The value once, then repeats of it
+            run = run > 7 ? 7 : run;
+            rle[nrle++] = lengths[i];
+            rle[nrle] = 16;
+            rle_extra[nrle++] = run - 4;
+        }
+        else
+        {
+            run = 1;
+            rle[nrle++] = lengths[i];
+        }
+        i += run;
+    }
+    for (int i = 0; i < nrle; i++)
+    {
+        cfreq[rle[i]]++;
+    }
+    two_codes_at_least(cfreq, FLATE_CLEN_CODES);
+    build_lengths(cfreq, FLATE_CLEN_CODES, 7, clens);
+    build_codes(clens, FLATE_CLEN_CODES, ccodes);
+    while (hclen > 4 && clens[clen_order[hclen - 1]] == 0)
+        hclen--;
+
+    put_bits(def, last, 1);
+    put_bits(def, 2, 2);
+    put_bits(def, hlit - 257, 5);
+    put_bits(def, hdist - 1, 5);
+    put_bits(def, hclen - 4, 4);
+    for (int i = 0; i < hclen; i++)
+    {
+        put_bits(def, clens[clen_order[i]], 3);
+    }
+    for (int i = 0; i < nrle; i++)
+    {
+        put_bits(def, ccodes[rle[i]], clens[rle[i]]);
+        if (rle[i] >= 16)
+            put_bits(def, rle_extra[i], rle[i] == 16 ? 2 : rle[i] == 17 ? 3 : 7);
+    }
+
+    uint8_t *llens = lengths, *dlens = lengths + hlit;
+    for (size_t i = 0; i < def->nsyms; i++)
+    {
+        unsigned len = def->sym_len[i], dist = def->sym_dist[i];
+        if (dist == 0)
+        {
+            put_bits(def, lcodes[len], llens[len]);
+            continue;
+        }
+        unsigned lc = length_code(len), dc = dist_code(dist);
+        put_bits(def, lcodes[257 + lc], llens[257 + lc]);
+        put_bits(def, len - length_base[lc], length_extra[lc]);
+        put_bits(def, dcodes[dc], dlens[dc]);
+        put_bits(def, dist - dist_base[dc], dist_extra[dc]);
+    }
+    put_bits(def, lcodes[256], llens[256]);
+    def->nsyms = 0;
+}
+
+static uint32_t hash3(const unsigned char *p)
+{
+    return (((uint32_t)p[0] << 16 | p[1] << 8 | p[2]) * 2654435761u) >> (32 - DEFLATE_HASH_BITS);
+}
+
+/* Longest match for window[pos], up to max bytes, over the hash chain; inserts pos */
+static unsigned find_match(Deflater *def, size_t pos, unsigned max, unsigned *dist)
+{
+    unsigned long long at = def->base + pos;
+    uint32_t h = hash3(def->window + pos);
+    uint64_t cand = def->head[h];
+    unsigned best = 0;
+
+    for (int chain = DEFLATE_MAX_CHAIN; cand && chain > 0; chain--)
+    {
+        unsigned long long from = cand - 1;
+        if (from >= at || at - from > FLATE_WINDOW)
+            break;
+        const unsigned char *a = def->window + (from - def->base), *b = def->window + pos;
+        if (a[best] == b[best])
+        {
+            unsigned len = 0;
+            while (len < max && a[len] == b[len])
+                len++;
+            if (len > best)
+            {
+                best = len;
+                *dist = at - from;
+                if (len == max)
+                    break;
+            }
+        }
+        uint64_t older = def->prev[from & FLATE_WINDOW_MASK];
+        if (older >= cand)
+            break;
+        cand = older;
+    }
+    def->prev[at & FLATE_WINDOW_MASK] = def->head[h];
+    def->head[h] = at + 1;
+    return best;
+}
+
+static void insert_position(Deflater *def, size_t pos)
+{
+    unsigned long long at = def->base + pos;
+    uint32_t h = hash3(def->window + pos);
+    def->prev[at & FLATE_WINDOW_MASK] = def->head[h];
+    def->head[h] = at + 1;
+}
+
+/*
+ * Turn the input into literals and matches. Unless this is the end of the
+ * stream, FLATE_MAX_MATCH bytes stay behind so no match is cut short by
+ * where the caller's pieces happen to end.
+ */
+static void deflate_run(Deflater *def, int flush)
+{
+    size_t limit = flush ? def->end : def->end > FLATE_MAX_MATCH ? def->end - FLATE_MAX_MATCH : 0;
+    while (def->start < limit && def->status == e_success)
+    {
+        size_t pos = def->start, avail = def->end - pos;
+        unsigned len = 0, dist = 0;
+        if (avail >= FLATE_MIN_MATCH)
+        {
+            len = find_match(def, pos, avail < FLATE_MAX_MATCH ? avail : FLATE_MAX_MATCH, &dist);
+        }
+        if (len >= FLATE_MIN_MATCH)
+        {
+            for (unsigned i = 1; i < len && pos + i + FLATE_MIN_MATCH <= def->end; i++)
+                insert_position(def, pos + i);
+            def->sym_len[def->nsyms] = len;
+            def->sym_dist[def->nsyms++] = dist;
+            def->start += len;
+        }
+        else
+        {
+            def->sym_len[def->nsyms] = def->window[pos];
+            def->sym_dist[def->nsyms++] = 0;
+            def->start++;
+        }
+        if (def->nsyms == DEFLATE_BLOCK_SYMBOLS)
+        {
+            flush_block(def, 0);
+        }
+    }
+}
+
+Status deflater_write(Deflater *def, const unsigned char *data, size_t n)
+{
+    def->adler = adler32_update(def->adler, data, n);
+    while (n > 0 && def->status == e_success)
+    {
+        if (def->end == sizeof(def->window))
+        {
+            deflate_run(def, 0);
+            // Keep one window of history in front of what is left
+            size_t shift = def->start - FLATE_WINDOW;
+            memmove(def->window, def->window + shift, def->end - shift);
+            def->base += shift;
+            def->start -= shift;
+            def->end -= shift;
+        }
+        size_t take = sizeof(def->window) - def->end < n ? sizeof(def->window) - def->end : n;
+        memcpy(def->window + def->end, data, take);
+        def->end += take;
+        data += take;
+        n -= take;
+    }
+    return def->status;
+}
+
+Status deflater_finish(Deflater *def)
+{
+    deflate_run(def, 1);
+    flush_block(def, 1);
+    // The trailer starts on a byte boundary, MSB first
+    if (def->nbits % 8)
+    {
+        put_bits(def, 0, 8 - def->nbits % 8);
+    }
+    for (int i = 3; i >= 0; i--)
+    {
+        put_bits(def, (def->adler >> (8 * i)) & 0xff, 8);
+    }
+    flush_out(def);
+    return def->status;
+}
+
+void deflater_free(Deflater *def)
+{
+    free(def);
+}
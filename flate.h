@@ -0,0 +1,52 @@
+#ifndef FLATE_H
+#define FLATE_H
+
+#include <stddef.h>
+#include "types.h"
+
+/*
+ * Deflate (RFC 1951) in a zlib wrapper (RFC 1950), the compression of PNG
+ * image data
+ * Both directions stream with a fixed amount of memory: the inflater pulls
+ * compressed bytes through a callback and hands out as many plain bytes as
+ * it is asked for, the deflater takes plain bytes in pieces of any size and
+ * pushes compressed bytes out through a callback. Either keeps a 32 KiB
+ * window, never the whole stream.
+ * The deflater aims at speed: greedy LZ77 over a short hash chain, every
+ * block Huffman coded with its own code lengths.
+ */
+#define FLATE_WINDOW (32 * 1024)
+
+/* Next compressed byte, -1 when there are no more */
+typedef int (*FlateReadFn)(void *ctx);
+
+/* Take n compressed bytes, e_failure stops the deflater */
+typedef Status (*FlateWriteFn)(void *ctx, const unsigned char *data, size_t n);
+
+typedef struct _Inflater Inflater;
+typedef struct _Deflater Deflater;
+
+/* Inflater reading compressed bytes from read(ctx), NULL when out of memory */
+Inflater *inflater_create(FlateReadFn read, void *ctx);
+
+/*
+ * Inflate up to n bytes into out, *got says how many. Fewer than n means
+ * the stream ended and its Adler-32 checked out. e_failure if the stream
+ * is corrupt or cut off.
+ */
+Status inflater_read(Inflater *inf, unsigned char *out, size_t n, size_t *got);
+
+void inflater_free(Inflater *inf);
+
+/* Deflater writing compressed bytes to write(ctx), NULL when out of memory */
+Deflater *deflater_create(FlateWriteFn write, void *ctx);
+
+/* Compress n more bytes */
+Status deflater_write(Deflater *def, const unsigned char *data, size_t n);
+
+/* Compress what is left, end the stream and write its Adler-32 */
+Status deflater_finish(Deflater *def);
+
+void deflater_free(Deflater *def);
+
+#endif
@@ -0,0 +1,732 @@
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "lsb.h"
+#include "crc32c.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define LSB_HAVE_X86 1
+#include <immintrin.h>
+#endif
+
+#define LSB_ONES 0x0101010101010101ULL
+
+typedef void (*lsb_embed_fn)(const unsigned char *, size_t, unsigned char *);
+typedef void (*lsb_extract_fn)(const unsigned char *, size_t, unsigned char *);
+
+/* One kernel family, indexed by depth (entry 0 is unused) */
+typedef struct
+{
+    const char *name;
+    lsb_embed_fn embed[LSB_MAX_DEPTH + 1];
+    lsb_extract_fn extract[LSB_MAX_DEPTH + 1];
+} LsbKernel;
+
+/*
+ * Scalar reference kernel for any depth: the secret is a MSB-first bit
+ * stream and every carrier byte takes the next depth bits in its low bits.
+ * A trailing partial carrier byte is padded with zero bits.
+ */
+static void embed_scalar(const unsigned char *secret, size_t n, unsigned char *carrier, int depth)
+{
+    unsigned mask = (1u << depth) - 1;
+    unsigned acc = 0;
+    int nbits = 0;
+
+    for (size_t i = 0; i < n; i++)
+    {
+        acc = (acc << 8) | secret[i];
+        nbits += 8;
+        while (nbits >= depth)
+        {
+            nbits -= depth;
+            *carrier = (*carrier & ~mask) | ((acc >> nbits) & mask);
+            carrier++;
+        }
+        acc &= (1u << nbits) - 1;
+    }
+    if (nbits > 0)
+    {
+        *carrier = (*carrier & ~mask) | ((acc << (depth - nbits)) & mask);
+    }
+}
+
+static void extract_scalar(const unsigned char *carrier, size_t n, unsigned char *secret, int depth)
+{
+    unsigned mask = (1u << depth) - 1;
+    unsigned acc = 0;
+    int nbits = 0;
+
+    for (size_t i = 0; i < n; i++)
+    {
+        while (nbits < 8)
+        {
+            acc = (acc << depth) | (*carrier++ & mask);
+            nbits += depth;
+        }
+        nbits -= 8;
+        secret[i] = (unsigned char)(acc >> nbits);
+        acc &= (1u << nbits) - 1;
+    }
+}
+
+#define SCALAR_KERNELS(d) \
+    static void embed##d##_scalar(const unsigned char *s, size_t n, unsigned char *c) { embed_scalar(s, n, c, d); } \
+    static void extract##d##_scalar(const unsigned char *c, size_t n, unsigned char *s) { extract_scalar(c, n, s, d); }
+SCALAR_KERNELS(1)
+SCALAR_KERNELS(2)
+SCALAR_KERNELS(3)
+SCALAR_KERNELS(4)
+
+/*
+ * Portable SWAR kernel: 8 carrier bytes are handled as one 64-bit word.
+ * Embed replicates the secret byte into every lane and keeps one bit per lane,
+ * extract gathers the 8 LSBs into the top byte with a single multiply
+ * (every partial product lands on a distinct bit, so nothing carries).
+ */
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+#define LSB_SPREAD_MASK 0x8040201008040201ULL
+#define LSB_GATHER_MUL 0x0102040810204080ULL
+#else
+#define LSB_SPREAD_MASK 0x0102040810204080ULL
+#define LSB_GATHER_MUL 0x8040201008040201ULL
+#endif
+
+static inline uint64_t spread_byte(unsigned char data)
+{
+    uint64_t bits = ((uint64_t)data * LSB_ONES) & LSB_SPREAD_MASK;
+    // A lane is non-zero iff its bit is set; fold that into bit 0
+    return ((bits + 0x7F7F7F7F7F7F7F7FULL) >> 7) & LSB_ONES;
+}
+
+static void embed1_portable(const unsigned char *secret, size_t n, unsigned char *carrier)
+{
+    for (size_t i = 0; i < n; i++)
+    {
+        uint64_t word;
+        memcpy(&word, carrier + 8 * i, 8);
+        word = (word & ~LSB_ONES) | spread_byte(secret[i]);
+        memcpy(carrier + 8 * i, &word, 8);
+    }
+}
+
+static void extract1_portable(const unsigned char *carrier, size_t n, unsigned char *secret)
+{
+    for (size_t i = 0; i < n; i++)
+    {
+        uint64_t word;
+        memcpy(&word, carrier + 8 * i, 8);
+        secret[i] = (unsigned char)(((word & LSB_ONES) * LSB_GATHER_MUL) >> 56);
+    }
+}
+
+/* Portable depth 2 and 4: one secret byte spreads over 4 or 2 carrier bytes */
+static void embed2_portable(const unsigned char *secret, size_t n, unsigned char *carrier)
+{
+    for (size_t i = 0; i < n; i++)
+    {
+        unsigned char *c = carrier + 4 * i;
+        c[0] = (c[0] & 0xFC) | (secret[i] >> 6);
+        c[1] = (c[1] & 0xFC) | ((secret[i] >> 4) & 3);
+        c[2] = (c[2] & 0xFC) | ((secret[i] >> 2) & 3);
+        c[3] = (c[3] & 0xFC) | (secret[i] & 3);
+    }
+}
+
+static void extract2_portable(const unsigned char *carrier, size_t n, unsigned char *secret)
+{
+    for (size_t i = 0; i < n; i++)
+    {
+        const unsigned char *c = carrier + 4 * i;
+        secret[i] = ((c[0] & 3) << 6) | ((c[1] & 3) << 4) | ((c[2] & 3) << 2) | (c[3] & 3);
+    }
+}
+
+static void embed4_portable(const unsigned char *secret, size_t n, unsigned char *carrier)
+{
+    for (size_t i = 0; i < n; i++)
+    {
+        carrier[2 * i] = (carrier[2 * i] & 0xF0) | (secret[i] >> 4);
+        carrier[2 * i + 1] = (carrier[2 * i + 1] & 0xF0) | (secret[i] & 0x0F);
+    }
+}
+
+static void extract4_portable(const unsigned char *carrier, size_t n, unsigned char *secret)
+{
+    for (size_t i = 0; i < n; i++)
+    {
+        secret[i] = ((carrier[2 * i] & 0x0F) << 4) | (carrier[2 * i + 1] & 0x0F);
+    }
+}
+
+/* Portable depth 3: 3 secret bytes (24 bits) fill exactly 8 carrier bytes */
+static void embed3_portable(const unsigned char *secret, size_t n, unsigned char *carrier)
+{
+    size_t i = 0;
+    for (; i + 3 <= n; i += 3, carrier += 8)
+    {
+        unsigned bits = (secret[i] << 16) | (secret[i + 1] << 8) | secret[i + 2];
+        for (int b = 0; b < 8; b++)
+        {
+            carrier[b] = (carrier[b] & 0xF8) | ((bits >> (21 - 3 * b)) & 7);
+        }
+    }
+    embed_scalar(secret + i, n - i, carrier, 3);
+}
+
+static void extract3_portable(const unsigned char *carrier, size_t n, unsigned char *secret)
+{
+    size_t i = 0;
+    for (; i + 3 <= n; i += 3, carrier += 8)
+    {
+        unsigned bits = 0;
+        for (int b = 0; b < 8; b++)
+        {
+            bits = (bits << 3) | (carrier[b] & 7);
+        }
+        secret[i] = (unsigned char)(bits >> 16);
+        secret[i + 1] = (unsigned char)(bits >> 8);
+        secret[i + 2] = (unsigned char)bits;
+    }
+    extract_scalar(carrier, n - i, secret + i, 3);
+}
+
+#ifdef LSB_HAVE_X86
+
+/* SSE2: 2 secret bytes <-> 16 carrier bytes per step */
+__attribute__((target("sse2")))
+static void embed1_sse2(const unsigned char *secret, size_t n, unsigned char *carrier)
+{
+    const __m128i sel = _mm_setr_epi8((char)0x80, 0x40, 0x20, 0x10, 0x08, 0x04, 0x02, 0x01,
+                                      (char)0x80, 0x40, 0x20, 0x10, 0x08, 0x04, 0x02, 0x01);
+    const __m128i one = _mm_set1_epi8(1);
+    const __m128i keep = _mm_set1_epi8((char)0xFE);
+    size_t i = 0;
+
+    for (; i + 2 <= n; i += 2)
+    {
+        __m128i v = _mm_cvtsi32_si128(secret[i] | (secret[i + 1] << 8));
+        v = _mm_unpacklo_epi8(v, v);
+        v = _mm_unpacklo_epi16(v, v);
+        v = _mm_unpacklo_epi32(v, v);
+        __m128i bits = _mm_and_si128(_mm_cmpeq_epi8(_mm_and_si128(v, sel), sel), one);
+
+        __m128i c = _mm_loadu_si128((const __m128i *)(carrier + 8 * i));
+        c = _mm_or_si128(_mm_and_si128(c, keep), bits);
+        _mm_storeu_si128((__m128i *)(carrier + 8 * i), c);
+    }
+    embed1_portable(secret + i, n - i, carrier + 8 * i);
+}
+
+__attribute__((target("sse2")))
+static void extract1_sse2(const unsigned char *carrier, size_t n, unsigned char *secret)
+{
+    size_t i = 0;
+
+    for (; i + 2 <= n; i += 2)
+    {
+        __m128i c = _mm_loadu_si128((const __m128i *)(carrier + 8 * i));
+        // Reverse byte order inside each 8-byte group so movemask yields MSB first
+        c = _mm_shufflelo_epi16(c, 0x1B);
+        c = _mm_shufflehi_epi16(c, 0x1B);
+        c = _mm_or_si128(_mm_slli_epi16(c, 8), _mm_srli_epi16(c, 8));
+        int mask = _mm_movemask_epi8(_mm_slli_epi64(c, 7));
+        secret[i] = (unsigned char)mask;
+        secret[i + 1] = (unsigned char)(mask >> 8);
+    }
+    extract1_portable(carrier + 8 * i, n - i, secret + i);
+}
+
+/* BMI2: pdep/pext move 8 bits <-> 8 lanes in one instruction */
+__attribute__((target("bmi2")))
+static void embed1_bmi2(const unsigned char *secret, size_t n, unsigned char *carrier)
+{
+    for (size_t i = 0; i < n; i++)
+    {
+        uint64_t word;
+        memcpy(&word, carrier + 8 * i, 8);
+        word = (word & ~LSB_ONES) | __builtin_bswap64(_pdep_u64(secret[i], LSB_ONES));
+        memcpy(carrier + 8 * i, &word, 8);
+    }
+}
+
+__attribute__((target("bmi2")))
+static void extract1_bmi2(const unsigned char *carrier, size_t n, unsigned char *secret)
+{
+    for (size_t i = 0; i < n; i++)
+    {
+        uint64_t word;
+        memcpy(&word, carrier + 8 * i, 8);
+        secret[i] = (unsigned char)_pext_u64(__builtin_bswap64(word), LSB_ONES);
+    }
+}
+
+/* AVX2: 4 secret bytes <-> 32 carrier bytes per step */
+__attribute__((target("avx2")))
+static void embed1_avx2(const unsigned char *secret, size_t n, unsigned char *carrier)
+{
+    const __m256i idx = _mm256_setr_epi8(0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 1, 1, 1, 1,
+                                         2, 2, 2, 2, 2, 2, 2, 2, 3, 3, 3, 3, 3, 3, 3, 3);
+    const __m256i sel = _mm256_set1_epi64x((long long)LSB_SPREAD_MASK);
+    const __m256i one = _mm256_set1_epi8(1);
+    const __m256i keep = _mm256_set1_epi8((char)0xFE);
+    size_t i = 0;
+
+    for (; i + 4 <= n; i += 4)
+    {
+        int32_t quad;
+        memcpy(&quad, secret + i, 4);
+        __m256i v = _mm256_shuffle_epi8(_mm256_set1_epi32(quad), idx);
+        __m256i bits = _mm256_and_si256(_mm256_cmpeq_epi8(_mm256_and_si256(v, sel), sel), one);
+
+        __m256i c = _mm256_loadu_si256((const __m256i *)(carrier + 8 * i));
+        c = _mm256_or_si256(_mm256_and_si256(c, keep), bits);
+        _mm256_storeu_si256((__m256i *)(carrier + 8 * i), c);
+    }
+    embed1_portable(secret + i, n - i, carrier + 8 * i);
+}
+
+__attribute__((target("avx2")))
+static void extract1_avx2(const unsigned char *carrier, size_t n, unsigned char *secret)
+{
+    const __m256i rev = _mm256_setr_epi8(7, 6, 5, 4, 3, 2, 1, 0, 15, 14, 13, 12, 11, 10, 9, 8,
+                                         7, 6, 5, 4, 3, 2, 1, 0, 15, 14, 13, 12, 11, 10, 9, 8);
+    size_t i = 0;
+
+    for (; i + 4 <= n; i += 4)
+    {
+        __m256i c = _mm256_loadu_si256((const __m256i *)(carrier + 8 * i));
+        c = _mm256_shuffle_epi8(c, rev);
+        uint32_t mask = (uint32_t)_mm256_movemask_epi8(_mm256_slli_epi64(c, 7));
+        memcpy(secret + i, &mask, 4);
+    }
+    extract1_portable(carrier + 8 * i, n - i, secret + i);
+}
+
+/*
+ * Depth 2 and 4 on SSE2/AVX2: a "split" turns every byte into two bytes
+ * holding its high and low halves (interleaved, high first), a "combine"
+ * reverses it. Depth 4 is one split of the secret bytes, depth 2 splits the
+ * resulting nibbles once more.
+ */
+__attribute__((target("sse2")))
+static inline void split_sse2(__m128i v, int shift, __m128i mask, __m128i *a, __m128i *b)
+{
+    __m128i hi = _mm_and_si128(_mm_srl_epi16(v, _mm_cvtsi32_si128(shift)), mask);
+    __m128i lo = _mm_and_si128(v, mask);
+    *a = _mm_unpacklo_epi8(hi, lo);
+    *b = _mm_unpackhi_epi8(hi, lo);
+}
+
+__attribute__((target("sse2")))
+static inline __m128i combine_sse2(__m128i a, __m128i b, int shift, __m128i mask)
+{
+    // Each 16-bit lane holds (high part, low part) as (low byte, high byte)
+    __m128i count = _mm_cvtsi32_si128(shift);
+    __m128i x = _mm_or_si128(_mm_sll_epi16(_mm_and_si128(a, mask), count), _mm_and_si128(_mm_srli_epi16(a, 8), mask));
+    __m128i y = _mm_or_si128(_mm_sll_epi16(_mm_and_si128(b, mask), count), _mm_and_si128(_mm_srli_epi16(b, 8), mask));
+    return _mm_packus_epi16(x, y);
+}
+
+__attribute__((target("sse2")))
+static inline void store_bits_sse2(unsigned char *carrier, __m128i bits, __m128i keep)
+{
+    __m128i c = _mm_loadu_si128((const __m128i *)carrier);
+    _mm_storeu_si128((__m128i *)carrier, _mm_or_si128(_mm_and_si128(c, keep), bits));
+}
+
+/* SSE2 depth 4: 16 secret bytes <-> 32 carrier bytes per step */
+__attribute__((target("sse2")))
+static void embed4_sse2(const unsigned char *secret, size_t n, unsigned char *carrier)
+{
+    const __m128i nibble = _mm_set1_epi16(0x0F0F);
+    const __m128i keep = _mm_set1_epi8((char)0xF0);
+    size_t i = 0;
+
+    for (; i + 16 <= n; i += 16)
+    {
+        __m128i a, b;
+        split_sse2(_mm_loadu_si128((const __m128i *)(secret + i)), 4, nibble, &a, &b);
+        store_bits_sse2(carrier + 2 * i, a, keep);
+        store_bits_sse2(carrier + 2 * i + 16, b, keep);
+    }
+    embed4_portable(secret + i, n - i, carrier + 2 * i);
+}
+
+__attribute__((target("sse2")))
+static void extract4_sse2(const unsigned char *carrier, size_t n, unsigned char *secret)
+{
+    const __m128i nibble = _mm_set1_epi16(0x000F);
+    size_t i = 0;
+
+    for (; i + 16 <= n; i += 16)
+    {
+        __m128i a = _mm_loadu_si128((const __m128i *)(carrier + 2 * i));
+        __m128i b = _mm_loadu_si128((const __m128i *)(carrier + 2 * i + 16));
+        _mm_storeu_si128((__m128i *)(secret + i), combine_sse2(a, b, 4, nibble));
+    }
+    extract4_portable(carrier + 2 * i, n - i, secret + i);
+}
+
+/* SSE2 depth 2: 16 secret bytes <-> 64 carrier bytes per step */
+__attribute__((target("sse2")))
+static void embed2_sse2(const unsigned char *secret, size_t n, unsigned char *carrier)
+{
+    const __m128i nibble = _mm_set1_epi16(0x0F0F);
+    const __m128i pair = _mm_set1_epi16(0x0303);
+    const __m128i keep = _mm_set1_epi8((char)0xFC);
+    size_t i = 0;
+
+    for (; i + 16 <= n; i += 16)
+    {
+        __m128i a, b, q[4];
+        split_sse2(_mm_loadu_si128((const __m128i *)(secret + i)), 4, nibble, &a, &b);
+        split_sse2(a, 2, pair, &q[0], &q[1]);
+        split_sse2(b, 2, pair, &q[2], &q[3]);
+        for (int k = 0; k < 4; k++)
+            store_bits_sse2(carrier + 4 * i + 16 * k, q[k], keep);
+    }
+    embed2_portable(secret + i, n - i, carrier + 4 * i);
+}
+
+__attribute__((target("sse2")))
+static void extract2_sse2(const unsigned char *carrier, size_t n, unsigned char *secret)
+{
+    const __m128i nibble = _mm_set1_epi16(0x000F);
+    const __m128i pair = _mm_set1_epi16(0x0003);
+    size_t i = 0;
+
+    for (; i + 16 <= n; i += 16)
+    {
+        const __m128i *c = (const __m128i *)(carrier + 4 * i);
+        __m128i a = combine_sse2(_mm_loadu_si128(c), _mm_loadu_si128(c + 1), 2, pair);
+        __m128i b = combine_sse2(_mm_loadu_si128(c + 2), _mm_loadu_si128(c + 3), 2, pair);
+        _mm_storeu_si128((__m128i *)(secret + i), combine_sse2(a, b, 4, nibble));
+    }
+    extract2_portable(carrier + 4 * i, n - i, secret + i);
+}
+
+/* AVX2 versions of split/combine; unpack and pack work per 128-bit lane, so fix the order */
+__attribute__((target("avx2")))
+static inline void split_avx2(__m256i v, int shift, __m256i mask, __m256i *a, __m256i *b)
+{
+    __m256i hi = _mm256_and_si256(_mm256_srl_epi16(v, _mm_cvtsi32_si128(shift)), mask);
+    __m256i lo = _mm256_and_si256(v, mask);
+    __m256i x = _mm256_unpacklo_epi8(hi, lo);
+    __m256i y = _mm256_unpackhi_epi8(hi, lo);
+    *a = _mm256_permute2x128_si256(x, y, 0x20);
+    *b = _mm256_permute2x128_si256(x, y, 0x31);
+}
+
+__attribute__((target("avx2")))
+static inline __m256i combine_avx2(__m256i a, __m256i b, int shift, __m256i mask)
+{
+    __m128i count = _mm_cvtsi32_si128(shift);
+    __m256i x = _mm256_or_si256(_mm256_sll_epi16(_mm256_and_si256(a, mask), count), _mm256_and_si256(_mm256_srli_epi16(a, 8), mask));
+    __m256i y = _mm256_or_si256(_mm256_sll_epi16(_mm256_and_si256(b, mask), count), _mm256_and_si256(_mm256_srli_epi16(b, 8), mask));
+    return _mm256_permute4x64_epi64(_mm256_packus_epi16(x, y), 0xD8);
+}
+
+__attribute__((target("avx2")))
+static inline void store_bits_avx2(unsigned char *carrier, __m256i bits, __m256i keep)
+{
+    __m256i c = _mm256_loadu_si256((const __m256i *)carrier);
+    _mm256_storeu_si256((__m256i *)carrier, _mm256_or_si256(_mm256_and_si256(c, keep), bits));
+}
+
+/* AVX2 depth 4: 32 secret bytes <-> 64 carrier bytes per step */
+__attribute__((target("avx2")))
+static void embed4_avx2(const unsigned char *secret, size_t n, unsigned char *carrier)
+{
+    const __m256i nibble = _mm256_set1_epi16(0x0F0F);
+    const __m256i keep = _mm256_set1_epi8((char)0xF0);
+    size_t i = 0;
+
+    for (; i + 32 <= n; i += 32)
+    {
+        __m256i a, b;
+        split_avx2(_mm256_loadu_si256((const __m256i *)(secret + i)), 4, nibble, &a, &b);
+        store_bits_avx2(carrier + 2 * i, a, keep);
+        store_bits_avx2(carrier + 2 * i + 32, b, keep);
+    }
+    embed4_portable(secret + i, n - i, carrier + 2 * i);
+}
+
+__attribute__((target("avx2")))
+static void extract4_avx2(const unsigned char *carrier, size_t n, unsigned char *secret)
+{
+    const __m256i nibble = _mm256_set1_epi16(0x000F);
+    size_t i = 0;
+
+    for (; i + 32 <= n; i += 32)
+    {
+        __m256i a = _mm256_loadu_si256((const __m256i *)(carrier + 2 * i));
+        __m256i b = _mm256_loadu_si256((const __m256i *)(carrier + 2 * i + 32));
+        _mm256_storeu_si256((__m256i *)(secret + i), combine_avx2(a, b, 4, nibble));
+    }
+    extract4_portable(carrier + 2 * i, n - i, secret + i);
+}
+
+/* AVX2 depth 2: 32 secret bytes <-> 128 carrier bytes per step */
+__attribute__((target("avx2")))
+static void embed2_avx2(const unsigned char *secret, size_t n, unsigned char *carrier)
+{
+    const __m256i nibble = _mm256_set1_epi16(0x0F0F);
+    const __m256i pair = _mm256_set1_epi16(0x0303);
+    const __m256i keep = _mm256_set1_epi8((char)0xFC);
+    size_t i = 0;
+
+    for (; i + 32 <= n; i += 32)
+    {
+        __m256i a, b, q[4];
+        split_avx2(_mm256_loadu_si256((const __m256i *)(secret + i)), 4, nibble, &a, &b);
+        split_avx2(a, 2, pair, &q[0], &q[1]);
+        split_avx2(b, 2, pair, &q[2], &q[3]);
+        for (int k = 0; k < 4; k++)
+            store_bits_avx2(carrier + 4 * i + 32 * k, q[k], keep);
+    }
+    embed2_portable(secret + i, n - i, carrier + 4 * i);
+}
+
+__attribute__((target("avx2")))
+static void extract2_avx2(const unsigned char *carrier, size_t n, unsigned char *secret)
+{
+    const __m256i nibble = _mm256_set1_epi16(0x000F);
+    const __m256i pair = _mm256_set1_epi16(0x0003);
+    size_t i = 0;
+
+    for (; i + 32 <= n; i += 32)
+    {
+        const __m256i *c = (const __m256i *)(carrier + 4 * i);
+        __m256i a = combine_avx2(_mm256_loadu_si256(c), _mm256_loadu_si256(c + 1), 2, pair);
+        __m256i b = combine_avx2(_mm256_loadu_si256(c + 2), _mm256_loadu_si256(c + 3), 2, pair);
+        _mm256_storeu_si256((__m256i *)(secret + i), combine_avx2(a, b, 4, nibble));
+    }
+    extract2_portable(carrier + 4 * i, n - i, secret + i);
+}
+
+/* BMI2 depth 3: pdep/pext move 24 bits <-> 8 lanes of 3 bits */
+#define LSB_THREES 0x0707070707070707ULL
+
+__attribute__((target("bmi2")))
+static void embed3_bmi2(const unsigned char *secret, size_t n, unsigned char *carrier)
+{
+    size_t i = 0;
+    for (; i + 3 <= n; i += 3, carrier += 8)
+    {
+        uint64_t word;
+        uint64_t bits = ((uint64_t)secret[i] << 16) | (secret[i + 1] << 8) | secret[i + 2];
+        memcpy(&word, carrier, 8);
+        word = (word & ~LSB_THREES) | __builtin_bswap64(_pdep_u64(bits, LSB_THREES));
+        memcpy(carrier, &word, 8);
+    }
+    embed_scalar(secret + i, n - i, carrier, 3);
+}
+
+__attribute__((target("bmi2")))
+static void extract3_bmi2(const unsigned char *carrier, size_t n, unsigned char *secret)
+{
+    size_t i = 0;
+    for (; i + 3 <= n; i += 3, carrier += 8)
+    {
+        uint64_t word;
+        memcpy(&word, carrier, 8);
+        uint64_t bits = _pext_u64(__builtin_bswap64(word), LSB_THREES);
+        secret[i] = (unsigned char)(bits >> 16);
+        secret[i + 1] = (unsigned char)(bits >> 8);
+        secret[i + 2] = (unsigned char)bits;
+    }
+    extract_scalar(carrier, n - i, secret + i, 3);
+}
+
+#endif
+
+/* Depths without a dedicated kernel in a family reuse the portable one */
+static const LsbKernel kernels[] = {
+#ifdef LSB_HAVE_X86
+    {"avx2", {NULL, embed1_avx2, embed2_avx2, embed3_portable, embed4_avx2},
+             {NULL, extract1_avx2, extract2_avx2, extract3_portable, extract4_avx2}},
+    {"bmi2", {NULL, embed1_bmi2, embed2_sse2, embed3_bmi2, embed4_sse2},
+             {NULL, extract1_bmi2, extract2_sse2, extract3_bmi2, extract4_sse2}},
+    {"sse2", {NULL, embed1_sse2, embed2_sse2, embed3_portable, embed4_sse2},
+             {NULL, extract1_sse2, extract2_sse2, extract3_portable, extract4_sse2}},
+#endif
+    {"portable", {NULL, embed1_portable, embed2_portable, embed3_portable, embed4_portable},
+                 {NULL, extract1_portable, extract2_portable, extract3_portable, extract4_portable}},
+    {"scalar", {NULL, embed1_scalar, embed2_scalar, embed3_scalar, embed4_scalar},
+               {NULL, extract1_scalar, extract2_scalar, extract3_scalar, extract4_scalar}},
+};
+
+#define LSB_KERNEL_COUNT (sizeof(kernels) / sizeof(kernels[0]))
+
+// Read by every embed/extract on any thread: published whole with release, read with acquire
+static _Atomic(const LsbKernel *) active_kernel;
+
+/* Check whether the CPU can run the given kernel */
+static int kernel_supported(const LsbKernel *kernel)
+{
+#ifdef LSB_HAVE_X86
+    __builtin_cpu_init();
+    if (strcmp(kernel->name, "avx2") == 0)
+        return __builtin_cpu_supports("avx2");
+    if (strcmp(kernel->name, "bmi2") == 0)
+        return __builtin_cpu_supports("bmi2");
+    if (strcmp(kernel->name, "sse2") == 0)
+        return __builtin_cpu_supports("sse2");
+#endif
+    return 1;
+}
+
+/* First supported kernel, or the named one (NULL if it is unknown or unsupported) */
+static const LsbKernel *find_kernel(const char *name)
+{
+    for (size_t i = 0; i < LSB_KERNEL_COUNT; i++)
+    {
+        if (name && strcmp(name, kernels[i].name) != 0)
+            continue;
+        if (kernel_supported(&kernels[i]))
+            return &kernels[i];
+    }
+    return NULL;
+}
+
+/* The first supported kernel, or the one named in STEGO_KERNEL */
+static const LsbKernel *default_kernel(void)
+{
+    const LsbKernel *chosen = find_kernel(getenv("STEGO_KERNEL"));
+    // Unknown or unsupported forced name: fall back to the portable kernel
+    if (chosen == NULL)
+        chosen = &kernels[LSB_KERNEL_COUNT - 2];
+    return chosen;
+}
+
+/* Kernel in use, chosen on first use; threads racing to choose it agree on the first one installed */
+static const LsbKernel *select_kernel(void)
+{
+    const LsbKernel *kernel = atomic_load_explicit(&active_kernel, memory_order_acquire);
+    if (kernel)
+        return kernel;
+
+    const LsbKernel *chosen = default_kernel();
+    if (atomic_compare_exchange_strong_explicit(&active_kernel, &kernel, chosen, memory_order_acq_rel,
+                                                memory_order_acquire))
+        return chosen;
+    return kernel; // Installed by another thread in the meantime
+}
+
+int lsb_use_kernel(const char *name)
+{
+    const LsbKernel *chosen = name ? find_kernel(name) : default_kernel();
+    if (chosen == NULL)
+        return 0;
+    atomic_store_explicit(&active_kernel, chosen, memory_order_release);
+    return 1;
+}
+
+size_t lsb_carrier_bytes(size_t n, int depth)
+{
+    return (n * 8 + depth - 1) / depth;
+}
+
+size_t lsb_chunk_bytes(int depth)
+{
+    // 3 bits per carrier byte: keep chunks a multiple of 3 bytes (24 bits)
+    return depth == 3 ? LSB_SECRET_CHUNK - 1 : LSB_SECRET_CHUNK;
+}
+
+void lsb_embed_block(const unsigned char *secret, size_t n, unsigned char *carrier, int depth)
+{
+    select_kernel()->embed[depth](secret, n, carrier);
+}
+
+void lsb_extract_block(const unsigned char *carrier, size_t n, unsigned char *secret, int depth)
+{
+    select_kernel()->extract[depth](carrier, n, secret);
+}
+
+const char *lsb_kernel_name(void)
+{
+    return select_kernel()->name;
+}
+
+/* One parallel embed/extract request, split in lsb_chunk_bytes() pieces */
+typedef struct
+{
+    const LsbKernel *kernel;
+    const unsigned char *src;
+    unsigned char *dst;
+    size_t n;
+    int depth;
+    size_t chunk;
+    uint32_t *crcs;  // CRC32C of every chunk's secret bytes (NULL = none)
+} LsbJob;
+
+static void embed_chunk(void *ctx, size_t index)
+{
+    LsbJob *job = ctx;
+    size_t start = index * job->chunk;
+    size_t len = job->n - start < job->chunk ? job->n - start : job->chunk;
+    job->kernel->embed[job->depth](job->src + start, len, job->dst + lsb_carrier_bytes(start, job->depth));
+    if (job->crcs)
+        job->crcs[index] = crc32c_update(0, job->src + start, len);
+}
+
+static void extract_chunk(void *ctx, size_t index)
+{
+    LsbJob *job = ctx;
+    size_t start = index * job->chunk;
+    size_t len = job->n - start < job->chunk ? job->n - start : job->chunk;
+    job->kernel->extract[job->depth](job->src + lsb_carrier_bytes(start, job->depth), len, job->dst + start);
+    if (job->crcs)
+        job->crcs[index] = crc32c_update(0, job->dst + start, len);
+}
+
+void lsb_embed_parallel(ThreadPool *pool, const unsigned char *secret, size_t n, unsigned char *carrier, int depth)
+{
+    // Select the kernel before any worker can race on it
+    LsbJob job = {select_kernel(), secret, carrier, n, depth, lsb_chunk_bytes(depth), NULL};
+    pool_parallel_for(pool, (n + job.chunk - 1) / job.chunk, embed_chunk, &job);
+}
+
+void lsb_extract_parallel(ThreadPool *pool, const unsigned char *carrier, size_t n, unsigned char *secret, int depth)
+{
+    LsbJob job = {select_kernel(), carrier, secret, n, depth, lsb_chunk_bytes(depth), NULL};
+    pool_parallel_for(pool, (n + job.chunk - 1) / job.chunk, extract_chunk, &job);
+}
+
+/* Run job with a CRC32C per chunk, then fold them into *crc in order */
+static void run_with_crc(ThreadPool *pool, LsbJob *job, pool_for_fn fn, const unsigned char *secret, uint32_t *crc)
+{
+    size_t chunks = (job->n + job->chunk - 1) / job->chunk;
+    uint32_t crcs_small[64];
+    job->crcs = chunks <= 64 ? crcs_small : malloc(chunks * sizeof(uint32_t));
+    pool_parallel_for(pool, chunks, fn, job);
+    if (job->crcs == NULL)
+    {
+        // No room for the chunk CRCs: one more pass over the secret instead
+        *crc = crc32c_update(*crc, secret, job->n);
+        return;
+    }
+    for (size_t i = 0; i < chunks; i++)
+    {
+        size_t len = job->n - i * job->chunk < job->chunk ? job->n - i * job->chunk : job->chunk;
+        *crc = crc32c_combine(*crc, job->crcs[i], len);
+    }
+    if (job->crcs != crcs_small)
+        free(job->crcs);
+}
+
+void lsb_embed_parallel_crc(ThreadPool *pool, const unsigned char *secret, size_t n, unsigned char *carrier, int depth,
+                            uint32_t *crc)
+{
+    LsbJob job = {select_kernel(), secret, carrier, n, depth, lsb_chunk_bytes(depth), NULL};
+    run_with_crc(pool, &job, embed_chunk, secret, crc);
+}
+
+void lsb_extract_parallel_crc(ThreadPool *pool, const unsigned char *carrier, size_t n, unsigned char *secret, int depth,
+                              uint32_t *crc)
+{
+    LsbJob job = {select_kernel(), carrier, secret, n, depth, lsb_chunk_bytes(depth), NULL};
+    run_with_crc(pool, &job, extract_chunk, secret, crc);
+}
@@ -0,0 +1,74 @@
+#ifndef LSB_H
+#define LSB_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "threadpool.h"
+
+/*
+ * Block LSB embed/extract kernels
+ * The secret is a MSB-first bit stream written depth bits at a time into
+ * the low bits of consecutive carrier bytes, the earliest bit in the
+ * highest of them; the other carrier bits are left alone. At depth 1 a
+ * secret byte takes the LSBs of 8 carrier bytes, its bit 7 first. A
+ * trailing partial carrier byte is zero padded.
+ * The best kernel for the running CPU is picked on first use;
+ * set STEGO_KERNEL=scalar|portable|sse2|bmi2|avx2 to force one.
+ */
+
+/* Supported bits per carrier byte */
+#define LSB_MIN_DEPTH 1
+#define LSB_MAX_DEPTH 4
+
+/* Secret bytes handled per block call by the encode/decode loops */
+#define LSB_SECRET_CHUNK (64 * 1024)
+
+/* Carrier bytes needed for one secret chunk (the worst case, depth 1) */
+#define LSB_CARRIER_CHUNK (LSB_SECRET_CHUNK * 8)
+
+/* Carrier bytes holding n secret bytes at the given depth */
+size_t lsb_carrier_bytes(size_t n, int depth);
+
+/*
+ * Secret bytes per chunk at the given depth. A chunk always ends on a
+ * carrier byte boundary, so callers feeding the kernels piecewise must use
+ * multiples of it for every piece but the last.
+ */
+size_t lsb_chunk_bytes(int depth);
+
+/* Embed n secret bytes into lsb_carrier_bytes(n, depth) carrier bytes (in place) */
+void lsb_embed_block(const unsigned char *secret, size_t n, unsigned char *carrier, int depth);
+
+/* Extract n secret bytes from lsb_carrier_bytes(n, depth) carrier bytes */
+void lsb_extract_block(const unsigned char *carrier, size_t n, unsigned char *secret, int depth);
+
+/*
+ * Same as above, split into lsb_chunk_bytes() pieces that run concurrently
+ * on the pool. Every chunk starts and ends on a carrier byte boundary, so
+ * chunks never overlap. A NULL pool runs serially.
+ */
+void lsb_embed_parallel(ThreadPool *pool, const unsigned char *secret, size_t n, unsigned char *carrier, int depth);
+void lsb_extract_parallel(ThreadPool *pool, const unsigned char *carrier, size_t n, unsigned char *secret, int depth);
+
+/*
+ * The parallel calls that also carry *crc, a CRC32C of the secret bytes,
+ * over these n bytes. Every worker checksums its chunk right after
+ * embedding or extracting it, while it is still in cache.
+ */
+void lsb_embed_parallel_crc(ThreadPool *pool, const unsigned char *secret, size_t n, unsigned char *carrier, int depth,
+                            uint32_t *crc);
+void lsb_extract_parallel_crc(ThreadPool *pool, const unsigned char *carrier, size_t n, unsigned char *secret, int depth,
+                              uint32_t *crc);
+
+/* Name of the kernel selected for this CPU */
+const char *lsb_kernel_name(void);
+
+/*
+ * Switch to the named kernel (NULL = back to the automatic choice).
+ * Returns 0 if the name is unknown or the CPU cannot run it.
+ * Safe from any thread: a call already running keeps the kernel it started
+ * with, later ones use the new choice.
+ */
+int lsb_use_kernel(const char *name);
+
+#endif
@@ -0,0 +1,300 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "lz.h"
+
+#define LZ_MIN_MATCH 4
+#define LZ_HASH_BITS 14
+/* A block always ends on literals, so match search never reads past it */
+#define LZ_LAST_LITERALS 5
+
+static uint32_t read32(const unsigned char *p)
+{
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static uint32_t hash4(uint32_t v)
+{
+    return (v * 2654435761u) >> (32 - LZ_HASH_BITS);
+}
+
+static void put_le32(unsigned char *p, uint32_t v)
+{
+    p[0] = v;
+    p[1] = v >> 8;
+    p[2] = v >> 16;
+    p[3] = v >> 24;
+}
+
+static uint32_t get_le32(const unsigned char *p)
+{
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+unsigned long long lz_pack_bound(unsigned long long n)
+{
+    return n + 4 * ((n + LZ_BLOCK - 1) / LZ_BLOCK);
+}
+
+/* Length beyond a 15 in the token: runs of 255 and the rest */
+static unsigned char *put_length(unsigned char *op, size_t len)
+{
+    while (len >= 255)
+    {
+        *op++ = 255;
+        len -= 255;
+    }
+    *op++ = (unsigned char)len;
+    return op;
+}
+
+/* Worst-case bytes of one sequence, checked before it is written */
+static size_t sequence_bound(size_t literals)
+{
+    return 1 + literals / 255 + 1 + literals + 2 + LZ_BLOCK / 255 + 1;
+}
+
+/* One sequence: literals from anchor, then a match (match_len 0 = last sequence) */
+static unsigned char *put_sequence(unsigned char *op, const unsigned char *literals, size_t lit_len,
+                                   size_t offset, size_t match_len)
+{
+    size_t ml = match_len ? match_len - LZ_MIN_MATCH : 0;
+    unsigned char *token = op++;
+
+    *token = (unsigned char)((lit_len < 15 ? lit_len : 15) << 4);
+    if (lit_len >= 15)
+        op = put_length(op, lit_len - 15);
+    memcpy(op, literals, lit_len);
+    op += lit_len;
+    if (match_len == 0)
+        return op;
+    *op++ = (unsigned char)offset;
+    *op++ = (unsigned char)(offset >> 8);
+    *token |= ml < 15 ? ml : 15;
+    if (ml >= 15)
+        op = put_length(op, ml - 15);
+    return op;
+}
+
+/* Compress one block into at most cap bytes, 0 when it does not shrink below that */
+static size_t compress_block(const unsigned char *src, size_t n, unsigned char *dst, size_t cap)
+{
+    uint16_t table[1 << LZ_HASH_BITS];
+    unsigned char *op = dst;
+    size_t ip = 0, anchor = 0;
+    unsigned misses = 0;
+
+    memset(table, 0, sizeof(table));
+    while (ip + LZ_MIN_MATCH + LZ_LAST_LITERALS <= n)
+    {
+        uint32_t h = hash4(read32(src + ip));
+        size_t ref = table[h];
+        table[h] = (uint16_t)ip;
+        if (ref >= ip || read32(src + ref) != read32(src + ip))
+        {
+            // Incompressible stretches are skipped faster and faster
+            ip += 1 + (misses++ >> 6);
+            continue;
+        }
+        size_t len = LZ_MIN_MATCH;
+        size_t max = n - LZ_LAST_LITERALS - ip;
+        while (len < max && src[ref + len] == src[ip + len])
+            len++;
+        if ((size_t)(op - dst) + sequence_bound(ip - anchor) > cap)
+            return 0;
+        op = put_sequence(op, src + anchor, ip - anchor, ip - ref, len);
+        ip += len;
+        anchor = ip;
+        misses = 0;
+    }
+    if ((size_t)(op - dst) + sequence_bound(n - anchor) > cap)
+        return 0;
+    op = put_sequence(op, src + anchor, n - anchor, 0, 0);
+    return op - dst;
+}
+
+/* Read a length continuation, 0 when the input ends first */
+static int get_length(const unsigned char *src, size_t n, size_t *ip, size_t *len)
+{
+    unsigned char b;
+    do
+    {
+        if (*ip >= n)
+            return 0;
+        b = src[(*ip)++];
+        *len += b;
+    } while (b == 255);
+    return 1;
+}
+
+/* Expand one compressed block of n bytes into exactly raw_n bytes */
+static Status expand_block(const unsigned char *src, size_t n, unsigned char *dst, size_t raw_n)
+{
+    size_t ip = 0, op = 0;
+
+    while (ip < n)
+    {
+        unsigned token = src[ip++];
+        size_t lit = token >> 4;
+        if (lit == 15 && !get_length(src, n, &ip, &lit))
+            return e_failure;
+        if (lit > n - ip || lit > raw_n - op)
+            return e_failure;
+        memcpy(dst + op, src + ip, lit);
+        ip += lit;
+        op += lit;
+        if (ip == n)
+            return op == raw_n ? e_success : e_failure;
+
+        if (n - ip < 2)
+            return e_failure;
+        size_t offset = src[ip] | (src[ip + 1] << 8);
+        ip += 2;
+        size_t len = token & 15;
+        if (len == 15 && !get_length(src, n, &ip, &len))
+            return e_failure;
+        len += LZ_MIN_MATCH;
+        if (offset == 0 || offset > op || len > raw_n - op)
+            return e_failure;
+        if (offset >= len)
+        {
+            memcpy(dst + op, dst + op - offset, len);
+        }
+        else
+        {
+            // Overlapping match: the last offset bytes repeat, copy the pattern in doubling runs
+            for (size_t done = 0; done < len;)
+            {
+                size_t run = done + offset < len - done ? done + offset : len - done;
+                memcpy(dst + op + done, dst + op - offset, run);
+                done += run;
+            }
+        }
+        op += len;
+    }
+    return e_failure;
+}
+
+/* One lz_pack()/lz_unpack() call, split in blocks */
+typedef struct
+{
+    const unsigned char *src;
+    unsigned char *dst;
+    size_t raw_n;
+    size_t *packed_pos; // Unpack: where each block starts in src
+    unsigned char *failed;
+} LzJob;
+
+/* Compress block index into its own slot of dst (4 + LZ_BLOCK bytes apart) */
+static void pack_block(void *ctx, size_t index)
+{
+    LzJob *job = ctx;
+    size_t start = index * LZ_BLOCK;
+    size_t n = job->raw_n - start < LZ_BLOCK ? job->raw_n - start : LZ_BLOCK;
+    unsigned char *slot = job->dst + index * (4 + (size_t)LZ_BLOCK);
+
+    size_t len = compress_block(job->src + start, n, slot + 4, n - 1);
+    if (len == 0)
+    {
+        memcpy(slot + 4, job->src + start, n);
+        put_le32(slot, LZ_BLOCK_STORED | n);
+        return;
+    }
+    put_le32(slot, len);
+}
+
+size_t lz_pack(ThreadPool *pool, const unsigned char *src, size_t n, unsigned char *dst)
+{
+    LzJob job = {src, dst, n, NULL, NULL};
+    size_t blocks = (n + LZ_BLOCK - 1) / LZ_BLOCK;
+    size_t out = 0;
+
+    pool_parallel_for(pool, blocks, pack_block, &job);
+    // Close the gaps between the slots, every block moves towards the front
+    for (size_t i = 0; i < blocks; i++)
+    {
+        unsigned char *slot = dst + i * (4 + (size_t)LZ_BLOCK);
+        size_t len = lz_block_span(slot);
+        memmove(dst + out, slot, len);
+        out += len;
+    }
+    return out;
+}
+
+size_t lz_block_span(const unsigned char *p)
+{
+    return 4 + (size_t)(get_le32(p) & ~LZ_BLOCK_STORED);
+}
+
+Status lz_unpack_block(const unsigned char *src, size_t n, size_t *pos, unsigned char *dst, size_t raw_n)
+{
+    if (n - *pos < 4)
+        return e_failure;
+    uint32_t header = get_le32(src + *pos);
+    size_t len = header & ~LZ_BLOCK_STORED;
+    const unsigned char *block = src + *pos + 4;
+    if (len > n - *pos - 4)
+        return e_failure;
+    *pos += 4 + len;
+    if (header & LZ_BLOCK_STORED)
+    {
+        if (len != raw_n)
+            return e_failure;
+        memcpy(dst, block, len);
+        return e_success;
+    }
+    return expand_block(block, len, dst, raw_n);
+}
+
+static void unpack_block(void *ctx, size_t index)
+{
+    LzJob *job = ctx;
+    size_t start = index * LZ_BLOCK;
+    size_t raw = job->raw_n - start < LZ_BLOCK ? job->raw_n - start : LZ_BLOCK;
+    size_t pos = job->packed_pos[index];
+
+    job->failed[index] = lz_unpack_block(job->src, job->packed_pos[index + 1], &pos, job->dst + start, raw) != e_success;
+}
+
+Status lz_unpack(ThreadPool *pool, const unsigned char *src, size_t n, unsigned char *dst, size_t raw_n)
+{
+    size_t blocks = (raw_n + LZ_BLOCK - 1) / LZ_BLOCK;
+    size_t *packed_pos = malloc((blocks + 1) * sizeof(size_t));
+    unsigned char *failed = calloc(blocks ? blocks : 1, 1);
+    Status status = e_success;
+
+    if (packed_pos == NULL || failed == NULL)
+    {
+        free(packed_pos);
+        free(failed);
+        return e_failure;
+    }
+    // The headers give every block's start, then the blocks expand concurrently
+    packed_pos[0] = 0;
+    for (size_t i = 0; i < blocks && status == e_success; i++)
+    {
+        if (n - packed_pos[i] < 4)
+            status = e_failure;
+        else
+            packed_pos[i + 1] = packed_pos[i] + lz_block_span(src + packed_pos[i]);
+        if (status == e_success && packed_pos[i + 1] > n)
+            status = e_failure;
+    }
+    if (status == e_success && packed_pos[blocks] != n)
+        status = e_failure;
+    if (status == e_success)
+    {
+        LzJob job = {src, dst, raw_n, packed_pos, failed};
+        pool_parallel_for(pool, blocks, unpack_block, &job);
+        for (size_t i = 0; i < blocks; i++)
+        {
+            if (failed[i])
+                status = e_failure;
+        }
+    }
+    free(packed_pos);
+    free(failed);
+    return status;
+}
@@ -0,0 +1,40 @@
+#ifndef LZ_H
+#define LZ_H
+
+#include <stddef.h>
+#include "types.h"
+#include "threadpool.h"
+
+/*
+ * Built-in payload compression (-z)
+ * An LZ77 codec with LZ4-style sequences: a token byte holding the literal
+ * and match lengths, the literals, a 16-bit match offset. The payload is
+ * cut into LZ_BLOCK raw bytes, and every block is compressed on its own so
+ * blocks run in parallel and decode one at a time into a small buffer.
+ * A packed block is a 4-byte little-endian header and its bytes: bit 31 set
+ * means stored as is (it did not shrink), the low bits give the length.
+ * The raw size of every block follows from the total recorded in the
+ * stego header (all LZ_BLOCK but the last).
+ */
+#define LZ_BLOCK (64 * 1024)
+#define LZ_BLOCK_STORED 0x80000000u
+
+/* Largest packed size of n raw bytes */
+unsigned long long lz_pack_bound(unsigned long long n);
+
+/* Compress n bytes into dst (lz_pack_bound(n) bytes), returns the packed size */
+size_t lz_pack(ThreadPool *pool, const unsigned char *src, size_t n, unsigned char *dst);
+
+/* Expand n packed bytes into exactly raw_n bytes, e_failure if they are corrupt */
+Status lz_unpack(ThreadPool *pool, const unsigned char *src, size_t n, unsigned char *dst, size_t raw_n);
+
+/* Bytes of the packed block starting at p, its 4-byte header included */
+size_t lz_block_span(const unsigned char *p);
+
+/*
+ * Expand the block at src + *pos into dst (raw_n bytes, at most LZ_BLOCK)
+ * and move *pos past it, for output that is written block by block
+ */
+Status lz_unpack_block(const unsigned char *src, size_t n, size_t *pos, unsigned char *dst, size_t raw_n);
+
+#endif
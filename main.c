@@ -29,22 +29,177 @@ and foundational information security techniques.
 #include "decode.h"
 #include "types.h"
 #include <string.h>
+#include <stdlib.h>
+#include "threadpool.h"
+#include "batch.h"
+#include "stream.h"
+#include "metrics.h"
+#include "server.h"
+#include "probe.h"
+#include "aead.h"
+#include "shard.h"
+#include "pnm.h"
+
+/* Options accepted after the operation type */
+typedef struct
+{
+    int use_mmap;               // -m : map files instead of streaming them
+    int jobs;                   // -j N : worker threads (0 = one per CPU, -1 = not given)
+    const char *batch_manifest; // -b FILE : run every job listed in FILE ("-" = stdin)
+    const char *batch_report;   // -r FILE : per-job status report (default stdout)
+    long long stream_size;      // --size N : payload size declared up front (-1 = unknown)
+    const char *stream_extn;    // --extn EXT : extension recorded for an fd:N secret
+    int depth;                  // -k N : LSBs per carrier byte when encoding (1-4)
+    int quiet;                  // -q : no INFO/progress lines, only errors
+    const char *metrics_path;   // --metrics FILE : stage timings dumped at exit
+    const char *connect_path;   // -c SOCKET : hand the job to a daemon (-s) listening on SOCKET
+    const char *key;            // --key KEY : scatter the payload over the carrier (implies -m)
+    int compress;               // -z : pack the payload before embedding it
+    const unsigned char *cipher_key; // --encrypt KEYFILE : seal/open the payload (points at cipher_key_bytes)
+    unsigned char cipher_key_bytes[AEAD_KEY_BYTES];
+    char **archive_files;       // -a FILE : more files for an archive payload, after the secret
+    int archive_count;
+    const char *member;         // -x NAME : decode only this archive member
+    char **shard_files;         // --shard FILE : more carriers (encode) or shards (decode) of one secret
+    int shard_count;
+    const RawLayout *raw;       // --raw SPEC : carrier/stego image is a headerless dump (points at raw_layout)
+    RawLayout raw_layout;
+} CliOptions;
 
 OperationType check_operation_type(char *);
+Status strip_options(int *argc, char *argv[], CliOptions *opts);
+Status run_batch_command(OperationType op, const CliOptions *opts);
+Status run_probe_command(int argc, char *argv[], const CliOptions *opts);
+void print_usage(void);
+Status run_cli(int argc, char *argv[]);
 
+/* Exit with 0 on success so scripts and batch drivers can rely on the status */
 int main(int argc, char *argv[])
+{
+    return run_cli(argc, argv) == e_success ? 0 : 1;
+}
+
+/* Parse the command line and run the requested operation */
+Status run_cli(int argc, char *argv[])
 {
     EncodeInfo encInfo;
     DecodeInfo decInfo;
+    CliOptions opts = {0, -1, NULL, NULL, -1, NULL, 1, 0, NULL, NULL, NULL, 0, NULL, {0}, NULL, 0, NULL, NULL, 0, NULL, {0}};
+    ThreadPool *pool = NULL;
+    Arena arena;
+    Status status = e_failure;
+
+    memset(&encInfo, 0, sizeof(encInfo));
+    memset(&decInfo, 0, sizeof(decInfo));
+    // The one job of a command line, released on the way out whatever the outcome
+    arena_init(&arena, NULL, 0);
+    encInfo.arena = &arena;
+    decInfo.arena = &arena;
+    if (strip_options(&argc, argv, &opts) != e_success)
+    {
+        print_usage();
+        goto cleanup;
+    }
+    if (opts.metrics_path && metrics_dump_at_exit(opts.metrics_path) != e_success)
+    {
+        printf("ERROR: Unable to set up the metrics dump\n");
+        goto cleanup;
+    }
+    if ((opts.key || opts.compress || opts.cipher_key) && opts.connect_path)
+    {
+        printf("ERROR: --key, -z and --encrypt cannot be passed to a daemon (-c)\n");
+        goto cleanup;
+    }
+    if ((opts.archive_count || opts.member) && (opts.connect_path || opts.batch_manifest))
+    {
+        printf("ERROR: -a and -x cannot be combined with -c or -b\n");
+        goto cleanup;
+    }
+    if (opts.shard_count && (opts.connect_path || opts.batch_manifest || opts.archive_count || opts.member))
+    {
+        printf("ERROR: --shard cannot be combined with -c, -b, -a or -x\n");
+        goto cleanup;
+    }
+    // Mapped images are read by the library, which tells the format by its header
+    if (opts.raw && (opts.connect_path || opts.shard_count || opts.use_mmap || opts.key))
+    {
+        printf("ERROR: --raw cannot be combined with -c, --shard, -m or --key\n");
+        goto cleanup;
+    }
+    // A daemon serves one connection per CPU unless told otherwise
+    if (opts.jobs < 0)
+    {
+        opts.jobs = argc > 1 && check_operation_type(argv[1]) == e_serve ? 0 : 1;
+    }
+    if (opts.jobs == 0)
+    {
+        opts.jobs = pool_cpu_count();
+    }
+    if (argc > 1 && check_operation_type(argv[1]) == e_probe)
+    {
+        status = run_probe_command(argc, argv, &opts);
+        goto cleanup;
+    }
+    if (opts.batch_manifest)
+    {
+        OperationType op = argc > 1 ? check_operation_type(argv[1]) : e_unsupported;
+        if (op != e_encode && op != e_decode)
+        {
+            printf("ERROR: Batch mode needs -e or -d\n");
+            print_usage();
+            goto cleanup;
+        }
+        status = run_batch_command(op, &opts);
+        goto cleanup;
+    }
+    if (argc > 1 && check_operation_type(argv[1]) == e_serve)
+    {
+        if (argc < 3)
+        {
+            printf("##Error: Insufficient arguments##\n");
+            print_usage();
+            goto cleanup;
+        }
+        status = run_server(argv[2], opts.jobs);
+        goto cleanup;
+    }
+    // The calling thread works too, so N jobs need N - 1 pool workers
+    if (opts.jobs > 1 && (pool = pool_create(opts.jobs - 1)) == NULL)
+    {
+        printf("ERROR: Unable to start %d worker threads\n", opts.jobs);
+        goto cleanup;
+    }
+    // Scattered bytes need random access to the files
+    encInfo.use_mmap = opts.use_mmap || opts.key;
+    encInfo.depth = opts.depth;
+    encInfo.key = opts.key;
+    encInfo.compress = opts.compress;
+    encInfo.cipher_key = opts.cipher_key;
+    encInfo.archive_files = opts.archive_files;
+    encInfo.archive_count = opts.archive_count;
+    encInfo.carrier.raw = opts.raw;
+    encInfo.quiet = opts.quiet;
+    decInfo.use_mmap = opts.use_mmap || opts.key;
+    decInfo.key = opts.key;
+    decInfo.cipher_key = opts.cipher_key;
+    decInfo.member = opts.member;
+    decInfo.raw_layout = opts.raw;
+    decInfo.quiet = opts.quiet;
+    encInfo.pool = pool;
+    decInfo.pool = pool;
+    if (opts.stream_size >= 0)
+    {
+        encInfo.size_secret_file = opts.stream_size;
+        encInfo.size_declared = 1;
+    }
+    encInfo.stream_extn = opts.stream_extn;
 
      if(argc < 3)
     {
         printf("##Error: Insufficient arguments##\n");
         //return 1;
-        printf("Usage:\n");
-        printf("  To encode : ./a.out -e <.bmp file> <.txt file> [output file(optional)]\n");
-        printf("  To decode : ./a.out -d <.bmp file> [output file(optional)]\n");
-        return e_failure;
+        print_usage();
+        goto cleanup;
     }
     if(check_operation_type(argv[1]) == e_encode)
     {
@@ -52,62 +207,104 @@ int main(int argc, char *argv[])
         {
             printf("##Error: Insufficient arguments##\n");
             //return 1;
-            printf("Usage:\n");
-            printf("  To encode : ./a.out -e <.bmp file> <.txt file> [output file(optional)]\n");
-            printf("  To decode : ./a.out -d <.bmp file> [output file(optional)]\n");
-            return e_failure;
+            print_usage();
+            goto cleanup;
          printf("Start Encoding operation...\n");
         }
         if(read_and_validate_encode_args(argv, &encInfo) == e_success)
         {
-           printf("Validation Successful\n");
-            if (do_encoding(&encInfo) == e_success)
+            int streaming = is_stream_name(encInfo.src_image_fname) || is_stream_name(encInfo.stego_image_fname);
+            if (streaming && (opts.connect_path || opts.key || opts.compress || opts.archive_count || opts.shard_count))
+            {
+                printf("ERROR: -c, --key, -z, -a and --shard need file names, not stdin/stdout\n");
+                goto cleanup;
+            }
+            if (opts.shard_count && is_secret_fd_name(encInfo.secret_fname))
             {
-                printf("Encoding Completed Successfully\n");
+                printf("ERROR: --shard needs the secret in a file, not fd:N\n");
+                goto cleanup;
+            }
+            // Stego image on stdout: every message from here on goes to stderr
+            if (is_stream_name(encInfo.stego_image_fname) && stream_take_stdout() == NULL)
+            {
+                goto cleanup;
+            }
+            if (!opts.quiet)
+                printf("Validation Successful\n");
+            Status done = opts.connect_path  ? client_encode(opts.connect_path, &encInfo)
+                          : streaming        ? do_stream_encoding(&encInfo)
+                          : opts.shard_count ? do_shard_encoding(&encInfo, opts.shard_files, opts.shard_count)
+                                             : do_encoding(&encInfo);
+            if (done == e_success)
+            {
+                if (!opts.quiet)
+                    printf("Encoding Completed Successfully\n");
             }
             else
             {
                 printf("ERROR: Encoding Failed\n");
-                return e_failure;
+                goto cleanup;
             }
         }
         else
         {
            printf("ERROR: Validation Failed\n"); 
-           return e_failure;
+           goto cleanup;
         }
     }
     else if (check_operation_type(argv[1]) == e_decode)
     {
          if (read_and_validate_decode_args(argv, &decInfo) == e_success)
         {
-            printf("Validation Successful\n");
-            if (do_decoding(&decInfo) == e_success)
+            int streaming = is_stream_name(decInfo.stego_image_fname) || is_stream_name(decInfo.output_fname);
+            if (streaming && (opts.connect_path || opts.key || opts.member || opts.shard_count))
             {
-                printf("Decoding Completed Successfully\n");
+                printf("ERROR: -c, --key, -x and --shard need file names, not stdin/stdout\n");
+                goto cleanup;
+            }
+            // Payload on stdout: every message from here on goes to stderr
+            if (is_stream_name(decInfo.output_fname) && stream_take_stdout() == NULL)
+            {
+                goto cleanup;
+            }
+            if (!opts.quiet)
+                printf("Validation Successful\n");
+            DStatus done = opts.connect_path  ? client_decode(opts.connect_path, &decInfo)
+                           : streaming        ? do_stream_decoding(&decInfo)
+                           : opts.shard_count ? do_shard_decoding(&decInfo, opts.shard_files, opts.shard_count)
+                                              : do_decoding(&decInfo);
+            if (done == d_success)
+            {
+                if (!opts.quiet)
+                    printf("Decoding Completed Successfully\n");
             }
             else
             {
                 printf("ERROR: Decoding Failed\n");
-                return e_failure;
+                goto cleanup;
             }
         }
         else
         {
             printf("ERROR: Validation Failed\n");
-            return e_failure;
+            goto cleanup;
         }
     }
     else
     {
         printf("ERROR: Unsupported operation type '%s'\n", argv[1]);
-        printf("Usage:\n");
-        printf("  To encode : ./a.out -e <.bmp file> <.txt file> [output file(optional)]\n");
-        printf("  To decode : ./a.out -d <.bmp file> [output file(optional)]\n");
-        return e_failure;
+        print_usage();
+        goto cleanup;
     }
 
-    return e_success;     
+    status = e_success;
+
+cleanup:
+    pool_destroy(pool);
+    arena_release(&arena);
+    free(opts.archive_files);
+    free(opts.shard_files);
+    return status;
     
 }
 
@@ -121,8 +318,260 @@ OperationType check_operation_type(char *symbol)
     {
         return e_decode ;
     }
+    else if(strcmp(symbol, "-p") == 0 || strcmp(symbol, "--probe") == 0)
+    {
+        return e_probe ;
+    }
+    else if(strcmp(symbol, "-s") == 0 || strcmp(symbol, "--serve") == 0)
+    {
+        return e_serve ;
+    }
     else
     {
         return e_unsupported;
     }
-}
\ No newline at end of file
+}
+
+/* Batch mode: every job of the manifest runs on a pool of opts->jobs workers */
+Status run_batch_command(OperationType op, const CliOptions *opts)
+{
+    BatchOptions batch;
+    BatchSummary summary;
+
+    batch.op = op;
+    batch.use_mmap = opts->use_mmap;
+    batch.depth = opts->depth;
+    batch.key = opts->key;
+    batch.compress = opts->compress;
+    batch.cipher_key = opts->cipher_key;
+    batch.raw = opts->raw;
+    batch.pool = NULL;
+    batch.report = stdout;
+    if (opts->batch_report && (batch.report = fopen(opts->batch_report, "w")) == NULL)
+    {
+        perror("fopen");
+        fprintf(stderr, "ERROR: Unable to open report file %s\n", opts->batch_report);
+        return e_failure;
+    }
+    // The main thread only reads the manifest, so every job slot is a pool worker
+    Status status = e_failure;
+    if (opts->jobs > 1 && (batch.pool = pool_create(opts->jobs)) == NULL)
+    {
+        printf("ERROR: Unable to start %d worker threads\n", opts->jobs);
+    }
+    else
+    {
+        status = run_batch(opts->batch_manifest, &batch, &summary);
+        pool_destroy(batch.pool);
+        fprintf(stderr, "INFO : Batch done: %lu jobs, %lu ok, %lu failed\n",
+                summary.jobs, summary.ok, summary.failed);
+    }
+    if (batch.report != stdout)
+    {
+        fclose(batch.report);
+    }
+    return status;
+}
+
+/* Probe mode: one report line per image named on the command line or in the -b list */
+Status run_probe_command(int argc, char *argv[], const CliOptions *opts)
+{
+    Status status = e_success;
+
+    if (argc < 3 && opts->batch_manifest == NULL)
+    {
+        printf("##Error: Insufficient arguments##\n");
+        print_usage();
+        return e_failure;
+    }
+    if (opts->batch_manifest && probe_list(opts->batch_manifest, opts->use_mmap, stdout) != e_success)
+    {
+        status = e_failure;
+    }
+    for (int i = 2; i < argc; i++)
+    {
+        if (probe_image(argv[i], opts->use_mmap, stdout) != e_success)
+        {
+            status = e_failure;
+        }
+    }
+    return status;
+}
+
+/* Print command line usage */
+void print_usage(void)
+{
+    printf("Usage:\n");
+    printf("  To encode : ./a.out -e <image> <.txt file> [output file(optional)] [options]\n");
+    printf("  To decode : ./a.out -d <image> [output file(optional)] [options]\n");
+    printf("  To probe  : ./a.out -p <image>... [-b list] (payload and free capacity, header bytes only)\n");
+    printf("  Images are BMP, PNG, binary PPM/PGM (told by their first bytes) or headerless dumps (--raw)\n");
+    printf("  Daemon    : ./a.out -s <socket> [-j N]  (N connections at once, default one per CPU)\n");
+    printf("Options:\n");
+    printf("  -m, --mmap : map files into memory instead of streaming them (BMP, PPM and PGM only)\n");
+    printf("  -j N       : embed/extract with N threads (0 = one per CPU, default 1)\n");
+    printf("  -k N       : encode N bits per carrier byte (1-4, default 1); decode reads it from the image\n");
+    printf("  -b FILE    : batch mode, run one job per line of FILE (- = stdin)\n");
+    printf("               encode lines: <image> <secret file> <output image>\n");
+    printf("               decode lines: <image> <output file>\n");
+    printf("  -r FILE    : batch mode per-job status report (default stdout)\n");
+    printf("  - as an image or output streams it through stdin/stdout\n");
+    printf("  fd:N       : read the secret from an open descriptor (e.g. a pipe)\n");
+    printf("  --size N   : payload size declared up front, so a piped secret is not read ahead\n");
+    printf("  --extn EXT : extension recorded for an fd:N secret (default .bin)\n");
+    printf("  -q, --quiet: print errors only, no per-stage INFO lines\n");
+    printf("  --key KEY  : scatter the payload over the carrier by KEY (implies -m); decode needs the same KEY\n");
+    printf("  -z, --compress : pack the payload before embedding it; decode expands it on its own\n");
+    printf("  --encrypt KEYFILE : seal the payload with ChaCha20-Poly1305 under the 32-byte key in KEYFILE\n");
+    printf("               (raw or 64 hex digits); decode needs the same KEYFILE\n");
+    printf("  -a FILE    : add FILE to the payload (repeat for more), which becomes an archive of the\n");
+    printf("               secret file and every FILE; decode writes the members into the output directory\n");
+    printf("  --raw SPEC : the image is a headerless dump of samples, SPEC = WIDTHxHEIGHT[xPLANES][:8|:16|:16le|:16be]\n");
+    printf("               (planes or interleaved samples, 8 bits by default); decode needs the same SPEC\n");
+    printf("  -x NAME    : decode only the archive member NAME, read straight from its own carrier bytes\n");
+    printf("  --shard FILE : encode: spread the secret over FILE too (repeat for more carriers), the\n");
+    printf("               shards go to <output>.1.bmp, <output>.2.bmp, ...; decode: put the secret\n");
+    printf("               back together from the .bmp file and every FILE, in any order\n");
+    printf("  -c SOCKET  : run the encode/decode in the daemon listening on SOCKET\n");
+    printf("  --metrics FILE : write stage timings, byte and syscall counters at exit\n");
+    printf("               (Prometheus textfile if FILE ends in .prom, JSON otherwise)\n");
+}
+
+/* Remove option flags found after the operation type from argv,
+ * so the remaining arguments keep their fixed positions */
+Status strip_options(int *argc, char *argv[], CliOptions *opts)
+{
+    int out = 2;
+    for (int i = 2; i < *argc; i++)
+    {
+        if (strcmp(argv[i], "-m") == 0 || strcmp(argv[i], "--mmap") == 0)
+        {
+            opts->use_mmap = 1;
+        }
+        else if (strcmp(argv[i], "--size") == 0 && i + 1 < *argc)
+        {
+            char *end;
+            opts->stream_size = strtoll(argv[++i], &end, 10);
+            if (*end != '\0' || opts->stream_size < 0)
+            {
+                printf("ERROR: --size expects a byte count\n");
+                return e_failure;
+            }
+        }
+        else if ((strcmp(argv[i], "-k") == 0 || strcmp(argv[i], "--depth") == 0) && i + 1 < *argc)
+        {
+            char *end;
+            long depth = strtol(argv[++i], &end, 10);
+            if (*end != '\0' || depth < 1 || depth > 4)
+            {
+                printf("ERROR: -k expects a depth between 1 and 4\n");
+                return e_failure;
+            }
+            opts->depth = (int)depth;
+        }
+        else if (strcmp(argv[i], "-q") == 0 || strcmp(argv[i], "--quiet") == 0)
+        {
+            opts->quiet = 1;
+        }
+        else if (strcmp(argv[i], "-z") == 0 || strcmp(argv[i], "--compress") == 0)
+        {
+            opts->compress = 1;
+        }
+        else if ((strcmp(argv[i], "-c") == 0 || strcmp(argv[i], "--connect") == 0) && i + 1 < *argc)
+        {
+            opts->connect_path = argv[++i];
+        }
+        else if (strcmp(argv[i], "--key") == 0 && i + 1 < *argc)
+        {
+            opts->key = argv[++i];
+            if (*opts->key == '\0')
+            {
+                printf("ERROR: --key expects a non-empty key\n");
+                return e_failure;
+            }
+        }
+        else if (strcmp(argv[i], "--encrypt") == 0 && i + 1 < *argc)
+        {
+            if (aead_load_key(argv[++i], opts->cipher_key_bytes) != e_success)
+            {
+                printf("ERROR: --encrypt expects a file holding a 32-byte key (raw or 64 hex digits)\n");
+                return e_failure;
+            }
+            opts->cipher_key = opts->cipher_key_bytes;
+        }
+        else if ((strcmp(argv[i], "-a") == 0 || strcmp(argv[i], "--add") == 0) && i + 1 < *argc)
+        {
+            // Room for every argument, so one allocation covers any number of -a
+            if (opts->archive_files == NULL && (opts->archive_files = malloc(*argc * sizeof(char *))) == NULL)
+            {
+                return e_failure;
+            }
+            opts->archive_files[opts->archive_count++] = argv[++i];
+        }
+        else if (strcmp(argv[i], "--shard") == 0 && i + 1 < *argc)
+        {
+            if (opts->shard_files == NULL && (opts->shard_files = malloc(*argc * sizeof(char *))) == NULL)
+            {
+                return e_failure;
+            }
+            opts->shard_files[opts->shard_count++] = argv[++i];
+        }
+        else if (strcmp(argv[i], "--raw") == 0 && i + 1 < *argc)
+        {
+            if (pnm_raw_spec(argv[++i], &opts->raw_layout) != e_success)
+            {
+                printf("ERROR: --raw expects WIDTHxHEIGHT[xPLANES][:8|:16|:16le|:16be]\n");
+                return e_failure;
+            }
+            opts->raw = &opts->raw_layout;
+        }
+        else if ((strcmp(argv[i], "-x") == 0 || strcmp(argv[i], "--extract") == 0) && i + 1 < *argc)
+        {
+            opts->member = argv[++i];
+        }
+        else if (strcmp(argv[i], "--metrics") == 0 && i + 1 < *argc)
+        {
+            opts->metrics_path = argv[++i];
+        }
+        else if (strcmp(argv[i], "--extn") == 0 && i + 1 < *argc)
+        {
+            // The decoder appends it to the output name, it must not name another directory
+            if (argv[++i][0] != '.' || !stego_extn_ok(argv[i]))
+            {
+                printf("ERROR: --extn expects '.' and up to %d more characters, no '/' or '\\'\n", STEGO_EXTN_MAX - 1);
+                return e_failure;
+            }
+            opts->stream_extn = argv[i];
+        }
+        else if ((strcmp(argv[i], "-b") == 0 || strcmp(argv[i], "-r") == 0) && i + 1 < *argc)
+        {
+            if (argv[i][1] == 'b')
+                opts->batch_manifest = argv[++i];
+            else
+                opts->batch_report = argv[++i];
+        }
+        else if (strncmp(argv[i], "-j", 2) == 0)
+        {
+            // Accept both "-j N" and "-jN"
+            const char *value = argv[i][2] ? argv[i] + 2 : (i + 1 < *argc ? argv[++i] : NULL);
+            char *end;
+            long jobs = value ? strtol(value, &end, 10) : -1;
+            if (value == NULL || *end != '\0' || jobs < 0 || jobs > 1024)
+            {
+                printf("ERROR: -j expects a thread count between 0 and 1024\n");
+                return e_failure;
+            }
+            opts->jobs = (int)jobs;
+        }
+        else
+        {
+            argv[out++] = argv[i];
+        }
+    }
+    if (*argc > 2)
+    {
+        *argc = out;
+        argv[out] = NULL;
+    }
+    return e_success;
+}
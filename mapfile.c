@@ -0,0 +1,176 @@
+#define _GNU_SOURCE
+#define _FILE_OFFSET_BITS 64
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include "mapfile.h"
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#ifdef _WIN32
+
+Status map_file_read(const char *fname, MappedFile *map)
+{
+    memset(map, 0, sizeof(*map));
+    fprintf(stderr, "ERROR: mmap mode is not supported on this platform (%s)\n", fname);
+    return e_failure;
+}
+
+Status map_file_create(const char *fname, size_t size, MappedFile *map)
+{
+    (void)size;
+    return map_file_read(fname, map);
+}
+
+Status map_fd_read(int fd, MappedFile *map)
+{
+    (void)fd;
+    memset(map, 0, sizeof(*map));
+    return e_failure;
+}
+
+Status map_fd_create(int fd, size_t size, MappedFile *map)
+{
+    (void)size;
+    return map_fd_read(fd, map);
+}
+
+Status file_preallocate(int fd, unsigned long long off, unsigned long long len)
+{
+    (void)fd, (void)off, (void)len;
+    return e_success;
+}
+
+void unmap_file(MappedFile *map)
+{
+    memset(map, 0, sizeof(*map));
+}
+
+#else
+
+/* Map an open descriptor read-only; fails quietly unless it is a regular file */
+Status map_fd_read(int fd, MappedFile *map)
+{
+    struct stat st;
+
+    memset(map, 0, sizeof(*map));
+    map->fd = fd;
+    if (fstat(fd, &st) < 0 || !S_ISREG(st.st_mode))
+    {
+        map->fd = -1;
+        return e_failure;
+    }
+
+    map->size = (size_t)st.st_size;
+    // mmap() rejects zero-length mappings, an empty file simply has no data
+    if (map->size == 0)
+        return e_success;
+
+    void *addr = mmap(NULL, map->size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (addr == MAP_FAILED)
+    {
+        map->fd = -1;
+        return e_failure;
+    }
+    map->data = addr;
+    // Both encode and decode walk the file front to back
+    madvise(map->data, map->size, MADV_SEQUENTIAL);
+    return e_success;
+}
+
+/* Map an existing file read-only */
+Status map_file_read(const char *fname, MappedFile *map)
+{
+    int fd = open(fname, O_RDONLY);
+
+    memset(map, 0, sizeof(*map));
+    if (fd < 0)
+    {
+        perror("open");
+        fprintf(stderr, "ERROR: Unable to open file %s\n", fname);
+        return e_failure;
+    }
+    if (map_fd_read(fd, map) != e_success)
+    {
+        perror("mmap");
+        fprintf(stderr, "ERROR: Unable to map file %s\n", fname);
+        close(fd);
+        return e_failure;
+    }
+    return e_success;
+}
+
+/* Size an open regular file and map it read-write; fails quietly otherwise */
+Status map_fd_create(int fd, size_t size, MappedFile *map)
+{
+    struct stat st;
+
+    memset(map, 0, sizeof(*map));
+    map->fd = -1;
+    if (fstat(fd, &st) < 0 || !S_ISREG(st.st_mode) || ftruncate(fd, (off_t)size) < 0)
+        return e_failure;
+
+    map->size = size;
+    if (size > 0)
+    {
+        void *addr = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if (addr == MAP_FAILED)
+            return e_failure;
+        map->data = addr;
+    }
+    map->fd = fd;
+    return e_success;
+}
+
+/* Create (or truncate) a file of the given size and map it read-write */
+Status map_file_create(const char *fname, size_t size, MappedFile *map)
+{
+    int fd = open(fname, O_RDWR | O_CREAT | O_TRUNC, 0644);
+
+    memset(map, 0, sizeof(*map));
+    if (fd < 0)
+    {
+        perror("open");
+        fprintf(stderr, "ERROR: Unable to open file %s\n", fname);
+        return e_failure;
+    }
+    if (map_fd_create(fd, size, map) != e_success)
+    {
+        perror("mmap");
+        fprintf(stderr, "ERROR: Unable to map file %s\n", fname);
+        close(fd);
+        return e_failure;
+    }
+    return e_success;
+}
+
+/* Reserve the blocks up front, the size only grows as the data is written */
+Status file_preallocate(int fd, unsigned long long off, unsigned long long len)
+{
+#ifdef __linux__
+    if (len == 0 || fallocate(fd, FALLOC_FL_KEEP_SIZE, (off_t)off, (off_t)len) == 0)
+        return e_success;
+    // Filesystems without fallocate() simply fill up as the data is written
+    return errno == ENOSPC || errno == EFBIG ? e_failure : e_success;
+#else
+    (void)fd, (void)off, (void)len;
+    return e_success;
+#endif
+}
+
+/* Unmap and close, safe to call on a zeroed MappedFile */
+void unmap_file(MappedFile *map)
+{
+    if (map->data)
+        munmap(map->data, map->size);
+    if (map->fd > 0)
+        close(map->fd);
+    memset(map, 0, sizeof(*map));
+}
+
+#endif
@@ -0,0 +1,37 @@
+#ifndef MAPFILE_H
+#define MAPFILE_H
+
+#include <stddef.h>
+#include "types.h"
+
+/* A whole file mapped into memory */
+typedef struct _MappedFile
+{
+    unsigned char *data; // Start of the mapping (NULL for an empty file)
+    size_t size;         // Size of the file in bytes
+    int fd;              // Descriptor backing the mapping
+} MappedFile;
+
+/* Map an existing file read-only */
+Status map_file_read(const char *fname, MappedFile *map);
+
+/* Map an open regular file read-only, the mapping takes over fd (fails quietly otherwise) */
+Status map_fd_read(int fd, MappedFile *map);
+
+/* Create (or truncate) a file of the given size and map it read-write */
+Status map_file_create(const char *fname, size_t size, MappedFile *map);
+
+/* Same on an open descriptor (regular files only, fails quietly otherwise) */
+Status map_fd_create(int fd, size_t size, MappedFile *map);
+
+/*
+ * Reserve disk blocks for len bytes of fd from off on, leaving the file size
+ * alone, so a file written piecemeal is laid out in one go; e_failure (errno
+ * set) only when the disk is full, filesystems that cannot reserve are skipped
+ */
+Status file_preallocate(int fd, unsigned long long off, unsigned long long len);
+
+/* Unmap and close, safe to call on a zeroed MappedFile */
+void unmap_file(MappedFile *map);
+
+#endif
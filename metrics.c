@@ -0,0 +1,201 @@
+#define _POSIX_C_SOURCE 200809L
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include "metrics.h"
+
+static const char *const stage_names[STAGE_COUNT] = {
+    "open", "parse", "header_copy", "magic", "descriptor", "extn_size", "extn", "size", "codec", "data", "tail", "close"};
+
+static const char *const stage_labels[STAGE_COUNT] = {
+    "Open files", "Parse BMP header", "Copy image header", "Magic string", "Format descriptor",
+    "Extension size", "Extension", "Payload size", "Payload codec", "Payload data", "Copy left over data", "Close files"};
+
+static const char *const op_names[METRICS_OPS] = {"encode", "decode"};
+
+/* Process-wide totals, written by finished jobs (batch jobs finish on any worker) */
+static pthread_mutex_t totals_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct
+{
+    unsigned long long jobs[METRICS_OPS];
+    unsigned long long failed[METRICS_OPS];
+    unsigned long long total_ns[METRICS_OPS];
+    unsigned long long stage_ns[METRICS_OPS][STAGE_COUNT];
+    unsigned long long stage_bytes[METRICS_OPS][STAGE_COUNT];
+} totals;
+
+/* Set once from main() before any job starts */
+static const char *dump_path;
+
+const char *metrics_stage_name(Stage stage)
+{
+    return stage_names[stage];
+}
+
+void metrics_print_stage(const JobMetrics *m, Stage stage, unsigned long long ns, unsigned long long bytes)
+{
+    (void)m;
+    if (bytes)
+        printf("INFO : %-20s %10.3f ms  %llu bytes\n", stage_labels[stage], ns / 1e6, bytes);
+    else
+        printf("INFO : %-20s %10.3f ms\n", stage_labels[stage], ns / 1e6);
+}
+
+void metrics_job_begin(JobMetrics *m, MetricsOp op, int quiet)
+{
+    memset(m, 0, sizeof(*m));
+    m->op = op;
+    m->verbose = !quiet;
+    m->timing = m->verbose || dump_path != NULL;
+    if (m->timing)
+        m->started_ns = metrics_now_ns();
+}
+
+void metrics_job_end(JobMetrics *m, int ok)
+{
+    if (!m->timing)
+        return;
+    unsigned long long total = metrics_now_ns() - m->started_ns;
+    if (m->verbose)
+        printf("INFO : %-20s %10.3f ms\n", "Total", total / 1e6);
+    if (dump_path == NULL)
+        return;
+
+    pthread_mutex_lock(&totals_lock);
+    totals.jobs[m->op]++;
+    totals.failed[m->op] += !ok;
+    totals.total_ns[m->op] += total;
+    for (int i = 0; i < STAGE_COUNT; i++)
+    {
+        totals.stage_ns[m->op][i] += m->stage_ns[i];
+        totals.stage_bytes[m->op][i] += m->stage_bytes[i];
+    }
+    pthread_mutex_unlock(&totals_lock);
+}
+
+/* Counters the kernel keeps for the whole process */
+typedef struct
+{
+    unsigned long long read_calls, write_calls; // syscr/syscw
+    unsigned long long read_bytes, write_bytes; // rchar/wchar
+    long peak_rss_kb;
+    double user_s, system_s;
+} ProcessCounters;
+
+static void read_process_counters(ProcessCounters *pc)
+{
+    char line[128];
+    FILE *fp = fopen("/proc/self/io", "r");
+    struct rusage ru;
+
+    memset(pc, 0, sizeof(*pc));
+    while (fp && fgets(line, sizeof(line), fp))
+    {
+        sscanf(line, "syscr: %llu", &pc->read_calls);
+        sscanf(line, "syscw: %llu", &pc->write_calls);
+        sscanf(line, "rchar: %llu", &pc->read_bytes);
+        sscanf(line, "wchar: %llu", &pc->write_bytes);
+    }
+    if (fp)
+        fclose(fp);
+    getrusage(RUSAGE_SELF, &ru);
+    pc->peak_rss_kb = ru.ru_maxrss;
+    pc->user_s = ru.ru_utime.tv_sec + ru.ru_utime.tv_usec / 1e6;
+    pc->system_s = ru.ru_stime.tv_sec + ru.ru_stime.tv_usec / 1e6;
+}
+
+static void write_json(FILE *fp, const ProcessCounters *pc)
+{
+    fprintf(fp, "{\n");
+    for (int op = 0; op < METRICS_OPS; op++)
+    {
+        fprintf(fp, "  \"%s\": {\"jobs\": %llu, \"failed\": %llu, \"seconds\": %.9f, \"stages\": {\n",
+                op_names[op], totals.jobs[op], totals.failed[op], totals.total_ns[op] / 1e9);
+        for (int i = 0; i < STAGE_COUNT; i++)
+            fprintf(fp, "    \"%s\": {\"seconds\": %.9f, \"bytes\": %llu}%s\n", stage_names[i],
+                    totals.stage_ns[op][i] / 1e9, totals.stage_bytes[op][i], i + 1 < STAGE_COUNT ? "," : "");
+        fprintf(fp, "  }},\n");
+    }
+    fprintf(fp, "  \"process\": {\"read_syscalls\": %llu, \"write_syscalls\": %llu, \"read_bytes\": %llu, "
+                "\"write_bytes\": %llu, \"peak_rss_kb\": %ld, \"user_seconds\": %.6f, \"system_seconds\": %.6f}\n}\n",
+            pc->read_calls, pc->write_calls, pc->read_bytes, pc->write_bytes, pc->peak_rss_kb, pc->user_s, pc->system_s);
+}
+
+/* Prometheus text exposition format, for the node_exporter textfile collector */
+static void write_prometheus(FILE *fp, const ProcessCounters *pc)
+{
+    fprintf(fp, "# HELP stego_jobs_total Encode/decode jobs run.\n# TYPE stego_jobs_total counter\n");
+    for (int op = 0; op < METRICS_OPS; op++)
+    {
+        fprintf(fp, "stego_jobs_total{op=\"%s\",result=\"ok\"} %llu\n", op_names[op], totals.jobs[op] - totals.failed[op]);
+        fprintf(fp, "stego_jobs_total{op=\"%s\",result=\"failed\"} %llu\n", op_names[op], totals.failed[op]);
+    }
+    fprintf(fp, "# HELP stego_job_seconds_total Wall time spent in jobs.\n# TYPE stego_job_seconds_total counter\n");
+    for (int op = 0; op < METRICS_OPS; op++)
+        fprintf(fp, "stego_job_seconds_total{op=\"%s\"} %.9f\n", op_names[op], totals.total_ns[op] / 1e9);
+    fprintf(fp, "# HELP stego_stage_seconds_total Wall time spent in each stage.\n# TYPE stego_stage_seconds_total counter\n");
+    for (int op = 0; op < METRICS_OPS; op++)
+        for (int i = 0; i < STAGE_COUNT; i++)
+            fprintf(fp, "stego_stage_seconds_total{op=\"%s\",stage=\"%s\"} %.9f\n", op_names[op], stage_names[i],
+                    totals.stage_ns[op][i] / 1e9);
+    fprintf(fp, "# HELP stego_stage_bytes_total Bytes moved by each stage.\n# TYPE stego_stage_bytes_total counter\n");
+    for (int op = 0; op < METRICS_OPS; op++)
+        for (int i = 0; i < STAGE_COUNT; i++)
+            fprintf(fp, "stego_stage_bytes_total{op=\"%s\",stage=\"%s\"} %llu\n", op_names[op], stage_names[i],
+                    totals.stage_bytes[op][i]);
+    fprintf(fp, "# HELP stego_syscalls_total Read and write system calls of the process.\n# TYPE stego_syscalls_total counter\n");
+    fprintf(fp, "stego_syscalls_total{kind=\"read\"} %llu\nstego_syscalls_total{kind=\"write\"} %llu\n",
+            pc->read_calls, pc->write_calls);
+    fprintf(fp, "# HELP stego_io_bytes_total Bytes passed to read and write system calls.\n# TYPE stego_io_bytes_total counter\n");
+    fprintf(fp, "stego_io_bytes_total{kind=\"read\"} %llu\nstego_io_bytes_total{kind=\"write\"} %llu\n",
+            pc->read_bytes, pc->write_bytes);
+    fprintf(fp, "# HELP stego_cpu_seconds_total CPU time of the process.\n# TYPE stego_cpu_seconds_total counter\n");
+    fprintf(fp, "stego_cpu_seconds_total{mode=\"user\"} %.6f\nstego_cpu_seconds_total{mode=\"system\"} %.6f\n",
+            pc->user_s, pc->system_s);
+    fprintf(fp, "# HELP stego_peak_rss_bytes Peak resident set size.\n# TYPE stego_peak_rss_bytes gauge\n");
+    fprintf(fp, "stego_peak_rss_bytes %lld\n", pc->peak_rss_kb * 1024LL);
+}
+
+/* Written next to the target and renamed, so collectors never read half a file */
+static void dump_metrics(void)
+{
+    size_t len = strlen(dump_path);
+    int prometheus = len >= 5 && strcmp(dump_path + len - 5, ".prom") == 0;
+    char *tmp = malloc(len + 5);
+    ProcessCounters pc;
+    FILE *fp;
+
+    if (tmp == NULL)
+        return;
+    sprintf(tmp, "%s.tmp", dump_path);
+    if ((fp = fopen(tmp, "w")) == NULL)
+    {
+        perror("fopen");
+        fprintf(stderr, "ERROR : Unable to write metrics to %s\n", tmp);
+        free(tmp);
+        return;
+    }
+    read_process_counters(&pc);
+    pthread_mutex_lock(&totals_lock);
+    if (prometheus)
+        write_prometheus(fp, &pc);
+    else
+        write_json(fp, &pc);
+    pthread_mutex_unlock(&totals_lock);
+    if (fclose(fp) != 0 || rename(tmp, dump_path) != 0)
+    {
+        perror("metrics");
+        remove(tmp);
+    }
+    free(tmp);
+}
+
+Status metrics_dump_at_exit(const char *path)
+{
+    if (path == NULL || *path == '\0' || atexit(dump_metrics) != 0)
+        return e_failure;
+    dump_path = path;
+    return e_success;
+}
@@ -0,0 +1,94 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <time.h>
+#include "types.h"
+
+/*
+ * Stage instrumentation
+ * Every encode/decode job records the time and bytes of each stage in
+ * its own JobMetrics (no locking on the hot path); finished jobs are
+ * merged into process-wide totals that can be dumped at exit as JSON or
+ * as a Prometheus textfile. With quiet output and no dump requested the
+ * timers are off and every hook is a single branch.
+ */
+
+/* Stages of do_encoding()/do_decoding(), in the order they run */
+typedef enum
+{
+    STAGE_OPEN,        // Open or map the files
+    STAGE_PARSE,       // BMP header parse (and capacity check when encoding)
+    STAGE_HEADER_COPY, // Header copied to the stego image (stdio encode)
+    STAGE_MAGIC,
+    STAGE_DESCRIPTOR,
+    STAGE_EXTN_SIZE,
+    STAGE_EXTN,        // Decoding also creates the output file here
+    STAGE_SIZE,
+    STAGE_CODEC,       // Payload compression (-z); decoding expands within STAGE_DATA
+    STAGE_DATA,        // Payload embed/extract
+    STAGE_TAIL,        // Pixels after the payload (stdio encode)
+    STAGE_CLOSE,
+    STAGE_COUNT
+} Stage;
+
+typedef enum
+{
+    METRICS_ENCODE,
+    METRICS_DECODE,
+    METRICS_OPS
+} MetricsOp;
+
+/* Per-job record, owned by one thread */
+typedef struct _JobMetrics
+{
+    int timing;                 // Timers running
+    int verbose;                // Print one INFO line per stage
+    MetricsOp op;
+    unsigned long long started_ns;  // Start of the job
+    unsigned long long stage_start; // Start of the running stage
+    unsigned long long stage_ns[STAGE_COUNT];
+    unsigned long long stage_bytes[STAGE_COUNT];
+} JobMetrics;
+
+/* Dump the process totals to path at exit: Prometheus text if it ends in .prom, JSON otherwise */
+Status metrics_dump_at_exit(const char *path);
+
+/* Reset m for a new job; quiet jobs only time stages when a dump was requested */
+void metrics_job_begin(JobMetrics *m, MetricsOp op, int quiet);
+
+/* Merge a finished (or failed) job into the process totals */
+void metrics_job_end(JobMetrics *m, int ok);
+
+/* Name of a stage as used in the dumps */
+const char *metrics_stage_name(Stage stage);
+
+/* Monotonic clock in nanoseconds */
+static inline unsigned long long metrics_now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* Print the INFO line for a finished stage */
+void metrics_print_stage(const JobMetrics *m, Stage stage, unsigned long long ns, unsigned long long bytes);
+
+static inline void stage_begin(JobMetrics *m)
+{
+    if (m->timing)
+        m->stage_start = metrics_now_ns();
+}
+
+/* Close the running stage, bytes is what it moved (payload or carrier bytes) */
+static inline void stage_end(JobMetrics *m, Stage stage, unsigned long long bytes)
+{
+    if (!m->timing)
+        return;
+    unsigned long long ns = metrics_now_ns() - m->stage_start;
+    m->stage_ns[stage] += ns;
+    m->stage_bytes[stage] += bytes;
+    if (m->verbose)
+        metrics_print_stage(m, stage, ns, bytes);
+}
+
+#endif
@@ -0,0 +1,566 @@
+#define _GNU_SOURCE
+#define _FILE_OFFSET_BITS 64
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include "png.h"
+#include "flate.h"
+
+const unsigned char png_signature[PNG_SIGNATURE_BYTES] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n'};
+
+/* IDAT chunks written hold this much compressed data */
+#define PNG_IDAT_BYTES (64 * 1024)
+/* Largest chunk the format allows */
+#define PNG_CHUNK_MAX 0x7fffffffu
+
+#define PNG_FILTER_PAETH 4
+
+struct _PngImage
+{
+    int refs;                 // Holders: the caller, the reader, the writer
+
+    /* Image header */
+    uint32_t width;
+    uint32_t height;
+    size_t pixel_bytes;       // Bytes per pixel, the distance the filters look back
+    size_t row_len;           // Bytes per row, the filter byte not counted
+
+    /* Chunks copied to the stego image as they are, length, type and CRC included */
+    unsigned char *head;      // Signature, IHDR and everything up to the first IDAT
+    size_t head_len;
+    unsigned char *tail;      // Everything after the last IDAT, through IEND
+    size_t tail_len;
+    int tail_done;            // IEND was read
+    unsigned char *filters;   // Filter type of every row, the writer uses the same
+
+    /* Reader */
+    FILE *in;
+    int close_in;             // in is not stdin
+    Inflater *inf;
+    uint32_t idat_left;       // Bytes left in the current IDAT chunk
+    uint32_t idat_crc;        // CRC-32 of the current IDAT chunk so far
+    int idat_end;             // The image data ended (or broke off)
+    unsigned char *row;       // Last row decoded
+    unsigned char *prev;      // The row before it (zeros above the first)
+    size_t row_pos;           // Next byte of row to hand out
+    uint32_t rows_read;
+
+    /* Writer */
+    FILE *out;
+    Deflater *def;
+    unsigned char *wrow;      // Row being written
+    unsigned char *wprev;     // The row before it
+    unsigned char *filtered;  // Filter byte and filtered row, what gets deflated
+    size_t wrow_pos;
+    uint32_t rows_written;
+    unsigned char *chunk;     // IDAT chunk being filled, room for its length and type in front
+    size_t chunk_len;
+    int write_failed;
+};
+
+/* CRC-32 (IEEE, reflected), the chunk checksum, a 4-bit table like crc32c.c without SSE4.2 */
+static const uint32_t crc32_nibble[16] = {0x00000000, 0x1db71064, 0x3b6e20c8, 0x26d930ac, 0x76dc4190, 0x6b6b51f4,
+                                          0x4db26158, 0x5005713c, 0xedb88320, 0xf00f9344, 0xd6d6a3e8, 0xcb61b38c,
+                                          0x9b64c2b0, 0x86d3d2d4, 0xa00ae278, 0xbdbdf21c};
+
+/* Running CRC-32 of n more bytes, start at 0xffffffff and invert at the end */
+static uint32_t crc32_update(uint32_t crc, const unsigned char *p, size_t n)
+{
+    while (n--)
+    {
+        crc ^= *p++;
+        crc = (crc >> 4) ^ crc32_nibble[crc & 15];
+        crc = (crc >> 4) ^ crc32_nibble[crc & 15];
+    }
+    return crc;
+}
+
+static uint32_t get_be32(const unsigned char *p)
+{
+    return ((uint32_t)p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+}
+
+static void put_be32(unsigned char *p, uint32_t v)
+{
+    p[0] = v >> 24;
+    p[1] = v >> 16;
+    p[2] = v >> 8;
+    p[3] = v;
+}
+
+static int read_exact(FILE *fp, void *buf, size_t n)
+{
+    return fread(buf, 1, n, fp) == n;
+}
+
+/*
+ * Read the chunk whose length and type are in hdr and append all of it to
+ * *buf, checking its CRC. The total is kept under PNG_MAX_CHUNKS.
+ */
+static Status append_chunk(FILE *fp, const unsigned char *hdr, unsigned char **buf, size_t *len)
+{
+    uint32_t data_len = get_be32(hdr);
+    if (data_len > PNG_CHUNK_MAX || *len + 12 + data_len > PNG_MAX_CHUNKS)
+    {
+        return e_failure;
+    }
+    unsigned char *grown = realloc(*buf, *len + 12 + data_len);
+    if (grown == NULL)
+    {
+        return e_failure;
+    }
+    *buf = grown;
+    unsigned char *chunk = grown + *len;
+    memcpy(chunk, hdr, 8);
+    if (!read_exact(fp, chunk + 8, data_len + 4)
+        || get_be32(chunk + 8 + data_len) != (crc32_update(0xffffffff, chunk + 4, 4 + data_len) ^ 0xffffffff))
+    {
+        return e_failure;
+    }
+    *len += 12 + data_len;
+    return e_success;
+}
+
+/* Chunks after the image data, the first one's length and type in hdr, through IEND */
+static Status read_tail(PngImage *img, unsigned char *hdr)
+{
+    for (;;)
+    {
+        // Image data must be one unbroken run of IDAT chunks
+        if (memcmp(hdr + 4, "IDAT", 4) == 0 || append_chunk(img->in, hdr, &img->tail, &img->tail_len) != e_success)
+        {
+            return e_failure;
+        }
+        if (memcmp(hdr + 4, "IEND", 4) == 0)
+        {
+            img->tail_done = 1;
+            return e_success;
+        }
+        if (!read_exact(img->in, hdr, 8))
+        {
+            return e_failure;
+        }
+    }
+}
+
+/* Compressed image data for the inflater: the IDAT chunks back to back, -1 after the last */
+static int next_idat_byte(void *ctx)
+{
+    PngImage *img = ctx;
+    while (img->idat_left == 0)
+    {
+        unsigned char hdr[8];
+        if (img->idat_end)
+        {
+            return -1;
+        }
+        img->idat_end = 1;
+        if (!read_exact(img->in, hdr, 4) || get_be32(hdr) != (img->idat_crc ^ 0xffffffff) || !read_exact(img->in, hdr, 8))
+        {
+            return -1;
+        }
+        if (memcmp(hdr + 4, "IDAT", 4) != 0)
+        {
+            read_tail(img, hdr);
+            return -1;
+        }
+        if (get_be32(hdr) > PNG_CHUNK_MAX)
+        {
+            return -1;
+        }
+        img->idat_end = 0;
+        img->idat_left = get_be32(hdr);
+        img->idat_crc = crc32_update(0xffffffff, hdr + 4, 4);
+    }
+    int c = getc(img->in);
+    if (c == EOF)
+    {
+        img->idat_end = 1;
+        return -1;
+    }
+    unsigned char byte = c;
+    img->idat_left--;
+    img->idat_crc = crc32_update(img->idat_crc, &byte, 1);
+    return c;
+}
+
+static unsigned char paeth(unsigned char a, unsigned char b, unsigned char c)
+{
+    int p = a + b - c;
+    int pa = abs(p - a), pb = abs(p - b), pc = abs(p - c);
+    return pa <= pb && pa <= pc ? a : pb <= pc ? b : c;
+}
+
+/* Undo filter type filter on row in place, prev is the reconstructed row above */
+static void unfilter_row(int filter, unsigned char *row, const unsigned char *prev, size_t len, size_t bpp)
+{
+    size_t i;
+    switch (filter)
+    {
+    case 1:
+        for (i = bpp; i < len; i++)
+            row[i] += row[i - bpp];
+        break;
+    case 2:
+        for (i = 0; i < len; i++)
+            row[i] += prev[i];
+        break;
+    case 3:
+        for (i = 0; i < bpp; i++)
+            row[i] += prev[i] >> 1;
+        for (; i < len; i++)
+            row[i] += (row[i - bpp] + prev[i]) >> 1;
+        break;
+    case 4:
+        for (i = 0; i < bpp; i++)
+            row[i] += prev[i];
+        for (; i < len; i++)
+            row[i] += paeth(row[i - bpp], prev[i], prev[i - bpp]);
+        break;
+    }
+}
+
+/* Apply filter type filter to row into out, prev is the row above */
+static void filter_row(int filter, const unsigned char *row, const unsigned char *prev, size_t len, size_t bpp,
+                       unsigned char *out)
+{
+    size_t i;
+    switch (filter)
+    {
+    case 0:
+        memcpy(out, row, len);
+        break;
+    case 1:
+        memcpy(out, row, bpp);
+        for (i = bpp; i < len; i++)
+            out[i] = row[i] - row[i - bpp];
+        break;
+    case 2:
+        for (i = 0; i < len; i++)
+            out[i] = row[i] - prev[i];
+        break;
+    case 3:
+        for (i = 0; i < bpp; i++)
+            out[i] = row[i] - (prev[i] >> 1);
+        for (; i < len; i++)
+            out[i] = row[i] - ((row[i - bpp] + prev[i]) >> 1);
+        break;
+    default:
+        for (i = 0; i < bpp; i++)
+            out[i] = row[i] - prev[i];
+        for (; i < len; i++)
+            out[i] = row[i] - paeth(row[i - bpp], prev[i], prev[i - bpp]);
+        break;
+    }
+}
+
+/*
+ * After the last row: the zlib stream must end there (its Adler-32 is
+ * checked on the way), and the chunks behind it are kept for the writer
+ */
+static Status finish_image_data(PngImage *img)
+{
+    unsigned char extra;
+    size_t got;
+    if (inflater_read(img->inf, &extra, 1, &got) != e_success || got != 0)
+    {
+        return e_failure;
+    }
+    while (next_idat_byte(img) >= 0)
+    {
+        // Bytes after the end of the zlib stream mean nothing, they are dropped
+    }
+    return img->tail_done ? e_success : e_failure;
+}
+
+/* Inflate and reconstruct the next row */
+static Status next_row(PngImage *img)
+{
+    unsigned char filter;
+    size_t got;
+    if (inflater_read(img->inf, &filter, 1, &got) != e_success || got != 1 || filter > PNG_FILTER_PAETH)
+    {
+        return e_failure;
+    }
+    unsigned char *above = img->row;
+    img->row = img->prev;
+    img->prev = above;
+    if (inflater_read(img->inf, img->row, img->row_len, &got) != e_success || got != img->row_len)
+    {
+        return e_failure;
+    }
+    unfilter_row(filter, img->row, img->prev, img->row_len, img->pixel_bytes);
+    img->filters[img->rows_read++] = filter;
+    img->row_pos = 0;
+    return img->rows_read == img->height ? finish_image_data(img) : e_success;
+}
+
+static ssize_t png_reader_read(void *cookie, char *buf, size_t size)
+{
+    PngImage *img = cookie;
+    size_t done = 0;
+    while (done < size)
+    {
+        if (img->row_pos == img->row_len)
+        {
+            if (img->rows_read == img->height)
+            {
+                break;
+            }
+            if (next_row(img) != e_success)
+            {
+                return -1;
+            }
+        }
+        size_t n = img->row_len - img->row_pos < size - done ? img->row_len - img->row_pos : size - done;
+        memcpy(buf + done, img->row + img->row_pos, n);
+        img->row_pos += n;
+        done += n;
+    }
+    return done;
+}
+
+static int png_reader_close(void *cookie)
+{
+    PngImage *img = cookie;
+    int status = img->close_in ? fclose(img->in) : 0;
+    img->in = NULL;
+    inflater_free(img->inf);
+    img->inf = NULL;
+    png_release(img);
+    return status;
+}
+
+void png_release(PngImage *image)
+{
+    if (image == NULL || --image->refs > 0)
+    {
+        return;
+    }
+    free(image->head);
+    free(image->tail);
+    free(image->filters);
+    free(image->row);
+    free(image->prev);
+    free(image->wrow);
+    free(image->wprev);
+    free(image->filtered);
+    free(image->chunk);
+    deflater_free(image->def);
+    free(image);
+}
+
+/* Row layout from IHDR, e_failure for images this carrier does not take */
+static Status parse_ihdr(PngImage *img, const unsigned char *ihdr, BmpInfo *info)
+{
+    // Samples per pixel and the colour ones among them, by colour type
+    static const int samples[7] = {1, 0, 3, 0, 2, 0, 4};
+    static const int colours[7] = {1, 0, 3, 0, 1, 0, 3};
+    uint32_t width = get_be32(ihdr), height = get_be32(ihdr + 4);
+    int depth = ihdr[8], type = ihdr[9];
+
+    if (width == 0 || height == 0 || width > PNG_CHUNK_MAX || height > PNG_CHUNK_MAX || (depth != 8 && depth != 16)
+        || type > 6 || samples[type] == 0 || ihdr[10] != 0 || ihdr[11] != 0 || ihdr[12] != 0)
+    {
+        return e_failure;
+    }
+    int sample_bytes = depth / 8;
+    img->width = width;
+    img->height = height;
+    img->pixel_bytes = samples[type] * sample_bytes;
+    img->row_len = (size_t)width * img->pixel_bytes;
+
+    memset(info, 0, sizeof(*info));
+    info->width = width;
+    info->height = height;
+    info->top_down = 1;
+    info->bpp = samples[type] * depth;
+    info->pixel_bytes = img->pixel_bytes;
+    info->channels = colours[type];
+    // Samples are MSB first, the low byte of each is the one that changes least
+    for (int i = 0; i < info->channels; i++)
+    {
+        info->channel_offset[i] = i * sample_bytes + sample_bytes - 1;
+    }
+    info->stride = img->row_len;
+    info->row_bytes = (size_t)width * info->channels;
+    info->capacity = (unsigned long long)info->row_bytes * height;
+    info->image_end = (unsigned long long)info->stride * height;
+    info->transcoded = 1;
+    return e_success;
+}
+
+Status png_open_read(FILE **fp, BmpInfo *info, PngImage **image)
+{
+    static const cookie_io_functions_t reader = {png_reader_read, NULL, NULL, png_reader_close};
+    PngImage *img = calloc(1, sizeof(*img));
+    unsigned char hdr[8] = {0};
+
+    *image = NULL;
+    if (img == NULL || (img->head = malloc(PNG_SIGNATURE_BYTES)) == NULL)
+    {
+        free(img);
+        return e_failure;
+    }
+    img->refs = 1;
+    img->in = *fp;
+    memcpy(img->head, png_signature, PNG_SIGNATURE_BYTES);
+    img->head_len = PNG_SIGNATURE_BYTES;
+
+    // IHDR first, then whatever comes before the image data
+    while (read_exact(img->in, hdr, 8) && memcmp(hdr + 4, "IDAT", 4) != 0)
+    {
+        int first = img->head_len == PNG_SIGNATURE_BYTES;
+        if (first != (memcmp(hdr + 4, "IHDR", 4) == 0) || (first && get_be32(hdr) != 13)
+            || memcmp(hdr + 4, "IEND", 4) == 0 || append_chunk(img->in, hdr, &img->head, &img->head_len) != e_success)
+        {
+            break;
+        }
+    }
+    if (memcmp(hdr + 4, "IDAT", 4) != 0 || img->head_len == PNG_SIGNATURE_BYTES || get_be32(hdr) > PNG_CHUNK_MAX
+        || parse_ihdr(img, img->head + PNG_SIGNATURE_BYTES + 8, info) != e_success)
+    {
+        png_release(img);
+        return e_failure;
+    }
+    img->idat_left = get_be32(hdr);
+    img->idat_crc = crc32_update(0xffffffff, hdr + 4, 4);
+
+    img->row = calloc(img->row_len, 1);
+    img->prev = calloc(img->row_len, 1);
+    img->filters = malloc(img->height);
+    img->inf = inflater_create(next_idat_byte, img);
+    img->row_pos = img->row_len;
+    FILE *rows = img->row && img->prev && img->filters && img->inf ? fopencookie(img, "rb", reader) : NULL;
+    if (rows == NULL)
+    {
+        inflater_free(img->inf);
+        png_release(img);
+        return e_failure;
+    }
+    img->close_in = *fp != stdin;
+    img->refs++;
+    *fp = rows;
+    *image = img;
+    return e_success;
+}
+
+/* Write the filled IDAT chunk */
+static Status emit_idat(PngImage *img)
+{
+    unsigned char *chunk = img->chunk;
+    unsigned char crc[4];
+    put_be32(chunk, img->chunk_len);
+    memcpy(chunk + 4, "IDAT", 4);
+    put_be32(crc, crc32_update(0xffffffff, chunk + 4, 4 + img->chunk_len) ^ 0xffffffff);
+    size_t len = 8 + img->chunk_len;
+    img->chunk_len = 0;
+    return fwrite(chunk, 1, len, img->out) == len && fwrite(crc, 1, 4, img->out) == 4 ? e_success : e_failure;
+}
+
+/* Compressed bytes from the deflater, cut into IDAT chunks */
+static Status put_idat_bytes(void *ctx, const unsigned char *data, size_t n)
+{
+    PngImage *img = ctx;
+    while (n > 0)
+    {
+        size_t take = PNG_IDAT_BYTES - img->chunk_len < n ? PNG_IDAT_BYTES - img->chunk_len : n;
+        memcpy(img->chunk + 8 + img->chunk_len, data, take);
+        img->chunk_len += take;
+        data += take;
+        n -= take;
+        if (img->chunk_len == PNG_IDAT_BYTES && emit_idat(img) != e_success)
+        {
+            return e_failure;
+        }
+    }
+    return e_success;
+}
+
+static ssize_t png_writer_write(void *cookie, const char *buf, size_t size)
+{
+    PngImage *img = cookie;
+    size_t done = 0;
+    while (done < size && !img->write_failed)
+    {
+        if (img->rows_written == img->height)
+        {
+            // More bytes than the image has rows for
+            img->write_failed = 1;
+            break;
+        }
+        size_t n = img->row_len - img->wrow_pos < size - done ? img->row_len - img->wrow_pos : size - done;
+        memcpy(img->wrow + img->wrow_pos, buf + done, n);
+        img->wrow_pos += n;
+        done += n;
+        if (img->wrow_pos < img->row_len)
+        {
+            continue;
+        }
+        // Whole row: filtered as the carrier had it, so the image compresses as well as it did
+        int filter = img->filters[img->rows_written];
+        img->filtered[0] = filter;
+        filter_row(filter, img->wrow, img->wprev, img->row_len, img->pixel_bytes, img->filtered + 1);
+        if (deflater_write(img->def, img->filtered, img->row_len + 1) != e_success)
+        {
+            img->write_failed = 1;
+        }
+        unsigned char *above = img->wrow;
+        img->wrow = img->wprev;
+        img->wprev = above;
+        img->wrow_pos = 0;
+        img->rows_written++;
+    }
+    return img->write_failed ? 0 : (ssize_t)done;
+}
+
+static int png_writer_close(void *cookie)
+{
+    static const unsigned char iend[12] = {0, 0, 0, 0, 'I', 'E', 'N', 'D', 0xae, 0x42, 0x60, 0x82};
+    PngImage *img = cookie;
+    int complete = !img->write_failed && img->rows_written == img->height;
+    int status = complete && deflater_finish(img->def) == e_success && (img->chunk_len == 0 || emit_idat(img) == e_success)
+                     ? 0 : -1;
+    if (status == 0)
+    {
+        // The carrier's trailing chunks if the reader got that far, a bare IEND otherwise
+        const unsigned char *tail = img->tail_done ? img->tail : iend;
+        size_t tail_len = img->tail_done ? img->tail_len : sizeof(iend);
+        status = fwrite(tail, 1, tail_len, img->out) == tail_len ? 0 : -1;
+    }
+    if (fclose(img->out) != 0)
+    {
+        status = -1;
+    }
+    img->out = NULL;
+    png_release(img);
+    return status;
+}
+
+Status png_open_write(PngImage *image, FILE **fp)
+{
+    static const cookie_io_functions_t writer = {NULL, png_writer_write, NULL, png_writer_close};
+    PngImage *img = image;
+
+    if (fwrite(img->head, 1, img->head_len, *fp) != img->head_len)
+    {
+        return e_failure;
+    }
+    img->out = *fp;
+    img->wrow = malloc(img->row_len);
+    img->wprev = calloc(img->row_len, 1);
+    img->filtered = malloc(img->row_len + 1);
+    img->chunk = malloc(8 + PNG_IDAT_BYTES);
+    img->def = deflater_create(put_idat_bytes, img);
+    FILE *rows = img->wrow && img->wprev && img->filtered && img->chunk && img->def ? fopencookie(img, "wb", writer) : NULL;
+    if (rows == NULL)
+    {
+        return e_failure;
+    }
+    img->refs++;
+    *fp = rows;
+    return e_success;
+}
@@ -0,0 +1,51 @@
+#ifndef PNG_H
+#define PNG_H
+
+#include <stdio.h>
+#include "types.h"
+#include "bmp.h"
+
+/*
+ * PNG carriers
+ * PNG pixels are filtered row by row and deflated (flate.h), so they are
+ * not embedded in place: png_open_read() puts a stream of reconstructed
+ * rows (no filter bytes) in place of the file and describes them in a
+ * BmpInfo, png_open_write() takes such rows, filters every one the way the
+ * carrier had it, deflates it into IDAT chunks and keeps every other chunk
+ * of the carrier as it was. Rows are decoded and encoded one at a time, the
+ * image is never held whole.
+ * 8 and 16-bit grey, grey + alpha, RGB and RGBA images are taken; the low
+ * byte of every colour sample carries data, alpha never does. Palette
+ * images (an LSB of an index is a different colour), bit depths below 8
+ * and interlaced images are not.
+ */
+#define PNG_SIGNATURE_BYTES 8
+
+/* Largest run of chunks accepted in front of or after the image data */
+#define PNG_MAX_CHUNKS (16 * 1024 * 1024)
+
+extern const unsigned char png_signature[PNG_SIGNATURE_BYTES];
+
+/* Chunks of one carrier and the row codec state, shared by its reader and writer */
+typedef struct _PngImage PngImage;
+
+/*
+ * Read the chunks in front of the image data from *fp (its signature
+ * already read) and put a stream of the image rows in its place; closing
+ * that stream closes *fp as well, unless it is stdin. *image is held until
+ * png_release(), for png_open_write().
+ */
+Status png_open_read(FILE **fp, BmpInfo *info, PngImage **image);
+
+/*
+ * Write the signature and the chunks in front of the image data to *fp
+ * and put a stream taking the image rows in its place. Closing that stream
+ * finishes the image data, writes the chunks that followed it in the
+ * carrier and closes *fp; it fails unless every row was written.
+ */
+Status png_open_write(PngImage *image, FILE **fp);
+
+/* Drop the hold png_open_read() gave the caller */
+void png_release(PngImage *image);
+
+#endif
@@ -0,0 +1,213 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "pnm.h"
+
+/* Header scanner, fed one byte at a time so pipes are read no further than the header */
+typedef struct
+{
+    int field;                // Number being read: width, height, maximum value
+    int in_number;
+    int in_comment;
+    unsigned long value[3];
+} PnmScan;
+
+/* Feed header byte c: 1 when it ends the header, 0 for more, -1 if this is no header */
+static int pnm_scan(PnmScan *s, int c)
+{
+    if (s->in_comment)
+    {
+        if (c == '\n' || c == '\r')
+            s->in_comment = 0;
+        return 0;
+    }
+    if (c >= '0' && c <= '9')
+    {
+        s->value[s->field] = s->value[s->field] * 10 + (c - '0');
+        s->in_number = 1;
+        return s->value[s->field] > INT32_MAX ? -1 : 0;
+    }
+    if (c == ' ' || c == '\t' || c == '\n' || c == '\r' || c == '\v' || c == '\f' || c == '#')
+    {
+        if (s->in_number)
+        {
+            s->in_number = 0;
+            // Exactly one whitespace byte separates the maximum value from the samples
+            if (++s->field == 3)
+                return c == '#' ? -1 : 1;
+        }
+        s->in_comment = c == '#';
+        return 0;
+    }
+    return -1;
+}
+
+/*
+ * Rows of width samples of sample_bytes each, channels per pixel, no
+ * padding; the low byte of a big-endian sample is its last one
+ */
+static Status sample_layout(BmpInfo *info, size_t data_offset, unsigned long long width,
+                            unsigned long long height, int channels, int sample_bytes, int big_endian)
+{
+    if (width == 0 || height == 0 || width > INT32_MAX || height > UINT32_MAX)
+    {
+        return e_failure;
+    }
+    memset(info, 0, sizeof(*info));
+    info->data_offset = data_offset;
+    info->width = (uint)width;
+    info->height = (uint)height;
+    info->top_down = 1;
+    info->pixel_bytes = channels * sample_bytes;
+    info->bpp = 8 * info->pixel_bytes;
+    info->channels = channels;
+    for (int i = 0; i < channels; i++)
+        info->channel_offset[i] = i * sample_bytes + (big_endian ? sample_bytes - 1 : 0);
+    // 31-bit width, 32-bit height: none of this can overflow 64 bits
+    info->stride = (size_t)width * info->pixel_bytes;
+    info->row_bytes = (size_t)width * channels;
+    info->capacity = (unsigned long long)info->row_bytes * height;
+    info->image_end = data_offset + (unsigned long long)info->stride * height;
+    return e_success;
+}
+
+/* Check the numbers of a scanned header ending at header_len and lay the samples out */
+static Status pnm_layout(const unsigned char *magic, const PnmScan *s, size_t header_len, BmpInfo *info)
+{
+    unsigned long maxval = s->value[2];
+    // 8 bits or more, all ones: no low bits can take a sample past it
+    if (maxval < 255 || maxval > 65535 || (maxval & (maxval + 1)) != 0)
+    {
+        return e_failure;
+    }
+    return sample_layout(info, header_len, s->value[0], s->value[1], magic[1] == '6' ? 3 : 1,
+                         maxval > 255 ? 2 : 1, 1);
+}
+
+int pnm_magic(const unsigned char *magic, size_t n)
+{
+    return n >= PNM_MAGIC_BYTES && magic[0] == 'P' && (magic[1] == '5' || magic[1] == '6');
+}
+
+Status pnm_parse(const unsigned char *buf, size_t len, BmpInfo *info)
+{
+    PnmScan scan = {0};
+    if (!pnm_magic(buf, len))
+    {
+        return e_failure;
+    }
+    // The magic number is followed by whitespace or a comment, never by a digit
+    if (len > PNM_MAGIC_BYTES && buf[PNM_MAGIC_BYTES] >= '0' && buf[PNM_MAGIC_BYTES] <= '9')
+    {
+        return e_failure;
+    }
+    for (size_t i = PNM_MAGIC_BYTES; i < len && i < PNM_MAX_HEADER; i++)
+    {
+        int r = pnm_scan(&scan, buf[i]);
+        if (r < 0)
+        {
+            return e_failure;
+        }
+        if (r > 0)
+        {
+            return pnm_layout(buf, &scan, i + 1, info);
+        }
+    }
+    return e_failure;
+}
+
+Status pnm_read_header(FILE *fp, const unsigned char *start, size_t got, unsigned char **header, BmpInfo *info)
+{
+    size_t size = 256;
+    unsigned char *buf = got <= size ? malloc(size) : NULL;
+    PnmScan scan = {0};
+    size_t len = 0;
+    int r = 0;
+
+    *header = NULL;
+    if (buf == NULL || !pnm_magic(start, got))
+    {
+        free(buf);
+        return e_failure;
+    }
+    memcpy(buf, start, got);
+    for (len = PNM_MAGIC_BYTES; r == 0; len++)
+    {
+        int c = len < got ? buf[len] : getc(fp);
+        if (c == EOF || len == PNM_MAX_HEADER || (len == PNM_MAGIC_BYTES && c >= '0' && c <= '9'))
+        {
+            break;
+        }
+        if (len == size)
+        {
+            unsigned char *grown = realloc(buf, size * 2);
+            if (grown == NULL)
+            {
+                break;
+            }
+            buf = grown;
+            size *= 2;
+        }
+        buf[len] = (unsigned char)c;
+        r = pnm_scan(&scan, c);
+    }
+    // Bytes read up front belong to the header, the samples start after them
+    if (r <= 0 || len < got || pnm_layout(buf, &scan, len, info) != e_success)
+    {
+        free(buf);
+        return e_failure;
+    }
+    *header = buf;
+    return e_success;
+}
+
+Status pnm_raw_spec(const char *spec, RawLayout *layout)
+{
+    unsigned long long v[3] = {0, 0, 1};
+    const char *p = spec;
+    char *end;
+    int n = 0;
+
+    memset(layout, 0, sizeof(*layout));
+    while (n < 3)
+    {
+        if (*p < '0' || *p > '9')
+        {
+            return e_failure;
+        }
+        v[n++] = strtoull(p, &end, 10);
+        p = end;
+        if (*p != 'x')
+        {
+            break;
+        }
+        p++;
+    }
+    if (n < 2 || v[0] == 0 || v[1] == 0 || v[2] == 0 || v[0] > INT32_MAX || v[1] > UINT32_MAX || v[2] > UINT32_MAX
+        || v[1] * v[2] > UINT32_MAX)
+    {
+        return e_failure;
+    }
+    layout->width = (uint)v[0];
+    layout->height = (uint)v[1];
+    layout->planes = (uint)v[2];
+    layout->sample_bytes = 1;
+    if (*p == '\0' || strcmp(p, ":8") == 0)
+    {
+        return e_success;
+    }
+    layout->sample_bytes = 2;
+    if (strcmp(p, ":16") == 0 || strcmp(p, ":16le") == 0)
+    {
+        return e_success;
+    }
+    layout->big_endian = 1;
+    return strcmp(p, ":16be") == 0 ? e_success : e_failure;
+}
+
+Status pnm_raw_layout(const RawLayout *layout, BmpInfo *info)
+{
+    // Every plane row is a row of one-sample pixels: planar and interleaved dumps alike
+    return sample_layout(info, 0, layout->width, (unsigned long long)layout->height * layout->planes, 1,
+                         layout->sample_bytes, layout->big_endian);
+}
@@ -0,0 +1,58 @@
+#ifndef PNM_H
+#define PNM_H
+
+#include <stdio.h>
+#include <stddef.h>
+#include "types.h"
+#include "bmp.h"
+
+/*
+ * Sample array carriers
+ * Binary PPM (P6) and PGM (P5) images are a short text header followed by
+ * the samples, row after row with no padding: they are embedded in place,
+ * like a BMP, from the first byte after the header. Samples are one byte,
+ * or two big-endian bytes when the maximum value is over 255; the low byte
+ * of every sample carries data. Only maximum values of all one bits (255,
+ * 1023, 4095, 65535, ...) are taken, the others could be overrun by a
+ * changed low bit.
+ * Headerless dumps (planes or interleaved samples, nothing else) have no
+ * magic to be told by, their layout is given with --raw instead.
+ */
+#define PNM_MAGIC_BYTES 2
+
+/* Largest header (comments included) accepted in front of the samples */
+#define PNM_MAX_HEADER (64 * 1024)
+
+/* Layout of a headerless dump, from a --raw spec */
+typedef struct _RawLayout
+{
+    uint width;
+    uint height;
+    uint planes;              // Samples per pixel: planes one after another, or interleaved
+    int sample_bytes;         // 1 or 2
+    int big_endian;           // 2-byte samples: the low byte is the second one
+} RawLayout;
+
+/* Does a file starting with these n bytes look like a binary PPM/PGM */
+int pnm_magic(const unsigned char *magic, size_t n);
+
+/* Parse a header held in memory (len bytes, at least up to the samples) */
+Status pnm_parse(const unsigned char *buf, size_t len, BmpInfo *info);
+
+/*
+ * Read the header from fp without seeking, the first got bytes already
+ * read and passed in start. On success *header holds info->data_offset
+ * bytes (malloc'd, the caller frees it).
+ */
+Status pnm_read_header(FILE *fp, const unsigned char *start, size_t got, unsigned char **header, BmpInfo *info);
+
+/*
+ * Parse a --raw spec: WIDTHxHEIGHT[xPLANES][:8|:16|:16le|:16be]. Planes
+ * default to 1, samples to 8 bits, 16-bit samples to little-endian.
+ */
+Status pnm_raw_spec(const char *spec, RawLayout *layout);
+
+/* Describe a headerless dump in the layout of the embedding code */
+Status pnm_raw_layout(const RawLayout *layout, BmpInfo *info);
+
+#endif
@@ -0,0 +1,150 @@
+#define _POSIX_C_SOURCE 200809L
+#define _FILE_OFFSET_BITS 64
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include "probe.h"
+#include "stego.h"
+#include "mapfile.h"
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+/* Enough for the fields of most images in one read */
+#define PROBE_FIRST_READ 512
+
+/* Probe on the first bytes of the file, read again only if the header asks for more */
+static StegoStatus probe_file(const char *fname, StegoProbe *probe)
+{
+    unsigned char first[PROBE_FIRST_READ];
+    unsigned char *buf = first;
+    size_t got = 0;
+    StegoStatus status;
+
+#ifdef _WIN32
+    FILE *fp = fopen(fname, "rb");
+    if (fp == NULL)
+        return STEGO_ERR_IO;
+    got = fread(first, 1, sizeof(first), fp);
+#else
+    int fd = open(fname, O_RDONLY);
+    if (fd < 0)
+        return STEGO_ERR_IO;
+    ssize_t n = pread(fd, first, sizeof(first), 0);
+    got = n > 0 ? n : 0;
+#endif
+    StegoView view = {first, got};
+    size_t asked = sizeof(first);
+    status = stego_probe(&view, probe);
+    // A large DIB header or pixel data offset: fetch exactly what the probe needs
+    while (status == STEGO_ERR_TRUNCATED && probe->needed > got && got == asked)
+    {
+        asked = probe->needed;
+        unsigned char *grown = realloc(buf == first ? NULL : buf, asked);
+        if (grown == NULL)
+        {
+            status = STEGO_ERR_NOMEM;
+            break;
+        }
+        if (buf == first)
+            memcpy(grown, first, got);
+        buf = grown;
+#ifdef _WIN32
+        got += fread(buf + got, 1, asked - got, fp);
+#else
+        while (got < asked && (n = pread(fd, buf + got, asked - got, got)) != 0)
+        {
+            if (n < 0 && errno != EINTR)
+                break;
+            if (n > 0)
+                got += n;
+        }
+#endif
+        // A short read leaves the view short of needed: truncated
+        view.data = buf;
+        view.size = got;
+        status = stego_probe(&view, probe);
+    }
+#ifdef _WIN32
+    fclose(fp);
+#else
+    close(fd);
+#endif
+    if (buf != first)
+        free(buf);
+    return status;
+}
+
+Status probe_image(const char *fname, int use_mmap, FILE *out)
+{
+    StegoProbe probe;
+    StegoStatus status;
+
+    if (use_mmap)
+    {
+        // Only the pages holding the header fields are ever faulted in
+        MappedFile map;
+        if (map_file_read(fname, &map) != e_success)
+        {
+            fprintf(out, "%s\terror\t%s\n", fname, stego_status_string(STEGO_ERR_IO));
+            return e_failure;
+        }
+        StegoView view = {map.data, map.size};
+        status = map.data ? stego_probe(&view, &probe) : STEGO_ERR_TRUNCATED;
+        unmap_file(&map);
+    }
+    else
+    {
+        status = probe_file(fname, &probe);
+    }
+
+    if (status == STEGO_OK)
+    {
+        fprintf(out, "%s\tstego\t%s\t%llu\t%d\t%d\t%llu\t%llu", fname,
+                probe.header.archive ? "archive" : probe.header.extn, probe.header.size,
+                probe.header.depth, probe.header.revision, probe.capacity, probe.free);
+        if (probe.header.sharded)
+            fprintf(out, "\tshard %u/%u %016llx", probe.header.shard.index + 1, probe.header.shard.count,
+                    probe.header.shard.set_id);
+        fputc('\n', out);
+        return e_success;
+    }
+    if (status == STEGO_ERR_NOT_STEGO)
+        fprintf(out, "%s\tclean\t-\t0\t1\t0\t%llu\t%llu\n", fname, probe.capacity, probe.free);
+    else if (status == STEGO_ERR_IO)
+        fprintf(out, "%s\terror\t%s\n", fname, strerror(errno));
+    else
+        fprintf(out, "%s\terror\t%s\n", fname, stego_status_string(status));
+    return e_failure;
+}
+
+Status probe_list(const char *list, int use_mmap, FILE *out)
+{
+    FILE *fp = strcmp(list, "-") == 0 ? stdin : fopen(list, "r");
+    char *line = NULL;
+    size_t cap = 0;
+    ssize_t len;
+    Status result = e_success;
+
+    if (fp == NULL)
+    {
+        perror("fopen");
+        fprintf(stderr, "ERROR: Unable to open list %s\n", list);
+        return e_failure;
+    }
+    while ((len = getline(&line, &cap, fp)) >= 0)
+    {
+        while (len > 0 && (line[len - 1] == '\n' || line[len - 1] == '\r'))
+            line[--len] = '\0';
+        if (len == 0)
+            continue;
+        if (probe_image(line, use_mmap, out) != e_success)
+            result = e_failure;
+    }
+    free(line);
+    if (fp != stdin)
+        fclose(fp);
+    return result;
+}
@@ -0,0 +1,24 @@
+#ifndef PROBE_H
+#define PROBE_H
+
+#include <stdio.h>
+#include "types.h"
+
+/*
+ * Probe mode: tell whether images carry a payload, and how much room is
+ * left, from the first few hundred bytes of each (see stego_probe()).
+ * One tab-separated line per image goes to out:
+ *   <image> stego <extension> <payload bytes> <depth> <revision> <capacity> <free>
+ *   (the extension reads "archive" for an archive payload, and a shard
+ *   ends with one more field: shard <index>/<count> <set ID in hex>)
+ *   <image> clean - 0 1 0 <capacity> <free>
+ *   <image> error <message>
+ */
+
+/* Probe one image, e_failure when it is not a readable stego image */
+Status probe_image(const char *fname, int use_mmap, FILE *out);
+
+/* Probe every image named on a line of list ("-" = stdin), e_failure unless all carry a payload */
+Status probe_list(const char *list, int use_mmap, FILE *out);
+
+#endif
@@ -0,0 +1,170 @@
+#include <string.h>
+#include "scatter.h"
+#include "lsb.h"
+
+/* Secret bytes per gather/embed/scatter step: whole carrier bytes at every depth (1536/768/512/384) */
+#define SCATTER_BLOCK 192
+
+/* Secret bytes per parallel task */
+#define SCATTER_CHUNK (SCATTER_BLOCK * 64)
+
+/* splitmix64 finalizer, the Feistel round function */
+static unsigned long long mix64(unsigned long long x)
+{
+    x ^= x >> 30;
+    x *= 0xbf58476d1ce4e5b9ULL;
+    x ^= x >> 27;
+    x *= 0x94d049bb133111ebULL;
+    x ^= x >> 31;
+    return x;
+}
+
+void scatter_init(ScatterMap *map, const char *key, unsigned long long count)
+{
+    // FNV-1a of the key, tied to the region size so one key gives unrelated maps on different carriers
+    unsigned long long seed = 0xcbf29ce484222325ULL;
+    for (const unsigned char *p = (const unsigned char *)key; *p; p++)
+    {
+        seed = (seed ^ *p) * 0x100000001b3ULL;
+    }
+    seed ^= mix64(count);
+
+    memset(map, 0, sizeof(*map));
+    map->count = count;
+    map->half_bits = 1;
+    while (map->half_bits < 32 && (1ULL << (2 * map->half_bits)) < count)
+    {
+        map->half_bits++;
+    }
+    map->half_mask = (1ULL << map->half_bits) - 1;
+    for (int r = 0; r < SCATTER_ROUNDS; r++)
+    {
+        map->round_key[r] = mix64(seed + (r + 1) * 0x9e3779b97f4a7c15ULL);
+    }
+}
+
+/* One pass of the balanced Feistel network over [0, 4^half_bits) */
+static unsigned long long feistel(const ScatterMap *map, unsigned long long x)
+{
+    unsigned long long left = x >> map->half_bits;
+    unsigned long long right = x & map->half_mask;
+    for (int r = 0; r < SCATTER_ROUNDS; r++)
+    {
+        unsigned long long t = left ^ (mix64(right ^ map->round_key[r]) & map->half_mask);
+        left = right;
+        right = t;
+    }
+    return (left << map->half_bits) | right;
+}
+
+unsigned long long scatter_index(const ScatterMap *map, unsigned long long i)
+{
+    // Cycle walking: the domain is less than 4 times count, so a few passes at most on average
+    unsigned long long x = i;
+    do
+    {
+        x = feistel(map, x);
+    } while (x >= map->count);
+    return x;
+}
+
+/* One scatter_embed()/scatter_extract() call, split in SCATTER_CHUNK pieces */
+typedef struct
+{
+    const ScatterMap *map;
+    const BmpInfo *bmp;
+    unsigned long long base;
+    const unsigned char *secret; // Embed: payload in
+    unsigned char *out;          // Extract: payload out
+    unsigned char *image;
+    unsigned long long first;    // Payload byte the slice starts at
+    size_t n;
+    int depth;
+} ScatterJob;
+
+/*
+ * File offsets of carrier bytes [slot, slot + len). The Feistel passes of
+ * a whole block run first with no branches, so consecutive indices overlap
+ * in the pipeline; the few that land past count are walked afterwards.
+ */
+static void scatter_offsets(const ScatterJob *job, unsigned long long slot, size_t len, unsigned long long *offset)
+{
+    const ScatterMap *map = job->map;
+    const BmpInfo *bmp = job->bmp;
+
+    for (size_t i = 0; i < len; i++)
+    {
+        offset[i] = feistel(map, slot + i);
+    }
+    for (size_t i = 0; i < len; i++)
+    {
+        while (offset[i] >= map->count)
+        {
+            offset[i] = feistel(map, offset[i]);
+        }
+    }
+    // Rows without padding or skipped bytes map usable bytes straight to file bytes
+    if (bmp->stride == bmp->row_bytes)
+    {
+        for (size_t i = 0; i < len; i++)
+        {
+            offset[i] += bmp->data_offset + job->base;
+        }
+        return;
+    }
+    for (size_t i = 0; i < len; i++)
+    {
+        offset[i] = bmp_offset(bmp, job->base + offset[i]);
+    }
+}
+
+static void scatter_chunk(void *ctx, size_t index)
+{
+    ScatterJob *job = ctx;
+    unsigned char carrier[SCATTER_BLOCK * 8];
+    unsigned long long offset[SCATTER_BLOCK * 8];
+    size_t start = index * SCATTER_CHUNK;
+    size_t end = job->n - start < SCATTER_CHUNK ? job->n : start + SCATTER_CHUNK;
+
+    for (size_t done = start; done < end; done += SCATTER_BLOCK)
+    {
+        size_t n = end - done < SCATTER_BLOCK ? end - done : SCATTER_BLOCK;
+        size_t len = lsb_carrier_bytes(n, job->depth);
+        scatter_offsets(job, (job->first + done) * 8 / job->depth, len, offset);
+        for (size_t i = 0; i < len; i++)
+        {
+            carrier[i] = job->image[offset[i]];
+        }
+        if (job->secret == NULL)
+        {
+            lsb_extract_block(carrier, n, job->out + done, job->depth);
+            continue;
+        }
+        lsb_embed_block(job->secret + done, n, carrier, job->depth);
+        for (size_t i = 0; i < len; i++)
+        {
+            job->image[offset[i]] = carrier[i];
+        }
+    }
+}
+
+void scatter_embed(ThreadPool *pool, const ScatterMap *map, const BmpInfo *bmp, unsigned long long base,
+                   const unsigned char *secret, size_t n, unsigned char *image, int depth)
+{
+    ScatterJob job = {map, bmp, base, secret, NULL, image, 0, n, depth};
+    pool_parallel_for(pool, (n + SCATTER_CHUNK - 1) / SCATTER_CHUNK, scatter_chunk, &job);
+}
+
+void scatter_extract(ThreadPool *pool, const ScatterMap *map, const BmpInfo *bmp, unsigned long long base,
+                     const unsigned char *image, size_t n, unsigned char *secret, int depth)
+{
+    scatter_extract_at(pool, map, bmp, base, image, 0, n, secret, depth);
+}
+
+void scatter_extract_at(ThreadPool *pool, const ScatterMap *map, const BmpInfo *bmp, unsigned long long base,
+                        const unsigned char *image, unsigned long long first, size_t n, unsigned char *secret, int depth)
+{
+    // Extraction only reads the image
+    ScatterJob job = {map, bmp, base, NULL, secret, (unsigned char *)image, first, n, depth};
+    pool_parallel_for(pool, (n + SCATTER_CHUNK - 1) / SCATTER_CHUNK, scatter_chunk, &job);
+}
@@ -0,0 +1,53 @@
+#ifndef SCATTER_H
+#define SCATTER_H
+
+#include <stddef.h>
+#include "bmp.h"
+#include "threadpool.h"
+
+/*
+ * Keyed scatter embedding
+ * With a key the payload does not fill the carrier from the top: carrier
+ * byte i of the payload goes to usable byte base + scatter_index(i) of the
+ * data region, through a keyed Feistel permutation of the region indices
+ * (cycle-walked down to the region size). Every position is computed on
+ * its own, so there is no permutation table to build or store, and any
+ * slice of the payload can be embedded or extracted independently.
+ *
+ * The permutation hides where the bits are, it does not encrypt them.
+ */
+
+#define SCATTER_ROUNDS 4
+
+typedef struct _ScatterMap
+{
+    unsigned long long count;     // Carrier bytes permuted: indices [0, count)
+    int half_bits;                // Each Feistel half; the domain is 4^half_bits >= count
+    unsigned long long half_mask;
+    unsigned long long round_key[SCATTER_ROUNDS];
+} ScatterMap;
+
+/* Permutation of [0, count) selected by key */
+void scatter_init(ScatterMap *map, const char *key, unsigned long long count);
+
+/* Position of carrier byte i, in [0, count) */
+unsigned long long scatter_index(const ScatterMap *map, unsigned long long i);
+
+/*
+ * Embed n secret bytes at depth into the carrier bytes scattered over
+ * usable bytes [base, base + map->count) of image (the whole file image),
+ * or extract them back. Slices run concurrently on pool.
+ */
+void scatter_embed(ThreadPool *pool, const ScatterMap *map, const BmpInfo *bmp, unsigned long long base,
+                   const unsigned char *secret, size_t n, unsigned char *image, int depth);
+void scatter_extract(ThreadPool *pool, const ScatterMap *map, const BmpInfo *bmp, unsigned long long base,
+                     const unsigned char *image, size_t n, unsigned char *secret, int depth);
+
+/*
+ * Extract n payload bytes from payload byte first on (first * 8 must be a
+ * multiple of depth, so the slice starts on a carrier byte)
+ */
+void scatter_extract_at(ThreadPool *pool, const ScatterMap *map, const BmpInfo *bmp, unsigned long long base,
+                        const unsigned char *image, unsigned long long first, size_t n, unsigned char *secret, int depth);
+
+#endif
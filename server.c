@@ -0,0 +1,679 @@
+#define _DEFAULT_SOURCE
+#define _FILE_OFFSET_BITS 64
+#include <errno.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "server.h"
+#include "stego.h"
+#include "stream.h"
+#include "metrics.h"
+#include "mapfile.h"
+#include "threadpool.h"
+#include "lsb.h"
+
+#ifdef _WIN32
+
+Status run_server(const char *socket_path, int jobs)
+{
+    (void)jobs;
+    fprintf(stderr, "ERROR: daemon mode is not supported on this platform (%s)\n", socket_path);
+    return e_failure;
+}
+
+Status client_encode(const char *socket_path, EncodeInfo *encInfo)
+{
+    (void)encInfo;
+    return run_server(socket_path, 0);
+}
+
+DStatus client_decode(const char *socket_path, DecodeInfo *decInfo)
+{
+    (void)decInfo;
+    return run_server(socket_path, 0) == e_success ? d_success : d_failure;
+}
+
+#else
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+static const char request_magic[4] = {'S', 'T', 'G', 'Q'};
+static const char response_magic[4] = {'S', 'T', 'G', 'R'};
+
+/* The wire format is little-endian whatever the host is */
+static void put_le32(unsigned char *p, uint32_t v)
+{
+    for (int i = 0; i < 4; i++)
+        p[i] = v >> (8 * i);
+}
+
+static void put_le64(unsigned char *p, uint64_t v)
+{
+    put_le32(p, (uint32_t)v);
+    put_le32(p + 4, (uint32_t)(v >> 32));
+}
+
+static uint32_t get_le32(const unsigned char *p)
+{
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static uint64_t get_le64(const unsigned char *p)
+{
+    return get_le32(p) | ((uint64_t)get_le32(p + 4) << 32);
+}
+
+/* Read exactly n bytes, 0 on EOF or error */
+static int read_all(int fd, void *buf, size_t n)
+{
+    unsigned char *p = buf;
+    while (n > 0)
+    {
+        ssize_t got = read(fd, p, n);
+        if (got < 0 && errno == EINTR)
+            continue;
+        if (got <= 0)
+            return 0;
+        p += got;
+        n -= got;
+    }
+    return 1;
+}
+
+/* Write exactly n bytes, 0 on error (SIGPIPE is ignored, a closed peer is EPIPE) */
+static int write_all(int fd, const void *buf, size_t n)
+{
+    const unsigned char *p = buf;
+    while (n > 0)
+    {
+        ssize_t put = write(fd, p, n);
+        if (put < 0 && errno == EINTR)
+            continue;
+        if (put <= 0)
+            return 0;
+        p += put;
+        n -= put;
+    }
+    return 1;
+}
+
+/* Receive a header of n bytes and the descriptors sent along with it */
+static int recv_with_fds(int sock, unsigned char *buf, size_t n, int *fds, int max_fds, int *nfds)
+{
+    union
+    {
+        struct cmsghdr align;
+        char buf[CMSG_SPACE(sizeof(int) * 4)];
+    } control;
+    struct iovec iov = {buf, n};
+    struct msghdr msg;
+    ssize_t got;
+
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control.buf;
+    msg.msg_controllen = sizeof(control.buf);
+    *nfds = 0;
+    do
+        got = recvmsg(sock, &msg, MSG_CMSG_CLOEXEC);
+    while (got < 0 && errno == EINTR);
+    if (got <= 0)
+        return 0;
+
+    for (struct cmsghdr *c = CMSG_FIRSTHDR(&msg); c != NULL; c = CMSG_NXTHDR(&msg, c))
+    {
+        if (c->cmsg_level != SOL_SOCKET || c->cmsg_type != SCM_RIGHTS)
+            continue;
+        int count = (c->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+        for (int i = 0; i < count; i++)
+        {
+            int fd;
+            memcpy(&fd, CMSG_DATA(c) + i * sizeof(int), sizeof(int));
+            // More than the request can use: the count check rejects it later
+            if (*nfds < max_fds)
+                fds[(*nfds)++] = fd;
+            else
+                close(fd);
+        }
+    }
+    if (msg.msg_flags & MSG_CTRUNC)
+        *nfds = max_fds + 1;
+    return read_all(sock, buf + got, n - got);
+}
+
+/* Send a header with descriptors attached */
+static int send_with_fds(int sock, const unsigned char *buf, size_t n, const int *fds, int nfds)
+{
+    union
+    {
+        struct cmsghdr align;
+        char buf[CMSG_SPACE(sizeof(int) * 4)];
+    } control;
+    struct iovec iov = {(void *)buf, n};
+    struct msghdr msg;
+    ssize_t put;
+
+    memset(&msg, 0, sizeof(msg));
+    memset(&control, 0, sizeof(control));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    if (nfds > 0)
+    {
+        msg.msg_control = control.buf;
+        msg.msg_controllen = CMSG_SPACE(sizeof(int) * nfds);
+        struct cmsghdr *c = CMSG_FIRSTHDR(&msg);
+        c->cmsg_level = SOL_SOCKET;
+        c->cmsg_type = SCM_RIGHTS;
+        c->cmsg_len = CMSG_LEN(sizeof(int) * nfds);
+        memcpy(CMSG_DATA(c), fds, sizeof(int) * nfds);
+    }
+    do
+        put = sendmsg(sock, &msg, MSG_NOSIGNAL);
+    while (put < 0 && errno == EINTR);
+    if (put <= 0)
+        return 0;
+    return write_all(sock, buf + put, n - put);
+}
+
+/* Request input: a mapping of a passed descriptor, or bytes read into memory */
+typedef struct
+{
+    MappedFile map;
+    unsigned char *owned;
+    const unsigned char *data;
+    size_t size;
+} Input;
+
+/* Regular files are mapped, pipes and sockets are read to the end (takes over fd) */
+static StegoStatus load_fd(int fd, Input *in)
+{
+    size_t cap = 64 * 1024;
+
+    if (map_fd_read(fd, &in->map) == e_success)
+    {
+        in->data = in->map.data;
+        in->size = in->map.size;
+        return STEGO_OK;
+    }
+    in->owned = malloc(cap);
+    while (in->owned != NULL)
+    {
+        ssize_t got = read(fd, in->owned + in->size, cap - in->size);
+        if (got < 0 && errno == EINTR)
+            continue;
+        if (got <= 0)
+        {
+            close(fd);
+            in->data = in->owned;
+            return got == 0 ? STEGO_OK : STEGO_ERR_IO;
+        }
+        in->size += got;
+        if (in->size == cap)
+        {
+            unsigned char *grown = cap < SERVER_MAX_INLINE ? realloc(in->owned, cap * 2) : NULL;
+            if (grown == NULL)
+                break;
+            in->owned = grown;
+            cap *= 2;
+        }
+    }
+    close(fd);
+    return STEGO_ERR_NOMEM;
+}
+
+/* Bytes that follow the request header */
+static StegoStatus load_inline(int sock, unsigned long long len, Input *in)
+{
+    if (len > SERVER_MAX_INLINE)
+        return STEGO_ERR_ARGS;
+    if ((in->owned = malloc(len ? len : 1)) == NULL)
+        return STEGO_ERR_NOMEM;
+    in->data = in->owned;
+    in->size = len;
+    return read_all(sock, in->owned, len) ? STEGO_OK : STEGO_ERR_IO;
+}
+
+static void free_input(Input *in)
+{
+    unmap_file(&in->map);
+    free(in->owned);
+}
+
+/*
+ * Result into an output descriptor: regular files are sized and mapped so
+ * the library writes straight into them, anything else gets a write().
+ */
+static StegoStatus run_to_fd(int op, StegoView *inputs, StegoHeader *header, const StegoOptions *opts, int fd,
+                             unsigned long long *length)
+{
+    StegoBuffer out = {NULL, 0, 0};
+    MappedFile map;
+    StegoStatus status;
+    unsigned long long size = inputs[0].size;
+
+    if (op == SERVER_OP_DECODE && (status = stego_decode_header(&inputs[0], header)) != STEGO_OK)
+        return status;
+    if (op == SERVER_OP_DECODE)
+        size = header->size;
+    if (size <= SIZE_MAX && map_fd_create(fd, size, &map) == e_success)
+    {
+        out.data = map.data;
+        out.capacity = map.size;
+    }
+    else
+    {
+        memset(&map, 0, sizeof(map));
+    }
+
+    if (op == SERVER_OP_ENCODE)
+        status = stego_encode(&inputs[0], &inputs[1], &out, opts);
+    else
+        status = stego_decode(&inputs[0], &out, header, opts);
+    if (status == STEGO_OK && out.data != map.data && !write_all(fd, out.data, out.size))
+        status = STEGO_ERR_IO;
+    *length = out.size;
+    if (out.data != map.data)
+        free(out.data);
+    // The mapping borrowed fd, the caller closes it
+    if (map.data)
+        munmap(map.data, map.size);
+    return status;
+}
+
+/* Serve one request out of the connection's arena; 0 once the connection is closed or out of sync */
+static int serve_request(int sock, ThreadPool *pool, Arena *arena)
+{
+    unsigned char req[SERVER_REQUEST_SIZE];
+    unsigned char resp[SERVER_RESPONSE_SIZE];
+    int fds[3], nfds;
+    Input in[2];
+    StegoView views[2];
+    StegoHeader header;
+    StegoBuffer out = {NULL, 0, 0};
+    JobMetrics m;
+    char extn[SERVER_EXTN_BYTES + 1];
+    unsigned long long length = 0;
+    StegoStatus status = STEGO_OK;
+    int keep = 1;
+
+    if (!recv_with_fds(sock, req, sizeof(req), fds, 3, &nfds))
+    {
+        for (int i = 0; i < nfds && i < 3; i++)
+            close(fds[i]);
+        return 0;
+    }
+    memset(in, 0, sizeof(in));
+    memset(&header, 0, sizeof(header));
+    int op = req[4];
+    int flags = req[6];
+    int inputs = op == SERVER_OP_ENCODE ? 2 : 1;
+    int wanted = (flags & SERVER_FD_INPUT ? inputs : 0) + (flags & SERVER_FD_OUTPUT ? 1 : 0);
+    int out_fd = -1;
+    int loaded = 0;
+
+    // A bad header leaves the stream out of sync: answer, then hang up
+    if (memcmp(req, request_magic, 4) != 0 || (op != SERVER_OP_ENCODE && op != SERVER_OP_DECODE) || nfds != wanted)
+    {
+        for (int i = 0; i < nfds && i < 3; i++)
+            close(fds[i]);
+        status = STEGO_ERR_ARGS;
+        keep = 0;
+    }
+    else if (flags & SERVER_FD_OUTPUT)
+    {
+        out_fd = fds[wanted - 1];
+    }
+    for (; status == STEGO_OK && loaded < inputs; loaded++)
+    {
+        if (flags & SERVER_FD_INPUT)
+            status = load_fd(fds[loaded], &in[loaded]);
+        else if ((status = load_inline(sock, get_le64(req + 8 + 8 * loaded), &in[loaded])) != STEGO_OK)
+            keep = 0;
+    }
+    // Input descriptors left behind by a failed load
+    for (; keep && (flags & SERVER_FD_INPUT) && loaded < inputs; loaded++)
+        close(fds[loaded]);
+
+    if (status == STEGO_OK)
+    {
+        memcpy(extn, req + 24, SERVER_EXTN_BYTES);
+        extn[SERVER_EXTN_BYTES] = '\0';
+        // The protocol carries no keys: keyed and sealed images fail with STEGO_ERR_KEY/ENCRYPTED
+        StegoOptions opts = {req[5], extn[0] ? extn : NULL, pool, &m, NULL, 0, NULL, 0, NULL, arena};
+        for (int i = 0; i < inputs; i++)
+        {
+            views[i].data = in[i].data;
+            views[i].size = in[i].size;
+        }
+        metrics_job_begin(&m, op == SERVER_OP_ENCODE ? METRICS_ENCODE : METRICS_DECODE, 1);
+        if (out_fd >= 0)
+            status = run_to_fd(op, views, &header, &opts, out_fd, &length);
+        else if (op == SERVER_OP_ENCODE)
+            status = stego_encode(&views[0], &views[1], &out, &opts);
+        else
+            status = stego_decode(&views[0], &out, &header, &opts);
+        metrics_job_end(&m, status == STEGO_OK);
+        if (out_fd < 0)
+            length = out.size;
+        // The answer has no room for a longer extension
+        if (status == STEGO_OK && strlen(header.extn) > SERVER_EXTN_BYTES)
+            status = STEGO_ERR_UNSUPPORTED;
+    }
+    for (int i = 0; i < inputs; i++)
+        free_input(&in[i]);
+    if (out_fd >= 0)
+        close(out_fd);
+
+    memset(resp, 0, sizeof(resp));
+    memcpy(resp, response_magic, 4);
+    put_le32(resp + 4, status);
+    put_le64(resp + 8, status == STEGO_OK ? length : 0);
+    if (status == STEGO_OK)
+        memcpy(resp + 16, header.extn, strlen(header.extn));
+    // Results go back straight from the library's buffer
+    if (!write_all(sock, resp, sizeof(resp))
+        || (status == STEGO_OK && out_fd < 0 && !write_all(sock, out.data, out.size)))
+    {
+        keep = 0;
+    }
+    free(out.data);
+    return keep;
+}
+
+typedef struct
+{
+    int fd;
+    ThreadPool *pool;
+} ServerConn;
+
+/* Pool task: serve one connection until the client hangs up or goes idle */
+static void serve_connection(void *arg)
+{
+    ServerConn *conn = arg;
+    Arena arena;
+    // Requests on a connection take turns in one arena, it stays as large as the largest of them
+    arena_init(&arena, NULL, 0);
+    while (serve_request(conn->fd, conn->pool, &arena))
+        arena_reset(&arena);
+    arena_release(&arena);
+    close(conn->fd);
+    free(conn);
+}
+
+static volatile sig_atomic_t stop_requested;
+
+static void request_stop(int sig)
+{
+    (void)sig;
+    stop_requested = 1;
+}
+
+Status run_server(const char *socket_path, int jobs)
+{
+    struct sockaddr_un addr;
+    struct sigaction sa;
+    sigset_t stop_signals, old_mask;
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (strlen(socket_path) >= sizeof(addr.sun_path))
+    {
+        printf("ERROR: Socket path is too long: %s\n", socket_path);
+        return e_failure;
+    }
+    strcpy(addr.sun_path, socket_path);
+
+    int lfd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (lfd < 0)
+    {
+        perror("socket");
+        return e_failure;
+    }
+    // A socket left over from a previous run would make bind() fail
+    unlink(socket_path);
+    // Only the owner may connect: requests read and write files as this user
+    mode_t old_umask = umask(077);
+    int bound = bind(lfd, (struct sockaddr *)&addr, sizeof(addr));
+    umask(old_umask);
+    if (bound < 0 || listen(lfd, 64) < 0)
+    {
+        perror("bind");
+        fprintf(stderr, "ERROR: Unable to listen on %s\n", socket_path);
+        close(lfd);
+        return e_failure;
+    }
+
+    // Workers inherit a mask without the stop signals, so they reach accept() below
+    sigemptyset(&stop_signals);
+    sigaddset(&stop_signals, SIGINT);
+    sigaddset(&stop_signals, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &stop_signals, &old_mask);
+    ThreadPool *pool = pool_create(jobs);
+    pthread_sigmask(SIG_SETMASK, &old_mask, NULL);
+    if (pool == NULL)
+    {
+        printf("ERROR: Unable to start %d worker threads\n", jobs);
+        close(lfd);
+        unlink(socket_path);
+        return e_failure;
+    }
+
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = request_stop; // No SA_RESTART: accept() returns EINTR
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+    signal(SIGPIPE, SIG_IGN);
+
+    printf("INFO : Listening on %s, %d connections at a time (%s kernel)\n", socket_path, pool_size(pool),
+           lsb_kernel_name());
+    fflush(stdout);
+    while (!stop_requested)
+    {
+        int fd = accept(lfd, NULL, NULL);
+        if (fd < 0)
+        {
+            if (errno != EINTR && errno != ECONNABORTED)
+                perror("accept");
+            continue;
+        }
+        struct timeval idle = {SERVER_IDLE_TIMEOUT, 0};
+        setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &idle, sizeof(idle));
+        fcntl(fd, F_SETFD, FD_CLOEXEC);
+
+        ServerConn *conn = malloc(sizeof(*conn));
+        if (conn == NULL)
+        {
+            close(fd);
+            continue;
+        }
+        conn->fd = fd;
+        conn->pool = pool;
+        if (pool_submit(pool, serve_connection, conn) != e_success)
+        {
+            free(conn);
+            close(fd);
+        }
+    }
+
+    printf("INFO : Stopping, finishing open connections\n");
+    close(lfd);
+    unlink(socket_path);
+    pool_destroy(pool);
+    return e_success;
+}
+
+/* Connect to the daemon, -1 on failure */
+static int client_connect(const char *socket_path)
+{
+    struct sockaddr_un addr;
+    int fd;
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (strlen(socket_path) >= sizeof(addr.sun_path) || (fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0)) < 0)
+        return -1;
+    strcpy(addr.sun_path, socket_path);
+    if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0)
+    {
+        perror("connect");
+        fprintf(stderr, "ERROR: No daemon listening on %s\n", socket_path);
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+/* Send a request with its descriptors and read the answer header */
+static StegoStatus client_call(const char *socket_path, const unsigned char *req, const int *fds, int nfds,
+                               int *sock, unsigned char *resp)
+{
+    if ((*sock = client_connect(socket_path)) < 0)
+        return STEGO_ERR_IO;
+    if (!send_with_fds(*sock, req, SERVER_REQUEST_SIZE, fds, nfds) || !read_all(*sock, resp, SERVER_RESPONSE_SIZE)
+        || memcmp(resp, response_magic, 4) != 0)
+    {
+        return STEGO_ERR_IO;
+    }
+    return (StegoStatus)get_le32(resp + 4);
+}
+
+static void close_fds(int *fds, int nfds)
+{
+    for (int i = 0; i < nfds; i++)
+    {
+        if (fds[i] >= 0)
+            close(fds[i]);
+    }
+}
+
+Status client_encode(const char *socket_path, EncodeInfo *encInfo)
+{
+    unsigned char req[SERVER_REQUEST_SIZE];
+    unsigned char resp[SERVER_RESPONSE_SIZE];
+    const char *extn = secret_file_extension(encInfo->secret_fname);
+    int fds[3];
+    int sock = -1;
+
+    if (is_secret_fd_name(encInfo->secret_fname))
+        extn = encInfo->stream_extn ? encInfo->stream_extn : ".bin";
+    if (extn == NULL || !stego_extn_ok(extn) || strlen(extn) > SERVER_EXTN_BYTES)
+    {
+        printf("ERROR : Unsupported secret file extension (the daemon records up to %d characters)\n", SERVER_EXTN_BYTES);
+        return e_failure;
+    }
+    fds[0] = open(encInfo->src_image_fname, O_RDONLY | O_CLOEXEC);
+    fds[1] = is_secret_fd_name(encInfo->secret_fname) ? atoi(encInfo->secret_fname + 3)
+                                                      : open(encInfo->secret_fname, O_RDONLY | O_CLOEXEC);
+    fds[2] = open(encInfo->stego_image_fname, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fds[0] < 0 || fds[1] < 0 || fds[2] < 0)
+    {
+        perror("open");
+        printf("ERROR: Failed to Open files \n");
+        close_fds(fds, 3);
+        return e_failure;
+    }
+
+    memset(req, 0, sizeof(req));
+    memcpy(req, request_magic, 4);
+    req[4] = SERVER_OP_ENCODE;
+    req[5] = encInfo->depth;
+    req[6] = SERVER_FD_INPUT | SERVER_FD_OUTPUT;
+    memcpy(req + 24, extn, strlen(extn));
+    StegoStatus status = client_call(socket_path, req, fds, 3, &sock, resp);
+    close_fds(fds, 3);
+    if (sock >= 0)
+        close(sock);
+    if (status != STEGO_OK)
+    {
+        printf("ERROR : %s\n", stego_status_string(status));
+        return e_failure;
+    }
+    if (!encInfo->quiet)
+        printf("INFO : Daemon wrote %llu bytes to %s\n", (unsigned long long)get_le64(resp + 8), encInfo->stego_image_fname);
+    return e_success;
+}
+
+DStatus client_decode(const char *socket_path, DecodeInfo *decInfo)
+{
+    unsigned char req[SERVER_REQUEST_SIZE];
+    unsigned char resp[SERVER_RESPONSE_SIZE];
+    unsigned char buffer[64 * 1024];
+    int sock = -1;
+    int fd = open(decInfo->stego_image_fname, O_RDONLY | O_CLOEXEC);
+
+    if (fd < 0)
+    {
+        perror("open");
+        fprintf(stderr, "ERROR : Unable to open file %s\n", decInfo->stego_image_fname);
+        return d_failure;
+    }
+    // The output name depends on the decoded extension, so the payload comes back inline
+    memset(req, 0, sizeof(req));
+    memcpy(req, request_magic, 4);
+    req[4] = SERVER_OP_DECODE;
+    req[6] = SERVER_FD_INPUT;
+    StegoStatus status = client_call(socket_path, req, &fd, 1, &sock, resp);
+    close(fd);
+    if (status != STEGO_OK)
+    {
+        printf("ERROR : %s\n", stego_status_string(status));
+        if (sock >= 0)
+            close(sock);
+        return d_failure;
+    }
+
+    decInfo->size_secret_file = get_le64(resp + 8);
+    if ((decInfo->file_extn = arena_alloc(decInfo->arena, SERVER_EXTN_BYTES + 1)) == NULL)
+    {
+        close(sock);
+        return d_failure;
+    }
+    memcpy(decInfo->file_extn, resp + 16, SERVER_EXTN_BYTES);
+    decInfo->file_extn[SERVER_EXTN_BYTES] = '\0';
+    if (!stego_extn_ok(decInfo->file_extn))
+    {
+        printf("ERROR : Daemon sent an unusable extension\n");
+        close(sock);
+        return d_failure;
+    }
+    if (append_extension(decInfo, decInfo->file_extn) != d_success)
+    {
+        close(sock);
+        return d_failure;
+    }
+    FILE *out = fopen(decInfo->output_fname, "wb");
+    unsigned long long remaining = decInfo->size_secret_file;
+    DStatus result = out ? d_success : d_failure;
+    // Stream the payload to the file as it arrives
+    while (result == d_success && remaining > 0)
+    {
+        size_t n = remaining < sizeof(buffer) ? remaining : sizeof(buffer);
+        if (!read_all(sock, buffer, n) || fwrite(buffer, 1, n, out) != n)
+            result = d_failure;
+        remaining -= n;
+    }
+    if (out && fclose(out) != 0)
+        result = d_failure;
+    close(sock);
+    if (result != d_success)
+    {
+        perror("write");
+        fprintf(stderr, "ERROR: Unable to write %s\n", decInfo->output_fname);
+    }
+    else if (!decInfo->quiet)
+    {
+        printf("INFO : Payload written to %s\n", decInfo->output_fname);
+    }
+    return result;
+}
+
+#endif
@@ -0,0 +1,63 @@
+#ifndef SERVER_H
+#define SERVER_H
+
+#include "types.h"
+#include "encode.h"
+#include "decode.h"
+
+/*
+ * Daemon mode
+ * A long-running process listens on a Unix domain socket and serves
+ * encode/decode requests through the in-memory library API (stego.h),
+ * so a request costs no fork/exec and no file opens of its own.
+ * Connections are persistent and served on a worker pool, one request
+ * at a time per connection, answers in order.
+ *
+ * Every request is a 32-byte header, all integers little-endian:
+ *   0  4  "STGQ"
+ *   4  1  op: 1 = encode, 2 = decode
+ *   5  1  depth (encode, 1-4)
+ *   6  1  flags: SERVER_FD_INPUT, SERVER_FD_OUTPUT
+ *   7  1  reserved, 0
+ *   8  8  carrier (encode) or stego image (decode) length
+ *  16  8  payload length (encode)
+ *  24  8  extension to record (encode), NUL padded
+ * With SERVER_FD_INPUT the inputs come as descriptors (SCM_RIGHTS, sent
+ * with the header: carrier and payload, or the stego image) and the two
+ * lengths are ignored; otherwise the carrier and payload bytes follow the
+ * header. With SERVER_FD_OUTPUT one more descriptor receives the result.
+ *
+ * Every answer is a 24-byte header:
+ *   0  4  "STGR"
+ *   4  4  StegoStatus (0 = success)
+ *   8  8  result length: stego image or payload
+ *  16  8  decoded extension, NUL padded
+ * followed by the result bytes unless they went to an output descriptor.
+ */
+
+#define SERVER_REQUEST_SIZE 32
+#define SERVER_RESPONSE_SIZE 24
+
+/* Longest extension the headers carry, longer ones are refused with STEGO_ERR_UNSUPPORTED */
+#define SERVER_EXTN_BYTES 8
+
+#define SERVER_OP_ENCODE 1
+#define SERVER_OP_DECODE 2
+
+#define SERVER_FD_INPUT 1
+#define SERVER_FD_OUTPUT 2
+
+/* Largest inline carrier or payload accepted, larger ones must be passed as descriptors */
+#define SERVER_MAX_INLINE (1ULL << 30)
+
+/* Idle connections are dropped after this many seconds */
+#define SERVER_IDLE_TIMEOUT 60
+
+/* Serve on socket_path with jobs connections at once, until SIGINT/SIGTERM */
+Status run_server(const char *socket_path, int jobs);
+
+/* Client side of the -c option: the files are opened here and passed to the daemon */
+Status client_encode(const char *socket_path, EncodeInfo *encInfo);
+DStatus client_decode(const char *socket_path, DecodeInfo *decInfo);
+
+#endif
@@ -0,0 +1,452 @@
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/random.h>
+#include "shard.h"
+#include "stego.h"
+#include "carrier.h"
+#include "lsb.h"
+#include "common.h"
+#include "crc32c.h"
+
+static void shard_info(int quiet, const char *fmt, ...)
+{
+    if (quiet)
+    {
+        return;
+    }
+    va_list ap;
+    va_start(ap, fmt);
+    vprintf(fmt, ap);
+    va_end(ap);
+}
+
+/* One image of the set, carrier and stego image when encoding, stego image when decoding */
+typedef struct
+{
+    const char *fname;
+    char *stego_fname;        // Encoding: the shard written out (malloc'd)
+    MappedFile map;           // Carrier, or the shard when decoding
+    MappedFile out;           // Encoding: the stego image
+    unsigned long long room;  // Encoding: largest slice the carrier holds
+    unsigned long long size;  // Bytes of the slice
+    StegoShard shard;
+    StegoStatus status;
+} ShardSlot;
+
+/* What every parallel job shares */
+typedef struct
+{
+    ShardSlot *slots;
+    unsigned char *secret;    // Encoding: the mapped secret; decoding: the mapped output
+    StegoOptions opts;        // Per job copy, .shard set to the slot
+} ShardSet;
+
+/* stego.bmp → stego.<index + 1>.bmp (the number is appended when there is no extension) */
+static char *shard_output_name(const char *stego_fname, int index)
+{
+    const char *slash = strrchr(stego_fname, '/');
+    const char *dot = strrchr(slash ? slash + 1 : stego_fname, '.');
+    size_t stem = dot ? (size_t)(dot - stego_fname) : strlen(stego_fname);
+    size_t size = strlen(stego_fname) + 16;
+    char *name = malloc(size);
+    if (name)
+    {
+        snprintf(name, size, "%.*s.%d%s", (int)stem, stego_fname, index + 1, dot ? dot : "");
+    }
+    return name;
+}
+
+/*
+ * Largest slice a carrier holds with every field of a shard in front, the
+ * raw size field included with -z (a slice that does not shrink goes
+ * without it, which only leaves room to spare)
+ */
+static unsigned long long shard_room(const BmpInfo *bmp, size_t extn_len, int depth, int flags)
+{
+    unsigned long long fields = stego_required_bytes(0, extn_len, depth, flags);
+    unsigned long long room = bmp->capacity > fields ? bmp->capacity - fields : 0;
+    unsigned long long stored = room / 8 * depth + room % 8 * depth / 8;
+    if (!(flags & STEGO_FLAG_ENCRYPTED))
+    {
+        return stored;
+    }
+    // Whole sealed segments, then what is left of the last one past its tag
+    unsigned long long last = stored % AEAD_SEALED_SEGMENT;
+    return stored / AEAD_SEALED_SEGMENT * AEAD_SEGMENT + (last > AEAD_TAG_BYTES ? last - AEAD_TAG_BYTES : 0);
+}
+
+/*
+ * Cut total bytes into one slice per carrier, in proportion to its room.
+ * Rounding every share up keeps what is left within the room of the
+ * carriers still to go, so the last one takes the rest and it fits.
+ */
+static void plan_slices(ShardSlot *slots, int count, unsigned long long total)
+{
+    unsigned long long rooms = 0, offset = 0;
+    for (int i = 0; i < count; i++)
+    {
+        rooms += slots[i].room;
+    }
+    for (int i = 0; i < count; i++)
+    {
+        unsigned long long left = total - offset;
+        unsigned long long size = (unsigned long long)(((unsigned __int128)left * slots[i].room + rooms - 1) / rooms);
+        slots[i].size = size < left ? size : left;
+        slots[i].shard.offset = offset;
+        offset += slots[i].size;
+        rooms -= slots[i].room;
+    }
+}
+
+static void encode_shard(void *ctx, size_t index)
+{
+    ShardSet *set = ctx;
+    ShardSlot *slot = &set->slots[index];
+    StegoOptions opts = set->opts;
+    StegoView carrier = {slot->map.data, slot->map.size};
+    StegoView payload = {set->secret ? set->secret + slot->shard.offset : NULL, slot->size};
+    StegoBuffer out = {slot->out.data, 0, slot->out.size};
+
+    opts.shard = &slot->shard;
+    slot->status = stego_encode(&carrier, &payload, &out, &opts);
+}
+
+static void decode_shard(void *ctx, size_t index)
+{
+    ShardSet *set = ctx;
+    ShardSlot *slot = &set->slots[index];
+    StegoView stego = {slot->map.data, slot->map.size};
+    unsigned char *base = set->secret ? set->secret + slot->shard.offset : NULL;
+    StegoBuffer out = {base, 0, slot->size};
+
+    slot->status = stego_decode(&stego, &out, NULL, &set->opts);
+    // An empty secret has no mapping, the library allocated a placeholder
+    if (out.data != base)
+        free(out.data);
+}
+
+static void release_slots(ShardSlot *slots, int count)
+{
+    for (int i = 0; slots && i < count; i++)
+    {
+        unmap_file(&slots[i].map);
+        unmap_file(&slots[i].out);
+        free(slots[i].stego_fname);
+    }
+    free(slots);
+}
+
+/* Map every carrier and size its slice, e_failure if they cannot hold the secret together */
+static Status plan_encoding(EncodeInfo *encInfo, ShardSlot *slots, int count, unsigned long long total)
+{
+    int flags = STEGO_FLAG_SHARD | (encInfo->compress ? STEGO_FLAG_COMPRESSED : 0)
+                | (encInfo->cipher_key ? STEGO_FLAG_ENCRYPTED : 0);
+    unsigned long long rooms = 0;
+
+    for (int i = 0; i < count; i++)
+    {
+        BmpInfo bmp;
+        if (map_file_read(slots[i].fname, &slots[i].map) != e_success)
+        {
+            return e_failure;
+        }
+        if (carrier_parse(slots[i].map.data, slots[i].map.size, NULL, &bmp) != e_success
+            || bmp.image_end > slots[i].map.size)
+        {
+            printf("ERROR : %s: unsupported, corrupt or truncated carrier (BMP, PPM or PGM)\n", slots[i].fname);
+            return e_failure;
+        }
+        slots[i].room = shard_room(&bmp, strlen(encInfo->extn_secret_file), encInfo->depth, flags);
+        if (slots[i].room == 0)
+        {
+            printf("ERROR : %s is too small to hold a shard\n", slots[i].fname);
+            return e_failure;
+        }
+        rooms += slots[i].room;
+    }
+    if (total > rooms)
+    {
+        printf("ERROR : The carriers hold %llu bytes together, the secret is %llu bytes\n", rooms, total);
+        return e_failure;
+    }
+    plan_slices(slots, count, total);
+    return e_success;
+}
+
+Status do_shard_encoding(EncodeInfo *encInfo, char *const *carriers, int count)
+{
+    JobMetrics *m = &encInfo->metrics;
+    int total_count = count + 1;
+    const char *extn = secret_file_extension(encInfo->secret_fname);
+    unsigned long long set_id;
+    MappedFile secret;
+    ShardSet set;
+    Status status = e_failure;
+
+    if (extn == NULL || !stego_extn_ok(extn))
+    {
+        printf("ERROR : Unsupported secret file extension\n");
+        return e_failure;
+    }
+    encInfo->extn_secret_file = extn;
+    if (total_count > SHARD_MAX)
+    {
+        printf("ERROR : At most %d carriers per secret\n", SHARD_MAX);
+        return e_failure;
+    }
+    metrics_job_begin(m, METRICS_ENCODE, encInfo->quiet);
+    shard_info(encInfo->quiet, "INFO : ## Encoding %s over %d carriers (%s kernel, %s crc32c, %d bit depth) ##\n",
+               encInfo->secret_fname, total_count, lsb_kernel_name(), crc32c_kernel_name(), encInfo->depth);
+
+    ShardSlot *slots = calloc(total_count, sizeof(*slots));
+    memset(&secret, 0, sizeof(secret));
+    if (slots == NULL || getrandom(&set_id, sizeof(set_id), 0) != sizeof(set_id))
+    {
+        free(slots);
+        metrics_job_end(m, 0);
+        return e_failure;
+    }
+    stage_begin(m);
+    if (map_file_read(encInfo->secret_fname, &secret) != e_success)
+    {
+        goto done;
+    }
+    for (int i = 0; i < total_count; i++)
+    {
+        slots[i].fname = i ? carriers[i - 1] : encInfo->src_image_fname;
+        slots[i].shard.set_id = set_id;
+        slots[i].shard.index = i;
+        slots[i].shard.count = total_count;
+        slots[i].shard.total = secret.size;
+    }
+    stage_end(m, STAGE_OPEN, 0);
+
+    stage_begin(m);
+    if (plan_encoding(encInfo, slots, total_count, secret.size) != e_success)
+    {
+        goto done;
+    }
+    stage_end(m, STAGE_PARSE, 0);
+
+    // Every stego image starts as a copy of its carrier, made by the library
+    stage_begin(m);
+    for (int i = 0; i < total_count; i++)
+    {
+        if ((slots[i].stego_fname = shard_output_name(encInfo->stego_image_fname, i)) == NULL
+            || map_file_create(slots[i].stego_fname, slots[i].map.size, &slots[i].out) != e_success)
+        {
+            goto done;
+        }
+        shard_info(encInfo->quiet, "INFO : Shard %d: %llu bytes at %llu, %s -> %s\n", i + 1, slots[i].size,
+                   slots[i].shard.offset, slots[i].fname, slots[i].stego_fname);
+    }
+    stage_end(m, STAGE_OPEN, 0);
+
+    // Shards are embedded side by side, each call keeps its own scratch memory
+    StegoOptions opts = {encInfo->depth, extn, encInfo->pool, NULL, encInfo->key, encInfo->compress, encInfo->cipher_key,
+                         0, NULL, NULL};
+    set.slots = slots;
+    set.secret = secret.data;
+    set.opts = opts;
+    stage_begin(m);
+    pool_parallel_for(encInfo->pool, total_count, encode_shard, &set);
+    status = e_success;
+    for (int i = 0; i < total_count; i++)
+    {
+        if (slots[i].status != STEGO_OK)
+        {
+            printf("ERROR : Shard %d (%s): %s\n", i + 1, slots[i].fname, stego_status_string(slots[i].status));
+            status = e_failure;
+        }
+    }
+    stage_end(m, STAGE_DATA, secret.size);
+
+done:
+    stage_begin(m);
+    for (int i = 0; i < total_count; i++)
+    {
+        unmap_file(&slots[i].out);
+        // A partial set is no use, none of it is left behind
+        if (status != e_success && slots[i].stego_fname)
+            remove(slots[i].stego_fname);
+    }
+    release_slots(slots, total_count);
+    unmap_file(&secret);
+    stage_end(m, STAGE_CLOSE, 0);
+    metrics_job_end(m, status == e_success);
+    return status;
+}
+
+/* Read the header of every shard and check that together they make up one whole secret */
+static DStatus check_set(DecodeInfo *decInfo, ShardSlot *slots, int count, StegoHeader *first)
+{
+    ShardSlot **by_index = calloc(count, sizeof(*by_index));
+    DStatus status = by_index ? d_success : d_failure;
+
+    for (int i = 0; status == d_success && i < count; i++)
+    {
+        StegoView view = {slots[i].map.data, slots[i].map.size};
+        StegoHeader header;
+        StegoStatus res = stego_decode_header(&view, &header);
+        if (res == STEGO_OK && header.keyed && decInfo->key == NULL)
+            res = STEGO_ERR_KEY;
+        if (res == STEGO_OK && header.encrypted && decInfo->cipher_key == NULL)
+            res = STEGO_ERR_ENCRYPTED;
+        if (res != STEGO_OK || !header.sharded)
+        {
+            printf("ERROR : %s: %s\n", slots[i].fname, res != STEGO_OK ? stego_status_string(res) : "not a shard");
+            status = d_failure;
+            break;
+        }
+        if (i == 0)
+            *first = header;
+        if (header.shard.set_id != first->shard.set_id || header.shard.count != first->shard.count
+            || header.shard.total != first->shard.total || strcmp(header.extn, first->extn) != 0)
+        {
+            printf("ERROR : %s belongs to another set of shards than %s\n", slots[i].fname, slots[0].fname);
+            status = d_failure;
+            break;
+        }
+        if (header.shard.count != (unsigned)count)
+        {
+            printf("ERROR : The secret is spread over %u shards, %d images given\n", header.shard.count, count);
+            status = d_failure;
+            break;
+        }
+        if (by_index[header.shard.index])
+        {
+            printf("ERROR : %s and %s are both shard %u\n", by_index[header.shard.index]->fname, slots[i].fname,
+                   header.shard.index + 1);
+            status = d_failure;
+            break;
+        }
+        by_index[header.shard.index] = &slots[i];
+        slots[i].shard = header.shard;
+        slots[i].size = header.size;
+    }
+
+    // Every shard is there exactly once, so the slices only have to follow each other to the end
+    unsigned long long offset = 0;
+    for (int i = 0; status == d_success && i < count; i++)
+    {
+        if (by_index[i]->shard.offset != offset)
+        {
+            printf("ERROR : %s does not start where shard %d ends\n", by_index[i]->fname, i);
+            status = d_failure;
+        }
+        offset += by_index[i]->size;
+    }
+    if (status == d_success && offset != first->shard.total)
+    {
+        printf("ERROR : The shards hold %llu bytes, the secret is %llu bytes\n", offset, first->shard.total);
+        status = d_failure;
+    }
+    free(by_index);
+    return status;
+}
+
+DStatus do_shard_decoding(DecodeInfo *decInfo, char *const *images, int count)
+{
+    JobMetrics *m = &decInfo->metrics;
+    int total_count = count + 1;
+    StegoHeader header;
+    MappedFile out_map;
+    ShardSet set;
+    int created = 0;
+    DStatus status = d_failure;
+
+    if (total_count > SHARD_MAX)
+    {
+        printf("ERROR : At most %d shards per secret\n", SHARD_MAX);
+        return d_failure;
+    }
+    metrics_job_begin(m, METRICS_DECODE, decInfo->quiet);
+    shard_info(decInfo->quiet, "INFO : ## Decoding %d shards from %s (%s kernel, %s crc32c) ##\n", total_count,
+               decInfo->stego_image_fname, lsb_kernel_name(), crc32c_kernel_name());
+
+    ShardSlot *slots = calloc(total_count, sizeof(*slots));
+    memset(&out_map, 0, sizeof(out_map));
+    if (slots == NULL)
+    {
+        metrics_job_end(m, 0);
+        return d_failure;
+    }
+    stage_begin(m);
+    for (int i = 0; i < total_count; i++)
+    {
+        slots[i].fname = i ? images[i - 1] : decInfo->stego_image_fname;
+        if (map_file_read(slots[i].fname, &slots[i].map) != e_success)
+        {
+            goto done;
+        }
+    }
+    stage_end(m, STAGE_OPEN, 0);
+
+    stage_begin(m);
+    if (check_set(decInfo, slots, total_count, &header) != d_success)
+    {
+        goto done;
+    }
+    if (header.shard.total > SIZE_MAX)
+    {
+        printf("ERROR : payload too large to map\n");
+        goto done;
+    }
+    stage_end(m, STAGE_PARSE, 0);
+    if (append_extension(decInfo, header.extn) != d_success)
+    {
+        goto done;
+    }
+    shard_info(decInfo->quiet, "INFO : %d shards, %llu bytes, format revision %d\n", total_count, header.shard.total,
+               header.revision);
+
+    // Every slice is extracted straight to its offset in the output
+    stage_begin(m);
+    if (map_file_create(decInfo->output_fname, header.shard.total, &out_map) != e_success)
+    {
+        goto done;
+    }
+    created = 1;
+    // Slices land all over the mapping: without blocks behind it a full disk would only show as SIGBUS
+    if (file_preallocate(out_map.fd, 0, header.shard.total) != e_success)
+    {
+        perror("fallocate");
+        printf("ERROR : No room for the %llu byte output %s\n", header.shard.total, decInfo->output_fname);
+        goto done;
+    }
+    stage_end(m, STAGE_OPEN, 0);
+
+    StegoOptions opts = {0, NULL, decInfo->pool, NULL, decInfo->key, 0, decInfo->cipher_key, 0, NULL, NULL};
+    set.slots = slots;
+    set.secret = out_map.data;
+    set.opts = opts;
+    stage_begin(m);
+    pool_parallel_for(decInfo->pool, total_count, decode_shard, &set);
+    status = d_success;
+    for (int i = 0; i < total_count; i++)
+    {
+        if (slots[i].status != STEGO_OK)
+        {
+            printf("ERROR : Shard %u (%s): %s\n", slots[i].shard.index + 1, slots[i].fname,
+                   stego_status_string(slots[i].status));
+            status = d_failure;
+        }
+    }
+    stage_end(m, STAGE_DATA, header.shard.total);
+    if (status == d_success)
+        shard_info(decInfo->quiet, "INFO : Payload written to %s\n", decInfo->output_fname);
+
+done:
+    stage_begin(m);
+    unmap_file(&out_map);
+    // Slices that failed their checks leave holes, the file is no use
+    if (status != d_success && created)
+        remove(decInfo->output_fname);
+    release_slots(slots, total_count);
+    stage_end(m, STAGE_CLOSE, 0);
+    metrics_job_end(m, status == d_success);
+    return status;
+}
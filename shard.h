@@ -0,0 +1,33 @@
+#ifndef SHARD_H
+#define SHARD_H
+
+#include "types.h"
+#include "encode.h"
+#include "decode.h"
+
+/*
+ * Sharding (--shard): one secret spread over several carriers
+ * The secret is cut into contiguous slices, one per carrier, sized in
+ * proportion to what each carrier holds. Every slice becomes a complete
+ * stego payload of its own (packed and sealed on its own with -z and
+ * --encrypt) whose header records the set ID, shard index and count, the
+ * slice offset and the secret size (STEGO_FLAG_SHARD in common.h).
+ * Shards are encoded and decoded in parallel on the pool; decoding takes
+ * the images in any order and extracts every slice straight to its offset
+ * in the output file, mapped at the secret size.
+ */
+
+/* Most carriers (the positional one included) a secret is spread over */
+#define SHARD_MAX 4096
+
+/*
+ * Encode the secret over the carrier of encInfo and count more carriers.
+ * Shard i + 1 goes to the stego image name with ".<i + 1>" in front of
+ * its extension (stego.bmp → stego.1.bmp, stego.2.bmp, ...).
+ */
+Status do_shard_encoding(EncodeInfo *encInfo, char *const *carriers, int count);
+
+/* Put the secret back together from the stego image of decInfo and count more shards, in any order */
+DStatus do_shard_decoding(DecodeInfo *decInfo, char *const *images, int count);
+
+#endif
@@ -0,0 +1,414 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "stego.h"
+#include "encode.h"
+#include "decode.h"
+#include "lsb.h"
+#include "common.h"
+
+/*
+ * The buffers stand in for the mappings of mmap mode, so the encode_*
+ * and decode_* steps run unchanged on them; quiet keeps them silent.
+ */
+
+/*
+ * Stack storage of a call without an arena from the caller: the longest
+ * extension and the carrier bytes it takes at 1 bit depth always fit
+ */
+#define STEGO_STACK_ARENA (9 * (STEGO_EXTN_MAX + 1) + ARENA_ALIGN)
+
+static const char *const status_strings[] = {
+    "success",
+    "invalid arguments",
+    "unsupported or corrupt carrier header",
+    "carrier pixel data is truncated",
+    "image cannot hold secret data",
+    "not a stego image",
+    "unsupported format revision, depth or extension",
+    "corrupt stego fields",
+    "output buffer too small",
+    "out of memory",
+    "I/O error",
+    "payload is scattered by a key, none given",
+    "payload is encrypted, no key given",
+    "authentication failed (wrong key or tampered image)",
+    "checksum mismatch (corrupt image)",
+};
+
+const char *stego_status_string(StegoStatus status)
+{
+    if ((unsigned)status >= sizeof(status_strings) / sizeof(status_strings[0]))
+        return "unknown error";
+    return status_strings[status];
+}
+
+int stego_extn_ok(const char *extn)
+{
+    size_t len = strlen(extn);
+    return len == 0 || (len <= STEGO_EXTN_MAX && extn[0] == '.' && strpbrk(extn, "/\\") == NULL);
+}
+
+/* Make out ready for size bytes, *allocated tells whether it was malloc'd here */
+static StegoStatus prepare_buffer(StegoBuffer *out, unsigned long long size, int *allocated)
+{
+    *allocated = 0;
+    if (size > SIZE_MAX)
+        return STEGO_ERR_NOMEM;
+    if (out->data == NULL)
+    {
+        // malloc(0) may return NULL, an empty payload still gets a valid pointer
+        if ((out->data = malloc(size ? size : 1)) == NULL)
+            return STEGO_ERR_NOMEM;
+        out->capacity = size;
+        *allocated = 1;
+    }
+    else if (out->capacity < size)
+    {
+        out->size = size;
+        return STEGO_ERR_BUFFER;
+    }
+    return STEGO_OK;
+}
+
+static void release_buffer(StegoBuffer *out, int allocated)
+{
+    if (allocated)
+    {
+        free(out->data);
+        out->data = NULL;
+        out->capacity = 0;
+    }
+    out->size = 0;
+}
+
+static unsigned long long read_le32(const unsigned char *p)
+{
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((unsigned long long)p[3] << 24);
+}
+
+/* Parse the carrier and check that its pixels are all there */
+static StegoStatus parse_carrier(const StegoView *carrier, BmpInfo *bmp)
+{
+    if (carrier_parse(carrier->data, carrier->size, NULL, bmp) != e_success)
+        return STEGO_ERR_FORMAT;
+    if (bmp->image_end > carrier->size)
+        return STEGO_ERR_TRUNCATED;
+    return STEGO_OK;
+}
+
+StegoStatus stego_capacity(const StegoView *carrier, int depth, unsigned long long *max_payload)
+{
+    BmpInfo bmp;
+    if (carrier == NULL || carrier->data == NULL || max_payload == NULL || depth < LSB_MIN_DEPTH || depth > LSB_MAX_DEPTH)
+        return STEGO_ERR_ARGS;
+    StegoStatus status = parse_carrier(carrier, &bmp);
+    if (status != STEGO_OK)
+        return status;
+    unsigned long long fields = stego_required_bytes(0, STEGO_EXTN_ESTIMATE, depth, 0);
+    unsigned long long room = bmp.capacity > fields ? bmp.capacity - fields : 0;
+    // depth bits per carrier byte, rounded down to whole payload bytes
+    *max_payload = room / 8 * depth + room % 8 * depth / 8;
+    return STEGO_OK;
+}
+
+StegoStatus stego_encode(const StegoView *carrier, const StegoView *payload, StegoBuffer *out, const StegoOptions *opts)
+{
+    EncodeInfo encInfo;
+    JobMetrics untimed;
+    JobMetrics *m = opts && opts->metrics ? opts->metrics : &untimed;
+    unsigned char storage[STEGO_STACK_ARENA];
+    Arena own;
+    int depth = opts && opts->depth ? opts->depth : 1;
+    int archive = opts ? opts->archive : 0;
+    const StegoShard *shard = opts ? opts->shard : NULL;
+    // Archives name their members themselves
+    const char *extn = archive ? "" : opts && opts->extn ? opts->extn : ".bin";
+    int allocated;
+
+    if (carrier == NULL || carrier->data == NULL || payload == NULL || (payload->data == NULL && payload->size)
+        || out == NULL || depth < LSB_MIN_DEPTH || depth > LSB_MAX_DEPTH
+        || !stego_extn_ok(extn) || (archive && opts->compress)
+        || (shard && (archive || shard->index >= shard->count || shard->offset > shard->total
+                      || payload->size > shard->total - shard->offset)))
+    {
+        return STEGO_ERR_ARGS;
+    }
+    memset(&encInfo, 0, sizeof(encInfo));
+    memset(&untimed, 0, sizeof(untimed));
+    arena_init(&own, storage, sizeof(storage));
+
+    encInfo.arena = opts && opts->arena ? opts->arena : &own;
+    encInfo.use_mmap = 1;
+    encInfo.quiet = 1;
+    encInfo.depth = depth;
+    encInfo.key = opts ? opts->key : NULL;
+    encInfo.pool = opts ? opts->pool : NULL;
+    encInfo.compress = opts ? opts->compress : 0;
+    encInfo.archive = archive;
+    encInfo.shard = shard;
+    encInfo.cipher_key = opts ? opts->cipher_key : NULL;
+    encInfo.secret_map.data = (unsigned char *)payload->data;
+    encInfo.secret_map.size = payload->size;
+    encInfo.secret_map.fd = -1;
+    encInfo.size_secret_file = payload->size;
+
+    stage_begin(m);
+    StegoStatus status = parse_carrier(carrier, &encInfo.bmp);
+    if (status != STEGO_OK)
+        return status;
+    stage_end(m, STAGE_PARSE, 0);
+    // The capacity check needs the packed size (sealing adds a known amount)
+    if (encInfo.compress)
+    {
+        stage_begin(m);
+        if (compress_secret(&encInfo) != e_success)
+            return STEGO_ERR_NOMEM;
+        stage_end(m, STAGE_CODEC, payload->size);
+    }
+    if (encInfo.bmp.capacity
+        < stego_required_bytes(encode_stored_size(&encInfo), strlen(extn), depth, encode_payload_flags(&encInfo)))
+    {
+        free(encInfo.packed);
+        return STEGO_ERR_CAPACITY;
+    }
+
+    // Embedding in place needs no copy (nor a capacity from the caller)
+    allocated = 0;
+    if (out->data != carrier->data)
+    {
+        stage_begin(m);
+        if ((status = prepare_buffer(out, carrier->size, &allocated)) != STEGO_OK)
+        {
+            free(encInfo.packed);
+            return status;
+        }
+        memcpy(out->data, carrier->data, carrier->size);
+        stage_end(m, STAGE_OPEN, carrier->size);
+    }
+
+    encInfo.stego_map.data = out->data;
+    encInfo.stego_map.size = carrier->size;
+    encInfo.stego_map.fd = -1;
+    encInfo.image_capacity = encInfo.bmp.capacity;
+    encInfo.extn_secret_file = extn;
+    bmp_cursor_init(&encInfo.bmp, &encInfo.cursor);
+
+    // The capacity check above leaves room for every field
+    stage_begin(m);
+    status = STEGO_ERR_CAPACITY;
+    if (encode_magic_string(MAGIC_STRING, &encInfo) != e_success)
+        goto fail;
+    stage_end(m, STAGE_MAGIC, strlen(MAGIC_STRING));
+    stage_begin(m);
+    if (encode_format_descriptor(&encInfo) != e_success)
+        goto fail;
+    stage_end(m, STAGE_DESCRIPTOR, 1);
+    stage_begin(m);
+    if (encode_secret_file_extn_size(strlen(extn), &encInfo) != e_success)
+        goto fail;
+    stage_end(m, STAGE_EXTN_SIZE, sizeof(int));
+    stage_begin(m);
+    if (encode_secret_file_extn(extn, &encInfo) != e_success)
+        goto fail;
+    stage_end(m, STAGE_EXTN, strlen(extn));
+    stage_begin(m);
+    if (encode_secret_file_size(encInfo.size_secret_file, &encInfo) != e_success)
+        goto fail;
+    stage_end(m, STAGE_SIZE, STEGO_SIZE_FIELD_BYTES(STEGO_FORMAT_REVISION));
+    stage_begin(m);
+    // Only fails when its block buffer cannot be allocated
+    status = STEGO_ERR_NOMEM;
+    if (encode_secret_file_data(&encInfo) != e_success)
+        goto fail;
+    stage_end(m, STAGE_DATA, encInfo.size_secret_file);
+
+    free(encInfo.packed);
+    arena_release(&own);
+    out->size = carrier->size;
+    return STEGO_OK;
+
+fail:
+    free(encInfo.packed);
+    arena_release(&own);
+    release_buffer(out, allocated);
+    return status;
+}
+
+/* Decode everything in front of the payload, leaving decInfo at its first carrier byte */
+static StegoStatus decode_fields(DecodeInfo *decInfo, const StegoView *stego, StegoHeader *header, JobMetrics *m,
+                                 Arena *arena)
+{
+    if (stego == NULL || stego->data == NULL)
+        return STEGO_ERR_ARGS;
+    memset(decInfo, 0, sizeof(*decInfo));
+    decInfo->arena = arena;
+    decInfo->use_mmap = 1;
+    decInfo->quiet = 1;
+    decInfo->stego_map.data = (unsigned char *)stego->data;
+    decInfo->stego_map.size = stego->size;
+    decInfo->stego_map.fd = -1;
+
+    stage_begin(m);
+    if (skip_bmp_header(decInfo) != d_success)
+        return STEGO_ERR_FORMAT;
+    stage_end(m, STAGE_PARSE, decInfo->bmp.data_offset);
+    stage_begin(m);
+    if (decode_magic_string(decInfo) != d_success)
+        return STEGO_ERR_NOT_STEGO;
+    stage_end(m, STAGE_MAGIC, strlen(MAGIC_STRING));
+    stage_begin(m);
+    if (decode_format_descriptor(decInfo) != d_success)
+        return STEGO_ERR_UNSUPPORTED;
+    stage_end(m, STAGE_DESCRIPTOR, !decInfo->legacy);
+    stage_begin(m);
+    if (decode_secret_file_extn_size(decInfo) != d_success)
+        return STEGO_ERR_CORRUPT;
+    stage_end(m, STAGE_EXTN_SIZE, sizeof(int));
+    stage_begin(m);
+    if (decInfo->extn_size > STEGO_EXTN_MAX || decode_secret_file_extn(decInfo) != d_success)
+        return STEGO_ERR_CORRUPT;
+    stage_end(m, STAGE_EXTN, decInfo->extn_size);
+    stage_begin(m);
+    if (decode_secret_file_size(decInfo) != d_success)
+        return decInfo->checksum_failed ? STEGO_ERR_CHECKSUM : STEGO_ERR_CORRUPT;
+    stage_end(m, STAGE_SIZE, STEGO_SIZE_FIELD_BYTES(decInfo->revision));
+
+    if (header)
+    {
+        strcpy(header->extn, decInfo->file_extn);
+        header->size = decInfo->size_unpacked;
+        header->stored = decInfo->size_secret_file;
+        header->depth = decInfo->depth;
+        header->revision = decInfo->revision;
+        header->keyed = decInfo->keyed;
+        header->compressed = (decInfo->flags & STEGO_FLAG_COMPRESSED) != 0;
+        header->encrypted = (decInfo->flags & STEGO_FLAG_ENCRYPTED) != 0;
+        header->archive = (decInfo->flags & STEGO_FLAG_ARCHIVE) != 0;
+        header->sharded = (decInfo->flags & STEGO_FLAG_SHARD) != 0;
+        memset(&header->shard, 0, sizeof(header->shard));
+        if (header->sharded)
+            header->shard = decInfo->shard;
+    }
+    return STEGO_OK;
+}
+
+StegoStatus stego_decode_header(const StegoView *stego, StegoHeader *header)
+{
+    DecodeInfo decInfo;
+    JobMetrics untimed;
+    unsigned char storage[STEGO_STACK_ARENA];
+    Arena own;
+    memset(&untimed, 0, sizeof(untimed));
+    arena_init(&own, storage, sizeof(storage));
+    StegoStatus status = header ? decode_fields(&decInfo, stego, header, &untimed, &own) : STEGO_ERR_ARGS;
+    arena_release(&own);
+    return status;
+}
+
+StegoStatus stego_probe(const StegoView *stego, StegoProbe *probe)
+{
+    DecodeInfo decInfo;
+    BmpInfo bmp;
+    JobMetrics untimed;
+    unsigned char storage[STEGO_STACK_ARENA];
+    Arena own;
+
+    if (stego == NULL || stego->data == NULL || probe == NULL)
+        return STEGO_ERR_ARGS;
+    memset(probe, 0, sizeof(*probe));
+    memset(&untimed, 0, sizeof(untimed));
+    if (pnm_magic(stego->data, stego->size))
+    {
+        // A text header of any length up to PNM_MAX_HEADER: ask for all of it when it is not complete
+        probe->needed = PNM_MAX_HEADER;
+        if (pnm_parse(stego->data, stego->size, &bmp) != e_success)
+            return stego->size < probe->needed ? STEGO_ERR_TRUNCATED : STEGO_ERR_FORMAT;
+    }
+    else
+    {
+        if (stego->size >= 2 && (stego->data[0] != 'B' || stego->data[1] != 'M'))
+            return STEGO_ERR_FORMAT;
+        // First the DIB header, plus the channel masks that may follow it
+        probe->needed = 18;
+        if (stego->size >= 18)
+            probe->needed += read_le32(stego->data + 14) + 12;
+        if (stego->size < probe->needed && probe->needed <= BMP_MAX_HEADER)
+            return STEGO_ERR_TRUNCATED;
+        if (bmp_parse(stego->data, stego->size, &bmp) != e_success)
+            return STEGO_ERR_FORMAT;
+    }
+
+    // Legacy images keep their fields right after a 54-byte header
+    probe->needed = bmp_offset(&bmp, STEGO_PROBE_SPAN - 1) + 1;
+    if (probe->needed < 54 + STEGO_PROBE_SPAN)
+        probe->needed = 54 + STEGO_PROBE_SPAN;
+    if (probe->needed > bmp.image_end)
+        probe->needed = bmp.image_end;
+    if (stego->size < probe->needed)
+        return STEGO_ERR_TRUNCATED;
+
+    arena_init(&own, storage, sizeof(storage));
+    StegoStatus status = decode_fields(&decInfo, stego, &probe->header, &untimed, &own);
+    arena_release(&own);
+    if (status == STEGO_ERR_NOT_STEGO)
+    {
+        // Clean carrier: the room a new payload gets at 1 bit depth
+        unsigned long long fields = stego_required_bytes(0, STEGO_EXTN_ESTIMATE, 1, 0);
+        probe->capacity = bmp.capacity > fields ? (bmp.capacity - fields) / 8 : 0;
+        probe->free = probe->capacity;
+    }
+    if (status != STEGO_OK)
+        return status;
+    unsigned long long usable = decInfo.legacy ? bmp.image_end - 54 : bmp.capacity;
+    unsigned long long room = usable > decInfo.cursor.pos ? usable - decInfo.cursor.pos : 0;
+    probe->capacity = room / 8 * decInfo.depth + room % 8 * decInfo.depth / 8;
+    // The payload checksum trails the data unless it was stored in front of a keyed payload
+    unsigned long long used = probe->header.stored + (decInfo.keyed ? 0 : STEGO_CHECKSUM_FIELD_BYTES(decInfo.revision));
+    probe->free = probe->capacity > used ? probe->capacity - used : 0;
+    return STEGO_OK;
+}
+
+StegoStatus stego_decode(const StegoView *stego, StegoBuffer *out, StegoHeader *header, const StegoOptions *opts)
+{
+    DecodeInfo decInfo;
+    JobMetrics untimed;
+    JobMetrics *m = opts && opts->metrics ? opts->metrics : &untimed;
+    unsigned char storage[STEGO_STACK_ARENA];
+    Arena own;
+    int allocated;
+
+    if (out == NULL)
+        return STEGO_ERR_ARGS;
+    memset(&untimed, 0, sizeof(untimed));
+    arena_init(&own, storage, sizeof(storage));
+    // Up to the data step only the extension fields are taken from the arena, they fit the storage
+    StegoStatus status = decode_fields(&decInfo, stego, header, m, opts && opts->arena ? opts->arena : &own);
+    if (status != STEGO_OK)
+        return status;
+    decInfo.key = opts ? opts->key : NULL;
+    if (decInfo.keyed && decInfo.key == NULL)
+        return STEGO_ERR_KEY;
+    decInfo.cipher_key = opts ? opts->cipher_key : NULL;
+    if ((decInfo.flags & STEGO_FLAG_ENCRYPTED) && decInfo.cipher_key == NULL)
+        return STEGO_ERR_ENCRYPTED;
+    if ((status = prepare_buffer(out, decInfo.size_unpacked, &allocated)) != STEGO_OK)
+        return status;
+
+    stage_begin(m);
+    decInfo.out_data = out->data;
+    decInfo.pool = opts ? opts->pool : NULL;
+    DStatus decoded = decode_secret_file_data(&decInfo);
+    arena_release(&own);
+    if (decoded != d_success)
+    {
+        release_buffer(out, allocated);
+        return decInfo.truncated         ? STEGO_ERR_TRUNCATED
+               : decInfo.checksum_failed ? STEGO_ERR_CHECKSUM
+               : decInfo.auth_failed     ? STEGO_ERR_AUTH
+                                         : STEGO_ERR_CORRUPT;
+    }
+    stage_end(m, STAGE_DATA, decInfo.size_secret_file);
+    out->size = decInfo.size_unpacked;
+    return STEGO_OK;
+}
@@ -0,0 +1,156 @@
+#ifndef STEGO_H
+#define STEGO_H
+
+#include <stddef.h>
+#include "threadpool.h"
+#include "metrics.h"
+#include "arena.h"
+
+/*
+ * In-memory library API
+ * Encode and decode between buffers the caller already holds: no file
+ * I/O, no output, no global state (apart from the LSB kernel chosen for
+ * the CPU on first use), so any number of threads can call it at once.
+ * The command line mmap mode runs on top of these functions.
+ */
+
+/* Bytes owned by the caller */
+typedef struct _StegoView
+{
+    const unsigned char *data;
+    size_t size;
+} StegoView;
+
+/*
+ * Output buffer. With data == NULL the library mallocs one of the right
+ * size (the caller frees it); otherwise data must hold capacity bytes.
+ * size is set to the bytes produced, or to the bytes needed when the
+ * call fails with STEGO_ERR_BUFFER.
+ */
+typedef struct _StegoBuffer
+{
+    unsigned char *data;
+    size_t size;
+    size_t capacity;
+} StegoBuffer;
+
+/*
+ * Where one shard sits in a secret spread over several carriers: the
+ * extracted bytes of the shard are bytes [offset, offset + size) of a
+ * total byte secret, and every shard of the set carries the same set_id
+ */
+typedef struct _StegoShard
+{
+    unsigned long long set_id; // Random, shared by the shards of one secret
+    unsigned index;            // 0 to count - 1
+    unsigned count;
+    unsigned long long offset; // Secret offset of the first byte of this shard
+    unsigned long long total;  // Secret bytes over all shards
+} StegoShard;
+
+typedef struct _StegoOptions
+{
+    int depth;           // LSBs per carrier byte when encoding (1-4, 0 = 1)
+    const char *extn;    // Extension recorded when encoding, e.g. ".txt" (NULL = ".bin")
+    ThreadPool *pool;    // Workers for chunk-parallel embed/extract (NULL = serial)
+    JobMetrics *metrics; // Stage timings (NULL = none)
+    const char *key;     // Scatter the payload by this key, see scatter.h (NULL = sequential)
+    int compress;        // Pack the payload with lz.h first, kept as is when it does not shrink
+    const unsigned char *cipher_key; // Seal (encode) or open (decode) the payload with this
+                                     // AEAD_KEY_BYTES key, see aead.h (NULL = in the clear)
+    int archive;         // Encode: the payload is an archive from archive_build() (no extn, not with compress)
+    const StegoShard *shard; // Encode: the payload is this slice of a sharded secret (NULL = the whole secret)
+    Arena *arena;        // Scratch memory of the call, reset by the caller between calls (NULL = the call's own)
+} StegoOptions;
+
+/*
+ * What a stego image says about its payload. The extension ends up at the
+ * end of a file name, so it can be no longer than one (NAME_MAX).
+ */
+#define STEGO_EXTN_MAX 255
+
+/*
+ * The extensions an image may record: none, or a '.' and the rest of a
+ * name with no path separator in it, so the decoded name stays where the
+ * output was asked for.
+ */
+int stego_extn_ok(const char *extn);
+
+typedef struct _StegoHeader
+{
+    char extn[STEGO_EXTN_MAX + 1];
+    unsigned long long size; // Payload bytes
+    unsigned long long stored; // Carrier room the payload takes: size, or its packed and/or sealed size
+    int depth;
+    int revision;            // 0 = legacy image, from before the format descriptor
+    int keyed;               // Payload scattered by a key, decoding needs it
+    int compressed;          // Payload stored packed, see lz.h
+    int encrypted;           // Payload sealed, see aead.h; decoding needs the key
+    int archive;             // Payload is an archive, stego_decode() returns it whole (archive.h)
+    int sharded;             // Payload is one shard of a secret, stego_decode() returns just that slice
+    StegoShard shard;        // Set when sharded
+} StegoHeader;
+
+typedef enum
+{
+    STEGO_OK,
+    STEGO_ERR_ARGS,        // NULL view, bad depth or extension
+    STEGO_ERR_FORMAT,      // Not a supported BMP, PPM or PGM
+    STEGO_ERR_TRUNCATED,   // Pixel data ends before the header says
+    STEGO_ERR_CAPACITY,    // Payload does not fit in the carrier
+    STEGO_ERR_NOT_STEGO,   // No magic string
+    STEGO_ERR_UNSUPPORTED, // Unknown format revision or depth, or an extension the daemon cannot carry
+    STEGO_ERR_CORRUPT,     // Fields inconsistent with the carrier
+    STEGO_ERR_BUFFER,      // Caller buffer too small, size says how much is needed
+    STEGO_ERR_NOMEM,
+    STEGO_ERR_IO,          // Daemon only: reading an input or writing the result failed
+    STEGO_ERR_KEY,         // Payload scattered by a key and none given
+    STEGO_ERR_ENCRYPTED,   // Payload sealed and no cipher key given
+    STEGO_ERR_AUTH,        // A sealed segment failed authentication: wrong key or tampered image
+    STEGO_ERR_CHECKSUM     // Header or payload checksum mismatch (revision 4): corrupt image
+} StegoStatus;
+
+/*
+ * Hide payload in carrier (a BMP, PPM or PGM file image) and store the stego image in
+ * out. out->data may be carrier->data to embed in place.
+ */
+StegoStatus stego_encode(const StegoView *carrier, const StegoView *payload, StegoBuffer *out, const StegoOptions *opts);
+
+/* Read the fields in front of the payload */
+StegoStatus stego_decode_header(const StegoView *stego, StegoHeader *header);
+
+/* Extract the payload into out; header (may be NULL) receives the fields */
+StegoStatus stego_decode(const StegoView *stego, StegoBuffer *out, StegoHeader *header, const StegoOptions *opts);
+
+/*
+ * Probe: the header fields and the room left in the carrier, from the
+ * first bytes of the image only. The fields end within STEGO_PROBE_SPAN
+ * usable bytes of the pixel data (the worst case, every field at 1 bit).
+ */
+#define STEGO_PROBE_SPAN (8 * (2 + 1) + 8 * 1 + 8 * 4 + 8 * STEGO_EXTN_MAX + 8 * 8 + 8 * 8 + 8 * 8 + 8 * 32 + 8 * 4 + 8 * 4)
+
+typedef struct _StegoProbe
+{
+    StegoHeader header;
+    unsigned long long capacity; // Largest payload the carrier holds at header.depth
+    unsigned long long free;     // capacity - header.stored
+    unsigned long long needed;   // Bytes from the start of the file the probe reads
+} StegoProbe;
+
+/*
+ * Inspect a stego image without decoding its payload. stego may hold just
+ * the start of the file: with fewer than probe->needed bytes the call fails
+ * with STEGO_ERR_TRUNCATED and needed says how many to pass (a few hundred
+ * past the pixel data offset). The pixel data past that is never touched.
+ * A clean carrier fails with STEGO_ERR_NOT_STEGO and capacity/free set to
+ * the room a new payload would get at 1 bit depth.
+ */
+StegoStatus stego_probe(const StegoView *stego, StegoProbe *probe);
+
+/* Largest payload carrier can hold at the given depth */
+StegoStatus stego_capacity(const StegoView *carrier, int depth, unsigned long long *max_payload);
+
+/* Short description of a status */
+const char *stego_status_string(StegoStatus status);
+
+#endif
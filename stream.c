@@ -0,0 +1,381 @@
+#define _FILE_OFFSET_BITS 64
+#define _POSIX_C_SOURCE 200809L
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "stream.h"
+#include "lsb.h"
+#include "common.h"
+#include "metrics.h"
+#include "stego.h"
+
+int is_stream_name(const char *fname)
+{
+    return fname != NULL && strcmp(fname, "-") == 0;
+}
+
+int is_secret_fd_name(const char *fname)
+{
+    return fname != NULL && strncmp(fname, "fd:", 3) == 0 && fname[3] >= '0' && fname[3] <= '9';
+}
+
+/* Data half of stdout once stream_take_stdout() has run */
+static FILE *data_stdout;
+
+FILE *stream_take_stdout(void)
+{
+    if (data_stdout)
+        return data_stdout;
+
+    fflush(stdout);
+    int fd = dup(STDOUT_FILENO);
+    if (fd < 0)
+    {
+        perror("dup");
+        return NULL;
+    }
+    dup2(STDERR_FILENO, STDOUT_FILENO);
+    data_stdout = fdopen(fd, "wb");
+    return data_stdout;
+}
+
+/* Open the secret: a path, a named pipe, or "fd:N" */
+static FILE *open_secret(const char *fname)
+{
+    FILE *fp = is_secret_fd_name(fname) ? fdopen(atoi(fname + 3), "rb") : fopen(fname, "rb");
+    if (fp == NULL)
+    {
+        perror("open");
+        fprintf(stderr, "ERROR: Unable to open secret %s\n", fname);
+    }
+    return fp;
+}
+
+/* Read exactly n bytes, 0 on a short read */
+static int read_exact(FILE *fp, void *buf, size_t n)
+{
+    return fread(buf, 1, n, fp) == n;
+}
+
+/* Read a whole stream into memory, failing once it exceeds limit bytes */
+static unsigned char *read_all(FILE *fp, size_t limit, size_t *len)
+{
+    size_t cap = 64 * 1024;
+    unsigned char *data = malloc(cap);
+    *len = 0;
+
+    while (data != NULL)
+    {
+        size_t n = fread(data + *len, 1, cap - *len, fp);
+        *len += n;
+        if (n == 0 || *len > limit)
+            break;
+        if (*len == cap)
+        {
+            unsigned char *grown = realloc(data, cap * 2);
+            if (grown == NULL)
+            {
+                free(data);
+                return NULL;
+            }
+            data = grown;
+            cap *= 2;
+        }
+    }
+    if (data != NULL && (ferror(fp) || *len > limit))
+    {
+        free(data);
+        return NULL;
+    }
+    return data;
+}
+
+/* Extension to record for the secret */
+static const char *secret_extension(const EncodeInfo *encInfo)
+{
+    const char *extn = secret_file_extension(encInfo->secret_fname);
+    if (encInfo->stream_extn)
+        return encInfo->stream_extn;
+    if (is_secret_fd_name(encInfo->secret_fname) || extn == NULL)
+        return ".bin";
+    return extn;
+}
+
+/* Embed the payload chunk by chunk, from memory when it was read ahead */
+static Status stream_secret_data(EncodeInfo *encInfo, const unsigned char *preloaded)
+{
+    size_t batch = encode_batch_bytes(encInfo);
+    unsigned char *secret = preloaded ? NULL : arena_alloc(encInfo->arena, batch);
+    unsigned char *scratch = arena_alloc(encInfo->arena, encode_scratch_bytes(encInfo));
+    unsigned long long remaining = encInfo->size_secret_file;
+    size_t done = 0;
+    Status status = e_success;
+
+    if (scratch == NULL || (preloaded == NULL && secret == NULL))
+        return e_failure;
+
+    // At least one block: a sealed payload has a tag even when it is empty
+    do
+    {
+        size_t n = remaining < batch ? remaining : batch;
+        const unsigned char *chunk = preloaded ? preloaded + done : secret;
+
+        if (preloaded == NULL && !read_exact(encInfo->fptr_secret, secret, n))
+        {
+            printf("ERROR : Secret ended before the declared size\n");
+            status = e_failure;
+        }
+        else
+        {
+            status = encode_payload_block(encInfo, chunk, n, n == remaining, scratch);
+        }
+        remaining -= n;
+        done += n;
+    } while (status == e_success && remaining > 0);
+
+    if (status == e_success && preloaded == NULL && fgetc(encInfo->fptr_secret) != EOF)
+    {
+        printf("ERROR : Secret is longer than the declared size\n");
+        status = e_failure;
+    }
+    return status;
+}
+
+/* Pass the rest of the carrier through a fixed buffer */
+static Status stream_remaining_data(FILE *src, FILE *dest, CopyResult *res)
+{
+    unsigned char *buffer = malloc(LSB_CARRIER_CHUNK);
+    size_t n;
+    Status status = e_success;
+
+    res->bytes = 0;
+    res->method = "stream";
+    if (buffer == NULL)
+        return e_failure;
+    while ((n = fread(buffer, 1, LSB_CARRIER_CHUNK, src)) > 0)
+    {
+        if (fwrite(buffer, 1, n, dest) != n)
+        {
+            status = e_failure;
+            break;
+        }
+        res->bytes += n;
+    }
+    if (ferror(src))
+        status = e_failure;
+    free(buffer);
+    return status;
+}
+
+static Status finish_stream_encoding(EncodeInfo *encInfo, Status status)
+{
+    if (encInfo->fptr_src_image && encInfo->fptr_src_image != stdin)
+        fclose(encInfo->fptr_src_image);
+    if (encInfo->fptr_secret)
+        fclose(encInfo->fptr_secret);
+    if (encInfo->fptr_stego_image && fclose(encInfo->fptr_stego_image) != 0)
+    {
+        perror("write");
+        status = e_failure;
+    }
+    encInfo->fptr_src_image = NULL;
+    encInfo->fptr_secret = NULL;
+    encInfo->fptr_stego_image = NULL;
+    carrier_close(&encInfo->carrier);
+    encInfo->raw = NULL;
+    encInfo->raw_size = 0;
+    metrics_job_end(&encInfo->metrics, status == e_success);
+    return status;
+}
+
+Status do_stream_encoding(EncodeInfo *encInfo)
+{
+    unsigned char *preloaded = NULL;
+
+    // Only the whole job is timed: the stages overlap with reading the pipe
+    metrics_job_begin(&encInfo->metrics, METRICS_ENCODE, encInfo->quiet);
+    if (encInfo->use_mmap)
+    {
+        printf("ERROR : mmap mode cannot be combined with stdin/stdout\n");
+        return finish_stream_encoding(encInfo, e_failure);
+    }
+    if (encInfo->depth < LSB_MIN_DEPTH || encInfo->depth > LSB_MAX_DEPTH)
+    {
+        printf("ERROR : Depth must be %d to %d bits per byte\n", LSB_MIN_DEPTH, LSB_MAX_DEPTH);
+        return finish_stream_encoding(encInfo, e_failure);
+    }
+    encInfo->fptr_src_image = is_stream_name(encInfo->src_image_fname) ? stdin : fopen(encInfo->src_image_fname, "rb");
+    encInfo->fptr_secret = open_secret(encInfo->secret_fname);
+    encInfo->fptr_stego_image = is_stream_name(encInfo->stego_image_fname) ? stream_take_stdout() : fopen(encInfo->stego_image_fname, "wb");
+    if (encInfo->fptr_src_image == NULL || encInfo->fptr_secret == NULL || encInfo->fptr_stego_image == NULL)
+    {
+        printf("ERROR: Failed to Open files \n");
+        return finish_stream_encoding(encInfo, e_failure);
+    }
+
+    // No seeking: read the header once, it is written out unchanged below (a PNG is decoded row by row)
+    if (carrier_open_read(&encInfo->fptr_src_image, &encInfo->carrier, &encInfo->bmp) != e_success)
+    {
+        printf("ERROR : Unsupported or corrupt carrier header\n");
+        return finish_stream_encoding(encInfo, e_failure);
+    }
+    bmp_cursor_init(&encInfo->bmp, &encInfo->cursor);
+    encInfo->image_capacity = encInfo->bmp.capacity;
+
+    // The extension is recorded ahead of the size, so it counts in the room left for the secret
+    encInfo->extn_secret_file = secret_extension(encInfo);
+    if (!stego_extn_ok(encInfo->extn_secret_file))
+    {
+        printf("ERROR : Unsupported secret file extension\n");
+        return finish_stream_encoding(encInfo, e_failure);
+    }
+
+    if (!encInfo->size_declared)
+    {
+        // The size goes in front of the data: read the secret ahead, bounded by the capacity
+        unsigned long long fields = stego_required_bytes(0, strlen(encInfo->extn_secret_file), encInfo->depth,
+                                                       encode_payload_flags(encInfo));
+        unsigned long long room = encInfo->image_capacity > fields ? (encInfo->image_capacity - fields) / 8 * encInfo->depth : 0;
+        size_t limit = room < SIZE_MAX ? room : SIZE_MAX;
+        size_t len;
+        preloaded = read_all(encInfo->fptr_secret, limit, &len);
+        if (preloaded == NULL)
+        {
+            printf("ERROR : Image cannot hold secret data\n");
+            return finish_stream_encoding(encInfo, e_failure);
+        }
+        encInfo->size_secret_file = len;
+    }
+    if (encInfo->image_capacity < stego_required_bytes(encode_stored_size(encInfo), strlen(encInfo->extn_secret_file),
+                                                       encInfo->depth, encode_payload_flags(encInfo)))
+    {
+        printf("ERROR : Image cannot hold secret data\n");
+        free(preloaded);
+        return finish_stream_encoding(encInfo, e_failure);
+    }
+
+
+    Status status = e_failure;
+    if (carrier_open_write(&encInfo->carrier, &encInfo->fptr_stego_image) == e_success
+        && encode_magic_string(MAGIC_STRING, encInfo) == e_success
+        && encode_format_descriptor(encInfo) == e_success
+        && encode_secret_file_extn_size(strlen(encInfo->extn_secret_file), encInfo) == e_success
+        && encode_secret_file_extn(encInfo->extn_secret_file, encInfo) == e_success
+        && encode_secret_file_size(encInfo->size_secret_file, encInfo) == e_success
+        && stream_secret_data(encInfo, preloaded) == e_success
+        && stream_remaining_data(encInfo->fptr_src_image, encInfo->fptr_stego_image, &encInfo->tail_copy) == e_success)
+    {
+        status = e_success;
+    }
+    else
+    {
+        printf("ERROR : Streaming encode failed\n");
+    }
+    free(preloaded);
+    return finish_stream_encoding(encInfo, status);
+}
+
+static DStatus finish_stream_decoding(DecodeInfo *decInfo, DStatus status)
+{
+    if (decInfo->fptr_stego_image && decInfo->fptr_stego_image != stdin)
+        fclose(decInfo->fptr_stego_image);
+    if (decInfo->fptr_output && fclose(decInfo->fptr_output) != 0)
+    {
+        perror("write");
+        status = d_failure;
+    }
+    decInfo->fptr_stego_image = NULL;
+    decInfo->fptr_output = NULL;
+    decInfo->raw = NULL;
+    decInfo->raw_size = 0;
+    metrics_job_end(&decInfo->metrics, status == d_success);
+    return status;
+}
+
+DStatus do_stream_decoding(DecodeInfo *decInfo)
+{
+    int to_stdout = is_stream_name(decInfo->output_fname);
+
+    metrics_job_begin(&decInfo->metrics, METRICS_DECODE, decInfo->quiet);
+    decInfo->fptr_output = NULL;
+    decInfo->fptr_stego_image = NULL;
+    if (decInfo->use_mmap)
+    {
+        printf("ERROR : mmap mode cannot be combined with stdin/stdout\n");
+        return finish_stream_decoding(decInfo, d_failure);
+    }
+    decInfo->fptr_stego_image = is_stream_name(decInfo->stego_image_fname) ? stdin : fopen(decInfo->stego_image_fname, "rb");
+    if (decInfo->fptr_stego_image == NULL)
+    {
+        perror("fopen");
+        return finish_stream_decoding(decInfo, d_failure);
+    }
+    // Take stdout over before anything is printed
+    if (to_stdout && (decInfo->fptr_output = stream_take_stdout()) == NULL)
+        return finish_stream_decoding(decInfo, d_failure);
+
+    // Skip the header by reading it, stdin cannot seek
+    if (skip_bmp_header(decInfo) != d_success
+        || decode_magic_string(decInfo) != d_success
+        || decode_format_descriptor(decInfo) != d_success
+        || decode_secret_file_extn_size(decInfo) != d_success
+        || decode_secret_file_extn(decInfo) != d_success)
+    {
+        printf("ERROR : Not a stego image\n");
+        return finish_stream_decoding(decInfo, d_failure);
+    }
+    if (!decInfo->quiet)
+        printf("INFO : Payload extension %s\n", decInfo->file_extn);
+    // Scattered carrier bytes cannot be reached without seeking
+    if (decInfo->keyed)
+    {
+        printf("ERROR : Payload is scattered by a key, decode it from a file with --key\n");
+        return finish_stream_decoding(decInfo, d_failure);
+    }
+
+    if (decode_secret_file_size(decInfo) != d_success)
+    {
+        printf(decInfo->checksum_failed ? "ERROR : Header checksum mismatch (corrupt image)\n"
+                                        : "ERROR : Failed decoding secret file size\n");
+        return finish_stream_decoding(decInfo, d_failure);
+    }
+    if ((decInfo->flags & STEGO_FLAG_ENCRYPTED) && decInfo->cipher_key == NULL)
+    {
+        printf("ERROR : Payload is encrypted, decode with --encrypt KEYFILE\n");
+        return finish_stream_decoding(decInfo, d_failure);
+    }
+    // Members are extracted by seeking to them
+    if ((decInfo->flags & STEGO_FLAG_ARCHIVE) || decInfo->member)
+    {
+        printf("ERROR : Archives are extracted from a file into a directory, not streamed\n");
+        return finish_stream_decoding(decInfo, d_failure);
+    }
+    if (decInfo->flags & STEGO_FLAG_SHARD)
+    {
+        printf("ERROR : Image holds shard %u of %u, decode it together with the others (--shard)\n",
+               decInfo->shard.index + 1, decInfo->shard.count);
+        return finish_stream_decoding(decInfo, d_failure);
+    }
+    // The output is only created once the header checked out
+    if (!to_stdout && (decInfo->fptr_output = fopen(decInfo->output_fname, "wb")) == NULL)
+    {
+        perror("fopen");
+        return finish_stream_decoding(decInfo, d_failure);
+    }
+    if (decode_secret_file_data(decInfo) != d_success)
+    {
+        const char *reason = decode_failure_reason(decInfo);
+        printf("ERROR : %s\n", reason ? reason : "Failed decoding secret file data");
+        // Data already on stdout cannot be taken back, a file can
+        if (reason && !to_stdout)
+        {
+            finish_stream_decoding(decInfo, d_failure);
+            remove(decInfo->output_fname);
+            return d_failure;
+        }
+        return finish_stream_decoding(decInfo, d_failure);
+    }
+    return finish_stream_decoding(decInfo, d_success);
+}
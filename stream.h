@@ -0,0 +1,40 @@
+#ifndef STREAM_H
+#define STREAM_H
+
+#include <stdio.h>
+#include "types.h"
+#include "encode.h"
+#include "decode.h"
+
+/*
+ * Pipeline mode: the carrier (or stego image) may come from stdin and the
+ * result may go to stdout, so nothing here ever seeks. Data moves through
+ * fixed LSB_CARRIER_CHUNK-sized buffers, memory use does not depend on the
+ * image size. When stdout carries data, every message goes to stderr.
+ *
+ * The payload size is written before the payload, so for a pipe secret it
+ * is either declared up front (--size) or the secret is read ahead into
+ * memory, bounded by what the carrier can hold.
+ */
+
+/* "-" names stdin/stdout */
+int is_stream_name(const char *fname);
+
+/* "fd:N" names an already open descriptor (e.g. a pipe from the shell) */
+int is_secret_fd_name(const char *fname);
+
+/*
+ * Take over stdout for binary data. The original descriptor is kept for the
+ * data and fd 1 is pointed at stderr, so every later printf() becomes a
+ * diagnostic instead of corrupting the stream. Calling it again returns
+ * the same FILE.
+ */
+FILE *stream_take_stdout(void);
+
+/* Encode with stdin/stdout in place of the carrier/stego image */
+Status do_stream_encoding(EncodeInfo *encInfo);
+
+/* Decode a stego image from stdin and/or the payload to stdout */
+DStatus do_stream_decoding(DecodeInfo *decInfo);
+
+#endif
@@ -0,0 +1,238 @@
+#include <pthread.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include "threadpool.h"
+
+typedef struct _PoolTask
+{
+    pool_task_fn fn;
+    void *arg;
+    struct _PoolTask *next;
+} PoolTask;
+
+struct _ThreadPool
+{
+    pthread_mutex_t lock;
+    pthread_cond_t work_cv;  // Signalled when a task is queued or on shutdown
+    pthread_cond_t done_cv;  // Signalled when a task or parallel loop finishes
+    PoolTask *head;
+    PoolTask *tail;
+    int pending;             // Queued + running tasks
+    int shutdown;
+    int nthreads;
+    pthread_t *threads;
+};
+
+/* Shared state of one pool_parallel_for() call */
+typedef struct
+{
+    ThreadPool *pool;
+    pool_for_fn fn;
+    void *ctx;
+    size_t count;
+    size_t next;  // Next index to hand out (under pool->lock)
+    int active;   // Helpers currently running indices
+    int refs;     // Caller + helpers not yet finished with this struct
+    int closed;   // Caller ran out of indices, late helpers must not start
+} ParallelFor;
+
+static void *worker_main(void *arg)
+{
+    ThreadPool *pool = arg;
+
+    pthread_mutex_lock(&pool->lock);
+    for (;;)
+    {
+        while (pool->head == NULL && !pool->shutdown)
+            pthread_cond_wait(&pool->work_cv, &pool->lock);
+        if (pool->head == NULL)
+            break;
+
+        PoolTask *task = pool->head;
+        pool->head = task->next;
+        if (pool->head == NULL)
+            pool->tail = NULL;
+        pthread_mutex_unlock(&pool->lock);
+
+        task->fn(task->arg);
+        free(task);
+
+        pthread_mutex_lock(&pool->lock);
+        pool->pending--;
+        pthread_cond_broadcast(&pool->done_cv);
+    }
+    pthread_mutex_unlock(&pool->lock);
+    return NULL;
+}
+
+ThreadPool *pool_create(int nthreads)
+{
+    if (nthreads < 1)
+        nthreads = 1;
+
+    ThreadPool *pool = calloc(1, sizeof(*pool));
+    if (pool == NULL)
+        return NULL;
+    pool->threads = calloc(nthreads, sizeof(pthread_t));
+    if (pool->threads == NULL)
+    {
+        free(pool);
+        return NULL;
+    }
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->work_cv, NULL);
+    pthread_cond_init(&pool->done_cv, NULL);
+
+    for (int i = 0; i < nthreads; i++)
+    {
+        if (pthread_create(&pool->threads[i], NULL, worker_main, pool) != 0)
+            break;
+        pool->nthreads++;
+    }
+    if (pool->nthreads == 0)
+    {
+        pool_destroy(pool);
+        return NULL;
+    }
+    return pool;
+}
+
+int pool_size(const ThreadPool *pool)
+{
+    return pool ? pool->nthreads : 0;
+}
+
+Status pool_submit(ThreadPool *pool, pool_task_fn fn, void *arg)
+{
+    PoolTask *task = malloc(sizeof(*task));
+    if (task == NULL)
+        return e_failure;
+    task->fn = fn;
+    task->arg = arg;
+    task->next = NULL;
+
+    pthread_mutex_lock(&pool->lock);
+    if (pool->tail)
+        pool->tail->next = task;
+    else
+        pool->head = task;
+    pool->tail = task;
+    pool->pending++;
+    pthread_cond_signal(&pool->work_cv);
+    pthread_mutex_unlock(&pool->lock);
+    return e_success;
+}
+
+/* Hand out indices until none are left; called with pool->lock held */
+static void run_indices(ParallelFor *loop)
+{
+    ThreadPool *pool = loop->pool;
+    while (loop->next < loop->count)
+    {
+        size_t index = loop->next++;
+        pthread_mutex_unlock(&pool->lock);
+        loop->fn(loop->ctx, index);
+        pthread_mutex_lock(&pool->lock);
+    }
+}
+
+/* Drop one reference; the last holder frees the loop. Called with pool->lock held */
+static void release_loop(ParallelFor *loop)
+{
+    if (--loop->refs == 0)
+        free(loop);
+}
+
+static void parallel_for_helper(void *arg)
+{
+    ParallelFor *loop = arg;
+    ThreadPool *pool = loop->pool;
+
+    pthread_mutex_lock(&pool->lock);
+    if (!loop->closed)
+    {
+        loop->active++;
+        run_indices(loop);
+        loop->active--;
+        pthread_cond_broadcast(&pool->done_cv);
+    }
+    release_loop(loop);
+    pthread_mutex_unlock(&pool->lock);
+}
+
+void pool_parallel_for(ThreadPool *pool, size_t count, pool_for_fn fn, void *ctx)
+{
+    ParallelFor *loop = NULL;
+
+    if (pool && count > 1)
+        loop = calloc(1, sizeof(*loop));
+    if (loop == NULL)
+    {
+        for (size_t i = 0; i < count; i++)
+            fn(ctx, i);
+        return;
+    }
+
+    loop->pool = pool;
+    loop->fn = fn;
+    loop->ctx = ctx;
+    loop->count = count;
+    loop->refs = 1;
+
+    size_t helpers = count - 1 < (size_t)pool->nthreads ? count - 1 : (size_t)pool->nthreads;
+    for (size_t i = 0; i < helpers; i++)
+    {
+        pthread_mutex_lock(&pool->lock);
+        loop->refs++;
+        pthread_mutex_unlock(&pool->lock);
+        if (pool_submit(pool, parallel_for_helper, loop) != e_success)
+        {
+            pthread_mutex_lock(&pool->lock);
+            loop->refs--;
+            pthread_mutex_unlock(&pool->lock);
+            break;
+        }
+    }
+
+    pthread_mutex_lock(&pool->lock);
+    run_indices(loop);
+    loop->closed = 1;
+    while (loop->active > 0)
+        pthread_cond_wait(&pool->done_cv, &pool->lock);
+    release_loop(loop);
+    pthread_mutex_unlock(&pool->lock);
+}
+
+void pool_wait(ThreadPool *pool)
+{
+    pthread_mutex_lock(&pool->lock);
+    while (pool->pending > 0)
+        pthread_cond_wait(&pool->done_cv, &pool->lock);
+    pthread_mutex_unlock(&pool->lock);
+}
+
+void pool_destroy(ThreadPool *pool)
+{
+    if (pool == NULL)
+        return;
+
+    pthread_mutex_lock(&pool->lock);
+    pool->shutdown = 1;
+    pthread_cond_broadcast(&pool->work_cv);
+    pthread_mutex_unlock(&pool->lock);
+
+    for (int i = 0; i < pool->nthreads; i++)
+        pthread_join(pool->threads[i], NULL);
+
+    pthread_mutex_destroy(&pool->lock);
+    pthread_cond_destroy(&pool->work_cv);
+    pthread_cond_destroy(&pool->done_cv);
+    free(pool->threads);
+    free(pool);
+}
+
+int pool_cpu_count(void)
+{
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    return n > 0 ? (int)n : 1;
+}
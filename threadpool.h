@@ -0,0 +1,42 @@
+#ifndef THREADPOOL_H
+#define THREADPOOL_H
+
+#include <stddef.h>
+#include "types.h"
+
+/* Fixed set of worker threads consuming a FIFO of tasks */
+typedef struct _ThreadPool ThreadPool;
+
+/* Task run on a worker thread */
+typedef void (*pool_task_fn)(void *arg);
+
+/* Body of a parallel loop, called once per index */
+typedef void (*pool_for_fn)(void *ctx, size_t index);
+
+/* Start a pool of nthreads workers (NULL on failure) */
+ThreadPool *pool_create(int nthreads);
+
+/* Number of worker threads */
+int pool_size(const ThreadPool *pool);
+
+/* Queue a task, it runs as soon as a worker is free */
+Status pool_submit(ThreadPool *pool, pool_task_fn fn, void *arg);
+
+/*
+ * Run fn(ctx, i) for every i in [0, count) on the workers and the calling
+ * thread, and return once all indices are done. With a NULL pool the loop
+ * runs serially. Safe to call from inside a pool task: helpers that have
+ * not started by the time the caller runs out of work are simply dropped.
+ */
+void pool_parallel_for(ThreadPool *pool, size_t count, pool_for_fn fn, void *ctx);
+
+/* Wait for every queued task to finish */
+void pool_wait(ThreadPool *pool);
+
+/* Finish queued tasks, stop the workers and free the pool */
+void pool_destroy(ThreadPool *pool);
+
+/* Number of online CPUs, at least 1 */
+int pool_cpu_count(void);
+
+#endif
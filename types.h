@@ -22,6 +22,8 @@ typedef enum
 {
     e_encode,
     e_decode,
+    e_serve,
+    e_probe,
     e_unsupported
 } OperationType;
 